@@ -156,6 +156,30 @@ struct gen6_mfc_avc_surface_aux
     dri_bo *dmv_bottom;
 };
 
+/*
+ * Hardware tables built from the JPEG quantization and Huffman tables of
+ * the last picture. Most streams use the same tables for every picture, so
+ * they are only rebuilt when the tables sent by the application change.
+ */
+struct gen6_mfc_jpeg_qm_cache
+{
+    int valid;
+    unsigned int quality;
+    unsigned char qm[64];               /* as sent, in zigzag order */
+    uint32_t dword_qm[32];
+};
+
+struct gen6_mfc_jpeg_huff_cache
+{
+    int valid;
+    uint8_t num_dc_codes[16];
+    uint8_t dc_values[12];
+    uint8_t num_ac_codes[16];
+    uint8_t ac_values[162];
+    uint32_t dc_table[12];
+    uint32_t ac_table[162];
+};
+
 struct gen6_mfc_context
 {
     struct {
@@ -186,6 +210,10 @@ struct gen6_mfc_context
         dri_bo *bo;
     } macroblock_status_buffer;         //INTERNAL:
 
+    /* Picture size the scratch buffers above were allocated for */
+    int scratch_width_in_mbs;
+    int scratch_height_in_mbs;
+
     struct {
         dri_bo *bo;								
     } deblocking_filter_row_store_scratch_buffer;       //INTERNAL:
@@ -293,6 +321,22 @@ struct gen6_mfc_context
     //"buffered_QMatrix" will be used to buffer the QMatrix if the app sends one.
     // Or else, we will load a default QMatrix from the driver for JPEG encode.
     VAQMatrixBufferJPEG buffered_qmatrix;
+
+    struct {
+        struct gen6_mfc_jpeg_qm_cache lum_qm;
+        struct gen6_mfc_jpeg_qm_cache chroma_qm;
+        struct gen6_mfc_jpeg_huff_cache huff[2];
+    } jpeg_cache;
+
+    /*
+     * Consecutive JPEG pictures may share one batch, see
+     * VA_INTEL_JPEG_ENCODE_BATCH. The scratch buffers only depend on the
+     * picture size, so they are kept until the size changes.
+     */
+    struct {
+        int num_pending;                /* pictures in the batch, not submitted yet */
+        unsigned int submit_count;      /* batch->submit_count after the last picture */
+    } jpeg_batch;
     struct i965_gpe_context gpe_context;
     struct i965_buffer_surface mfc_batchbuffer_surface;
     struct intel_batchbuffer *aux_batchbuffer;
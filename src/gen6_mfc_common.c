@@ -536,6 +536,34 @@ int intel_mfc_interlace_check(VADriverContextP ctx,
     return 1;
 }
 
+/*
+ * A P picture promoted to an I picture on a scene cut is an I picture
+ * the GOP didn't plan for. The I QP may date from the previous GOP, so
+ * it starts from the current P QP, and is raised further when the HRD
+ * buffer is below its target fullness.
+ */
+static void intel_mfc_brc_scene_cut(struct intel_encoder_context *encoder_context)
+{
+    struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
+    int layer_id = encoder_context->layer.curr_frame_layer_id;
+    int min_qp = MAX(1, encoder_context->brc.min_qp);
+    int qpi = mfc_context->brc.qp_prime_y[layer_id][SLICE_TYPE_I];
+    int qpp = mfc_context->brc.qp_prime_y[layer_id][SLICE_TYPE_P];
+    double x;
+
+    qpi = MAX(qpi, qpp - BRC_I_P_QP_DIFF);
+
+    x = mfc_context->hrd.target_buffer_fullness[layer_id] - mfc_context->hrd.current_buffer_fullness[layer_id];
+
+    if (x > 0 && mfc_context->hrd.target_buffer_fullness[layer_id] > 0) {
+        x /= mfc_context->hrd.target_buffer_fullness[layer_id];
+        qpi += (int)(BRC_QP_MAX_CHANGE * MIN(x, 1.0) + 0.5);
+    }
+
+    BRC_CLIP(qpi, min_qp, 51);
+    mfc_context->brc.qp_prime_y[layer_id][SLICE_TYPE_I] = qpi;
+}
+
 void intel_mfc_brc_prepare(struct encode_state *encode_state,
                            struct intel_encoder_context *encoder_context)
 {
@@ -555,6 +583,9 @@ void intel_mfc_brc_prepare(struct encode_state *encode_state,
         /*Programing HRD control */
         if (encoder_context->brc.need_reset)
             intel_mfc_hrd_context_init(encode_state, encoder_context);    
+
+        if (encoder_context->is_scene_cut)
+            intel_mfc_brc_scene_cut(encoder_context);
     }
 }
 
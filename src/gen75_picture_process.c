@@ -45,45 +45,90 @@ extern struct hw_context *
 i965_proc_context_init(VADriverContextP ctx,
                        struct object_config *obj_config);
 
+/* i965_proc_picture() takes the parameters and the target from the codec
+ * state, it gets a copy of it with the ones of this run */
 static VAStatus 
 gen75_vpp_fmt_cvt(VADriverContextP ctx, 
                   VAProfile profile, 
                   union codec_state *codec_state,
-                  struct hw_context *hw_context)
+                  struct hw_context *hw_context,
+                  VAProcPipelineParameterBuffer *pipeline_param,
+                  VASurfaceID render_target)
 {
     VAStatus va_status = VA_STATUS_SUCCESS;
     struct intel_video_process_context *proc_ctx = 
              (struct intel_video_process_context *)hw_context;
+    struct proc_state *proc_st = &proc_ctx->fmt_cvt_state.proc;
+
+    memset(&proc_ctx->fmt_cvt_pipeline_param, 0, sizeof(proc_ctx->fmt_cvt_pipeline_param));
+    proc_ctx->fmt_cvt_pipeline_param.buffer = (unsigned char *)pipeline_param;
+    proc_ctx->fmt_cvt_pipeline_param.num_elements = 1;
+
+    *proc_st = codec_state->proc;
+    proc_st->pipeline_param = &proc_ctx->fmt_cvt_pipeline_param;
+    proc_st->num_layer_params = 0;
+    proc_st->current_render_target = render_target;
   
-    va_status = i965_proc_picture(ctx, profile, codec_state,
+    va_status = i965_proc_picture(ctx, profile, &proc_ctx->fmt_cvt_state,
                                   proc_ctx->vpp_fmt_cvt_ctx);
 
     return va_status;
 }
 
+static VAStatus
+gen75_vpp_vebox_process_picture(VADriverContextP ctx,
+                                struct intel_vebox_context *vebox_ctx)
+{
+     struct i965_driver_data *i965 = i965_driver_data(ctx);
+     VAStatus va_status = VA_STATUS_SUCCESS;
+
+     if (IS_HASWELL(i965->intel.device_info))
+         va_status = gen75_vebox_process_picture(ctx, vebox_ctx);
+     else if (IS_GEN8(i965->intel.device_info))
+         va_status = gen8_vebox_process_picture(ctx, vebox_ctx);
+     else if (IS_GEN9(i965->intel.device_info))
+         va_status = gen9_vebox_process_picture(ctx, vebox_ctx);
+
+     return va_status;
+}
+
 static VAStatus 
 gen75_vpp_vebox(VADriverContextP ctx, 
                 struct intel_video_process_context* proc_ctx)
 {
      VAStatus va_status = VA_STATUS_SUCCESS;
      VAProcPipelineParameterBuffer* pipeline_param = proc_ctx->pipeline_param; 
-     struct i965_driver_data *i965 = i965_driver_data(ctx); 
+     struct intel_vebox_context *vebox_ctx;
  
      /* vpp features based on VEBox fixed function */
      if(proc_ctx->vpp_vebox_ctx == NULL) {
          proc_ctx->vpp_vebox_ctx = gen75_vebox_context_init(ctx);
      }
 
-     proc_ctx->vpp_vebox_ctx->pipeline_param  = pipeline_param;
-     proc_ctx->vpp_vebox_ctx->surface_input_object = proc_ctx->surface_pipeline_input_object;
-     proc_ctx->vpp_vebox_ctx->surface_output_object  = proc_ctx->surface_render_output_object;
+     vebox_ctx = proc_ctx->vpp_vebox_ctx;
+     vebox_ctx->pipeline_param  = pipeline_param;
+     vebox_ctx->surface_input_object = proc_ctx->surface_pipeline_input_object;
+     vebox_ctx->surface_output_object  = proc_ctx->surface_render_output_object;
+     vebox_ctx->surface_second_field_object = proc_ctx->surface_second_field_object;
+     vebox_ctx->statistics = proc_ctx->statistics;
 
-     if (IS_HASWELL(i965->intel.device_info))
-         va_status = gen75_vebox_process_picture(ctx, proc_ctx->vpp_vebox_ctx);
-     else if (IS_GEN8(i965->intel.device_info))
-         va_status = gen8_vebox_process_picture(ctx, proc_ctx->vpp_vebox_ctx);
-     else if (IS_GEN9(i965->intel.device_info))
-         va_status = gen9_vebox_process_picture(ctx, proc_ctx->vpp_vebox_ctx);
+     va_status = gen75_vpp_vebox_process_picture(ctx, vebox_ctx);
+
+     /* Without a previous frame the VEBOX only outputs the first field, the
+      * second one gets a run of its own */
+     if (va_status == VA_STATUS_SUCCESS &&
+         vebox_ctx->surface_second_field_object &&
+         !vebox_ctx->is_field_rate) {
+         vebox_ctx->surface_output_object = vebox_ctx->surface_second_field_object;
+         vebox_ctx->is_second_field_pass = 1;
+
+         va_status = gen75_vpp_vebox_process_picture(ctx, vebox_ctx);
+
+         vebox_ctx->is_second_field_pass = 0;
+     }
+
+     vebox_ctx->surface_second_field_object = NULL;
+     vebox_ctx->statistics = NULL;
 
      return va_status;
 } 
@@ -203,22 +248,24 @@ gen8plus_vpp_clear_surface(VADriverContextP ctx,
     intel_batchbuffer_end_atomic(batch);
 }
 
-VAStatus 
-gen75_proc_picture(VADriverContextP ctx,
-                   VAProfile profile,
-                   union codec_state *codec_state,
-                   struct hw_context *hw_context)
+/* Runs @pipeline_param for a single output, @render_target */
+static VAStatus
+gen75_proc_picture_output(VADriverContextP ctx,
+                          VAProfile profile,
+                          union codec_state *codec_state,
+                          struct hw_context *hw_context,
+                          VAProcPipelineParameterBuffer *pipeline_param,
+                          VASurfaceID render_target)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct proc_state* proc_st = &(codec_state->proc);
     struct intel_video_process_context *proc_ctx = 
              (struct intel_video_process_context *)hw_context;
-    VAProcPipelineParameterBuffer *pipeline_param = 
-             (VAProcPipelineParameterBuffer *)proc_st->pipeline_param->buffer;
     struct object_surface *obj_dst_surf = NULL;
     struct object_surface *obj_src_surf = NULL;
 
-    VAProcPipelineParameterBuffer pipeline_param2;
+    VAProcPipelineParameterBuffer pipeline_param2, stage2_param;
+    VASurfaceID stage2_target = render_target;
     struct object_surface *stage1_dst_surf = NULL;
     struct object_surface *stage2_dst_surf = NULL;
     VARectangle src_rect, dst_rect;
@@ -229,14 +276,15 @@ gen75_proc_picture(VADriverContextP ctx,
     VAStatus status;
 
     proc_ctx->pipeline_param = pipeline_param;
+    proc_ctx->statistics = proc_st->statistics;
 
-    if (proc_st->current_render_target == VA_INVALID_SURFACE ||
+    if (render_target == VA_INVALID_SURFACE ||
         pipeline_param->surface == VA_INVALID_SURFACE) {
         status = VA_STATUS_ERROR_INVALID_SURFACE;
         goto error;
     }
 
-    obj_dst_surf = SURFACE(proc_st->current_render_target);
+    obj_dst_surf = SURFACE(render_target);
 
     if (!obj_dst_surf) {
         status = VA_STATUS_ERROR_INVALID_SURFACE;
@@ -499,25 +547,28 @@ gen75_proc_picture(VADriverContextP ctx,
     VABufferID *filter_id = (VABufferID*) pipeline_param->filters;
 
     if(vpp_stage2 == 1) {
+        stage2_param = *pipeline_param;
+
         if(stage1_dst_surf != NULL) {
             proc_ctx->surface_pipeline_input_object = stage1_dst_surf;
             proc_ctx->surface_render_output_object = obj_dst_surf;
 
-            pipeline_param->surface = out_surface_id1;
+            stage2_param.surface = out_surface_id1;
         }
 
         if(stage2_dst_surf != NULL) {
             proc_ctx->surface_render_output_object = stage2_dst_surf;
 
-            proc_st->current_render_target = out_surface_id2;
+            stage2_target = out_surface_id2;
         }
 
-        proc_ctx->pipeline_param = pipeline_param;
+        proc_ctx->pipeline_param = &stage2_param;
 
         if(pipeline_param->num_filters == 0 || pipeline_param->filters == NULL ){
             /* implicity surface format coversion and scaling */
 
-            status = gen75_vpp_fmt_cvt(ctx, profile, codec_state, hw_context);
+            status = gen75_vpp_fmt_cvt(ctx, profile, codec_state, hw_context,
+                                       &stage2_param, stage2_target);
             if(status != VA_STATUS_SUCCESS)
                 goto error;
         }else if(pipeline_param->num_filters == 1) {
@@ -603,6 +654,248 @@ error:
     return status;
 }
 
+static int
+gen75_proc_is_yuv420p8(unsigned int fourcc)
+{
+    return (fourcc == VA_FOURCC_NV12 || fourcc == VA_FOURCC_I420);
+}
+
+/* Scales an unfiltered 8-bit 4:2:0 input to all the outputs, the walks of
+ * the GPE scaling kernel are queued in a single batch */
+static VAStatus
+gen75_proc_picture_yuv420p8_outputs(VADriverContextP ctx,
+                                    struct intel_video_process_context *proc_ctx,
+                                    VAProcPipelineParameterBuffer *pipeline_param,
+                                    struct object_surface *obj_src_surf,
+                                    VARectangle *src_rect,
+                                    struct object_surface **obj_dst_surfs,
+                                    VARectangle *dst_rects,
+                                    int num_outputs)
+{
+    struct i965_proc_context *gpe_proc_ctx = (struct i965_proc_context *)proc_ctx->vpp_fmt_cvt_ctx;
+    struct i965_post_processing_context *pp_context = &gpe_proc_ctx->pp_context;
+    struct i965_surface src_surface, dst_surface;
+    VAStatus status = VA_STATUS_SUCCESS;
+    unsigned int tmp_x;
+    int i;
+
+    src_surface.base = (struct object_base *)obj_src_surf;
+    src_surface.type = I965_SURFACE_TYPE_SURFACE;
+
+    if (obj_dst_surfs[0]->fourcc == VA_FOURCC_NV12 &&
+        pipeline_param->output_background_color)
+        gen8plus_vpp_clear_surface(ctx, pp_context,
+                                   obj_dst_surfs[0],
+                                   pipeline_param->output_background_color);
+
+    pp_context->defer_flush = 1;
+
+    for (i = 0; i < num_outputs; i++) {
+        tmp_x = ALIGN_FLOOR(dst_rects[i].x, 4);
+        dst_rects[i].width += dst_rects[i].x - tmp_x;
+        dst_rects[i].x = tmp_x;
+
+        dst_surface.base = (struct object_base *)obj_dst_surfs[i];
+        dst_surface.type = I965_SURFACE_TYPE_SURFACE;
+
+        status = intel_yuv420p8_scaling_post_processing(ctx, pp_context,
+                                                        &src_surface, src_rect,
+                                                        &dst_surface, &dst_rects[i]);
+
+        if (status != VA_STATUS_SUCCESS)
+            break;
+    }
+
+    pp_context->defer_flush = 0;
+    intel_batchbuffer_flush(pp_context->batch);
+
+    return status;
+}
+
+VAStatus
+gen75_proc_picture(VADriverContextP ctx,
+                   VAProfile profile,
+                   union codec_state *codec_state,
+                   struct hw_context *hw_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct proc_state *proc_st = &codec_state->proc;
+    struct intel_video_process_context *proc_ctx =
+             (struct intel_video_process_context *)hw_context;
+    VAProcPipelineParameterBuffer *pipeline_param =
+             (VAProcPipelineParameterBuffer *)proc_st->pipeline_param->buffer;
+    VAProcPipelineParameterBuffer output_param;
+    VASurfaceID render_target = proc_st->current_render_target;
+    VASurfaceID filtered_surface_id = VA_INVALID_SURFACE;
+    struct object_surface *obj_src_surf, *obj_scale_surf;
+    struct object_surface *obj_dst_surfs[1 + I965_PROC_MAX_ADDITIONAL_OUTPUTS];
+    VARectangle src_rect, dst_rects[1 + I965_PROC_MAX_ADDITIONAL_OUTPUTS];
+    VAStatus status = VA_STATUS_SUCCESS;
+    int i, num_outputs, fused;
+
+    if (proc_st->num_layer_params > 0) {
+        if (proc_ctx->vpp_fmt_cvt_ctx == NULL)
+            proc_ctx->vpp_fmt_cvt_ctx = i965_proc_context_init(ctx, NULL);
+
+        return i965_proc_compose(ctx,
+                                 &((struct i965_proc_context *)proc_ctx->vpp_fmt_cvt_ctx)->pp_context,
+                                 proc_st);
+    }
+
+    if (pipeline_param->num_additional_outputs == 0)
+        return gen75_proc_picture_output(ctx, profile, codec_state, hw_context,
+                                         pipeline_param, render_target);
+
+    if (pipeline_param->num_additional_outputs > I965_PROC_MAX_ADDITIONAL_OUTPUTS ||
+        !pipeline_param->additional_outputs)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    obj_src_surf = SURFACE(pipeline_param->surface);
+
+    if (!obj_src_surf || !obj_src_surf->bo)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    if (pipeline_param->surface_region) {
+        src_rect = *pipeline_param->surface_region;
+    } else {
+        src_rect.x = 0;
+        src_rect.y = 0;
+        src_rect.width = obj_src_surf->orig_width;
+        src_rect.height = obj_src_surf->orig_height;
+    }
+
+    num_outputs = 1 + pipeline_param->num_additional_outputs;
+
+    /* The additional outputs take the whole surface */
+    for (i = 0; i < num_outputs; i++) {
+        struct object_surface *obj_dst_surf;
+
+        obj_dst_surf = SURFACE(i ? pipeline_param->additional_outputs[i - 1] : render_target);
+
+        if (!obj_dst_surf)
+            return VA_STATUS_ERROR_INVALID_SURFACE;
+
+        if (!obj_dst_surf->bo) {
+            unsigned int fourcc = VA_FOURCC_NV12;
+
+            if (obj_dst_surf->expected_format == VA_RT_FORMAT_YUV420_10BPP)
+                fourcc = VA_FOURCC_P010;
+
+            i965_check_alloc_surface_bo(ctx, obj_dst_surf, 1, fourcc, SUBSAMPLE_YUV420);
+        }
+
+        if (i == 0 && pipeline_param->output_region) {
+            dst_rects[i] = *pipeline_param->output_region;
+        } else {
+            dst_rects[i].x = 0;
+            dst_rects[i].y = 0;
+            dst_rects[i].width = obj_dst_surf->orig_width;
+            dst_rects[i].height = obj_dst_surf->orig_height;
+        }
+
+        obj_dst_surfs[i] = obj_dst_surf;
+    }
+
+    /* Field rate deinterlacing if asked for, a single VEBOX run writes both
+     * fields */
+    if (i965_proc_field_rate_filter(ctx, pipeline_param, obj_dst_surfs[0]) >= 0 &&
+        obj_src_surf->fourcc != VA_FOURCC_P010 &&
+        obj_dst_surfs[0]->fourcc != VA_FOURCC_P010) {
+        output_param = *pipeline_param;
+        output_param.additional_outputs = NULL;
+        output_param.num_additional_outputs = 0;
+
+        proc_ctx->surface_second_field_object = obj_dst_surfs[1];
+
+        status = gen75_proc_picture_output(ctx, profile, codec_state, hw_context,
+                                           &output_param, render_target);
+
+        proc_ctx->surface_second_field_object = NULL;
+
+        return status;
+    }
+
+    if (proc_ctx->vpp_fmt_cvt_ctx == NULL)
+        proc_ctx->vpp_fmt_cvt_ctx = i965_proc_context_init(ctx, NULL);
+
+    /* As on Gen7, the filters run once into an intermediate NV12 surface
+     * that all the outputs are scaled from */
+    obj_scale_surf = obj_src_surf;
+    output_param = *pipeline_param;
+    output_param.additional_outputs = NULL;
+    output_param.num_additional_outputs = 0;
+
+    if (pipeline_param->num_filters && pipeline_param->filters) {
+        status = i965_CreateSurfaces(ctx,
+                                     obj_src_surf->orig_width,
+                                     obj_src_surf->orig_height,
+                                     VA_RT_FORMAT_YUV420,
+                                     1,
+                                     &filtered_surface_id);
+
+        if (status != VA_STATUS_SUCCESS)
+            return status;
+
+        obj_scale_surf = SURFACE(filtered_surface_id);
+        assert(obj_scale_surf);
+        i965_check_alloc_surface_bo(ctx, obj_scale_surf, 1, VA_FOURCC_NV12, SUBSAMPLE_YUV420);
+
+        output_param.surface_region = NULL;
+        output_param.output_region = NULL;
+        output_param.output_background_color = 0;
+
+        status = gen75_proc_picture_output(ctx, profile, codec_state, hw_context,
+                                           &output_param, filtered_surface_id);
+
+        if (status != VA_STATUS_SUCCESS)
+            goto out;
+
+        output_param = *pipeline_param;
+        output_param.surface = filtered_surface_id;
+        output_param.filter_flags &= VA_FILTER_SCALING_MASK;
+        output_param.filters = NULL;
+        output_param.num_filters = 0;
+        output_param.additional_outputs = NULL;
+        output_param.num_additional_outputs = 0;
+    }
+
+    fused = intel_vpp_support_yuv420p8_scaling(proc_ctx) &&
+        gen75_proc_is_yuv420p8(obj_scale_surf->fourcc);
+
+    for (i = 0; fused && i < num_outputs; i++)
+        fused = gen75_proc_is_yuv420p8(obj_dst_surfs[i]->fourcc);
+
+    if (fused) {
+        status = gen75_proc_picture_yuv420p8_outputs(ctx, proc_ctx,
+                                                     &output_param,
+                                                     obj_scale_surf, &src_rect,
+                                                     obj_dst_surfs, dst_rects,
+                                                     num_outputs);
+        goto out;
+    }
+
+    /* Anything else runs the unfiltered single output pipeline once per
+     * output, the AVS coefficients of all the walks are generated first */
+    i965_post_processing_prepare_avs(ctx, &src_rect, dst_rects, num_outputs,
+                                     output_param.filter_flags);
+
+    output_param.surface_region = &src_rect;
+
+    for (i = 0; i < num_outputs && status == VA_STATUS_SUCCESS; i++) {
+        output_param.output_region = &dst_rects[i];
+
+        status = gen75_proc_picture_output(ctx, profile, codec_state, hw_context,
+                                           &output_param,
+                                           i ? pipeline_param->additional_outputs[i - 1] : render_target);
+    }
+
+out:
+    if (filtered_surface_id != VA_INVALID_SURFACE)
+        i965_DestroySurfaces(ctx, &filtered_surface_id, 1);
+
+    return status;
+}
+
 static void 
 gen75_proc_context_destroy(void *hw_context)
 {
@@ -44,6 +44,16 @@ struct intel_video_process_context
 
     struct object_surface *surface_render_output_object;
     struct object_surface *surface_pipeline_input_object;
+
+    /* Second field output of a field rate deinterlacing picture */
+    struct object_surface *surface_second_field_object;
+
+    /* Statistics buffer of the picture, VEBOX runs only */
+    struct buffer_store *statistics;
+
+    /* The picture as i965_proc_picture() sees it, see gen75_vpp_fmt_cvt() */
+    union codec_state fmt_cvt_state;
+    struct buffer_store fmt_cvt_pipeline_param;
 };
 
 struct hw_context *
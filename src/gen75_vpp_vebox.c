@@ -37,6 +37,7 @@
 #include "i965_defines.h"
 #include "i965_structs.h"
 #include "gen75_vpp_vebox.h"
+#include "i965_vpp_statistics.h"
 #include "intel_media.h"
 
 #include "i965_post_processing.h"
@@ -928,35 +929,6 @@ void hsw_veb_iecp_aoi_table(VADriverContextP ctx, struct intel_vebox_context *pr
    }
 }
 
-void hsw_veb_state_table_setup(VADriverContextP ctx, struct intel_vebox_context *proc_ctx)
-{
-    if(proc_ctx->filters_mask & VPP_DNDI_MASK) {
-        dri_bo *dndi_bo = proc_ctx->dndi_state_table.bo;
-        dri_bo_map(dndi_bo, 1);
-        proc_ctx->dndi_state_table.ptr = dndi_bo->virtual;
-
-        hsw_veb_dndi_table(ctx, proc_ctx);
-
-        dri_bo_unmap(dndi_bo);
-    }
-
-    if(proc_ctx->filters_mask & VPP_IECP_MASK) {
-        dri_bo *iecp_bo = proc_ctx->iecp_state_table.bo;
-        dri_bo_map(iecp_bo, 1);
-        proc_ctx->iecp_state_table.ptr = iecp_bo->virtual;
-        memset(proc_ctx->iecp_state_table.ptr, 0, 97 * 4);
-
-        hsw_veb_iecp_std_table(ctx, proc_ctx);
-        hsw_veb_iecp_ace_table(ctx, proc_ctx);
-        hsw_veb_iecp_tcc_table(ctx, proc_ctx);
-        hsw_veb_iecp_pro_amp_table(ctx, proc_ctx);
-        hsw_veb_iecp_csc_transform_table(ctx, proc_ctx);
-        hsw_veb_iecp_aoi_table(ctx, proc_ctx);
-   
-        dri_bo_unmap(iecp_bo);
-    }
-}
-
 void hsw_veb_state_command(VADriverContextP ctx, struct intel_vebox_context *proc_ctx)
 {
     struct intel_batchbuffer *batch = proc_ctx->batch;
@@ -1133,9 +1105,15 @@ void hsw_veb_dndi_iecp_command(VADriverContextP ctx, struct intel_vebox_context
     OUT_RELOC(batch,
               proc_ctx->frame_store[FRAME_OUT_PREVIOUS].obj_surface->bo,
               I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, frame_ctrl_bits);
-    OUT_RELOC(batch,
-              proc_ctx->frame_store[FRAME_OUT_STATISTIC].obj_surface->bo,
-              I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, frame_ctrl_bits);
+    if (proc_ctx->statistics)
+        OUT_RELOC(batch,
+                  proc_ctx->statistics->bo,
+                  I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
+                  I965_PROC_STATISTICS_HEADER_SIZE | frame_ctrl_bits);
+    else
+        OUT_RELOC(batch,
+                  proc_ctx->frame_store[FRAME_OUT_STATISTIC].obj_surface->bo,
+                  I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, frame_ctrl_bits);
 
     ADVANCE_VEB_BATCH(batch);
 }
@@ -1149,17 +1127,176 @@ frame_store_reset(VEBFrameStore *fs)
     fs->is_scratch_surface = 0;
 }
 
+static int
+veb_scratch_surface_is_busy(struct intel_vebox_context *proc_ctx,
+    struct object_surface *obj_surface)
+{
+    int i;
+
+    for (i = 0; i < FRAME_STORE_COUNT; i++) {
+        if (proc_ctx->frame_store[i].is_scratch_surface &&
+            proc_ctx->frame_store[i].obj_surface == obj_surface)
+            return 1;
+    }
+
+    return 0;
+}
+
+static VEBScratchSurface *
+veb_scratch_surface_lookup(struct intel_vebox_context *proc_ctx,
+    struct object_surface *obj_surface)
+{
+    int i;
+
+    for (i = 0; i < VEB_SCRATCH_RING_SIZE; i++) {
+        if (proc_ctx->scratch_ring[i].obj_surface == obj_surface)
+            return &proc_ctx->scratch_ring[i];
+    }
+
+    return NULL;
+}
+
+static int
+veb_scratch_surface_matches(struct intel_vebox_context *proc_ctx,
+    const VEBScratchSurface *entry, unsigned int fourcc, unsigned int sampling,
+    int tiled)
+{
+    return entry->obj_surface &&
+        entry->fourcc == fourcc &&
+        entry->sampling == sampling &&
+        entry->tiled == tiled &&
+        entry->width == proc_ctx->width_input &&
+        entry->height == proc_ctx->height_input;
+}
+
 static void
-frame_store_clear(VEBFrameStore *fs, VADriverContextP ctx)
+veb_scratch_surface_release(VADriverContextP ctx, VEBScratchSurface *entry)
 {
-    if (fs->obj_surface && fs->is_scratch_surface) {
-        VASurfaceID surface_id = fs->obj_surface->base.id;
-        i965_DestroySurfaces(ctx, &surface_id, 1);
+    VASurfaceID surface_id;
+
+    if (!entry->obj_surface)
+        return;
+
+    surface_id = entry->obj_surface->base.id;
+    i965_DestroySurfaces(ctx, &surface_id, 1);
+    memset(entry, 0, sizeof(*entry));
+}
+
+/* Hands out an idle ring surface of the current input size and the given
+ * layout, recycling the least recently used entry when none matches */
+static VAStatus
+veb_scratch_surface_get(VADriverContextP ctx,
+    struct intel_vebox_context *proc_ctx, unsigned int fourcc,
+    unsigned int sampling, int tiled, struct object_surface **out_obj_surface)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    VEBScratchSurface *entry, *victim = NULL;
+    struct object_surface *obj_surface;
+    VASurfaceID new_surface;
+    VAStatus status;
+    int i;
+
+    for (i = 0; i < VEB_SCRATCH_RING_SIZE; i++) {
+        entry = &proc_ctx->scratch_ring[i];
+
+        if (entry->obj_surface &&
+            veb_scratch_surface_is_busy(proc_ctx, entry->obj_surface))
+            continue;
+
+        if (veb_scratch_surface_matches(proc_ctx, entry, fourcc, sampling, tiled)) {
+            entry->last_frame = proc_ctx->frame;
+            *out_obj_surface = entry->obj_surface;
+            return VA_STATUS_SUCCESS;
+        }
+
+        if (!victim ||
+            (victim->obj_surface &&
+             (!entry->obj_surface || entry->last_frame < victim->last_frame)))
+            victim = entry;
     }
-    frame_store_reset(fs);
+
+    if (!victim)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    veb_scratch_surface_release(ctx, victim);
+
+    status = i965_CreateSurfaces(ctx, proc_ctx->width_input,
+        proc_ctx->height_input, VA_RT_FORMAT_YUV420, 1, &new_surface);
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    obj_surface = SURFACE(new_surface);
+    assert(obj_surface != NULL);
+
+    status = i965_check_alloc_surface_bo(ctx, obj_surface, tiled, fourcc,
+        sampling);
+    if (status != VA_STATUS_SUCCESS) {
+        i965_DestroySurfaces(ctx, &new_surface, 1);
+        return status;
+    }
+
+    victim->obj_surface = obj_surface;
+    victim->fourcc = fourcc;
+    victim->sampling = sampling;
+    victim->width = proc_ctx->width_input;
+    victim->height = proc_ctx->height_input;
+    victim->tiled = tiled;
+    victim->last_frame = proc_ctx->frame;
+    proc_ctx->num_reallocations++;
+
+    *out_obj_surface = obj_surface;
+
+    return VA_STATUS_SUCCESS;
 }
 
+
+/* Points the VEBOX statistics output of the picture into the application
+   buffer, growing its BO for the picture size */
 static VAStatus
+veb_prepare_statistics(VADriverContextP ctx,
+    struct intel_vebox_context *proc_ctx)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct buffer_store * const buffer_store = proc_ctx->statistics;
+    unsigned int size, flags = 0;
+    dri_bo *bo;
+
+    size = I965_PROC_STATISTICS_HEADER_SIZE +
+        i965_proc_statistics_size(i965->intel.device_info,
+            proc_ctx->width_input, proc_ctx->height_input);
+
+    if (buffer_store->bo->size < size) {
+        bo = drm_intel_bo_alloc(i965->intel.bufmgr, "vebox: statistics",
+            size, 0x1000);
+        if (!bo)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+        drm_intel_bo_unreference(buffer_store->bo);
+        buffer_store->bo = bo;
+    }
+
+    if (!(proc_ctx->filters_mask & VPP_SHARP_MASK)) {
+        if (proc_ctx->is_iecp_enabled)
+            flags |= VA_PROC_STATISTICS_HISTOGRAM;
+        if (proc_ctx->is_dn_enabled)
+            flags |= VA_PROC_STATISTICS_NOISE;
+        if (proc_ctx->is_di_enabled && !proc_ctx->is_first_frame)
+            flags |= VA_PROC_STATISTICS_MOTION;
+    }
+
+    dri_bo_map(buffer_store->bo, 1);
+    if (!buffer_store->bo->virtual)
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+
+    i965_proc_statistics_init(buffer_store->bo->virtual,
+        i965->intel.device_info, proc_ctx->width_input,
+        proc_ctx->height_input, flags);
+    dri_bo_unmap(buffer_store->bo);
+
+    return VA_STATUS_SUCCESS;
+}
+
+VAStatus
 gen75_vebox_ensure_surfaces_storage(VADriverContextP ctx,
     struct intel_vebox_context *proc_ctx)
 {
@@ -1238,73 +1375,109 @@ gen75_vebox_ensure_surfaces_storage(VADriverContextP ctx,
 
     proc_ctx->is_iecp_enabled = (proc_ctx->filters_mask & VPP_IECP_MASK) != 0;
    
-    /* Create pipeline surfaces */
+    /* Create pipeline surfaces, or keep the scratch surfaces of the
+       previous picture when their layout still fits */
+    proc_ctx->frame++;
+
     for (i = 0; i < ARRAY_ELEMS(proc_ctx->frame_store); i ++) {
-        struct object_surface *obj_surface;
-        VASurfaceID new_surface;
+        VEBFrameStore * const fs = &proc_ctx->frame_store[i];
+        struct object_surface *obj_surface = NULL;
+        VEBScratchSurface *entry;
+        unsigned int fourcc, sampling;
+        int tiled;
 
-        if (proc_ctx->frame_store[i].obj_surface)
+        if (fs->obj_surface && !fs->is_scratch_surface)
             continue; // user allocated surface, not VEBOX internal
 
-        status = i965_CreateSurfaces(ctx, proc_ctx->width_input,
-            proc_ctx->height_input, VA_RT_FORMAT_YUV420, 1, &new_surface);
-        if (status != VA_STATUS_SUCCESS)
-            return status;
-
-        obj_surface = SURFACE(new_surface);
-        assert(obj_surface != NULL);
-
         if (i <= FRAME_IN_PREVIOUS || i == FRAME_OUT_CURRENT_DN) {
-            status = i965_check_alloc_surface_bo(ctx, obj_surface,
-                input_tiling, input_fourcc, input_sampling);
+            fourcc = input_fourcc;
+            sampling = input_sampling;
+            tiled = input_tiling;
         }
         else if (i == FRAME_IN_STMM || i == FRAME_OUT_STMM) {
-            status = i965_check_alloc_surface_bo(ctx, obj_surface,
-                1, input_fourcc, input_sampling);
+            fourcc = input_fourcc;
+            sampling = input_sampling;
+            tiled = 1;
+        }
+        else {
+            fourcc = output_fourcc;
+            sampling = output_sampling;
+            tiled = output_tiling;
         }
-        else if (i >= FRAME_OUT_CURRENT) {
-            status = i965_check_alloc_surface_bo(ctx, obj_surface,
-                output_tiling, output_fourcc, output_sampling);
+
+        if (fs->obj_surface) {
+            entry = veb_scratch_surface_lookup(proc_ctx, fs->obj_surface);
+            if (entry && veb_scratch_surface_matches(proc_ctx, entry,
+                    fourcc, sampling, tiled)) {
+                entry->last_frame = proc_ctx->frame;
+                continue;
+            }
+
+            /* The layout changed, the surface goes back to the ring */
+            frame_store_reset(fs);
         }
+
+        status = veb_scratch_surface_get(ctx, proc_ctx, fourcc, sampling,
+            tiled, &obj_surface);
         if (status != VA_STATUS_SUCCESS)
             return status;
 
-        proc_ctx->frame_store[i].obj_surface = obj_surface;
-        proc_ctx->frame_store[i].is_internal_surface = 1;
-        proc_ctx->frame_store[i].is_scratch_surface = 1;
+        fs->obj_surface = obj_surface;
+        fs->is_internal_surface = 1;
+        fs->is_scratch_surface = 1;
     }
 
-    /* Allocate DNDI state table  */
-    drm_intel_bo_unreference(proc_ctx->dndi_state_table.bo);
-    bo = drm_intel_bo_alloc(i965->intel.bufmgr, "vebox: dndi state Buffer",
-        0x1000, 0x1000);
-    proc_ctx->dndi_state_table.bo = bo;
-    if (!bo)
-        return VA_STATUS_ERROR_ALLOCATION_FAILED;
- 
-    /* Allocate IECP state table  */
-    drm_intel_bo_unreference(proc_ctx->iecp_state_table.bo);
-    bo = drm_intel_bo_alloc(i965->intel.bufmgr, "vebox: iecp state Buffer",
-        0x1000, 0x1000);
-    proc_ctx->iecp_state_table.bo = bo;
-    if (!bo)
-        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    for (i = 0; i < VEB_SCRATCH_RING_SIZE; i++) {
+        VEBScratchSurface * const entry = &proc_ctx->scratch_ring[i];
 
-    /* Allocate Gamut state table  */
-    drm_intel_bo_unreference(proc_ctx->gamut_state_table.bo);
-    bo = drm_intel_bo_alloc(i965->intel.bufmgr, "vebox: gamut state Buffer",
-        0x1000, 0x1000);
-    proc_ctx->gamut_state_table.bo = bo;
-    if (!bo)
-        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        if (entry->obj_surface &&
+            proc_ctx->frame - entry->last_frame > VEB_SCRATCH_IDLE_FRAMES &&
+            !veb_scratch_surface_is_busy(proc_ctx, entry->obj_surface))
+            veb_scratch_surface_release(ctx, entry);
+    }
 
-    /* Allocate vertex state table  */
-    drm_intel_bo_unreference(proc_ctx->vertex_state_table.bo);
-    bo = drm_intel_bo_alloc(i965->intel.bufmgr, "vebox: vertex state Buffer",
-        0x1000, 0x1000);
-    proc_ctx->vertex_state_table.bo = bo;
-    if (!bo)
-        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    /* Upload the DNDI and IECP state tables when they changed. The VEBOX
+       may still read the previous ones, so they go to new BOs rather than
+       waiting for the old ones to be idle */
+    if (gen75_vebox_prepare_state_tables(ctx, proc_ctx) ||
+        !proc_ctx->dndi_state_table.bo ||
+        !proc_ctx->iecp_state_table.bo) {
+        drm_intel_bo_unreference(proc_ctx->dndi_state_table.bo);
+        bo = drm_intel_bo_alloc(i965->intel.bufmgr, "vebox: dndi state Buffer",
+            0x1000, 0x1000);
+        proc_ctx->dndi_state_table.bo = bo;
+        if (!bo)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        dri_bo_subdata(bo, 0, sizeof(proc_ctx->dndi_table), proc_ctx->dndi_table);
+
+        drm_intel_bo_unreference(proc_ctx->iecp_state_table.bo);
+        bo = drm_intel_bo_alloc(i965->intel.bufmgr, "vebox: iecp state Buffer",
+            0x1000, 0x1000);
+        proc_ctx->iecp_state_table.bo = bo;
+        if (!bo)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        dri_bo_subdata(bo, 0, sizeof(proc_ctx->iecp_table), proc_ctx->iecp_table);
+    }
+
+    /* The gamut and vertex state tables are never written */
+    if (!proc_ctx->gamut_state_table.bo) {
+        bo = drm_intel_bo_alloc(i965->intel.bufmgr, "vebox: gamut state Buffer",
+            0x1000, 0x1000);
+        proc_ctx->gamut_state_table.bo = bo;
+        if (!bo)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    if (!proc_ctx->vertex_state_table.bo) {
+        bo = drm_intel_bo_alloc(i965->intel.bufmgr, "vebox: vertex state Buffer",
+            0x1000, 0x1000);
+        proc_ctx->vertex_state_table.bo = bo;
+        if (!bo)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    if (proc_ctx->statistics)
+        return veb_prepare_statistics(ctx, proc_ctx);
 
     return VA_STATUS_SUCCESS;
 }
@@ -1341,7 +1514,7 @@ gen75_vebox_ensure_surfaces(VADriverContextP ctx,
             if (!obj_surface || obj_surface->base.id == ifs->surface_id)
                 break;
 
-            frame_store_clear(ifs, ctx);
+            frame_store_reset(ifs);
             if (obj_surface->base.id == ofs->surface_id) {
                 *ifs = *ofs;
                 frame_store_reset(ofs);
@@ -1360,7 +1533,7 @@ gen75_vebox_ensure_surfaces(VADriverContextP ctx,
         proc_ctx->surface_input_vebox_object : proc_ctx->surface_input_object;
 
     ifs = &proc_ctx->frame_store[FRAME_IN_CURRENT];
-    frame_store_clear(ifs, ctx);
+    frame_store_reset(ifs);
     ifs->obj_surface = obj_surface;
     ifs->surface_id = proc_ctx->surface_input_object->base.id;
     ifs->is_internal_surface = proc_ctx->surface_input_vebox_object != NULL;
@@ -1397,12 +1570,65 @@ gen75_vebox_ensure_surfaces(VADriverContextP ctx,
     else
         proc_ctx->current_output = FRAME_OUT_CURRENT;
     ofs = &proc_ctx->frame_store[proc_ctx->current_output];
-    frame_store_clear(ofs, ctx);
+    frame_store_reset(ofs);
     ofs->obj_surface = obj_surface;
     ofs->surface_id = proc_ctx->surface_input_object->base.id;
     ofs->is_internal_surface = proc_ctx->surface_output_vebox_object != NULL;
     ofs->is_scratch_surface = 0;
 
+    /* The second field goes straight to its surface, unless the output is
+       converted afterwards. It then stays in a scratch surface */
+    if (proc_ctx->is_field_rate && !proc_ctx->surface_output_vebox_object) {
+        ofs = &proc_ctx->frame_store[FRAME_OUT_CURRENT];
+        frame_store_reset(ofs);
+        ofs->obj_surface = proc_ctx->surface_second_field_object;
+        ofs->surface_id = proc_ctx->surface_input_object->base.id;
+    }
+
+    return VA_STATUS_SUCCESS;
+}
+
+/* (Re)creates one of the NV12 temporaries of the format conversion passes,
+ * only when the picture size changed since it was allocated */
+static VAStatus
+veb_ensure_temp_surface(VADriverContextP ctx,
+    struct intel_vebox_context *proc_ctx, VASurfaceID *surface_id,
+    struct object_surface **obj_surface, int width, int height)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    VAStatus status;
+    int i;
+
+    if (*obj_surface && (*obj_surface)->orig_width == width &&
+        (*obj_surface)->orig_height == height)
+        return VA_STATUS_SUCCESS;
+
+    if (*surface_id != VA_INVALID_ID) {
+        for (i = 0; i < FRAME_STORE_COUNT; i++) {
+            if (proc_ctx->frame_store[i].obj_surface == *obj_surface)
+                frame_store_reset(&proc_ctx->frame_store[i]);
+        }
+
+        i965_DestroySurfaces(ctx, surface_id, 1);
+        *surface_id = VA_INVALID_ID;
+        *obj_surface = NULL;
+    }
+
+    status = i965_CreateSurfaces(ctx, width, height, VA_RT_FORMAT_YUV420, 1,
+        surface_id);
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    *obj_surface = SURFACE(*surface_id);
+    assert(*obj_surface);
+
+    status = i965_check_alloc_surface_bo(ctx, *obj_surface, 1,
+        VA_FOURCC_NV12, SUBSAMPLE_YUV420);
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    proc_ctx->num_reallocations++;
+
     return VA_STATUS_SUCCESS;
 }
 
@@ -1410,11 +1636,8 @@ VAStatus hsw_veb_pre_format_convert(VADriverContextP ctx,
                            struct intel_vebox_context *proc_ctx)
 {
     VAStatus va_status;
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct object_surface* obj_surf_input = proc_ctx->surface_input_object;
     struct object_surface* obj_surf_output = proc_ctx->surface_output_object;
-    struct object_surface* obj_surf_input_vebox;
-    struct object_surface* obj_surf_output_vebox;
 
     proc_ctx->format_convert_flags = 0;
 
@@ -1477,24 +1700,16 @@ VAStatus hsw_veb_pre_format_convert(VADriverContextP ctx,
      }
     
      if (proc_ctx->format_convert_flags & PRE_FORMAT_CONVERT) {
-         if(proc_ctx->surface_input_vebox_object == NULL){
-             va_status = i965_CreateSurfaces(ctx,
-                                            proc_ctx->width_input,
-                                            proc_ctx->height_input,
-                                            VA_RT_FORMAT_YUV420,
-                                            1,
-                                            &(proc_ctx->surface_input_vebox));
-             assert(va_status == VA_STATUS_SUCCESS);
-             obj_surf_input_vebox = SURFACE(proc_ctx->surface_input_vebox);
-             assert(obj_surf_input_vebox);
-
-             if (obj_surf_input_vebox) {
-                 proc_ctx->surface_input_vebox_object = obj_surf_input_vebox;
-                 i965_check_alloc_surface_bo(ctx, obj_surf_input_vebox, 1, VA_FOURCC_NV12, SUBSAMPLE_YUV420);
-             }
-         }
-       
+         va_status = veb_ensure_temp_surface(ctx, proc_ctx,
+                                             &proc_ctx->surface_input_vebox,
+                                             &proc_ctx->surface_input_vebox_object,
+                                             proc_ctx->width_input,
+                                             proc_ctx->height_input);
+         if (va_status != VA_STATUS_SUCCESS)
+             return va_status;
+
          vpp_surface_convert(ctx, proc_ctx->surface_input_object, proc_ctx->surface_input_vebox_object);
+         proc_ctx->num_conversions++;
       }
 
       /* create one temporary NV12 surfaces for conversion*/
@@ -1519,49 +1734,31 @@ VAStatus hsw_veb_pre_format_convert(VADriverContextP ctx,
   
      if(proc_ctx->format_convert_flags & POST_FORMAT_CONVERT ||
         proc_ctx->format_convert_flags & POST_SCALING_CONVERT){
-       if(proc_ctx->surface_output_vebox_object == NULL){
-             va_status = i965_CreateSurfaces(ctx,
-                                            proc_ctx->width_input,
-                                            proc_ctx->height_input,
-                                            VA_RT_FORMAT_YUV420,
-                                            1,
-                                            &(proc_ctx->surface_output_vebox));
-             assert(va_status == VA_STATUS_SUCCESS);
-             obj_surf_output_vebox = SURFACE(proc_ctx->surface_output_vebox);
-             assert(obj_surf_output_vebox);
-
-             if (obj_surf_output_vebox) {
-                 proc_ctx->surface_output_vebox_object = obj_surf_output_vebox;
-                 i965_check_alloc_surface_bo(ctx, obj_surf_output_vebox, 1, VA_FOURCC_NV12, SUBSAMPLE_YUV420);
-             }
-       }
+         va_status = veb_ensure_temp_surface(ctx, proc_ctx,
+                                             &proc_ctx->surface_output_vebox,
+                                             &proc_ctx->surface_output_vebox_object,
+                                             proc_ctx->width_input,
+                                             proc_ctx->height_input);
+         if (va_status != VA_STATUS_SUCCESS)
+             return va_status;
      }   
 
      if(proc_ctx->format_convert_flags & POST_SCALING_CONVERT){
-       if(proc_ctx->surface_output_scaled_object == NULL){
-             va_status = i965_CreateSurfaces(ctx,
-                                            proc_ctx->width_output,
-                                            proc_ctx->height_output,
-                                            VA_RT_FORMAT_YUV420,
-                                            1,
-                                            &(proc_ctx->surface_output_scaled));
-             assert(va_status == VA_STATUS_SUCCESS);
-             obj_surf_output_vebox = SURFACE(proc_ctx->surface_output_scaled);
-             assert(obj_surf_output_vebox);
-
-             if (obj_surf_output_vebox) {
-                 proc_ctx->surface_output_scaled_object = obj_surf_output_vebox;
-                 i965_check_alloc_surface_bo(ctx, obj_surf_output_vebox, 1, VA_FOURCC_NV12, SUBSAMPLE_YUV420);
-             }
-       }
+         va_status = veb_ensure_temp_surface(ctx, proc_ctx,
+                                             &proc_ctx->surface_output_scaled,
+                                             &proc_ctx->surface_output_scaled_object,
+                                             proc_ctx->width_output,
+                                             proc_ctx->height_output);
+         if (va_status != VA_STATUS_SUCCESS)
+             return va_status;
      } 
     
      return VA_STATUS_SUCCESS;
 }
 
-VAStatus
-hsw_veb_post_format_convert(VADriverContextP ctx,
-                           struct intel_vebox_context *proc_ctx)
+static VAStatus
+hsw_veb_post_format_convert_output(VADriverContextP ctx,
+                                   struct intel_vebox_context *proc_ctx)
 {
     struct object_surface *obj_surface = NULL;
     VAStatus va_status = VA_STATUS_SUCCESS;
@@ -1571,6 +1768,7 @@ hsw_veb_post_format_convert(VADriverContextP ctx,
     if (proc_ctx->format_convert_flags & POST_COPY_CONVERT) {
         /* copy the saved frame in the second call */
         va_status = vpp_surface_convert(ctx, obj_surface, proc_ctx->surface_output_object);
+        proc_ctx->num_conversions++;
     } else if(!(proc_ctx->format_convert_flags & POST_FORMAT_CONVERT) &&
        !(proc_ctx->format_convert_flags & POST_SCALING_CONVERT)){
         /* Output surface format is covered by vebox pipeline and 
@@ -1580,6 +1778,7 @@ hsw_veb_post_format_convert(VADriverContextP ctx,
                !(proc_ctx->format_convert_flags & POST_SCALING_CONVERT)){
        /* convert and copy NV12 to YV12/IMC3/IMC2/RGBA output*/
         va_status = vpp_surface_convert(ctx, obj_surface, proc_ctx->surface_output_object);
+        proc_ctx->num_conversions++;
 
     } else if(proc_ctx->format_convert_flags & POST_SCALING_CONVERT) {
         VAProcPipelineParameterBuffer * const pipe = proc_ctx->pipeline_param;
@@ -1594,11 +1793,35 @@ hsw_veb_post_format_convert(VADriverContextP ctx,
         obj_surface = proc_ctx->surface_output_object;
 
 	va_status = vpp_surface_convert(ctx, proc_ctx->surface_output_scaled_object, obj_surface);
+        proc_ctx->num_conversions++;
    }
 
     return va_status;
 }
 
+VAStatus
+hsw_veb_post_format_convert(VADriverContextP ctx,
+                           struct intel_vebox_context *proc_ctx)
+{
+    struct object_surface * const obj_output = proc_ctx->surface_output_object;
+    const int current_output = proc_ctx->current_output;
+    VAStatus va_status;
+
+    va_status = hsw_veb_post_format_convert_output(ctx, proc_ctx);
+
+    /* Field rate: the second field was left in FRAME_OUT_CURRENT */
+    if (va_status == VA_STATUS_SUCCESS && proc_ctx->is_field_rate &&
+        proc_ctx->surface_output_vebox_object) {
+        proc_ctx->current_output = FRAME_OUT_CURRENT;
+        proc_ctx->surface_output_object = proc_ctx->surface_second_field_object;
+        va_status = hsw_veb_post_format_convert_output(ctx, proc_ctx);
+        proc_ctx->current_output = current_output;
+        proc_ctx->surface_output_object = obj_output;
+    }
+
+    return va_status;
+}
+
 static VAStatus
 gen75_vebox_init_pipe_params(VADriverContextP ctx,
     struct intel_vebox_context *proc_ctx)
@@ -1626,6 +1849,14 @@ gen75_vebox_init_pipe_params(VADriverContextP ctx,
         case VAProcFilterDeinterlacing:
             proc_ctx->filters_mask |= VPP_DNDI_DI;
             proc_ctx->filter_di = filter;
+
+            /* Same frame again, for the other field */
+            if (proc_ctx->is_second_field_pass) {
+                proc_ctx->di_second_field =
+                    *(VAProcFilterParameterBufferDeinterlacing *)filter;
+                proc_ctx->di_second_field.flags ^= VA_DEINTERLACING_BOTTOM_FIELD;
+                proc_ctx->filter_di = &proc_ctx->di_second_field;
+            }
             break;
         case VAProcFilterColorBalance:
             proc_ctx->filters_mask |= VPP_IECP_PRO_AMP;
@@ -1663,6 +1894,7 @@ gen75_vebox_init_filter_params(VADriverContextP ctx,
     proc_ctx->is_di_adv_enabled = 0;
     proc_ctx->is_first_frame = 0;
     proc_ctx->is_second_field = 0;
+    proc_ctx->is_field_rate = 0;
 
     /* Check whether we are deinterlacing the second field */
     if (proc_ctx->is_di_enabled) {
@@ -1725,6 +1957,15 @@ gen75_vebox_init_filter_params(VADriverContextP ctx,
             return VA_STATUS_ERROR_UNSUPPORTED_FILTER;
         }
     }
+
+    /* A motion adaptive run on the first field outputs both fields */
+    proc_ctx->is_field_rate = proc_ctx->surface_second_field_object &&
+        !proc_ctx->is_second_field_pass &&
+        proc_ctx->is_di_adv_enabled &&
+        !proc_ctx->is_first_frame &&
+        !proc_ctx->is_second_field &&
+        !(proc_ctx->filters_mask & VPP_SHARP_MASK);
+
     return VA_STATUS_SUCCESS;
 }
 
@@ -1762,7 +2003,6 @@ gen75_vebox_process_picture(VADriverContextP ctx,
     } else {
         intel_batchbuffer_start_atomic_veb(proc_ctx->batch, 0x1000);
         intel_batchbuffer_emit_mi_flush(proc_ctx->batch);
-        hsw_veb_state_table_setup(ctx, proc_ctx);
         hsw_veb_state_command(ctx, proc_ctx);		
         hsw_veb_surface_state(ctx, proc_ctx, INPUT_SURFACE);
         hsw_veb_surface_state(ctx, proc_ctx, OUTPUT_SURFACE);
@@ -1805,7 +2045,10 @@ void gen75_vebox_context_destroy(VADriverContextP ctx,
      }
 
     for (i = 0; i < ARRAY_ELEMS(proc_ctx->frame_store); i++)
-        frame_store_clear(&proc_ctx->frame_store[i], ctx);
+        frame_store_reset(&proc_ctx->frame_store[i]);
+
+    for (i = 0; i < VEB_SCRATCH_RING_SIZE; i++)
+        veb_scratch_surface_release(ctx, &proc_ctx->scratch_ring[i]);
 
     /* dndi state table  */
     drm_intel_bo_unreference(proc_ctx->dndi_state_table.bo);
@@ -1948,9 +2191,15 @@ void bdw_veb_dndi_iecp_command(VADriverContextP ctx, struct intel_vebox_context
               proc_ctx->frame_store[FRAME_OUT_PREVIOUS].obj_surface->bo,
               I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, frame_ctrl_bits);//DWord 14
 
-    OUT_RELOC64(batch,
-              proc_ctx->frame_store[FRAME_OUT_STATISTIC].obj_surface->bo,
-              I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, frame_ctrl_bits);//DWord 16
+    if (proc_ctx->statistics)
+        OUT_RELOC64(batch,
+                  proc_ctx->statistics->bo,
+                  I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
+                  I965_PROC_STATISTICS_HEADER_SIZE | frame_ctrl_bits);//DWord 16
+    else
+        OUT_RELOC64(batch,
+                  proc_ctx->frame_store[FRAME_OUT_STATISTIC].obj_surface->bo,
+                  I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, frame_ctrl_bits);//DWord 16
 
     OUT_VEB_BATCH(batch,0);//DWord 18
     OUT_VEB_BATCH(batch,0);//DWord 19
@@ -1992,7 +2241,6 @@ gen8_vebox_process_picture(VADriverContextP ctx,
     } else {
         intel_batchbuffer_start_atomic_veb(proc_ctx->batch, 0x1000);
         intel_batchbuffer_emit_mi_flush(proc_ctx->batch);
-        hsw_veb_state_table_setup(ctx, proc_ctx);
         bdw_veb_state_command(ctx, proc_ctx);		
         hsw_veb_surface_state(ctx, proc_ctx, INPUT_SURFACE);
         hsw_veb_surface_state(ctx, proc_ctx, OUTPUT_SURFACE);
@@ -2245,33 +2493,105 @@ void skl_veb_iecp_aoi_table(VADriverContextP ctx, struct intel_vebox_context *pr
     }
 }
 
-void skl_veb_state_table_setup(VADriverContextP ctx, struct intel_vebox_context *proc_ctx)
+/* Everything the table builders above read, filled in only for the
+ * filters that are enabled so that unrelated changes still hit the cache.
+ * Returns 0 when the picture can't be described by a key */
+static int
+veb_state_key_init(struct intel_vebox_context *proc_ctx, VEBStateKey *key)
 {
-    if(proc_ctx->filters_mask & VPP_DNDI_MASK) {
-        dri_bo *dndi_bo = proc_ctx->dndi_state_table.bo;
-        dri_bo_map(dndi_bo, 1);
-        proc_ctx->dndi_state_table.ptr = dndi_bo->virtual;
+    unsigned int i;
 
-        skl_veb_dndi_table(ctx, proc_ctx);
+    memset(key, 0, sizeof(*key));
+    key->filters_mask = proc_ctx->filters_mask & (VPP_DNDI_MASK | VPP_IECP_MASK);
 
-        dri_bo_unmap(dndi_bo);
+    if (proc_ctx->filters_mask & VPP_DNDI_DI) {
+        const VAProcFilterParameterBufferDeinterlacing * const deint_params =
+            proc_ctx->filter_di;
+
+        key->is_first_frame = proc_ctx->is_first_frame;
+        key->di_algorithm = deint_params->algorithm;
+        key->di_flags = deint_params->flags;
     }
 
-    if(proc_ctx->filters_mask & VPP_IECP_MASK) {
-        dri_bo *iecp_bo = proc_ctx->iecp_state_table.bo;
-        dri_bo_map(iecp_bo, 1);
-        proc_ctx->iecp_state_table.ptr = iecp_bo->virtual;
-        memset(proc_ctx->iecp_state_table.ptr, 0, 90 * 4);
+    if (proc_ctx->filters_mask & VPP_IECP_STD_STE) {
+        const VAProcFilterParameterBuffer * const std_param =
+            proc_ctx->filter_iecp_std;
+
+        key->std_value = std_param->value;
+    }
 
+    if (proc_ctx->filters_mask & VPP_IECP_PRO_AMP) {
+        const VAProcFilterParameterBufferColorBalance * const amp_params =
+            proc_ctx->filter_iecp_amp;
+
+        if (proc_ctx->filter_iecp_amp_num_elements > VEB_STATE_MAX_AMP_ELEMENTS)
+            return 0;
+
+        key->num_amp_elements = proc_ctx->filter_iecp_amp_num_elements;
+
+        for (i = 0; i < key->num_amp_elements; i++) {
+            key->amp[i].attrib = amp_params[i].attrib;
+            key->amp[i].value = amp_params[i].value;
+        }
+    }
+
+    if (proc_ctx->filters_mask & VPP_IECP_CSC_TRANSFORM) {
+        key->fourcc_input = proc_ctx->fourcc_input;
+        key->fourcc_output = proc_ctx->fourcc_output;
+    }
+
+    return 1;
+}
+
+int
+gen75_vebox_prepare_state_tables(VADriverContextP ctx,
+                                 struct intel_vebox_context *proc_ctx)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    VEBStateKey key;
+    int is_valid;
+
+    is_valid = veb_state_key_init(proc_ctx, &key);
+
+    if (is_valid && proc_ctx->state_key_valid &&
+        memcmp(&key, &proc_ctx->state_key, sizeof(key)) == 0)
+        return 0;
+
+    memset(proc_ctx->dndi_table, 0, sizeof(proc_ctx->dndi_table));
+    memset(proc_ctx->iecp_table, 0, sizeof(proc_ctx->iecp_table));
+    proc_ctx->dndi_state_table.ptr = (char *)proc_ctx->dndi_table;
+    proc_ctx->iecp_state_table.ptr = (char *)proc_ctx->iecp_table;
+
+    if (proc_ctx->filters_mask & VPP_DNDI_MASK) {
+        if (IS_GEN9(i965->intel.device_info))
+            skl_veb_dndi_table(ctx, proc_ctx);
+        else
+            hsw_veb_dndi_table(ctx, proc_ctx);
+    }
+
+    if (proc_ctx->filters_mask & VPP_IECP_MASK) {
         hsw_veb_iecp_std_table(ctx, proc_ctx);
         hsw_veb_iecp_ace_table(ctx, proc_ctx);
         hsw_veb_iecp_tcc_table(ctx, proc_ctx);
         hsw_veb_iecp_pro_amp_table(ctx, proc_ctx);
-        skl_veb_iecp_csc_transform_table(ctx, proc_ctx);
-        skl_veb_iecp_aoi_table(ctx, proc_ctx);
 
-        dri_bo_unmap(iecp_bo);
+        if (IS_GEN9(i965->intel.device_info)) {
+            skl_veb_iecp_csc_transform_table(ctx, proc_ctx);
+            skl_veb_iecp_aoi_table(ctx, proc_ctx);
+        } else {
+            hsw_veb_iecp_csc_transform_table(ctx, proc_ctx);
+            hsw_veb_iecp_aoi_table(ctx, proc_ctx);
+        }
     }
+
+    proc_ctx->dndi_state_table.ptr = NULL;
+    proc_ctx->iecp_state_table.ptr = NULL;
+
+    proc_ctx->state_key = key;
+    proc_ctx->state_key_valid = is_valid;
+    proc_ctx->num_state_table_builds++;
+
+    return 1;
 }
 
 void
@@ -2466,7 +2786,6 @@ gen9_vebox_process_picture(VADriverContextP ctx,
     } else {
         intel_batchbuffer_start_atomic_veb(proc_ctx->batch, 0x1000);
         intel_batchbuffer_emit_mi_flush(proc_ctx->batch);
-        skl_veb_state_table_setup(ctx, proc_ctx);
         skl_veb_state_command(ctx, proc_ctx);
         skl_veb_surface_state(ctx, proc_ctx, INPUT_SURFACE);
         skl_veb_surface_state(ctx, proc_ctx, OUTPUT_SURFACE);
@@ -98,6 +98,52 @@ typedef struct veb_frame_store {
     unsigned int is_scratch_surface : 1;
 } VEBFrameStore;
 
+/*
+ * The scratch frame stores (previous input, STMM, DN/DI outputs and the
+ * statistics) come from a per-context ring and stay there across pictures.
+ * A slot lent to a user surface for one picture hands its scratch surface
+ * back to the ring instead of destroying it, and a format or size change
+ * only swaps in surfaces of the new layout, so the STMM history survives
+ * stream switches at the same resolution. Entries idle for
+ * VEB_SCRATCH_IDLE_FRAMES pictures are released.
+ */
+#define VEB_SCRATCH_RING_SIZE   (2 * FRAME_STORE_COUNT)
+#define VEB_SCRATCH_IDLE_FRAMES 64
+
+typedef struct veb_scratch_surface {
+    struct object_surface *obj_surface;
+    unsigned int fourcc;
+    unsigned int sampling;
+    int width;
+    int height;
+    int tiled;
+    unsigned int last_frame;
+} VEBScratchSurface;
+
+/*
+ * The DNDI and IECP state tables only depend on the filter parameters and
+ * the pipeline formats. They are rebuilt into CPU copies when those change
+ * and uploaded to the state BOs, other pictures reuse the BOs as they are.
+ */
+#define VEB_DNDI_TABLE_DWORDS           32
+#define VEB_IECP_TABLE_DWORDS           128
+#define VEB_STATE_MAX_AMP_ELEMENTS      8
+
+typedef struct veb_state_key {
+    unsigned int filters_mask;
+    unsigned int fourcc_input;
+    unsigned int fourcc_output;
+    unsigned int is_first_frame;
+    unsigned int di_algorithm;
+    unsigned int di_flags;
+    float std_value;
+    unsigned int num_amp_elements;
+    struct {
+        unsigned int attrib;
+        float value;
+    } amp[VEB_STATE_MAX_AMP_ELEMENTS];
+} VEBStateKey;
+
 typedef struct veb_buffer {
     dri_bo  *bo;
     char *  ptr;
@@ -126,12 +172,23 @@ struct intel_vebox_context
     int height_output;
 
     VEBFrameStore frame_store[FRAME_STORE_COUNT];
+    VEBScratchSurface scratch_ring[VEB_SCRATCH_RING_SIZE];
+    unsigned int frame;
+
+    unsigned int num_conversions;       /* vpp_surface_convert() calls */
+    unsigned int num_reallocations;     /* scratch and temporary surfaces created */
 
     VEBBuffer dndi_state_table;
     VEBBuffer iecp_state_table;
     VEBBuffer gamut_state_table;
     VEBBuffer vertex_state_table;
 
+    VEBStateKey state_key;
+    unsigned int state_key_valid;
+    unsigned int dndi_table[VEB_DNDI_TABLE_DWORDS];
+    unsigned int iecp_table[VEB_IECP_TABLE_DWORDS];
+    unsigned int num_state_table_builds;
+
     unsigned int  filters_mask;
     int current_output;
     int current_output_type; /* 0:Both, 1:Previous, 2:Current */
@@ -147,6 +204,18 @@ struct intel_vebox_context
     unsigned int  filter_iecp_amp_num_elements;
     unsigned char format_convert_flags;
 
+    /* Field rate deinterlacing: the second field of the input frame goes
+       to this surface, set by the caller for the current picture only.
+       A motion adaptive run writes both fields at once, otherwise the
+       caller runs the picture again with is_second_field_pass set */
+    struct object_surface *surface_second_field_object;
+    VAProcFilterParameterBufferDeinterlacing di_second_field;
+    unsigned int is_second_field_pass   : 1;
+
+    /* VAProcStatisticsBufferTypeIntel buffer of the current picture, the
+       VEBOX writes its statistics there instead of the scratch surface */
+    struct buffer_store *statistics;
+
     /* Temporary flags live until the current picture is processed */
     unsigned int is_iecp_enabled        : 1;
     unsigned int is_dn_enabled          : 1;
@@ -154,6 +223,7 @@ struct intel_vebox_context
     unsigned int is_di_adv_enabled      : 1;
     unsigned int is_first_frame         : 1;
     unsigned int is_second_field        : 1;
+    unsigned int is_field_rate          : 1;
 
     struct vpp_gpe_context     *vpp_gpe_ctx;
 };
@@ -172,4 +242,20 @@ VAStatus gen8_vebox_process_picture(VADriverContextP ctx,
 VAStatus gen9_vebox_process_picture(VADriverContextP ctx,
                          struct intel_vebox_context *proc_ctx);
 
+/* Converts the inputs the VEBOX can't read to NV12, and sizes the NV12
+ * temporaries of the conversions around the VEBOX walk */
+VAStatus hsw_veb_pre_format_convert(VADriverContextP ctx,
+                         struct intel_vebox_context *proc_ctx);
+
+/* Takes the scratch frame stores of the picture from the ring of the
+ * context and uploads the state tables */
+VAStatus gen75_vebox_ensure_surfaces_storage(VADriverContextP ctx,
+                         struct intel_vebox_context *proc_ctx);
+
+/* Rebuilds the CPU copies of the DNDI and IECP state tables when the filter
+ * parameters or the formats changed since the previous picture. Returns
+ * whether they were rebuilt */
+int gen75_vebox_prepare_state_tables(VADriverContextP ctx,
+                         struct intel_vebox_context *proc_ctx);
+
 #endif
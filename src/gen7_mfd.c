@@ -35,6 +35,7 @@
 #include "i965_defines.h"
 #include "i965_drv_video.h"
 #include "i965_decoder_utils.h"
+#include "i965_jpeg_sw_decoder.h"
 
 #include "gen7_mfd.h"
 #include "intel_media.h"
@@ -2656,6 +2657,11 @@ gen7_mfd_decode_picture(VADriverContextP ctx,
         break;
 
     case VAProfileJPEGBaseline:
+        if (i965_jpeg_sw_decode_wanted(ctx, decode_state)) {
+            vaStatus = i965_jpeg_sw_decode_picture(ctx, decode_state);
+            goto out;
+        }
+
         gen7_mfd_jpeg_decode_picture(ctx, decode_state, gen7_mfd_context);
         break;
 
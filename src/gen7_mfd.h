@@ -87,6 +87,7 @@ struct gen7_mfd_context
     GenBuffer           mpr_row_store_scratch_buffer;
     GenBuffer           bitplane_read_buffer;
     GenBuffer           segmentation_buffer;
+    GenSliceDataBuffer  slice_data_buffer;
     
     VASurfaceID jpeg_wa_surface_id;
     struct object_surface *jpeg_wa_surface_object;
@@ -583,6 +583,16 @@ static void gen8_mfc_init(VADriverContextP ctx,
         mfc_context->reference_surfaces[i].bo = NULL;  
     }
 
+    /* JPEG uses neither the slice batch nor the GPE kernels */
+    if (encoder_context->codec == CODEC_JPEG &&
+        mfc_context->intra_row_store_scratch_buffer.bo &&
+        mfc_context->scratch_width_in_mbs == width_in_mbs &&
+        mfc_context->scratch_height_in_mbs == height_in_mbs)
+        return;
+
+    mfc_context->scratch_width_in_mbs = width_in_mbs;
+    mfc_context->scratch_height_in_mbs = height_in_mbs;
+
     dri_bo_unreference(mfc_context->intra_row_store_scratch_buffer.bo);
     bo = dri_bo_alloc(i965->intel.bufmgr,
                       "Buffer",
@@ -2735,16 +2745,61 @@ get_reciprocal_dword_qm(unsigned char *raster_qm, uint32_t *dword_qm)
 }
 
 
+//Applies the quality factor to a zigzag ordered QM and converts it to the
+//reciprocal dwords expected by the HW. The result is kept in the cache and
+//reused as long as neither the QM nor the quality change.
+static const uint32_t *
+gen8_mfc_jpeg_get_dword_qm(struct gen6_mfc_jpeg_qm_cache *cache,
+                           const unsigned char *qm,
+                           unsigned int quality)
+{
+    unsigned char raster_qm[64], column_raster_qm[64];
+    uint32_t temp;
+    int j;
+
+    if (cache->valid &&
+        cache->quality == quality &&
+        !memcmp(cache->qm, qm, sizeof(cache->qm)))
+        return cache->dword_qm;
+
+    //Step 1. Apply Quality factor and clip to range [1, 255]
+    //For VAAPI, the VAQMatrixBuffer needs to be in zigzag order.
+    //The App should send it in zigzag. Now, the driver has to extract the raster from it.
+    for (j = 0; j < 64; j++) {
+        temp = (qm[j] * quality)/100;
+        temp = (temp > 255) ? 255 : temp;
+        temp = (temp < 1) ? 1 : temp;
+        raster_qm[zigzag_direct[j]] = (unsigned char)temp;
+    }
+
+    //Convert the raster order(row-ordered) to the column-raster (column by column).
+    //To be consistent with the other encoders, send it in column order.
+    //Need to double check if our HW expects col or row raster.
+    for (j = 0; j < 64; j++) {
+        int row = j / 8, col = j % 8;
+        column_raster_qm[col * 8 + row] = raster_qm[j];
+    }
+
+    //Step 2. HW expects the 1/Q[i] values in the qm sent, so get reciprocals
+    //Step 3. HW also expects 32 dwords, hence combine 2 (1/Q) values into 1 dword
+    get_reciprocal_dword_qm(column_raster_qm, cache->dword_qm);
+
+    memcpy(cache->qm, qm, sizeof(cache->qm));
+    cache->quality = quality;
+    cache->valid = 1;
+
+    return cache->dword_qm;
+}
+
 static void 
 gen8_mfc_jpeg_fqm_state(VADriverContextP ctx,
                         struct intel_encoder_context *encoder_context,
                         struct encode_state *encode_state)
 {
     unsigned int quality = 0;
-    uint32_t temp, i = 0, j = 0, dword_qm[32];
+    const uint32_t *dword_qm;
     VAEncPictureParameterBufferJPEG *pic_param;
     VAQMatrixBufferJPEG *qmatrix;
-    unsigned char raster_qm[64], column_raster_qm[64];
     struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
     
     assert(encode_state->pic_param_ext && encode_state->pic_param_ext->buffer);
@@ -2782,75 +2837,29 @@ gen8_mfc_jpeg_fqm_state(VADriverContextP ctx,
     //the correct header information (See build_packed_jpeg_header_buffer() in jpegenc.c in LibVa on
     //how to do this). QTables can be different for different applications. If no tables are provided,
     //the default tables in the driver are used.
+    //The scaling is not applied to the app's buffer in place, so a QM buffer reused for several
+    //pictures is not scaled again on each of them.
 
     //Normalization of the quality factor
     if (quality > 100) quality=100;
     if (quality == 0)  quality=1;
     quality = (quality < 50) ? (5000/quality) : (200 - (quality*2)); 
     
-    //Step 1. Apply Quality factor and clip to range [1, 255] for luma and chroma Quantization matrices
-    //Step 2. HW expects the 1/Q[i] values in the qm sent, so get reciprocals
-    //Step 3. HW also expects 32 dwords, hence combine 2 (1/Q) values into 1 dword
-    //Step 4. Send the Quantization matrix to the HW, use gen8_mfc_fqm_state
-    
     //For luma (Y or R)
     if(qmatrix->load_lum_quantiser_matrix) {
-        //apply quality to lum_quantiser_matrix
-        for(i=0; i < 64; i++) {
-            temp = (qmatrix->lum_quantiser_matrix[i] * quality)/100;
-            //clamp to range [1,255]
-            temp = (temp > 255) ? 255 : temp;
-            temp = (temp < 1) ? 1 : temp;
-            qmatrix->lum_quantiser_matrix[i] = (unsigned char)temp;
-        }       
-        
-        //For VAAPI, the VAQMatrixBuffer needs to be in zigzag order. 
-        //The App should send it in zigzag. Now, the driver has to extract the raster from it. 
-        for (j = 0; j < 64; j++)
-            raster_qm[zigzag_direct[j]] = qmatrix->lum_quantiser_matrix[j];
-
-        //Convert the raster order(row-ordered) to the column-raster (column by column).
-        //To be consistent with the other encoders, send it in column order.
-        //Need to double check if our HW expects col or row raster.
-        for (j = 0; j < 64; j++) {
-            int row = j / 8, col = j % 8;
-            column_raster_qm[col * 8 + row] = raster_qm[j];
-        }
-        
-        //Convert to raster QM to reciprocal. HW expects values in reciprocal.
-        get_reciprocal_dword_qm(column_raster_qm, dword_qm);
-        
+        dword_qm = gen8_mfc_jpeg_get_dword_qm(&mfc_context->jpeg_cache.lum_qm,
+                                              qmatrix->lum_quantiser_matrix,
+                                              quality);
+
         //send the luma qm to the command buffer
         gen8_mfc_fqm_state(ctx, MFX_QM_JPEG_LUMA_Y_QUANTIZER_MATRIX, dword_qm, 32, encoder_context);
     } 
     
     //For Chroma, if chroma exists (Cb, Cr or G, B)
     if(qmatrix->load_chroma_quantiser_matrix) {
-        //apply quality to chroma_quantiser_matrix
-        for(i=0; i < 64; i++) {
-            temp = (qmatrix->chroma_quantiser_matrix[i] * quality)/100;
-            //clamp to range [1,255]
-            temp = (temp > 255) ? 255 : temp;
-            temp = (temp < 1) ? 1 : temp;
-            qmatrix->chroma_quantiser_matrix[i] = (unsigned char)temp;
-        }
-        
-        //For VAAPI, the VAQMatrixBuffer needs to be in zigzag order. 
-        //The App should send it in zigzag. Now, the driver has to extract the raster from it. 
-        for (j = 0; j < 64; j++)
-            raster_qm[zigzag_direct[j]] = qmatrix->chroma_quantiser_matrix[j];
-        
-        //Convert the raster order(row-ordered) to the column-raster (column by column).
-        //To be consistent with the other encoders, send it in column order.
-        //Need to double check if our HW expects col or row raster.
-        for (j = 0; j < 64; j++) {
-            int row = j / 8, col = j % 8;
-            column_raster_qm[col * 8 + row] = raster_qm[j];
-        }
-
-
-        //Convert to raster QM to reciprocal. HW expects values in reciprocal.
-        get_reciprocal_dword_qm(column_raster_qm, dword_qm);
+        dword_qm = gen8_mfc_jpeg_get_dword_qm(&mfc_context->jpeg_cache.chroma_qm,
+                                              qmatrix->chroma_quantiser_matrix,
+                                              quality);
 
         //send the same chroma qm to the command buffer (for both U,V or G,B)
         gen8_mfc_fqm_state(ctx, MFX_QM_JPEG_CHROMA_CB_QUANTIZER_MATRIX, dword_qm, 32, encoder_context);
@@ -2875,115 +2884,37 @@ uint8_t map_huffval_to_index(uint8_t huff_val)
 }
 
 
-//Implementation of Flow chart Annex C  - Figure C.1
+//This method converts the huffman table to code words which is needed by the HW
+//Flowcharts from Jpeg Spec Annex C - Figure C.1, Figure C.2, Figure C.3 are folded
+//into a single pass: codes are assigned in order of increasing length (C.1, C.2)
+//and stored straight at the index of their huffval (C.3)
 static void
-generate_huffman_codesizes_table(uint8_t *bits, uint8_t *huff_size_table, uint8_t *lastK) 
+convert_hufftable_to_codes(const uint8_t *huff_bits, const uint8_t *huff_vals, uint32_t *table, uint8_t type)
 {
-    uint8_t i=1, j=1, k=0;
+    uint8_t huff_val_size = 0, index;
+    uint16_t code = 0;
+    int i, j, k = 0;
 
-    while(i <= 16) {
-        while(j <= (uint8_t)bits[i-1]) {
-            huff_size_table[k] = i;
-            k = k+1;
-            j = j+1;
-        }
-        
-        i = i+1;
-        j = 1;
-    }
-    huff_size_table[k] = 0;
-    (*lastK) = k;    
-}
+    huff_val_size = (type == 0) ? 12 : 162; 
+    memset(table, 0, huff_val_size * sizeof(*table));
 
-//Implementation of Flow chart Annex C - Figure C.2
-static void
-generate_huffman_codes_table(uint8_t *huff_size_table, uint16_t *huff_code_table)
-{
-    uint8_t k=0;
-    uint16_t code=0;
-    uint8_t si=huff_size_table[k];
-    
-    while(huff_size_table[k] != 0) {
-    
-        while(huff_size_table[k] == si) {
-            
+    for (i = 1; i <= 16; i++) {
+        for (j = 0; j < huff_bits[i - 1] && k < huff_val_size; j++, k++) {
             // An huffman code can never be 0xFFFF. Replace it with 0 if 0xFFFF 
-            if(code == 0xFFFF) {
+            if (code == 0xFFFF)
                 code = 0x0000;
-            }
-
-            huff_code_table[k] = code;
-            code = code+1;
-            k = k+1;
-        }
-    
-        code <<= 1;
-        si = si+1;
-    }
-    
-}
-
-//Implementation of Flow chat Annex C - Figure C.3
-static void
-generate_ordered_codes_table(uint8_t *huff_vals, uint8_t *huff_size_table, uint16_t *huff_code_table, uint8_t type, uint8_t lastK)
-{
-    uint8_t huff_val_size=0, i=0, k=0;
-    
-    huff_val_size = (type == 0) ? 12 : 162; 
-    uint8_t huff_si_table[huff_val_size]; 
-    uint16_t huff_co_table[huff_val_size];
-    
-    memset(huff_si_table, 0, sizeof(huff_si_table));
-    memset(huff_co_table, 0, sizeof(huff_co_table));
-    
-    do {
-        i = map_huffval_to_index(huff_vals[k]);
-        huff_co_table[i] = huff_code_table[k];
-        huff_si_table[i] = huff_size_table[k];
-        k++;
-    } while(k < lastK);
-    
-    memcpy(huff_size_table, huff_si_table, sizeof(uint8_t)*huff_val_size);
-    memcpy(huff_code_table, huff_co_table, sizeof(uint16_t)*huff_val_size);
-}
 
+            index = map_huffval_to_index(huff_vals[k]);
 
-//This method converts the huffman table to code words which is needed by the HW
-//Flowcharts from Jpeg Spec Annex C - Figure C.1, Figure C.2, Figure C.3 are used here
-static void
-convert_hufftable_to_codes(VAHuffmanTableBufferJPEGBaseline *huff_buffer, uint32_t *table, uint8_t type, uint8_t index)
-{
-    uint8_t lastK = 0, i=0; 
-    uint8_t huff_val_size = 0;
-    uint8_t *huff_bits, *huff_vals;
+            //HW expects Byte0: Code length; Byte1,Byte2: Code Word, Byte3: Dummy
+            if (index < huff_val_size)
+                table[index] = (i & 0xFF) | ((code & 0xFFFF) << 8);
 
-    huff_val_size = (type == 0) ? 12 : 162; 
-    uint8_t huff_size_table[huff_val_size+1]; //The +1 for adding 0 at the end of huff_val_size
-    uint16_t huff_code_table[huff_val_size];
-
-    memset(huff_size_table, 0, sizeof(huff_size_table));
-    memset(huff_code_table, 0, sizeof(huff_code_table));
-
-    huff_bits = (type == 0) ? (huff_buffer->huffman_table[index].num_dc_codes) : (huff_buffer->huffman_table[index].num_ac_codes);
-    huff_vals = (type == 0) ? (huff_buffer->huffman_table[index].dc_values) : (huff_buffer->huffman_table[index].ac_values);
-    
+            code++;
+        }
 
-    //Generation of table of Huffman code sizes
-    generate_huffman_codesizes_table(huff_bits, huff_size_table, &lastK);
-       
-    //Generation of table of Huffman codes
-    generate_huffman_codes_table(huff_size_table, huff_code_table);
-       
-    //Ordering procedure for encoding procedure code tables
-    generate_ordered_codes_table(huff_vals, huff_size_table, huff_code_table, type, lastK);
-
-    //HW expects Byte0: Code length; Byte1,Byte2: Code Word, Byte3: Dummy
-    //Since IA is littlended, &, | and << accordingly to store the values in the DWord.
-    for(i=0; i<huff_val_size; i++) {
-        table[i] = 0;
-        table[i] = ((huff_size_table[i] & 0xFF) | ((huff_code_table[i] & 0xFFFF) << 8));
+        code <<= 1;
     }
-
 }
 
 //send the huffman table using MFC_JPEG_HUFF_TABLE_STATE
@@ -2995,36 +2926,50 @@ gen8_mfc_jpeg_huff_table_state(VADriverContextP ctx,
 {
     VAHuffmanTableBufferJPEGBaseline *huff_buffer;
     struct intel_batchbuffer *batch = encoder_context->base.batch;
+    struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
+    struct gen6_mfc_jpeg_huff_cache *cache;
     uint8_t index;
-    uint32_t dc_table[12], ac_table[162]; 
     
     assert(encode_state->huffman_table && encode_state->huffman_table->buffer);
     huff_buffer = (VAHuffmanTableBufferJPEGBaseline *)encode_state->huffman_table->buffer;
 
-    memset(dc_table, 0, 12);
-    memset(ac_table, 0, 162);
-
     for (index = 0; index < num_tables; index++) {
         int id = va_to_gen7_jpeg_hufftable[index];
  
         if (!huff_buffer->load_huffman_table[index])
             continue;
-     
-        //load DC table with 12 DWords
-        convert_hufftable_to_codes(huff_buffer, dc_table, 0, index);  //0 for Dc
 
-        //load AC table with 162 DWords 
-        convert_hufftable_to_codes(huff_buffer, ac_table, 1, index);  //1 for AC 
+        cache = &mfc_context->jpeg_cache.huff[index];
+
+        //Only convert the tables again if they changed since the last picture
+        if (!cache->valid ||
+            memcmp(cache->num_dc_codes, huff_buffer->huffman_table[index].num_dc_codes, sizeof(cache->num_dc_codes)) ||
+            memcmp(cache->dc_values, huff_buffer->huffman_table[index].dc_values, sizeof(cache->dc_values)) ||
+            memcmp(cache->num_ac_codes, huff_buffer->huffman_table[index].num_ac_codes, sizeof(cache->num_ac_codes)) ||
+            memcmp(cache->ac_values, huff_buffer->huffman_table[index].ac_values, sizeof(cache->ac_values))) {
+            memcpy(cache->num_dc_codes, huff_buffer->huffman_table[index].num_dc_codes, sizeof(cache->num_dc_codes));
+            memcpy(cache->dc_values, huff_buffer->huffman_table[index].dc_values, sizeof(cache->dc_values));
+            memcpy(cache->num_ac_codes, huff_buffer->huffman_table[index].num_ac_codes, sizeof(cache->num_ac_codes));
+            memcpy(cache->ac_values, huff_buffer->huffman_table[index].ac_values, sizeof(cache->ac_values));
+
+            //load DC table with 12 DWords
+            convert_hufftable_to_codes(cache->num_dc_codes, cache->dc_values, cache->dc_table, 0);  //0 for Dc
+
+            //load AC table with 162 DWords 
+            convert_hufftable_to_codes(cache->num_ac_codes, cache->ac_values, cache->ac_table, 1);  //1 for AC 
+
+            cache->valid = 1;
+        }
 
         BEGIN_BCS_BATCH(batch, 176);
         OUT_BCS_BATCH(batch, MFC_JPEG_HUFF_TABLE_STATE | (176 - 2));
         OUT_BCS_BATCH(batch, id); //Huff table id
 
         //DWord 2 - 13 has DC_TABLE
-        intel_batchbuffer_data(batch, dc_table, 12*4);
+        intel_batchbuffer_data(batch, cache->dc_table, 12*4);
 
         //Dword 14 -175 has AC_TABLE
-        intel_batchbuffer_data(batch, ac_table, 162*4);
+        intel_batchbuffer_data(batch, cache->ac_table, 162*4);
         ADVANCE_BCS_BATCH(batch);
     }    
 }
@@ -3268,11 +3213,29 @@ gen8_mfc_jpeg_encode_picture(VADriverContextP ctx,
                               struct encode_state *encode_state,
                               struct intel_encoder_context *encoder_context)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
+    struct intel_batchbuffer *batch = encoder_context->base.batch;
+
     gen8_mfc_init(ctx, encode_state, encoder_context);
     intel_mfc_jpeg_prepare(ctx, encode_state, encoder_context);
     /*Programing bcs pipeline*/
     gen8_mfc_jpeg_pipeline_programing(ctx, encode_state, encoder_context);
-    gen8_mfc_run(ctx, encode_state, encoder_context);
+
+    /*
+     * The batch was submitted since the previous picture, either because
+     * it ran out of space or because the application waited for a result
+     */
+    if (mfc_context->jpeg_batch.submit_count != batch->submit_count)
+        mfc_context->jpeg_batch.num_pending = 0;
+
+    /* Leave the picture in the batch, the next ones are appended to it */
+    if (++mfc_context->jpeg_batch.num_pending >= i965->jpeg_encode_batch_size) {
+        gen8_mfc_run(ctx, encode_state, encoder_context);
+        mfc_context->jpeg_batch.num_pending = 0;
+    }
+
+    mfc_context->jpeg_batch.submit_count = batch->submit_count;
 
     return VA_STATUS_SUCCESS;
 }
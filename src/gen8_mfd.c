@@ -41,6 +41,7 @@
 #include "i965_defines.h"
 #include "i965_drv_video.h"
 #include "i965_decoder_utils.h"
+#include "i965_jpeg_sw_decoder.h"
 
 #include "gen7_mfd.h"
 #include "intel_media.h"
@@ -758,6 +759,7 @@ gen8_mfd_avc_bsd_object(VADriverContextP ctx,
                         VAPictureParameterBufferH264 *pic_param,
                         VASliceParameterBufferH264 *slice_param,
                         dri_bo *slice_data_bo,
+                        unsigned int slice_data_base,
                         VASliceParameterBufferH264 *next_slice_param,
                         struct gen7_mfd_context *gen7_mfd_context)
 {
@@ -771,7 +773,7 @@ gen8_mfd_avc_bsd_object(VADriverContextP ctx,
     OUT_BCS_BATCH(batch, MFD_AVC_BSD_OBJECT | (6 - 2));
     OUT_BCS_BATCH(batch, 
                   (slice_param->slice_data_size));
-    OUT_BCS_BATCH(batch, slice_param->slice_data_offset);
+    OUT_BCS_BATCH(batch, slice_data_base + slice_param->slice_data_offset);
     OUT_BCS_BATCH(batch,
                   (0 << 31) |
                   (0 << 14) |
@@ -909,7 +911,9 @@ gen8_mfd_avc_decode_picture(VADriverContextP ctx,
     struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     VAPictureParameterBufferH264 *pic_param;
     VASliceParameterBufferH264 *slice_param, *next_slice_param, *next_slice_group_param;
+    GenSliceDataBuffer *slice_data_buffer = &gen7_mfd_context->slice_data_buffer;
     dri_bo *slice_data_bo;
+    unsigned int slice_data_base = 0;
     int i, j;
 
     assert(decode_state->pic_param && decode_state->pic_param->buffer);
@@ -926,11 +930,18 @@ gen8_mfd_avc_decode_picture(VADriverContextP ctx,
     gen8_mfd_avc_picid_state(ctx, decode_state, gen7_mfd_context);
     gen8_mfd_avc_img_state(ctx, decode_state, gen7_mfd_context);
 
+    if (intel_coalesce_slice_data(ctx, decode_state, slice_data_buffer))
+        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_buffer->bo, MFX_FORMAT_AVC, gen7_mfd_context);
+
     for (j = 0; j < decode_state->num_slice_params; j++) {
         assert(decode_state->slice_params && decode_state->slice_params[j]->buffer);
         slice_param = (VASliceParameterBufferH264 *)decode_state->slice_params[j]->buffer;
         slice_data_bo = decode_state->slice_datas[j]->bo;
-        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_AVC, gen7_mfd_context);
+
+        if (slice_data_buffer->valid)
+            slice_data_base = slice_data_buffer->offsets[j];
+        else
+            gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_AVC, gen7_mfd_context);
 
         if (j == decode_state->num_slice_params - 1)
             next_slice_group_param = NULL;
@@ -957,7 +968,7 @@ gen8_mfd_avc_decode_picture(VADriverContextP ctx,
             gen8_mfd_avc_ref_idx_state(ctx, pic_param, slice_param, gen7_mfd_context);
             gen8_mfd_avc_weightoffset_state(ctx, pic_param, slice_param, gen7_mfd_context);
             gen8_mfd_avc_slice_state(ctx, pic_param, slice_param, next_slice_param, gen7_mfd_context);
-            gen8_mfd_avc_bsd_object(ctx, pic_param, slice_param, slice_data_bo, next_slice_param, gen7_mfd_context);
+            gen8_mfd_avc_bsd_object(ctx, pic_param, slice_param, slice_data_bo, slice_data_base, next_slice_param, gen7_mfd_context);
             slice_param++;
         }
     }
@@ -1124,6 +1135,7 @@ static void
 gen8_mfd_mpeg2_bsd_object(VADriverContextP ctx,
                           VAPictureParameterBufferMPEG2 *pic_param,
                           VASliceParameterBufferMPEG2 *slice_param,
+                          unsigned int slice_data_base,
                           VASliceParameterBufferMPEG2 *next_slice_param,
                           struct gen7_mfd_context *gen7_mfd_context)
 {
@@ -1155,7 +1167,7 @@ gen8_mfd_mpeg2_bsd_object(VADriverContextP ctx,
     OUT_BCS_BATCH(batch, 
                   slice_param->slice_data_size - (slice_param->macroblock_offset >> 3));
     OUT_BCS_BATCH(batch, 
-                  slice_param->slice_data_offset + (slice_param->macroblock_offset >> 3));
+                  slice_data_base + slice_param->slice_data_offset + (slice_param->macroblock_offset >> 3));
     OUT_BCS_BATCH(batch,
                   hpos0 << 24 |
                   vpos0 << 16 |
@@ -1177,7 +1189,9 @@ gen8_mfd_mpeg2_decode_picture(VADriverContextP ctx,
     struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     VAPictureParameterBufferMPEG2 *pic_param;
     VASliceParameterBufferMPEG2 *slice_param, *next_slice_param, *next_slice_group_param;
+    GenSliceDataBuffer *slice_data_buffer = &gen7_mfd_context->slice_data_buffer;
     dri_bo *slice_data_bo;
+    unsigned int slice_data_base = 0;
     int i, j;
 
     assert(decode_state->pic_param && decode_state->pic_param->buffer);
@@ -1197,11 +1211,18 @@ gen8_mfd_mpeg2_decode_picture(VADriverContextP ctx,
         gen7_mfd_context->wa_mpeg2_slice_vertical_position =
             mpeg2_wa_slice_vertical_position(decode_state, pic_param);
 
+    if (intel_coalesce_slice_data(ctx, decode_state, slice_data_buffer))
+        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_buffer->bo, MFX_FORMAT_MPEG2, gen7_mfd_context);
+
     for (j = 0; j < decode_state->num_slice_params; j++) {
         assert(decode_state->slice_params && decode_state->slice_params[j]->buffer);
         slice_param = (VASliceParameterBufferMPEG2 *)decode_state->slice_params[j]->buffer;
         slice_data_bo = decode_state->slice_datas[j]->bo;
-        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_MPEG2, gen7_mfd_context);
+
+        if (slice_data_buffer->valid)
+            slice_data_base = slice_data_buffer->offsets[j];
+        else
+            gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_MPEG2, gen7_mfd_context);
 
         if (j == decode_state->num_slice_params - 1)
             next_slice_group_param = NULL;
@@ -1216,7 +1237,7 @@ gen8_mfd_mpeg2_decode_picture(VADriverContextP ctx,
             else
                 next_slice_param = next_slice_group_param;
 
-            gen8_mfd_mpeg2_bsd_object(ctx, pic_param, slice_param, next_slice_param, gen7_mfd_context);
+            gen8_mfd_mpeg2_bsd_object(ctx, pic_param, slice_param, slice_data_base, next_slice_param, gen7_mfd_context);
             slice_param++;
         }
     }
@@ -3112,6 +3133,11 @@ gen8_mfd_decode_picture(VADriverContextP ctx,
         break;
 
     case VAProfileJPEGBaseline:
+        if (i965_jpeg_sw_decode_wanted(ctx, decode_state)) {
+            vaStatus = i965_jpeg_sw_decode_picture(ctx, decode_state);
+            goto out;
+        }
+
         gen8_mfd_jpeg_decode_picture(ctx, decode_state, gen7_mfd_context);
         break;
 
@@ -3162,6 +3188,8 @@ gen8_mfd_context_destroy(void *hw_context)
     dri_bo_unreference(gen7_mfd_context->segmentation_buffer.bo);
     gen7_mfd_context->segmentation_buffer.bo = NULL;
 
+    intel_free_coalesced_slice_data(&gen7_mfd_context->slice_data_buffer);
+
     dri_bo_unreference(gen7_mfd_context->jpeg_wa_slice_data_bo);
 
     if (gen7_mfd_context->jpeg_wa_surface_id != VA_INVALID_SURFACE) {
@@ -1738,10 +1738,12 @@ gen8_post_processing_context_init(VADriverContextP ctx,
 
 static void
 gen8_run_kernel_media_object_walker(VADriverContextP ctx,
-                                    struct intel_batchbuffer *batch,
+                                    struct i965_post_processing_context *pp_context,
                                     struct i965_gpe_context *gpe_context,
                                     struct gpe_media_object_walker_parameter *param)
 {
+    struct intel_batchbuffer *batch = pp_context->batch;
+
     if (!batch || !gpe_context || !param)
         return;
 
@@ -1756,7 +1758,8 @@ gen8_run_kernel_media_object_walker(VADriverContextP ctx,
 
     intel_batchbuffer_end_atomic(batch);
 
-    intel_batchbuffer_flush(batch);
+    if (!pp_context->defer_flush)
+        intel_batchbuffer_flush(batch);
     return;
 }
 
@@ -2123,7 +2126,7 @@ gen8_yuv420p8_scaling_post_processing(
 
     intel_vpp_init_media_object_walker_parameter(&kernel_walker_param, &media_object_walker_param);
 
-    gen8_run_kernel_media_object_walker(ctx, pp_context->batch,
+    gen8_run_kernel_media_object_walker(ctx, pp_context,
                                         gpe_context,
                                         &media_object_walker_param);
 
@@ -33,6 +33,7 @@
 #include <i915_drm.h>
 #include <intel_bufmgr.h>
 
+#include "i965_encoder.h"
 #include "i965_gpe_utils.h"
 
 struct encode_state;
@@ -147,19 +148,23 @@ struct gen9_hcpe_context {
         unsigned int target_frame_size;
     } bit_rate_control_context[3];      //INTERNAL: for I, P, B frames
 
+    /* Per temporal layer, indexed by encoder_context->layer.curr_frame_layer_id */
     struct {
         int mode;
-        int gop_nums[3];
-        int target_frame_size[3]; // I,P,B
-        double bits_per_frame;
-        double qpf_rounding_accumulator;
+        int gop_nums[MAX_TEMPORAL_LAYERS][3];
+        int target_frame_size[MAX_TEMPORAL_LAYERS][3]; // I,P,B
+        int qp_prime_y[MAX_TEMPORAL_LAYERS][3];
+        double bits_per_frame[MAX_TEMPORAL_LAYERS];
+        double qpf_rounding_accumulator[MAX_TEMPORAL_LAYERS];
+        int bits_prev_frame[MAX_TEMPORAL_LAYERS];
+        int prev_slice_type[MAX_TEMPORAL_LAYERS];
     } brc;
 
     struct {
-        double current_buffer_fullness;
-        double target_buffer_fullness;
-        double buffer_capacity;
-        unsigned int buffer_size;
+        double current_buffer_fullness[MAX_TEMPORAL_LAYERS];
+        double target_buffer_fullness[MAX_TEMPORAL_LAYERS];
+        double buffer_capacity[MAX_TEMPORAL_LAYERS];
+        unsigned int buffer_size[MAX_TEMPORAL_LAYERS];
         unsigned int violation_noted;
     } hrd;
 
@@ -194,6 +199,15 @@ struct gen9_hcpe_context {
 
     VAQMatrixBufferHEVC  iq_matrix_hevc;
 
+    /* Slice header built by the driver for the current picture. The header
+     * doesn't depend on the slice position, so it is reused by the slices
+     * with the same parameters. */
+    struct {
+        unsigned char *data;
+        int length_in_bits;
+        VAEncSliceParameterBufferHEVC slice_param;
+    } slice_header;
+
     struct i965_gpe_context gpe_context;
     struct i965_buffer_surface hcp_batchbuffer_surface;
     struct intel_batchbuffer *aux_batchbuffer;
@@ -228,6 +242,29 @@ struct gen9_hcpe_context {
                                 unsigned long surface_state_offset);
 };
 
+/* VME output of the MBs covered by one CTB */
+struct gen9_hcpe_ctb_vme_output
+{
+    const unsigned char *msg;       /* VME output of the top left MB */
+    int msg_size;                   /* size of the VME output of one MB */
+    int width_in_mbs;               /* picture width */
+    int ctb_width_in_mb;
+    int width_in_mb;                /* MBs of the CTB inside the picture */
+    int height_in_mb;
+    int drop_cu_row;                /* the bottom 8x8 CUs of the last MB row are outside */
+    int drop_cu_column;             /* the right 8x8 CUs of the last MB column are outside */
+    int is_intra;
+    int qp;
+    unsigned int ref_index_in_mb[2];
+};
+
+/* Converts the VME output into the CU records of one CTB, returns the
+ * number of records */
+int
+gen9_hcpe_hevc_fill_ctb_cu_records(const struct gen9_hcpe_ctb_vme_output *vme,
+                                   unsigned int *cu_records,
+                                   unsigned int *split_coding_unit_flag);
+
 VAStatus gen9_hcpe_pipeline(VADriverContextP ctx,
                             VAProfile profile,
                             struct encode_state *encode_state,
@@ -235,11 +272,11 @@ VAStatus gen9_hcpe_pipeline(VADriverContextP ctx,
 
 /* HEVC BRC */
 extern int intel_hcpe_update_hrd(struct encode_state *encode_state,
-                                 struct gen9_hcpe_context *hcpe_context,
+                                 struct intel_encoder_context *encoder_context,
                                  int frame_bits);
 
 extern int intel_hcpe_brc_postpack(struct encode_state *encode_state,
-                                   struct gen9_hcpe_context *hcpe_context,
+                                   struct intel_encoder_context *encoder_context,
                                    int frame_bits);
 
 extern void intel_hcpe_hrd_context_update(struct encode_state *encode_state,
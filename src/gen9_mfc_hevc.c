@@ -523,7 +523,7 @@ gen9_hcpe_hevc_pic_state(VADriverContextP ctx, struct encode_state *encode_state
     int ctb_size = 1 << log2_ctb_size;
     double rawctubits = 8 * 3 * ctb_size * ctb_size / 2.0;
     int maxctubits = (int)(5 * rawctubits / 3) ;
-    double bitrate = (double)encoder_context->brc.bits_per_second[0];
+    double bitrate = (double)encoder_context->brc.bits_per_second[encoder_context->layer.num_layers - 1];
     double framebitrate = bitrate / 32 / 8; //32 byte unit
     int minframebitrate = 0;//(int) (framebitrate * 3 / 10);
     int maxframebitrate = (int)(framebitrate * 10 / 10);
@@ -1225,328 +1225,233 @@ gen9_hcpe_hevc_pak_object(VADriverContextP ctx, int lcu_x, int lcu_y, int isLast
 #define     AVC_INTER_SUBMB_PRE_MODE_MASK       0x00ff0000
 #define     AVC_SUBMB_SHAPE_MASK    0x00FF00
 
-/* here 1 MB = 1CU = 16x16 */
-static void
-gen9_hcpe_hevc_fill_indirect_cu_intra(VADriverContextP ctx,
-                                      struct encode_state *encode_state,
-                                      struct intel_encoder_context *encoder_context,
-                                      int qp, unsigned int *msg,
-                                      int ctb_x, int ctb_y,
-                                      int mb_x, int mb_y,
-                                      int ctb_width_in_mb, int width_in_ctb, int num_cu_record, int slice_type,int cu_index,int index)
+#define HEVC_SPLIT_CU_FLAG_64_64 ((0x1<<20)|(0xf<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
+#define HEVC_SPLIT_CU_FLAG_32_32 ((0x1<<20)|(0x0<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
+#define HEVC_SPLIT_CU_FLAG_16_16 ((0x0<<20)|(0x0<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
+#define HEVC_SPLIT_CU_FLAG_8_8   ((0x1<<20)|(0x0<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
+
+/* AVC intra prediction modes to HEVC ones, the unused entries keep invalid
+ * VME output from reading out of the tables */
+static const unsigned char intra_mode_8x8_avc2hevc[16] = {26, 10, 1, 34, 18, 24, 13, 28, 8};
+static const unsigned char intra_mode_16x16_avc2hevc[16] = {26, 10, 1, 34};
+static const unsigned char intra_chroma_mode_avc2hevc[4] = {5, 4, 3, 2};
+
+/*
+ * The CU record layout (16 dwords):
+ *   DW0      interpred_idc, CU qp, intra chroma mode, part mode, pred mode and size
+ *   DW1      four intra modes
+ *   DW2-5    mvx/mvy of list 0
+ *   DW6-9    mvx/mvy of list 1
+ *   DW10     reference indexes
+ *   DW11     tu size
+ *   DW12     tu count - 1, tu_xform_Yskip
+ *   DW13-15  tu_xform_U/Vskip, reserved
+ */
+static inline void
+gen9_hcpe_hevc_fill_cu_tail(unsigned int *cu_msg, unsigned int tu_size)
 {
-    /* here cu == mb, so we use mb address as the cu address */
-    /* to fill the indirect cu by the vme out */
-    static int intra_mode_8x8_avc2hevc[9] = {26, 10, 1, 34, 18, 24, 13, 28, 8};
-    static int intra_mode_16x16_avc2hevc[4] = {26, 10, 1, 34};
-    struct gen9_hcpe_context *mfc_context = encoder_context->mfc_context;
-    unsigned char * cu_record_ptr = NULL;
-    unsigned int * cu_msg = NULL;
-    int ctb_address = (ctb_y * width_in_ctb + ctb_x) * num_cu_record;
-    int mb_address_in_ctb = 0;
-    int cu_address = (ctb_address + mb_address_in_ctb + cu_index) * 16 * 4;
-    int zero = 0;
-    int is_inter = 0;
-    int intraMbMode = 0;
-    int cu_part_mode = 0;
-    int intraMode[4];
-    int inerpred_idc = 0;
-    int intra_chroma_mode = 5;
-    int cu_size = 1;
-    int tu_size = 0x55;
-    int tu_count = 4;
-    int chroma_mode_remap[4]={5,4,3,2};
-
-    if (!is_inter) inerpred_idc = 0xff;
-
-    intraMbMode = (msg[0] & AVC_INTRA_MODE_MASK) >> 4;
-
-    intra_chroma_mode = (msg[3] & 0x3);
-    intra_chroma_mode =  chroma_mode_remap[intra_chroma_mode];
-    if (intraMbMode == AVC_INTRA_16X16) {
-        cu_part_mode = 0; //2Nx2N
-        cu_size = 1;
-        tu_size = 0x55;
-        tu_count = 4;
-        intraMode[0] = intra_mode_16x16_avc2hevc[msg[1] & 0xf];
-        intraMode[1] = intra_mode_16x16_avc2hevc[msg[1] & 0xf];
-        intraMode[2] = intra_mode_16x16_avc2hevc[msg[1] & 0xf];
-        intraMode[3] = intra_mode_16x16_avc2hevc[msg[1] & 0xf];
-    } else if (intraMbMode == AVC_INTRA_8X8) {
-        cu_part_mode = 0; //2Nx2N
-        cu_size = 0;
-        tu_size = 0;
-        tu_count = 4;
-        intraMode[0] = intra_mode_8x8_avc2hevc[msg[1] >> (index << 2) & 0xf];
-        intraMode[1] = intra_mode_8x8_avc2hevc[msg[1] >> (index << 2) & 0xf];
-        intraMode[2] = intra_mode_8x8_avc2hevc[msg[1] >> (index << 2) & 0xf];
-        intraMode[3] = intra_mode_8x8_avc2hevc[msg[1] >> (index << 2) & 0xf];
-
-    } else { // for 4x4 to use 8x8 replace
-        cu_part_mode = 3; //NxN
-        cu_size = 0;
-        tu_size = 0;
-        tu_count = 4;
-        intraMode[0] = intra_mode_8x8_avc2hevc[msg[1] >> ((index << 4) + 0) & 0xf];
-        intraMode[1] = intra_mode_8x8_avc2hevc[msg[1] >> ((index << 4) + 4) & 0xf];
-        intraMode[2] = intra_mode_8x8_avc2hevc[msg[1] >> ((index << 4) + 8) & 0xf];
-        intraMode[3] = intra_mode_8x8_avc2hevc[msg[1] >> ((index << 4) + 12) & 0xf];
-
-    }
-
-    cu_record_ptr = (unsigned char *)mfc_context->hcp_indirect_cu_object.bo->virtual;
-    /* get the mb info from the vme out */
-    cu_msg = (unsigned int *)(cu_record_ptr + cu_address);
-
-    cu_msg[0] = (inerpred_idc << 24 |   /* interpred_idc[3:0][1:0] */
-                 zero << 23 |   /* reserved */
-                 qp << 16 | /* CU_qp */
-                 zero << 11 |   /* reserved */
-                 intra_chroma_mode << 8 |   /* intra_chroma_mode */
-                 zero << 7 |    /* IPCM_enable , reserved for SKL*/
-                 cu_part_mode << 4 |    /* cu_part_mode */
-                 zero << 3 |    /* cu_transquant_bypass_flag */
-                 is_inter << 2 |    /* cu_pred_mode :intra 1,inter 1*/
-                 cu_size          /* cu_size */
-                );
-    cu_msg[1] = (zero << 30 |   /* reserved  */
-                 intraMode[3] << 24 |   /* intra_mode */
-                 zero << 22 |   /* reserved  */
-                 intraMode[2] << 16 |   /* intra_mode */
-                 zero << 14 |   /* reserved  */
-                 intraMode[1] << 8 |    /* intra_mode */
-                 zero << 6 |    /* reserved  */
-                 intraMode[0]           /* intra_mode */
-                );
-    /* l0: 4 MV (x,y); l1； 4 MV (x,y) */
-    cu_msg[2] = (zero << 16 |   /* mvx_l0[1]  */
-                 zero           /* mvx_l0[0] */
-                );
-    cu_msg[3] = (zero << 16 |   /* mvx_l0[3]  */
-                 zero           /* mvx_l0[2] */
-                );
-    cu_msg[4] = (zero << 16 |   /* mvy_l0[1]  */
-                 zero           /* mvy_l0[0] */
-                );
-    cu_msg[5] = (zero << 16 |   /* mvy_l0[3]  */
-                 zero           /* mvy_l0[2] */
-                );
-
-    cu_msg[6] = (zero << 16 |   /* mvx_l1[1]  */
-                 zero           /* mvx_l1[0] */
-                );
-    cu_msg[7] = (zero << 16 |   /* mvx_l1[3]  */
-                 zero           /* mvx_l1[2] */
-                );
-    cu_msg[8] = (zero << 16 |   /* mvy_l1[1]  */
-                 zero           /* mvy_l1[0] */
-                );
-    cu_msg[9] = (zero << 16 |   /* mvy_l1[3]  */
-                 zero           /* mvy_l1[2] */
-                );
-
-    cu_msg[10] = (zero << 28 |  /* ref_idx_l1[3]  */
-                  zero << 24 |  /* ref_idx_l1[2] */
-                  zero << 20 |  /* ref_idx_l1[1]  */
-                  zero << 16 |  /* ref_idx_l1[0] */
-                  zero << 12 |  /* ref_idx_l0[3]  */
-                  zero << 8 |   /* ref_idx_l0[2] */
-                  zero << 4 |   /* ref_idx_l0[1]  */
-                  zero          /* ref_idx_l0[0] */
-                 );
-
-    cu_msg[11] = tu_size; /* tu_size 00000000 00000000 00000000 10101010  or 0x0*/
-    cu_msg[12] = ((tu_count - 1) << 28 | /* tu count - 1 */
-                  zero << 16 |  /* reserved  */
-                  zero          /* tu_xform_Yskip[15:0] */
-                 );
-    cu_msg[13] = (zero << 16 |  /* tu_xform_Vskip[15:0]  */
-                  zero          /* tu_xform_Uskip[15:0] */
-                 );
-    cu_msg[14] = zero ;
-    cu_msg[15] = zero ;
+    cu_msg[11] = tu_size;
+    cu_msg[12] = 3 << 28;       /* tu count - 1 */
+    cu_msg[13] = 0;
+    cu_msg[14] = 0;
+    cu_msg[15] = 0;
 }
 
-/* here 1 MB = 1CU = 16x16 */
-static void
-gen9_hcpe_hevc_fill_indirect_cu_inter(VADriverContextP ctx,
-                                      struct encode_state *encode_state,
-                                      struct intel_encoder_context *encoder_context,
-                                      int qp, unsigned int *msg,
-                                      int ctb_x, int ctb_y,
-                                      int mb_x, int mb_y,
-                                      int ctb_width_in_mb, int width_in_ctb, int num_cu_record, int slice_type, int cu_index,int index)
+/* here 1 MB = 1CU = 16x16, @index selects the 8x8 block for 8x8 CUs */
+static inline void
+gen9_hcpe_hevc_fill_cu_intra(unsigned int *cu_msg, const unsigned int *msg,
+                             int intra_mb_mode, int index, unsigned int dw0)
 {
-    /* here cu == mb, so we use mb address as the cu address */
-    /* to fill the indirect cu by the vme out */
-    struct gen9_hcpe_context *mfc_context = encoder_context->mfc_context;
-    struct gen6_vme_context *vme_context = encoder_context->vme_context;
-    unsigned char * cu_record_ptr = NULL;
-    unsigned int * cu_msg = NULL;
-    int ctb_address = (ctb_y * width_in_ctb + ctb_x) * num_cu_record;
-    int mb_address_in_ctb = 0;
-    int cu_address = (ctb_address + mb_address_in_ctb + cu_index) * 16 * 4;
-    int zero = 0;
-    int cu_part_mode = 0;
-    int submb_pre_mode = 0;
-    int is_inter = 1;
-    int cu_size = 1;
-    int tu_size = 0x55;
-    int tu_count = 4;
-    int inter_mode = 0;
-
-    unsigned int *mv_ptr;
-    {
-        inter_mode = (msg[0] & AVC_INTER_MODE_MASK);
-        submb_pre_mode = (msg[1] & AVC_INTER_SUBMB_PRE_MODE_MASK) >> 16;
-#define MSG_MV_OFFSET   4
-        mv_ptr = msg + MSG_MV_OFFSET;
-        /* MV of VME output is based on 16 sub-blocks. So it is necessary
-        * to convert them to be compatible with the format of AVC_PAK
-        * command.
-        */
-        /* 0/2/4/6/8... ： l0, 1/3/5/7...: l1 ; now it only support 16x16,16x8,8x16,8x8*/
-
-        if (inter_mode == AVC_INTER_16X16) {
-            mv_ptr[4] = mv_ptr[0];
-            mv_ptr[5] = mv_ptr[1];
-            mv_ptr[2] = mv_ptr[0];
-            mv_ptr[3] = mv_ptr[1];
-            mv_ptr[6] = mv_ptr[0];
-            mv_ptr[7] = mv_ptr[1];
-            cu_part_mode = 0;
-            cu_size = 1;
-            tu_size = 0x55;
-            tu_count = 4;
-        } else if (inter_mode == AVC_INTER_8X16) {
-            mv_ptr[4] = mv_ptr[0];
-            mv_ptr[5] = mv_ptr[1];
-            mv_ptr[2] = mv_ptr[8];
-            mv_ptr[3] = mv_ptr[9];
-            mv_ptr[6] = mv_ptr[8];
-            mv_ptr[7] = mv_ptr[9];
-            cu_part_mode = 1;
-            cu_size = 1;
-            tu_size = 0x55;
-            tu_count = 4;
-        } else if (inter_mode == AVC_INTER_16X8) {
-            mv_ptr[2] = mv_ptr[0];
-            mv_ptr[3] = mv_ptr[1];
-            mv_ptr[4] = mv_ptr[16];
-            mv_ptr[5] = mv_ptr[17];
-            mv_ptr[6] = mv_ptr[24];
-            mv_ptr[7] = mv_ptr[25];
-            cu_part_mode = 2;
-            cu_size = 1;
-            tu_size = 0x55;
-            tu_count = 4;
-        }else if(inter_mode == AVC_INTER_8X8) {
-            mv_ptr[0] = mv_ptr[index * 8 + 0 ];
-            mv_ptr[1] = mv_ptr[index * 8 + 1 ];
-            mv_ptr[2] = mv_ptr[index * 8 + 0 ];
-            mv_ptr[3] = mv_ptr[index * 8 + 1 ];
-            mv_ptr[4] = mv_ptr[index * 8 + 0 ];
-            mv_ptr[5] = mv_ptr[index * 8 + 1 ];
-            mv_ptr[6] = mv_ptr[index * 8 + 0 ];
-            mv_ptr[7] = mv_ptr[index * 8 + 1 ];
-            cu_part_mode = 0;
-            cu_size = 0;
-            tu_size = 0x0;
-            tu_count = 4;
+    unsigned int mode, modes;
+
+    if (intra_mb_mode == AVC_INTRA_16X16) {
+        mode = intra_mode_16x16_avc2hevc[msg[1] & 0xf];
+        modes = mode * 0x01010101;
+        dw0 |= 1;               /* cu_size */
+    } else if (intra_mb_mode == AVC_INTRA_8X8) {
+        mode = intra_mode_8x8_avc2hevc[(msg[1] >> (index << 2)) & 0xf];
+        modes = mode * 0x01010101;
+    } else {
+        /* 4x4 is replaced by NxN 8x8, the modes of the four 4x4 blocks
+         * in the 8x8 block are in msg[1] for 0-1, msg[2] for 2-3 */
+        mode = msg[1 + (index >> 1)] >> ((index & 1) << 4);
+        modes = (intra_mode_8x8_avc2hevc[(mode >> 0) & 0xf] << 0 |
+                 intra_mode_8x8_avc2hevc[(mode >> 4) & 0xf] << 8 |
+                 intra_mode_8x8_avc2hevc[(mode >> 8) & 0xf] << 16 |
+                 intra_mode_8x8_avc2hevc[(mode >> 12) & 0xf] << 24);
+        dw0 |= 3 << 4;          /* cu_part_mode: NxN */
+    }
+
+    cu_msg[0] = dw0;
+    cu_msg[1] = modes;
+    memset(&cu_msg[2], 0, 9 * sizeof(unsigned int));
+    gen9_hcpe_hevc_fill_cu_tail(cu_msg, (dw0 & 1) ? 0x55 : 0);
+}
 
-        }else
-        {
-            mv_ptr[4] = mv_ptr[0];
-            mv_ptr[5] = mv_ptr[1];
-            mv_ptr[2] = mv_ptr[0];
-            mv_ptr[3] = mv_ptr[1];
-            mv_ptr[6] = mv_ptr[0];
-            mv_ptr[7] = mv_ptr[1];
-            cu_part_mode = 0;
-            cu_size = 1;
-            tu_size = 0x55;
-            tu_count = 4;
+/* @mv points to the 16 (l0, l1) MV pairs of the MB in the VME output */
+static inline void
+gen9_hcpe_hevc_fill_cu_inter(unsigned int *cu_msg, const unsigned int *mv,
+                             int inter_mb_mode, int index, unsigned int dw0,
+                             unsigned int ref_idx)
+{
+    unsigned int mv0, mv1, mv2, mv3;    /* l0 and l1 MVs of the four PUs */
 
-        }
+    switch (inter_mb_mode) {
+    case AVC_INTER_8X16:
+        mv0 = 0; mv1 = 8; mv2 = 0; mv3 = 8;
+        dw0 |= (1 << 4) | 1;
+        break;
+
+    case AVC_INTER_16X8:
+        mv0 = 0; mv1 = 0; mv2 = 16; mv3 = 24;
+        dw0 |= (2 << 4) | 1;
+        break;
+
+    case AVC_INTER_8X8:
+        mv0 = mv1 = mv2 = mv3 = index * 8;
+        break;
+
+    default:
+        mv0 = mv1 = mv2 = mv3 = 0;
+        dw0 |= 1;
+        break;
     }
 
-    cu_record_ptr = (unsigned char *)mfc_context->hcp_indirect_cu_object.bo->virtual;
-    /* get the mb info from the vme out */
-    cu_msg = (unsigned int *)(cu_record_ptr + cu_address);
-
-    cu_msg[0] = (submb_pre_mode << 24 | /* interpred_idc[3:0][1:0] */
-                 zero << 23 |   /* reserved */
-                 qp << 16 | /* CU_qp */
-                 zero << 11 |   /* reserved */
-                 5 << 8 |   /* intra_chroma_mode */
-                 zero << 7 |    /* IPCM_enable , reserved for SKL*/
-                 cu_part_mode << 4 |    /* cu_part_mode */
-                 zero << 3 |    /* cu_transquant_bypass_flag */
-                 is_inter << 2 |    /* cu_pred_mode :intra 1,inter 1*/
-                 cu_size          /* cu_size */
-                );
-    cu_msg[1] = (zero << 30 |   /* reserved  */
-                 zero << 24 |   /* intra_mode */
-                 zero << 22 |   /* reserved  */
-                 zero << 16 |   /* intra_mode */
-                 zero << 14 |   /* reserved  */
-                 zero << 8 |    /* intra_mode */
-                 zero << 6 |    /* reserved  */
-                 zero           /* intra_mode */
-                );
-    /* l0: 4 MV (x,y); l1； 4 MV (x,y) */
-    cu_msg[2] = ((mv_ptr[2] & 0xffff) << 16 |   /* mvx_l0[1]  */
-                 (mv_ptr[0] & 0xffff)           /* mvx_l0[0] */
-                );
-    cu_msg[3] = ((mv_ptr[6] & 0xffff) << 16 |   /* mvx_l0[3]  */
-                 (mv_ptr[4] & 0xffff)           /* mvx_l0[2] */
-                );
-    cu_msg[4] = ((mv_ptr[2] & 0xffff0000) |         /* mvy_l0[1]  */
-                 (mv_ptr[0] & 0xffff0000) >> 16     /* mvy_l0[0] */
-                );
-    cu_msg[5] = ((mv_ptr[6] & 0xffff0000) |         /* mvy_l0[3]  */
-                 (mv_ptr[4] & 0xffff0000) >> 16     /* mvy_l0[2] */
-                );
-
-    cu_msg[6] = ((mv_ptr[3] & 0xffff) << 16 |   /* mvx_l1[1]  */
-                 (mv_ptr[1] & 0xffff)           /* mvx_l1[0] */
-                );
-    cu_msg[7] = ((mv_ptr[7] & 0xffff) << 16 |   /* mvx_l1[3]  */
-                 (mv_ptr[5] & 0xffff)           /* mvx_l1[2] */
-                );
-    cu_msg[8] = ((mv_ptr[3] & 0xffff0000) |         /* mvy_l1[1]  */
-                 (mv_ptr[1] & 0xffff0000) >> 16     /* mvy_l1[0] */
-                );
-    cu_msg[9] = ((mv_ptr[7] & 0xffff0000) |         /* mvy_l1[3]  */
-                 (mv_ptr[5] & 0xffff0000) >> 16     /* mvy_l1[2] */
-                );
-
-    cu_msg[10] = (((vme_context->ref_index_in_mb[1] >> 24) & 0xf) << 28 |   /* ref_idx_l1[3]  */
-                  ((vme_context->ref_index_in_mb[1] >> 16) & 0xf) << 24 |   /* ref_idx_l1[2] */
-                  ((vme_context->ref_index_in_mb[1] >> 8) & 0xf) << 20 |    /* ref_idx_l1[1]  */
-                  ((vme_context->ref_index_in_mb[1] >> 0) & 0xf) << 16 |    /* ref_idx_l1[0] */
-                  ((vme_context->ref_index_in_mb[0] >> 24) & 0xf) << 12 |   /* ref_idx_l0[3]  */
-                  ((vme_context->ref_index_in_mb[0] >> 16) & 0xf) << 8  |   /* ref_idx_l0[2] */
-                  ((vme_context->ref_index_in_mb[0] >> 8) & 0xf) << 4 |     /* ref_idx_l0[1]  */
-                  ((vme_context->ref_index_in_mb[0] >> 0) & 0xf)            /* ref_idx_l0[0] */
-                 );
-
-    cu_msg[11] = tu_size; /* tu_size 00000000 00000000 00000000 10101010  or 0x0*/
-    cu_msg[12] = ((tu_count - 1) << 28 | /* tu count - 1 */
-                  zero << 16 |  /* reserved  */
-                  zero          /* tu_xform_Yskip[15:0] */
-                 );
-    cu_msg[13] = (zero << 16 |  /* tu_xform_Vskip[15:0]  */
-                  zero          /* tu_xform_Uskip[15:0] */
-                 );
-    cu_msg[14] = zero ;
-    cu_msg[15] = zero ;
+    cu_msg[0] = dw0;
+    cu_msg[1] = 0;
+    cu_msg[2] = (mv[mv1] & 0xffff) << 16 | (mv[mv0] & 0xffff);
+    cu_msg[3] = (mv[mv3] & 0xffff) << 16 | (mv[mv2] & 0xffff);
+    cu_msg[4] = (mv[mv1] & 0xffff0000) | (mv[mv0] >> 16);
+    cu_msg[5] = (mv[mv3] & 0xffff0000) | (mv[mv2] >> 16);
+    cu_msg[6] = (mv[mv1 + 1] & 0xffff) << 16 | (mv[mv0 + 1] & 0xffff);
+    cu_msg[7] = (mv[mv3 + 1] & 0xffff) << 16 | (mv[mv2 + 1] & 0xffff);
+    cu_msg[8] = (mv[mv1 + 1] & 0xffff0000) | (mv[mv0 + 1] >> 16);
+    cu_msg[9] = (mv[mv3 + 1] & 0xffff0000) | (mv[mv2 + 1] >> 16);
+    cu_msg[10] = ref_idx;
+    gen9_hcpe_hevc_fill_cu_tail(cu_msg, (dw0 & 1) ? 0x55 : 0);
 }
 
-#define HEVC_SPLIT_CU_FLAG_64_64 ((0x1<<20)|(0xf<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
-#define HEVC_SPLIT_CU_FLAG_32_32 ((0x1<<20)|(0x0<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
-#define HEVC_SPLIT_CU_FLAG_16_16 ((0x0<<20)|(0x0<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
-#define HEVC_SPLIT_CU_FLAG_8_8   ((0x1<<20)|(0x0<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
+static inline unsigned int
+gen9_hcpe_hevc_split_flag(int ctb_width_in_mb, int mb_x, int mb_y)
+{
+    if (ctb_width_in_mb == 2)
+        return 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
+    else if (ctb_width_in_mb == 1)
+        return 0x1 << 20;
+
+    return 0;
+}
+
+int
+gen9_hcpe_hevc_fill_ctb_cu_records(const struct gen9_hcpe_ctb_vme_output *vme,
+                                   unsigned int *cu_records,
+                                   unsigned int *split_coding_unit_flag)
+{
+    const unsigned int ref_idx =
+        ((vme->ref_index_in_mb[1] >> 24) & 0xf) << 28 |   /* ref_idx_l1[3] */
+        ((vme->ref_index_in_mb[1] >> 16) & 0xf) << 24 |   /* ref_idx_l1[2] */
+        ((vme->ref_index_in_mb[1] >> 8) & 0xf) << 20 |    /* ref_idx_l1[1] */
+        ((vme->ref_index_in_mb[1] >> 0) & 0xf) << 16 |    /* ref_idx_l1[0] */
+        ((vme->ref_index_in_mb[0] >> 24) & 0xf) << 12 |   /* ref_idx_l0[3] */
+        ((vme->ref_index_in_mb[0] >> 16) & 0xf) << 8 |    /* ref_idx_l0[2] */
+        ((vme->ref_index_in_mb[0] >> 8) & 0xf) << 4 |     /* ref_idx_l0[1] */
+        ((vme->ref_index_in_mb[0] >> 0) & 0xf);           /* ref_idx_l0[0] */
+    const unsigned int qp = vme->qp << 16;
+    unsigned int split = (vme->ctb_width_in_mb == 2) ? HEVC_SPLIT_CU_FLAG_32_32 : HEVC_SPLIT_CU_FLAG_16_16;
+    unsigned int *cu_msg = cu_records;
+    int mb_x, mb_y, max_cu_num_in_mb, mode;
+
+    for (mb_y = 0; mb_y < vme->height_in_mb; mb_y++) {
+        const unsigned char *msg_row = vme->msg + mb_y * vme->width_in_mbs * vme->msg_size;
+
+        for (mb_x = 0; mb_x < vme->width_in_mb; mb_x++) {
+            const unsigned int *msg = (const unsigned int *)(msg_row + mb_x * vme->msg_size);
+            int inter_rdo = msg[AVC_INTER_RDO_OFFSET] & AVC_RDO_MASK;
+            int intra_rdo = msg[AVC_INTRA_RDO_OFFSET] & AVC_RDO_MASK;
+
+            max_cu_num_in_mb = 4;
+
+            if (vme->drop_cu_row && mb_y == vme->height_in_mb - 1)
+                max_cu_num_in_mb /= 2;
+
+            if (vme->drop_cu_column && mb_x == vme->width_in_mb - 1)
+                max_cu_num_in_mb /= 2;
+
+            if (vme->is_intra || intra_rdo < inter_rdo) {
+                unsigned int dw0 = (0xff << 24 |
+                                    qp |
+                                    intra_chroma_mode_avc2hevc[msg[3] & 0x3] << 8);
+
+                mode = (msg[0] & AVC_INTRA_MODE_MASK) >> 4;
+
+                if (max_cu_num_in_mb < 4) {
+                    /* only the 8x8 CUs inside the picture are coded */
+                    if (mode == AVC_INTRA_16X16)
+                        mode = AVC_INTRA_8X8;
+
+                    gen9_hcpe_hevc_fill_cu_intra(cu_msg, msg, mode, 0, dw0);
+                    cu_msg += 16;
+
+                    if (max_cu_num_in_mb > 1) {
+                        gen9_hcpe_hevc_fill_cu_intra(cu_msg, msg, mode, 2, dw0);
+                        cu_msg += 16;
+                    }
+
+                    split |= gen9_hcpe_hevc_split_flag(vme->ctb_width_in_mb, mb_x, mb_y);
+                } else if (mode == AVC_INTRA_16X16) {
+                    gen9_hcpe_hevc_fill_cu_intra(cu_msg, msg, mode, 0, dw0);
+                    cu_msg += 16;
+                } else {
+                    gen9_hcpe_hevc_fill_cu_intra(cu_msg + 0, msg, mode, 0, dw0);
+                    gen9_hcpe_hevc_fill_cu_intra(cu_msg + 16, msg, mode, 1, dw0);
+                    gen9_hcpe_hevc_fill_cu_intra(cu_msg + 32, msg, mode, 2, dw0);
+                    gen9_hcpe_hevc_fill_cu_intra(cu_msg + 48, msg, mode, 3, dw0);
+                    cu_msg += 64;
+
+                    split |= gen9_hcpe_hevc_split_flag(vme->ctb_width_in_mb, mb_x, mb_y);
+                }
+            } else {
+                const unsigned int *mv;
+                unsigned int dw0;
+
+                msg += AVC_INTER_MSG_OFFSET;
+                mv = msg + 4;
+                mode = msg[0] & AVC_INTER_MODE_MASK;
+                dw0 = (((msg[1] & AVC_INTER_SUBMB_PRE_MODE_MASK) >> 16) << 24 |
+                       qp |
+                       5 << 8 |     /* intra_chroma_mode */
+                       1 << 2);     /* cu_pred_mode: inter */
+
+                if (max_cu_num_in_mb < 4) {
+                    gen9_hcpe_hevc_fill_cu_inter(cu_msg, mv, AVC_INTER_8X8, 0, dw0, ref_idx);
+                    cu_msg += 16;
+
+                    if (max_cu_num_in_mb > 1) {
+                        gen9_hcpe_hevc_fill_cu_inter(cu_msg, mv, AVC_INTER_8X8, 1, dw0, ref_idx);
+                        cu_msg += 16;
+                    }
+
+                    split |= gen9_hcpe_hevc_split_flag(vme->ctb_width_in_mb, mb_x, mb_y);
+                } else if (mode == AVC_INTER_8X8) {
+                    gen9_hcpe_hevc_fill_cu_inter(cu_msg + 0, mv, mode, 0, dw0, ref_idx);
+                    gen9_hcpe_hevc_fill_cu_inter(cu_msg + 16, mv, mode, 1, dw0, ref_idx);
+                    gen9_hcpe_hevc_fill_cu_inter(cu_msg + 32, mv, mode, 2, dw0, ref_idx);
+                    gen9_hcpe_hevc_fill_cu_inter(cu_msg + 48, mv, mode, 3, dw0, ref_idx);
+                    cu_msg += 64;
+
+                    split |= gen9_hcpe_hevc_split_flag(vme->ctb_width_in_mb, mb_x, mb_y);
+                } else {
+                    gen9_hcpe_hevc_fill_cu_inter(cu_msg, mv, mode, 0, dw0, ref_idx);
+                    cu_msg += 16;
+                }
+            }
+        }
+    }
+
+    *split_coding_unit_flag = split;
+
+    return (cu_msg - cu_records) / 16;
+}
 
 
 void
@@ -1603,25 +1508,36 @@ intel_hevc_slice_insert_packed_data(VADriverContextP ctx,
     }
 
     if (slice_header_index == -1) {
-        unsigned char *slice_header = NULL;
-        int slice_header_length_in_bits = 0;
         VAEncSequenceParameterBufferHEVC *pSequenceParameter = (VAEncSequenceParameterBufferHEVC *)encode_state->seq_param_ext->buffer;
         VAEncPictureParameterBufferHEVC *pPicParameter = (VAEncPictureParameterBufferHEVC *)encode_state->pic_param_ext->buffer;
-        VAEncSliceParameterBufferHEVC *pSliceParameter = (VAEncSliceParameterBufferHEVC *)encode_state->slice_params_ext[slice_index]->buffer;
+        VAEncSliceParameterBufferHEVC slice_param = *(VAEncSliceParameterBufferHEVC *)encode_state->slice_params_ext[slice_index]->buffer;
+
+        /* The header is built as for the first slice, so the position of
+         * the slice doesn't matter */
+        slice_param.slice_segment_address = 0;
+        slice_param.num_ctu_in_slice = 0;
+        slice_param.slice_fields.bits.last_slice_of_pic_flag = 0;
 
         /* For the Normal HEVC */
-        slice_header_length_in_bits = build_hevc_slice_header(pSequenceParameter,
-                                      pPicParameter,
-                                      pSliceParameter,
-                                      &slice_header,
-                                      0);
+        if (!mfc_context->slice_header.data ||
+            memcmp(&mfc_context->slice_header.slice_param, &slice_param, sizeof(slice_param))) {
+            free(mfc_context->slice_header.data);
+            mfc_context->slice_header.data = NULL;
+            mfc_context->slice_header.length_in_bits = build_hevc_slice_header(pSequenceParameter,
+                                                                               pPicParameter,
+                                                                               &slice_param,
+                                                                               &mfc_context->slice_header.data,
+                                                                               0,
+                                                                               encoder_context->layer.curr_frame_layer_id);
+            mfc_context->slice_header.slice_param = slice_param;
+        }
+
         mfc_context->insert_object(ctx, encoder_context,
-                                   (unsigned int *)slice_header,
-                                   ALIGN(slice_header_length_in_bits, 32) >> 5,
-                                   slice_header_length_in_bits & 0x1f,
+                                   (unsigned int *)mfc_context->slice_header.data,
+                                   ALIGN(mfc_context->slice_header.length_in_bits, 32) >> 5,
+                                   mfc_context->slice_header.length_in_bits & 0x1f,
                                    5,  /* first 6 bytes are start code + nal unit type */
                                    1, 0, 1, slice_batch);
-        free(slice_header);
     } else {
         unsigned int skip_emul_byte_cnt;
 
@@ -1684,19 +1600,12 @@ gen9_hcpe_hevc_pipeline_slice_programing(VADriverContextP ctx,
     int col_pad_flag = (pSequenceParameter->pic_width_in_luma_samples % ctb_size)> 0 ? 1:0;
 
     int is_intra = (slice_type == HEVC_SLICE_I);
-    unsigned int *msg = NULL;
-    unsigned char *msg_ptr = NULL;
+    struct gen9_hcpe_ctb_vme_output vme_output;
+    unsigned int *cu_record_ptr;
     int macroblock_address = 0;
     int num_cu_record = 64;
     int cu_count = 1;
-    int tmp_mb_mode = 0;
-    int mb_x = 0, mb_y = 0;
-    int mb_addr = 0;
-    int cu_index = 0;
-    int inter_rdo, intra_rdo;
     int qp;
-    int drop_cu_row_in_last_mb = 0;
-    int drop_cu_column_in_last_mb = 0;
 
     if (log2_ctb_size == 5) num_cu_record = 16;
     else if (log2_ctb_size == 4) num_cu_record = 4;
@@ -1704,14 +1613,16 @@ gen9_hcpe_hevc_pipeline_slice_programing(VADriverContextP ctx,
 
     qp = qp_slice;
     if (rate_control_mode == VA_RC_CBR) {
-        qp = mfc_context->bit_rate_control_context[slice_type].QpPrimeY;
+        int layer_id = encoder_context->layer.curr_frame_layer_id;
+
+        qp = mfc_context->brc.qp_prime_y[layer_id][slice_type];
         if(slice_type == HEVC_SLICE_B) {
             if(pSequenceParameter->ip_period == 1)
             {
-                qp = mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY;
+                qp = mfc_context->brc.qp_prime_y[layer_id][HEVC_SLICE_P];
 
             }else if(mfc_context->vui_hrd.i_frame_number % pSequenceParameter->ip_period == 1){
-                qp = mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY;
+                qp = mfc_context->brc.qp_prime_y[layer_id][HEVC_SLICE_P];
             }
         }
         if (encode_state->slice_header_index[slice_index] == 0) {
@@ -1751,146 +1662,55 @@ gen9_hcpe_hevc_pipeline_slice_programing(VADriverContextP ctx,
 
 
 
-    split_coding_unit_flag = (ctb_width_in_mb == 4) ? HEVC_SPLIT_CU_FLAG_64_64 : ((ctb_width_in_mb == 2) ? HEVC_SPLIT_CU_FLAG_32_32 : HEVC_SPLIT_CU_FLAG_16_16);
-
-    dri_bo_map(vme_context->vme_output.bo , 1);
-    msg_ptr = (unsigned char *)vme_context->vme_output.bo->virtual;
-    dri_bo_map(mfc_context->hcp_indirect_cu_object.bo , 1);
+    /* The VME output and the CU records are mapped for the whole picture */
+    vme_output.msg_size = vme_context->vme_output.size_block;
+    vme_output.width_in_mbs = width_in_mbs;
+    vme_output.ctb_width_in_mb = ctb_width_in_mb;
+    vme_output.is_intra = is_intra;
+    vme_output.qp = qp;
+    vme_output.ref_index_in_mb[0] = vme_context->ref_index_in_mb[0];
+    vme_output.ref_index_in_mb[1] = vme_context->ref_index_in_mb[1];
+    cu_record_ptr = (unsigned int *)mfc_context->hcp_indirect_cu_object.bo->virtual;
 
     for (i_ctb = pSliceParameter->slice_segment_address;i_ctb < pSliceParameter->slice_segment_address + pSliceParameter->num_ctu_in_slice; i_ctb++) {
         int last_ctb = (i_ctb == (pSliceParameter->slice_segment_address + pSliceParameter->num_ctu_in_slice - 1));
-        int ctb_height_in_mb_internal = ctb_width_in_mb;
-        int ctb_width_in_mb_internal = ctb_width_in_mb;
-        int max_cu_num_in_mb = 4;
 
         ctb_x = i_ctb % width_in_ctb;
         ctb_y = i_ctb / width_in_ctb;
 
-        drop_cu_row_in_last_mb = 0;
-        drop_cu_column_in_last_mb = 0;
+        vme_output.width_in_mb = ctb_width_in_mb;
+        vme_output.height_in_mb = ctb_width_in_mb;
+        vme_output.drop_cu_row = 0;
+        vme_output.drop_cu_column = 0;
 
         if(ctb_y == (height_in_ctb - 1) && row_pad_flag)
         {
-            ctb_height_in_mb_internal = (pSequenceParameter->pic_height_in_luma_samples - (ctb_y * ctb_size) + 15)/16;
+            vme_output.height_in_mb = (pSequenceParameter->pic_height_in_luma_samples - (ctb_y * ctb_size) + 15)/16;
 
             if((log2_cu_size == 3) && (pSequenceParameter->pic_height_in_luma_samples % 16))
-                drop_cu_row_in_last_mb = (16 - (pSequenceParameter->pic_height_in_luma_samples % 16))>>log2_cu_size;
+                vme_output.drop_cu_row = (16 - (pSequenceParameter->pic_height_in_luma_samples % 16))>>log2_cu_size;
         }
 
         if(ctb_x == (width_in_ctb - 1) && col_pad_flag)
         {
-            ctb_width_in_mb_internal = (pSequenceParameter->pic_width_in_luma_samples - (ctb_x * ctb_size) + 15) / 16;
+            vme_output.width_in_mb = (pSequenceParameter->pic_width_in_luma_samples - (ctb_x * ctb_size) + 15) / 16;
 
             if((log2_cu_size == 3) && (pSequenceParameter->pic_width_in_luma_samples % 16))
-                drop_cu_column_in_last_mb = (16 - (pSequenceParameter->pic_width_in_luma_samples % 16))>>log2_cu_size;
+                vme_output.drop_cu_column = (16 - (pSequenceParameter->pic_width_in_luma_samples % 16))>>log2_cu_size;
         }
 
-        mb_x = 0;
-        mb_y = 0;
         macroblock_address = ctb_y * width_in_mbs * ctb_width_in_mb + ctb_x * ctb_width_in_mb;
-        split_coding_unit_flag = ((ctb_width_in_mb == 2) ? HEVC_SPLIT_CU_FLAG_32_32 : HEVC_SPLIT_CU_FLAG_16_16);
-        cu_count = 1;
-        cu_index = 0;
-        mb_addr = 0;
-        msg = NULL;
-        for (mb_y = 0; mb_y < ctb_height_in_mb_internal; mb_y++)
-        {
-            mb_addr = macroblock_address + mb_y * width_in_mbs ;
-            for (mb_x = 0; mb_x < ctb_width_in_mb_internal; mb_x++)
-            {
-                max_cu_num_in_mb = 4;
-                if(drop_cu_row_in_last_mb && (mb_y == ctb_height_in_mb_internal - 1))
-                    max_cu_num_in_mb /= 2;
-
-                if(drop_cu_column_in_last_mb && (mb_x == ctb_width_in_mb_internal - 1))
-                    max_cu_num_in_mb /= 2;
-
-                /* get the mb info from the vme out */
-                msg = (unsigned int *)(msg_ptr + mb_addr * vme_context->vme_output.size_block);
-
-                inter_rdo = msg[AVC_INTER_RDO_OFFSET] & AVC_RDO_MASK;
-                intra_rdo = msg[AVC_INTRA_RDO_OFFSET] & AVC_RDO_MASK;
-                /*fill to indirect cu */
-                /*to do */
-                if (is_intra || intra_rdo < inter_rdo) {
-                    /* fill intra cu */
-                    tmp_mb_mode = (msg[0] & AVC_INTRA_MODE_MASK) >> 4;
-                    if(max_cu_num_in_mb < 4){
-                        if(tmp_mb_mode == AVC_INTRA_16X16)
-                        {
-                            msg[0] = (msg[0] & !AVC_INTRA_MODE_MASK) | (AVC_INTRA_8X8<<4);
-                            tmp_mb_mode = AVC_INTRA_8X8;
-                        }
-
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                        if(--max_cu_num_in_mb > 0)
-                            gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,2);
-
-                        if(ctb_width_in_mb == 2)
-                            split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
-                        else if(ctb_width_in_mb == 1)
-                            split_coding_unit_flag |= 0x1 << 20;
-                    }
-                    else if(tmp_mb_mode == AVC_INTRA_16X16) {
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                    } else { // for 4x4 to use 8x8 replace
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,1);
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,2);
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,3);
-                        if(ctb_width_in_mb == 2)
-                            split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
-                        else if(ctb_width_in_mb == 1)
-                            split_coding_unit_flag |= 0x1 << 20;
-                    }
-                } else {
-                    msg += AVC_INTER_MSG_OFFSET;
-                    /* fill inter cu */
-                    tmp_mb_mode = msg[0] & AVC_INTER_MODE_MASK;
-                    if(max_cu_num_in_mb < 4)
-                    {
-                        if(tmp_mb_mode != AVC_INTER_8X8)
-                        {
-                            msg[0] = (msg[0] & !AVC_INTER_MODE_MASK) | AVC_INTER_8X8;
-                            tmp_mb_mode = AVC_INTER_8X8;
-                        }
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                        if(--max_cu_num_in_mb > 0)
-                            gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,1);
-
-                        if(ctb_width_in_mb == 2)
-                            split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
-                        else if(ctb_width_in_mb == 1)
-                            split_coding_unit_flag |= 0x1 << 20;
-                    }
-                    else if (tmp_mb_mode == AVC_INTER_8X8){
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,1);
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,2);
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,3);
-                        if(ctb_width_in_mb == 2)
-                            split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
-                        else if(ctb_width_in_mb == 1)
-                            split_coding_unit_flag |= 0x1 << 20;
-
-                    }else if(tmp_mb_mode == AVC_INTER_16X16 ||
-                        tmp_mb_mode == AVC_INTER_8X16 ||
-                        tmp_mb_mode == AVC_INTER_16X8) {
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                    }
-                }
-                mb_addr++;
-            }
-        }
+        vme_output.msg = (unsigned char *)vme_context->vme_output.bo->virtual +
+            macroblock_address * vme_output.msg_size;
+
+        cu_count = gen9_hcpe_hevc_fill_ctb_cu_records(&vme_output,
+                                                      cu_record_ptr + (ctb_y * width_in_ctb + ctb_x) * num_cu_record * 16,
+                                                      &split_coding_unit_flag);
 
-        cu_count = cu_index;
         // PAK object fill accordingly.
         gen9_hcpe_hevc_pak_object(ctx, ctb_x, ctb_y, last_ctb, encoder_context, cu_count, split_coding_unit_flag, slice_batch);
     }
 
-    dri_bo_unmap(mfc_context->hcp_indirect_cu_object.bo);
-    dri_bo_unmap(vme_context->vme_output.bo);
-
     if (last_slice) {
         mfc_context->insert_object(ctx, encoder_context,
                                    tail_data, 2, 8,
@@ -1908,6 +1728,7 @@ gen9_hcpe_hevc_software_batchbuffer(VADriverContextP ctx,
                                     struct intel_encoder_context *encoder_context)
 {
     struct gen9_hcpe_context *mfc_context = encoder_context->mfc_context;
+    struct gen6_vme_context *vme_context = encoder_context->vme_context;
     struct intel_batchbuffer *batch;
     dri_bo *batch_bo;
     int i;
@@ -1915,10 +1736,20 @@ gen9_hcpe_hevc_software_batchbuffer(VADriverContextP ctx,
     batch = mfc_context->aux_batchbuffer;
     batch_bo = batch->buffer;
 
+    /* The sequence and picture parameters may have changed */
+    free(mfc_context->slice_header.data);
+    mfc_context->slice_header.data = NULL;
+
+    dri_bo_map(vme_context->vme_output.bo, 0);
+    dri_bo_map(mfc_context->hcp_indirect_cu_object.bo, 1);
+
     for (i = 0; i < encode_state->num_slice_params_ext; i++) {
         gen9_hcpe_hevc_pipeline_slice_programing(ctx, encode_state, encoder_context, i, batch);
     }
 
+    dri_bo_unmap(mfc_context->hcp_indirect_cu_object.bo);
+    dri_bo_unmap(vme_context->vme_output.bo);
+
     intel_batchbuffer_align(batch, 8);
 
     BEGIN_BCS_BATCH(batch, 2);
@@ -2169,8 +2000,9 @@ intel_hcpe_bit_rate_control_context_init(struct encode_state *encode_state,
     int width_in_mbs = (pSequenceParameter->pic_width_in_luma_samples + ctb_size - 1) / ctb_size;
     int height_in_mbs = (pSequenceParameter->pic_height_in_luma_samples + ctb_size - 1) / ctb_size;
 
-    double fps = (double)encoder_context->brc.framerate[0].num / (double)encoder_context->brc.framerate[0].den;
-    double bitrate = encoder_context->brc.bits_per_second[0];
+    int top_layer = encoder_context->layer.num_layers - 1;
+    double fps = (double)encoder_context->brc.framerate[top_layer].num / (double)encoder_context->brc.framerate[top_layer].den;
+    double bitrate = encoder_context->brc.bits_per_second[top_layer];
     int inter_mb_size = bitrate * 1.0 / (fps + 4.0) / width_in_mbs / height_in_mbs;
     int intra_mb_size = inter_mb_size * 5.0;
     int i;
@@ -2213,25 +2045,35 @@ static void intel_hcpe_brc_init(struct encode_state *encode_state,
 {
     struct gen9_hcpe_context *mfc_context = encoder_context->mfc_context;
     VAEncSequenceParameterBufferHEVC *pSequenceParameter = (VAEncSequenceParameterBufferHEVC *)encode_state->seq_param_ext->buffer;
-
-    double bitrate = (double)encoder_context->brc.bits_per_second[0];
-    double framerate = (double)encoder_context->brc.framerate[0].num / (double)encoder_context->brc.framerate[0].den;
+    int num_layers = encoder_context->layer.num_layers;
+    double total_bitrate = (double)encoder_context->brc.bits_per_second[num_layers - 1];
+    double total_framerate = (double)encoder_context->brc.framerate[num_layers - 1].num / (double)encoder_context->brc.framerate[num_layers - 1].den;
+    double bitrate, framerate;
     int inum = 1, pnum = 0, bnum = 0; /* Gop structure: number of I, P, B frames in the Gop. */
+    int gop_pnum = 0;
     int intra_period = pSequenceParameter->intra_period;
     int ip_period = pSequenceParameter->ip_period;
-    double qp1_size = 0.1 * 8 * 3 * pSequenceParameter->pic_width_in_luma_samples * pSequenceParameter->pic_height_in_luma_samples / 2;
-    double qp51_size = 0.001 * 8 * 3 * pSequenceParameter->pic_width_in_luma_samples * pSequenceParameter->pic_height_in_luma_samples / 2;
-    double bpf;
+    int layer_intra_period = intra_period;
+    int lower_intra_period = 0, lower_pnum = 0;
+    double frame_per_bits = 8 * 3 * pSequenceParameter->pic_width_in_luma_samples * pSequenceParameter->pic_height_in_luma_samples / 2;
+    double qp1_size = 0.1 * frame_per_bits;
+    double qp51_size = 0.001 * frame_per_bits;
+    double bpf, factor, hrd_factor, frame_weight;
     int ratio_min = 1;
     int ratio_max = 32;
     int ratio = 8;
     double buffer_size = 0;
+    double buffer_fullness;
     int bpp = 1;
+    int i;
 
     if((pSequenceParameter->seq_fields.bits.bit_depth_luma_minus8 > 0) ||
         (pSequenceParameter->seq_fields.bits.bit_depth_chroma_minus8 > 0))
         bpp = 2;
 
+    if (num_layers > 1)
+        qp1_size = 0.15 * frame_per_bits;
+
     qp1_size = qp1_size * bpp;
     qp51_size = qp51_size * bpp;
 
@@ -2240,86 +2082,128 @@ static void intel_hcpe_brc_init(struct encode_state *encode_state,
         bnum = intra_period - inum - pnum;
     }
 
-    mfc_context->brc.mode = encoder_context->rate_control_mode;
+    gop_pnum = pnum;
 
-    mfc_context->brc.target_frame_size[HEVC_SLICE_I] = (int)((double)((bitrate * intra_period) / framerate) /
-            (double)(inum + BRC_PWEIGHT * pnum + BRC_BWEIGHT * bnum));
-    mfc_context->brc.target_frame_size[HEVC_SLICE_P] = BRC_PWEIGHT * mfc_context->brc.target_frame_size[HEVC_SLICE_I];
-    mfc_context->brc.target_frame_size[HEVC_SLICE_B] = BRC_BWEIGHT * mfc_context->brc.target_frame_size[HEVC_SLICE_I];
-
-    mfc_context->brc.gop_nums[HEVC_SLICE_I] = inum;
-    mfc_context->brc.gop_nums[HEVC_SLICE_P] = pnum;
-    mfc_context->brc.gop_nums[HEVC_SLICE_B] = bnum;
-
-    bpf = mfc_context->brc.bits_per_frame = bitrate / framerate;
+    mfc_context->brc.mode = encoder_context->rate_control_mode;
 
+    /* HRD buffer of the whole stream, each layer gets its share below */
     if (!encoder_context->brc.hrd_buffer_size)
     {
-        mfc_context->hrd.buffer_size = bitrate * ratio;
-        mfc_context->hrd.current_buffer_fullness =
-            (double)(bitrate * ratio/2 < mfc_context->hrd.buffer_size) ?
-            bitrate * ratio/2 : mfc_context->hrd.buffer_size / 2.;
+        buffer_size = total_bitrate * ratio;
+        buffer_fullness =
+            (double)(total_bitrate * ratio/2 < buffer_size) ?
+            total_bitrate * ratio/2 : buffer_size / 2.;
     }else
     {
         buffer_size = (double)encoder_context->brc.hrd_buffer_size;
-        if(buffer_size < bitrate * ratio_min)
+        if(buffer_size < total_bitrate * ratio_min)
         {
-            buffer_size = bitrate * ratio_min;
-        }else if (buffer_size > bitrate * ratio_max)
+            buffer_size = total_bitrate * ratio_min;
+        }else if (buffer_size > total_bitrate * ratio_max)
         {
-            buffer_size = bitrate * ratio_max ;
+            buffer_size = total_bitrate * ratio_max ;
         }
-        mfc_context->hrd.buffer_size =buffer_size;
         if(encoder_context->brc.hrd_initial_buffer_fullness)
         {
-            mfc_context->hrd.current_buffer_fullness =
-                (double)(encoder_context->brc.hrd_initial_buffer_fullness < mfc_context->hrd.buffer_size) ?
-                encoder_context->brc.hrd_initial_buffer_fullness : mfc_context->hrd.buffer_size / 2.;
+            buffer_fullness =
+                (double)(encoder_context->brc.hrd_initial_buffer_fullness < buffer_size) ?
+                encoder_context->brc.hrd_initial_buffer_fullness : buffer_size / 2.;
         }else
         {
-            mfc_context->hrd.current_buffer_fullness = mfc_context->hrd.buffer_size / 2.;
+            buffer_fullness = buffer_size / 2.;
 
         }
     }
 
-    mfc_context->hrd.target_buffer_fullness = (double)mfc_context->hrd.buffer_size / 2.;
-    mfc_context->hrd.buffer_capacity = (double)mfc_context->hrd.buffer_size / qp1_size;
     mfc_context->hrd.violation_noted = 0;
 
-    if ((bpf > qp51_size) && (bpf < qp1_size)) {
-        mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY = 51 - 50 * (bpf - qp51_size) / (qp1_size - qp51_size);
-    } else if (bpf >= qp1_size)
-        mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY = 1;
-    else if (bpf <= qp51_size)
-        mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY = 51;
+    for (i = 0; i < num_layers; i++) {
+        /* The bit rate and frame rate of layer i include the lower layers */
+        if (i == 0) {
+            bitrate = encoder_context->brc.bits_per_second[0];
+            framerate = (double)encoder_context->brc.framerate[0].num / (double)encoder_context->brc.framerate[0].den;
+        } else {
+            bitrate = (encoder_context->brc.bits_per_second[i] - encoder_context->brc.bits_per_second[i - 1]);
+            framerate = ((double)encoder_context->brc.framerate[i].num / (double)encoder_context->brc.framerate[i].den) -
+                ((double)encoder_context->brc.framerate[i - 1].num / (double)encoder_context->brc.framerate[i - 1].den);
+        }
+
+        if (num_layers > 1) {
+            factor = ((double)encoder_context->brc.framerate[i].num / (double)encoder_context->brc.framerate[i].den) /
+                total_framerate;
+            layer_intra_period = (int)(intra_period * factor) - lower_intra_period;
+            inum = (i == 0);
+            pnum = (int)(gop_pnum * factor) - lower_pnum;
+            bnum = layer_intra_period - inum - pnum;
+            lower_intra_period += layer_intra_period;
+            lower_pnum += pnum;
+        }
+
+        hrd_factor = bitrate / total_bitrate;
+
+        mfc_context->hrd.buffer_size[i] = (unsigned int)(buffer_size * hrd_factor);
+        mfc_context->hrd.current_buffer_fullness[i] = buffer_fullness * hrd_factor;
+        mfc_context->hrd.target_buffer_fullness[i] = (double)mfc_context->hrd.buffer_size[i] / 2.;
+        mfc_context->hrd.buffer_capacity[i] = (double)mfc_context->hrd.buffer_size[i] / qp1_size;
+
+        mfc_context->brc.gop_nums[i][HEVC_SLICE_I] = inum;
+        mfc_context->brc.gop_nums[i][HEVC_SLICE_P] = pnum;
+        mfc_context->brc.gop_nums[i][HEVC_SLICE_B] = bnum;
 
-    mfc_context->bit_rate_control_context[HEVC_SLICE_I].QpPrimeY = mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY;
-    mfc_context->bit_rate_control_context[HEVC_SLICE_B].QpPrimeY = mfc_context->bit_rate_control_context[HEVC_SLICE_I].QpPrimeY;
+        bpf = mfc_context->brc.bits_per_frame[i] = bitrate / framerate;
 
-    BRC_CLIP(mfc_context->bit_rate_control_context[HEVC_SLICE_I].QpPrimeY, 1, 36);
-    BRC_CLIP(mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY, 1, 40);
-    BRC_CLIP(mfc_context->bit_rate_control_context[HEVC_SLICE_B].QpPrimeY, 1, 45);
+        frame_weight = inum + BRC_PWEIGHT * pnum + BRC_BWEIGHT * bnum;
+
+        if (layer_intra_period > 0 && frame_weight > 0)
+            mfc_context->brc.target_frame_size[i][HEVC_SLICE_I] = (int)((double)((bitrate * layer_intra_period) / framerate) /
+                                                                        frame_weight);
+        else
+            mfc_context->brc.target_frame_size[i][HEVC_SLICE_I] = (int)(bpf / BRC_PWEIGHT);
+
+        mfc_context->brc.target_frame_size[i][HEVC_SLICE_P] = BRC_PWEIGHT * mfc_context->brc.target_frame_size[i][HEVC_SLICE_I];
+        mfc_context->brc.target_frame_size[i][HEVC_SLICE_B] = BRC_BWEIGHT * mfc_context->brc.target_frame_size[i][HEVC_SLICE_I];
+
+        mfc_context->brc.qpf_rounding_accumulator[i] = 0.;
+        mfc_context->brc.bits_prev_frame[i] = 0;
+        mfc_context->brc.prev_slice_type[i] = HEVC_SLICE_P;
+
+        if ((bpf > qp51_size) && (bpf < qp1_size)) {
+            mfc_context->brc.qp_prime_y[i][HEVC_SLICE_P] = 51 - 50 * (bpf - qp51_size) / (qp1_size - qp51_size);
+        } else if (bpf >= qp1_size)
+            mfc_context->brc.qp_prime_y[i][HEVC_SLICE_P] = 1;
+        else if (bpf <= qp51_size)
+            mfc_context->brc.qp_prime_y[i][HEVC_SLICE_P] = 51;
+
+        mfc_context->brc.qp_prime_y[i][HEVC_SLICE_I] = mfc_context->brc.qp_prime_y[i][HEVC_SLICE_P];
+        mfc_context->brc.qp_prime_y[i][HEVC_SLICE_B] = mfc_context->brc.qp_prime_y[i][HEVC_SLICE_I];
+
+        BRC_CLIP(mfc_context->brc.qp_prime_y[i][HEVC_SLICE_I], 1, 36);
+        BRC_CLIP(mfc_context->brc.qp_prime_y[i][HEVC_SLICE_P], 1, 40);
+        BRC_CLIP(mfc_context->brc.qp_prime_y[i][HEVC_SLICE_B], 1, 45);
+    }
 }
 
 int intel_hcpe_update_hrd(struct encode_state *encode_state,
-                          struct gen9_hcpe_context *mfc_context,
+                          struct intel_encoder_context *encoder_context,
                           int frame_bits)
 {
-    double prev_bf = mfc_context->hrd.current_buffer_fullness;
+    struct gen9_hcpe_context *mfc_context = encoder_context->mfc_context;
+    int layer_id = encoder_context->layer.curr_frame_layer_id;
+    double prev_bf = mfc_context->hrd.current_buffer_fullness[layer_id];
 
-    mfc_context->hrd.current_buffer_fullness -= frame_bits;
+    mfc_context->hrd.current_buffer_fullness[layer_id] -= frame_bits;
 
-    if (mfc_context->hrd.buffer_size > 0 && mfc_context->hrd.current_buffer_fullness <= 0.) {
-        mfc_context->hrd.current_buffer_fullness = prev_bf;
+    if (mfc_context->hrd.buffer_size[layer_id] > 0 && mfc_context->hrd.current_buffer_fullness[layer_id] <= 0.) {
+        mfc_context->hrd.current_buffer_fullness[layer_id] = prev_bf;
         return BRC_UNDERFLOW;
     }
 
-    mfc_context->hrd.current_buffer_fullness += mfc_context->brc.bits_per_frame;
-    if (mfc_context->hrd.buffer_size > 0 && mfc_context->hrd.current_buffer_fullness > mfc_context->hrd.buffer_size) {
+    mfc_context->hrd.current_buffer_fullness[layer_id] += mfc_context->brc.bits_per_frame[layer_id];
+    if (mfc_context->hrd.buffer_size[layer_id] > 0 && mfc_context->hrd.current_buffer_fullness[layer_id] > mfc_context->hrd.buffer_size[layer_id]) {
         if (mfc_context->brc.mode == VA_RC_VBR)
-            mfc_context->hrd.current_buffer_fullness = mfc_context->hrd.buffer_size;
+            mfc_context->hrd.current_buffer_fullness[layer_id] = mfc_context->hrd.buffer_size[layer_id];
         else {
-            mfc_context->hrd.current_buffer_fullness = prev_bf;
+            mfc_context->hrd.current_buffer_fullness[layer_id] = prev_bf;
             return BRC_OVERFLOW;
         }
     }
@@ -2327,16 +2211,16 @@ int intel_hcpe_update_hrd(struct encode_state *encode_state,
 }
 
 int intel_hcpe_brc_postpack(struct encode_state *encode_state,
-                            struct gen9_hcpe_context *mfc_context,
+                            struct intel_encoder_context *encoder_context,
                             int frame_bits)
 {
+    struct gen9_hcpe_context *mfc_context = encoder_context->mfc_context;
     gen6_brc_status sts = BRC_NO_HRD_VIOLATION;
     VAEncSequenceParameterBufferHEVC *pSequenceParameter = (VAEncSequenceParameterBufferHEVC *)encode_state->seq_param_ext->buffer;
     VAEncSliceParameterBufferHEVC *pSliceParameter = (VAEncSliceParameterBufferHEVC *)encode_state->slice_params_ext[0]->buffer;
     int slicetype = pSliceParameter->slice_type;
-    int qpi = mfc_context->bit_rate_control_context[HEVC_SLICE_I].QpPrimeY;
-    int qpp = mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY;
-    int qpb = mfc_context->bit_rate_control_context[HEVC_SLICE_B].QpPrimeY;
+    int curr_frame_layer_id, next_frame_layer_id;
+    int qpi, qpp, qpb;
     int qp; // quantizer of previously encoded slice of current type
     int qpn; // predicted quantizer for next frame of current type in integer format
     double qpf; // predicted quantizer for next frame of current type in float format
@@ -2358,13 +2242,42 @@ int intel_hcpe_brc_postpack(struct encode_state *encode_state,
         }
     }
 
-    qp = mfc_context->bit_rate_control_context[slicetype].QpPrimeY;
+    if (encoder_context->layer.num_layers < 2 || encoder_context->layer.size_frame_layer_ids == 0) {
+        curr_frame_layer_id = 0;
+        next_frame_layer_id = 0;
+    } else {
+        curr_frame_layer_id = encoder_context->layer.curr_frame_layer_id;
+        next_frame_layer_id = encoder_context->layer.frame_layer_ids[encoder_context->num_frames_in_sequence % encoder_context->layer.size_frame_layer_ids];
+    }
+
+    /* checking wthether HRD compliance first */
+    sts = intel_hcpe_update_hrd(encode_state, encoder_context, frame_bits);
+
+    /* the frame is re-encoded on a HRD violation, so stay on this layer */
+    if (sts != BRC_NO_HRD_VIOLATION)
+        next_frame_layer_id = curr_frame_layer_id;
 
-    target_frame_size = mfc_context->brc.target_frame_size[slicetype];
-    if (mfc_context->hrd.buffer_capacity < 5)
+    mfc_context->brc.bits_prev_frame[curr_frame_layer_id] = frame_bits;
+    frame_bits = mfc_context->brc.bits_prev_frame[next_frame_layer_id];
+
+    mfc_context->brc.prev_slice_type[curr_frame_layer_id] = slicetype;
+    slicetype = mfc_context->brc.prev_slice_type[next_frame_layer_id];
+
+    /* 0 means the next frame is the first frame of next layer */
+    if (frame_bits == 0)
+        return sts;
+
+    qpi = mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_I];
+    qpp = mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_P];
+    qpb = mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_B];
+
+    qp = mfc_context->brc.qp_prime_y[next_frame_layer_id][slicetype];
+
+    target_frame_size = mfc_context->brc.target_frame_size[next_frame_layer_id][slicetype];
+    if (mfc_context->hrd.buffer_capacity[next_frame_layer_id] < 5)
         frame_size_alpha = 0;
     else
-        frame_size_alpha = (double)mfc_context->brc.gop_nums[slicetype];
+        frame_size_alpha = (double)mfc_context->brc.gop_nums[next_frame_layer_id][slicetype];
     if (frame_size_alpha > 30) frame_size_alpha = 30;
     frame_size_next = target_frame_size + (double)(target_frame_size - frame_bits) /
                       (double)(frame_size_alpha + 1.);
@@ -2378,13 +2291,13 @@ int intel_hcpe_brc_postpack(struct encode_state *encode_state,
 
     if (qpn == qp) {
         /* setting qpn we round qpf making mistakes: now we are trying to compensate this */
-        mfc_context->brc.qpf_rounding_accumulator += qpf - qpn;
-        if (mfc_context->brc.qpf_rounding_accumulator > 1.0) {
+        mfc_context->brc.qpf_rounding_accumulator[next_frame_layer_id] += qpf - qpn;
+        if (mfc_context->brc.qpf_rounding_accumulator[next_frame_layer_id] > 1.0) {
             qpn++;
-            mfc_context->brc.qpf_rounding_accumulator = 0.;
-        } else if (mfc_context->brc.qpf_rounding_accumulator < -1.0) {
+            mfc_context->brc.qpf_rounding_accumulator[next_frame_layer_id] = 0.;
+        } else if (mfc_context->brc.qpf_rounding_accumulator[next_frame_layer_id] < -1.0) {
             qpn--;
-            mfc_context->brc.qpf_rounding_accumulator = 0.;
+            mfc_context->brc.qpf_rounding_accumulator[next_frame_layer_id] = 0.;
         }
     }
     /* making sure that QP is not changing too fast */
@@ -2393,17 +2306,14 @@ int intel_hcpe_brc_postpack(struct encode_state *encode_state,
     /* making sure that with QP predictions we did do not leave QPs range */
     BRC_CLIP(qpn, 1, 51);
 
-    /* checking wthether HRD compliance is still met */
-    sts = intel_hcpe_update_hrd(encode_state, mfc_context, frame_bits);
-
     /* calculating QP delta as some function*/
-    x = mfc_context->hrd.target_buffer_fullness - mfc_context->hrd.current_buffer_fullness;
+    x = mfc_context->hrd.target_buffer_fullness[next_frame_layer_id] - mfc_context->hrd.current_buffer_fullness[next_frame_layer_id];
     if (x > 0) {
-        x /= mfc_context->hrd.target_buffer_fullness;
-        y = mfc_context->hrd.current_buffer_fullness;
+        x /= mfc_context->hrd.target_buffer_fullness[next_frame_layer_id];
+        y = mfc_context->hrd.current_buffer_fullness[next_frame_layer_id];
     } else {
-        x /= (mfc_context->hrd.buffer_size - mfc_context->hrd.target_buffer_fullness);
-        y = mfc_context->hrd.buffer_size - mfc_context->hrd.current_buffer_fullness;
+        x /= (mfc_context->hrd.buffer_size[next_frame_layer_id] - mfc_context->hrd.target_buffer_fullness[next_frame_layer_id]);
+        y = mfc_context->hrd.buffer_size[next_frame_layer_id] - mfc_context->hrd.current_buffer_fullness[next_frame_layer_id];
     }
     if (y < 0.01) y = 0.01;
     if (x > 1) x = 1;
@@ -2419,23 +2329,23 @@ int intel_hcpe_brc_postpack(struct encode_state *encode_state,
         /* correcting QPs of slices of other types */
         if (slicetype == HEVC_SLICE_P) {
             if (abs(qpn + BRC_P_B_QP_DIFF - qpb) > 2)
-                mfc_context->bit_rate_control_context[HEVC_SLICE_B].QpPrimeY += (qpn + BRC_P_B_QP_DIFF - qpb) >> 1;
+                mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_B] += (qpn + BRC_P_B_QP_DIFF - qpb) >> 1;
             if (abs(qpn - BRC_I_P_QP_DIFF - qpi) > 2)
-                mfc_context->bit_rate_control_context[HEVC_SLICE_I].QpPrimeY += (qpn - BRC_I_P_QP_DIFF - qpi) >> 1;
+                mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_I] += (qpn - BRC_I_P_QP_DIFF - qpi) >> 1;
         } else if (slicetype == HEVC_SLICE_I) {
             if (abs(qpn + BRC_I_B_QP_DIFF - qpb) > 4)
-                mfc_context->bit_rate_control_context[HEVC_SLICE_B].QpPrimeY += (qpn + BRC_I_B_QP_DIFF - qpb) >> 2;
+                mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_B] += (qpn + BRC_I_B_QP_DIFF - qpb) >> 2;
             if (abs(qpn + BRC_I_P_QP_DIFF - qpp) > 2)
-                mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY += (qpn + BRC_I_P_QP_DIFF - qpp) >> 2;
+                mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_P] += (qpn + BRC_I_P_QP_DIFF - qpp) >> 2;
         } else { // HEVC_SLICE_B
             if (abs(qpn - BRC_P_B_QP_DIFF - qpp) > 2)
-                mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY += (qpn - BRC_P_B_QP_DIFF - qpp) >> 1;
+                mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_P] += (qpn - BRC_P_B_QP_DIFF - qpp) >> 1;
             if (abs(qpn - BRC_I_B_QP_DIFF - qpi) > 4)
-                mfc_context->bit_rate_control_context[HEVC_SLICE_I].QpPrimeY += (qpn - BRC_I_B_QP_DIFF - qpi) >> 2;
+                mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_I] += (qpn - BRC_I_B_QP_DIFF - qpi) >> 2;
         }
-        BRC_CLIP(mfc_context->bit_rate_control_context[HEVC_SLICE_I].QpPrimeY, 1, 51);
-        BRC_CLIP(mfc_context->bit_rate_control_context[HEVC_SLICE_P].QpPrimeY, 1, 51);
-        BRC_CLIP(mfc_context->bit_rate_control_context[HEVC_SLICE_B].QpPrimeY, 1, 51);
+        BRC_CLIP(mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_I], 1, 51);
+        BRC_CLIP(mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_P], 1, 51);
+        BRC_CLIP(mfc_context->brc.qp_prime_y[next_frame_layer_id][HEVC_SLICE_B], 1, 51);
     } else if (sts == BRC_UNDERFLOW) { // underflow
         if (qpn <= qp) qpn = qp + 1;
         if (qpn > 51) {
@@ -2450,7 +2360,7 @@ int intel_hcpe_brc_postpack(struct encode_state *encode_state,
         }
     }
 
-    mfc_context->bit_rate_control_context[slicetype].QpPrimeY = qpn;
+    mfc_context->brc.qp_prime_y[next_frame_layer_id][slicetype] = qpn;
 
     return sts;
 }
@@ -2460,7 +2370,7 @@ static void intel_hcpe_hrd_context_init(struct encode_state *encode_state,
 {
     struct gen9_hcpe_context *mfc_context = encoder_context->mfc_context;
     unsigned int rate_control_mode = encoder_context->rate_control_mode;
-    unsigned int target_bit_rate = encoder_context->brc.bits_per_second[0];
+    unsigned int target_bit_rate = encoder_context->brc.bits_per_second[encoder_context->layer.num_layers - 1];
 
     // current we only support CBR mode.
     if (rate_control_mode == VA_RC_CBR) {
@@ -2554,7 +2464,7 @@ gen9_hcpe_hevc_encode_picture(VADriverContextP ctx,
         gen9_hcpe_run(ctx, encode_state, encoder_context);
         if (rate_control_mode == VA_RC_CBR /*|| rate_control_mode == VA_RC_VBR*/) {
             gen9_hcpe_stop(ctx, encode_state, encoder_context, &current_frame_bits_size);
-            sts = intel_hcpe_brc_postpack(encode_state, hcpe_context, current_frame_bits_size);
+            sts = intel_hcpe_brc_postpack(encode_state, encoder_context, current_frame_bits_size);
             if (sts == BRC_NO_HRD_VIOLATION) {
                 intel_hcpe_hrd_context_update(encode_state, hcpe_context);
                 break;
@@ -2638,6 +2548,8 @@ gen9_hcpe_context_destroy(void *context)
 
     hcpe_context->aux_batchbuffer = NULL;
 
+    free(hcpe_context->slice_header.data);
+
     free(hcpe_context);
 }
 
@@ -1014,8 +1014,51 @@ out:
         assert(gen_buffer->bo);                                 \
         gen_buffer->frame_width  = width ;                      \
         gen_buffer->frame_height = height;                      \
+        gen_buffer->alloc_size = size;                          \
     } while (0)
 
+/*
+ * Zeroes the segment id buffer with the blitter ahead of the decode batch,
+ * so that the CPU neither maps the buffer nor waits for the previous frame.
+ * The buffer is filled as a 32bpp surface with one 64 bytes row per SB row.
+ */
+static void
+vp9_clear_segment_id_buffer(VADriverContextP ctx,
+                            struct gen9_hcpd_context *gen9_hcpd_context,
+                            int size)
+{
+    struct intel_driver_data *intel = intel_driver_data(ctx);
+    struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
+    dri_bo *bo = gen9_hcpd_context->vp9_segment_id_buffer.bo;
+    int pitch = gen9_hcpd_context->picture_width_in_ctbs * 64;
+
+    if (!intel->has_blt || pitch > 0x7fff) {
+        dri_bo_map(bo, 1);
+        memset(bo->virtual, 0, size);
+        dri_bo_unmap(bo);
+
+        return;
+    }
+
+    intel_batchbuffer_start_atomic_blt(batch, 24);
+    BEGIN_BLT_BATCH(batch, 7);
+    OUT_BATCH(batch,
+              GEN8_XY_COLOR_BLT_CMD |
+              XY_COLOR_BLT_WRITE_RGB |
+              XY_COLOR_BLT_WRITE_ALPHA);
+    OUT_BATCH(batch, 0xf0 << 16 | BR13_8888 | pitch);
+    OUT_BATCH(batch, 0);
+    OUT_BATCH(batch,
+              gen9_hcpd_context->picture_height_in_ctbs << 16 |
+              pitch / 4);
+    OUT_RELOC64(batch, bo,
+                I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
+                0);
+    OUT_BATCH(batch, 0);
+    ADVANCE_BATCH(batch);
+    intel_batchbuffer_end_atomic(batch);
+}
+
 static void
 vp9_update_segmentId_buffer(VADriverContextP ctx,
                           struct decode_state *decode_state,
@@ -1031,9 +1074,11 @@ vp9_update_segmentId_buffer(VADriverContextP ctx,
 
     size = gen9_hcpd_context->picture_width_in_ctbs * gen9_hcpd_context->picture_height_in_ctbs * 1 ;
     size <<= 6;
-    if (gen9_hcpd_context->vp9_segment_id_buffer.bo == NULL || pic_param->frame_width > gen9_hcpd_context->last_frame.frame_width || pic_param->frame_height > gen9_hcpd_context->last_frame.frame_height)
+    //Only reallocate when the buffer is too small, not on every resolution increase
+    if (gen9_hcpd_context->vp9_segment_id_buffer.bo == NULL || size > gen9_hcpd_context->vp9_segment_id_buffer_size)
     {
         ALLOC_GEN_BUFFER((&gen9_hcpd_context->vp9_segment_id_buffer), "vp9 segment id buffer", size);
+        gen9_hcpd_context->vp9_segment_id_buffer_size = size;
     }
 
     is_scaling = (pic_param->frame_width != gen9_hcpd_context->last_frame.frame_width) || (pic_param->frame_height != gen9_hcpd_context->last_frame.frame_height);
@@ -1043,9 +1088,7 @@ vp9_update_segmentId_buffer(VADriverContextP ctx,
         pic_param->pic_fields.bits.intra_only || is_scaling) {
 
         //VP9 Segment ID buffer needs to be zero
-        dri_bo_map(gen9_hcpd_context->vp9_segment_id_buffer.bo,1);
-        memset((unsigned char *)gen9_hcpd_context->vp9_segment_id_buffer.bo->virtual,0, size);
-        dri_bo_unmap(gen9_hcpd_context->vp9_segment_id_buffer.bo);
+        vp9_clear_segment_id_buffer(ctx, gen9_hcpd_context, size);
     }
 }
 
@@ -1063,7 +1106,7 @@ vp9_update_mv_temporal_buffer(VADriverContextP ctx,
 
     size = gen9_hcpd_context->picture_width_in_ctbs * gen9_hcpd_context->picture_height_in_ctbs * 9 ;
     size <<= 6; //CL aligned
-    if (gen9_hcpd_context->vp9_mv_temporal_buffer_curr.bo == NULL || pic_param->frame_width > gen9_hcpd_context->vp9_mv_temporal_buffer_curr.frame_width || pic_param->frame_height > gen9_hcpd_context->vp9_mv_temporal_buffer_curr.frame_height)
+    if (gen9_hcpd_context->vp9_mv_temporal_buffer_curr.bo == NULL || size > gen9_hcpd_context->vp9_mv_temporal_buffer_curr.alloc_size)
     {
         ALLOC_MV_BUFFER((&gen9_hcpd_context->vp9_mv_temporal_buffer_curr), "vp9 curr mv temporal buffer", size,pic_param->frame_width,pic_param->frame_height);
     }
@@ -1130,17 +1173,120 @@ vp9_gen_default_probabilities(VADriverContextP ctx, struct gen9_hcpd_context *ge
     }
 }
 
+static inline int
+vp9_adapt_probabilities(VADecPictureParameterBufferVP9 *pic_param)
+{
+    //No adaptation if error resilient or frame_parallel_mode are set
+    return !(pic_param->pic_fields.bits.error_resilient_mode ||
+             pic_param->pic_fields.bits.frame_parallel_decoding_mode);
+}
+
+static void
+vp9_read_back_probabilities(struct gen9_hcpd_context *gen9_hcpd_context)
+{
+    VP9_PROB_BUFFER *prob_buffer;
+    int frame_context_idx;
+    void *pfc, *pprob;
+
+    if (!gen9_hcpd_context->vp9_prob_readback_pending)
+        return;
+
+    gen9_hcpd_context->vp9_prob_readback_pending = 0;
+    prob_buffer = &gen9_hcpd_context->vp9_prob_buffers[gen9_hcpd_context->vp9_prob_buffer_index];
+    frame_context_idx = gen9_hcpd_context->last_frame.frame_context_idx;
+    pfc = (void *)&gen9_hcpd_context->vp9_frame_ctx[frame_context_idx];
+
+    //update vp9_fc to frame_context, waits for the last frame to complete
+    dri_bo_map(prob_buffer->bo, 0);
+    pprob = prob_buffer->bo->virtual;
+
+    if (prob_buffer->key_frame)
+        memcpy(pfc, pprob, VP9_PROB_BUFFER_FIRST_PART_SIZE - VP9_PROB_BUFFER_KEY_INTER_SIZE);
+    else
+        memcpy(pfc, pprob, VP9_PROB_BUFFER_FIRST_PART_SIZE);
+
+    dri_bo_unmap(prob_buffer->bo);
+
+    gen9_hcpd_context->vp9_frame_ctx_serial[frame_context_idx]++;
+
+    /* The buffer matches the frame context again */
+    prob_buffer->frame_context_idx = frame_context_idx;
+    prob_buffer->serial = gen9_hcpd_context->vp9_frame_ctx_serial[frame_context_idx];
+}
+
+static VP9_PROB_BUFFER *
+vp9_get_probability_buffer(VADriverContextP ctx,
+                           struct gen9_hcpd_context *gen9_hcpd_context,
+                           int frame_context_idx,
+                           uint8_t key_frame,
+                           int *upload)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    VP9_PROB_BUFFER *prob_buffer;
+    int i, index;
+
+    //A buffer which still holds this frame context is used as is
+    for (i = 0; i < VP9_PROB_BUFFER_RING_SIZE; i++) {
+        prob_buffer = &gen9_hcpd_context->vp9_prob_buffers[i];
+
+        if (prob_buffer->bo &&
+            prob_buffer->frame_context_idx == frame_context_idx &&
+            prob_buffer->serial == gen9_hcpd_context->vp9_frame_ctx_serial[frame_context_idx] &&
+            prob_buffer->key_frame == key_frame) {
+            gen9_hcpd_context->vp9_prob_buffer_index = i;
+            *upload = 0;
+
+            return prob_buffer;
+        }
+    }
+
+    //Otherwise take the first idle buffer after the current one
+    index = (gen9_hcpd_context->vp9_prob_buffer_index + 1) % VP9_PROB_BUFFER_RING_SIZE;
+
+    for (i = 0; i < VP9_PROB_BUFFER_RING_SIZE; i++) {
+        prob_buffer = &gen9_hcpd_context->vp9_prob_buffers[(index + i) % VP9_PROB_BUFFER_RING_SIZE];
+
+        if (!prob_buffer->bo || !drm_intel_bo_busy(prob_buffer->bo)) {
+            index = (index + i) % VP9_PROB_BUFFER_RING_SIZE;
+            break;
+        }
+    }
+
+    prob_buffer = &gen9_hcpd_context->vp9_prob_buffers[index];
+
+    if (!prob_buffer->bo) {
+        prob_buffer->bo = dri_bo_alloc(i965->intel.bufmgr,
+                                       "vp9 probability buffer",
+                                       32 << 6,
+                                       0x1000);
+        assert(prob_buffer->bo);
+    }
+
+    prob_buffer->frame_context_idx = frame_context_idx;
+    prob_buffer->serial = gen9_hcpd_context->vp9_frame_ctx_serial[frame_context_idx];
+    prob_buffer->key_frame = key_frame;
+    gen9_hcpd_context->vp9_prob_buffer_index = index;
+    *upload = 1;
+
+    return prob_buffer;
+}
+
 static void
 vp9_update_probabilities(VADriverContextP ctx,
                           struct decode_state *decode_state,
                           struct gen9_hcpd_context *gen9_hcpd_context)
 {
     VADecPictureParameterBufferVP9 *pic_param;
-    int i = 0;
+    VP9_PROB_BUFFER *prob_buffer;
+    FRAME_CONTEXT *fc;
+    uint8_t key_frame;
+    int i = 0, upload = 0;
 
     assert(decode_state->pic_param && decode_state->pic_param->buffer);
     pic_param = (VADecPictureParameterBufferVP9 *)decode_state->pic_param->buffer;
 
+    vp9_read_back_probabilities(gen9_hcpd_context);
+
     //first part buffer update: Case 1)Reset all 4 probablity buffers
    if((pic_param->pic_fields.bits.frame_type == HCP_VP9_KEY_FRAME) ||pic_param->pic_fields.bits.intra_only||pic_param->pic_fields.bits.error_resilient_mode)
     {
@@ -1155,48 +1301,65 @@ vp9_update_probabilities(VADriverContextP ctx,
 
                 vp9_copy(gen9_hcpd_context->vp9_frame_ctx[i].seg_tree_probs, default_seg_tree_probs);
                 vp9_copy(gen9_hcpd_context->vp9_frame_ctx[i].seg_pred_probs, default_seg_pred_probs);
+                gen9_hcpd_context->vp9_frame_ctx_serial[i]++;
             }
         }else if(pic_param->pic_fields.bits.reset_frame_context == 2&&pic_param->pic_fields.bits.intra_only)
         {
             memcpy(&gen9_hcpd_context->vp9_frame_ctx[pic_param->pic_fields.bits.frame_context_idx],&gen9_hcpd_context->vp9_fc_inter_default,VP9_PROB_BUFFER_FIRST_PART_SIZE);
+            gen9_hcpd_context->vp9_frame_ctx_serial[pic_param->pic_fields.bits.frame_context_idx]++;
         }
         pic_param->pic_fields.bits.frame_context_idx = 0;
     }
 
+    fc = &gen9_hcpd_context->vp9_frame_ctx[pic_param->pic_fields.bits.frame_context_idx];
+
     //Case 3) Update only segment probabilities
     if((pic_param->pic_fields.bits.segmentation_enabled &&
-        pic_param->pic_fields.bits.segmentation_update_map))
+        pic_param->pic_fields.bits.segmentation_update_map) &&
+       (memcmp(fc->seg_tree_probs, pic_param->mb_segment_tree_probs, SEG_TREE_PROBS) ||
+        memcmp(fc->seg_pred_probs, pic_param->segment_pred_probs, PREDICTION_PROBS)))
     {
         //Update seg_tree_probs and seg_pred_probs accordingly
         for (i=0; i<SEG_TREE_PROBS; i++)
         {
-            gen9_hcpd_context->vp9_frame_ctx[pic_param->pic_fields.bits.frame_context_idx].seg_tree_probs[i] = pic_param->mb_segment_tree_probs[i];
+            fc->seg_tree_probs[i] = pic_param->mb_segment_tree_probs[i];
         }
         for (i=0; i<PREDICTION_PROBS; i++)
         {
-            gen9_hcpd_context->vp9_frame_ctx[pic_param->pic_fields.bits.frame_context_idx].seg_pred_probs[i] = pic_param->segment_pred_probs[i];
+            fc->seg_pred_probs[i] = pic_param->segment_pred_probs[i];
         }
+        gen9_hcpd_context->vp9_frame_ctx_serial[pic_param->pic_fields.bits.frame_context_idx]++;
     }
 
+    //only update 343bytes for key or intra_only frame
+    key_frame = (pic_param->pic_fields.bits.frame_type == HCP_VP9_KEY_FRAME ||
+                 pic_param->pic_fields.bits.intra_only);
+
+    prob_buffer = vp9_get_probability_buffer(ctx,
+                                             gen9_hcpd_context,
+                                             pic_param->pic_fields.bits.frame_context_idx,
+                                             key_frame,
+                                             &upload);
+
     //update vp9_fc according to frame_context_id
+    if (upload)
     {
-        void *pfc = (void *)&gen9_hcpd_context->vp9_frame_ctx[pic_param->pic_fields.bits.frame_context_idx];
+        void *pfc = (void *)fc;
         void *pprob = NULL;
 
-        dri_bo_map(gen9_hcpd_context->vp9_probability_buffer.bo,1);
+        dri_bo_map(prob_buffer->bo,1);
 
-        pprob = (void *)gen9_hcpd_context->vp9_probability_buffer.bo->virtual;
+        pprob = (void *)prob_buffer->bo->virtual;
         memcpy(pprob,pfc,2048);
-        //only update 343bytes for key or intra_only frame
-        if(pic_param->pic_fields.bits.frame_type == HCP_VP9_KEY_FRAME ||
-            pic_param->pic_fields.bits.intra_only)
+
+        if (key_frame)
         {
             memcpy(pprob + VP9_PROB_BUFFER_FIRST_PART_SIZE - VP9_PROB_BUFFER_KEY_INTER_SIZE
                     , gen9_hcpd_context->vp9_fc_key_default.inter_mode_probs
                     , VP9_PROB_BUFFER_KEY_INTER_SIZE);
         }
 
-        dri_bo_unmap(gen9_hcpd_context->vp9_probability_buffer.bo);
+        dri_bo_unmap(prob_buffer->bo);
     }
 }
 
@@ -1323,10 +1486,6 @@ gen9_hcpd_vp9_decode_init(VADriverContextP ctx,
     ALLOC_GEN_BUFFER((&gen9_hcpd_context->hvd_line_rowstore_buffer), "hvd line rowstore buffer", size);
     ALLOC_GEN_BUFFER((&gen9_hcpd_context->hvd_tile_rowstore_buffer), "hvd tile rowstore buffer", size);
 
-    size = 32;
-    size<<=6;
-    ALLOC_GEN_BUFFER((&gen9_hcpd_context->vp9_probability_buffer), "vp9 probability buffer", size);
-
     gen9_hcpd_context->first_inter_slice_collocated_ref_idx = 0;
     gen9_hcpd_context->first_inter_slice_collocated_from_l0_flag = 0;
     gen9_hcpd_context->first_inter_slice_valid = 0;
@@ -1459,7 +1618,7 @@ gen9_hcpd_vp9_pipe_buf_addr_state(VADriverContextP ctx,
 
     OUT_BCS_BATCH(batch, 0);    /* DW 82, memory address attributes */
 
-    OUT_BUFFER_MA_TARGET(gen9_hcpd_context->vp9_probability_buffer.bo); /* DW 83..85, VP9 Probability bufffer */
+    OUT_BUFFER_MA_TARGET(gen9_hcpd_context->vp9_prob_buffers[gen9_hcpd_context->vp9_prob_buffer_index].bo); /* DW 83..85, VP9 Probability bufffer */
     OUT_BUFFER_MA_TARGET(gen9_hcpd_context->vp9_segment_id_buffer.bo);  /* DW 86..88, VP9 Segment ID buffer */
     OUT_BUFFER_MA_TARGET(gen9_hcpd_context->hvd_line_rowstore_buffer.bo);/* DW 89..91, VP9 HVD Line Rowstore buffer */
     OUT_BUFFER_MA_TARGET(gen9_hcpd_context->hvd_tile_rowstore_buffer.bo);/* DW 92..94, VP9 HVD Tile Rowstore buffer */
@@ -1538,11 +1697,7 @@ gen9_hcpd_vp9_pic_state(VADriverContextP ctx,
                                 (last_frame_type == HCP_VP9_KEY_FRAME) ||
                                 (!gen9_hcpd_context->last_frame.show_frame));
 
-    uint8_t adapt_probabilities_flag = 0;
-    if((pic_param->pic_fields.bits.error_resilient_mode || pic_param->pic_fields.bits.frame_parallel_decoding_mode))
-        adapt_probabilities_flag = 0; //0: Do not adapt (error resilient or frame_parallel_mode are set)
-    else if(!(pic_param->pic_fields.bits.error_resilient_mode) && !(pic_param->pic_fields.bits.frame_parallel_decoding_mode))
-        adapt_probabilities_flag = 1; //1: Adapt (not error resilient and not frame_ parallel_mode)
+    uint8_t adapt_probabilities_flag = vp9_adapt_probabilities(pic_param);
 
     frame_width_in_pixel  = (gen9_hcpd_context->picture_width_in_min_cb_minus1  + 1) * gen9_hcpd_context->min_cb_size ;
     frame_height_in_pixel = (gen9_hcpd_context->picture_height_in_min_cb_minus1 + 1) * gen9_hcpd_context->min_cb_size ;
@@ -1745,7 +1900,7 @@ gen9_hcpd_vp9_decode_picture(VADriverContextP ctx,
     dri_bo *slice_data_bo;
     dri_bo *tmp_bo;
     uint16_t tmp;
-    int i = 0, num_segments=0;
+    int i = 0, num_segments=0, size;
 
     assert(decode_state->pic_param && decode_state->pic_param->buffer);
     assert(decode_state->slice_params && decode_state->slice_params[0]->buffer);
@@ -1828,25 +1983,19 @@ gen9_hcpd_vp9_decode_picture(VADriverContextP ctx,
         gen9_hcpd_context->vp9_mv_temporal_buffer_last.frame_height = gen9_hcpd_context->vp9_mv_temporal_buffer_curr.frame_height;
         gen9_hcpd_context->vp9_mv_temporal_buffer_curr.frame_height = tmp;
 
+        size = gen9_hcpd_context->vp9_mv_temporal_buffer_last.alloc_size;
+        gen9_hcpd_context->vp9_mv_temporal_buffer_last.alloc_size = gen9_hcpd_context->vp9_mv_temporal_buffer_curr.alloc_size;
+        gen9_hcpd_context->vp9_mv_temporal_buffer_curr.alloc_size = size;
 
     }
-    //update vp9_frame_ctx according to frame_context_id
-    if (pic_param->pic_fields.bits.refresh_frame_context)
-    {
-        void *pfc = (void *)&gen9_hcpd_context->vp9_frame_ctx[pic_param->pic_fields.bits.frame_context_idx];
-        void *pprob = NULL;
-
-        //update vp9_fc to frame_context
-        dri_bo_map(gen9_hcpd_context->vp9_probability_buffer.bo,1);
-        pprob = (void *)gen9_hcpd_context->vp9_probability_buffer.bo->virtual;
-        if(pic_param->pic_fields.bits.frame_type == HCP_VP9_KEY_FRAME||
-                pic_param->pic_fields.bits.intra_only)
-            memcpy(pfc, pprob, VP9_PROB_BUFFER_FIRST_PART_SIZE - VP9_PROB_BUFFER_KEY_INTER_SIZE);
-        else
-            memcpy(pfc, pprob, VP9_PROB_BUFFER_FIRST_PART_SIZE);
+    //The HW may write the probabilities back in place, so the buffer
+    //content is only known again once it has been read back
+    gen9_hcpd_context->vp9_prob_buffers[gen9_hcpd_context->vp9_prob_buffer_index].frame_context_idx = -1;
 
-        dri_bo_unmap(gen9_hcpd_context->vp9_probability_buffer.bo);
-    }
+    //update vp9_frame_ctx according to frame_context_id on the next frame,
+    //so that the GPU doesn't have to complete before returning
+    if (pic_param->pic_fields.bits.refresh_frame_context)
+        gen9_hcpd_context->vp9_prob_readback_pending = 1;
 
 out:
     return vaStatus;
@@ -1894,6 +2043,7 @@ static void
 gen9_hcpd_context_destroy(void *hw_context)
 {
     struct gen9_hcpd_context *gen9_hcpd_context = (struct gen9_hcpd_context *)hw_context;
+    int i;
 
     FREE_GEN_BUFFER((&gen9_hcpd_context->deblocking_filter_line_buffer));
     FREE_GEN_BUFFER((&gen9_hcpd_context->deblocking_filter_tile_line_buffer));
@@ -1906,11 +2056,13 @@ gen9_hcpd_context_destroy(void *hw_context)
     FREE_GEN_BUFFER((&gen9_hcpd_context->sao_tile_column_buffer));
     FREE_GEN_BUFFER((&gen9_hcpd_context->hvd_line_rowstore_buffer));
     FREE_GEN_BUFFER((&gen9_hcpd_context->hvd_tile_rowstore_buffer));
-    FREE_GEN_BUFFER((&gen9_hcpd_context->vp9_probability_buffer));
     FREE_GEN_BUFFER((&gen9_hcpd_context->vp9_segment_id_buffer));
     dri_bo_unreference(gen9_hcpd_context->vp9_mv_temporal_buffer_curr.bo);
     dri_bo_unreference(gen9_hcpd_context->vp9_mv_temporal_buffer_last.bo);
 
+    for (i = 0; i < VP9_PROB_BUFFER_RING_SIZE; i++)
+        dri_bo_unreference(gen9_hcpd_context->vp9_prob_buffers[i].bo);
+
     intel_batchbuffer_free(gen9_hcpd_context->base.batch);
     free(gen9_hcpd_context);
 }
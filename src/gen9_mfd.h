@@ -56,8 +56,25 @@ typedef struct vp9_mv_temporal_buffer
     dri_bo *bo;
     uint16_t frame_width;
     uint16_t frame_height;
+    int alloc_size;             /* only grows */
 }VP9_MV_BUFFER;
 
+/*
+ * The probability buffers are used round robin, so that uploading the
+ * frame context of a new frame doesn't wait for the previous frame.
+ * Each buffer remembers which frame context it holds, so an unchanged
+ * context isn't uploaded again.
+ */
+#define VP9_PROB_BUFFER_RING_SIZE       4
+
+typedef struct vp9_prob_buffer
+{
+    dri_bo *bo;
+    int frame_context_idx;      /* -1 if the content is unknown */
+    unsigned int serial;        /* vp9_frame_ctx_serial[] when uploaded */
+    uint8_t key_frame;          /* inter part holds the key frame defaults */
+}VP9_PROB_BUFFER;
+
 struct gen9_hcpd_context
 {
     struct hw_context base;
@@ -88,8 +105,10 @@ struct gen9_hcpd_context
     GenBuffer sao_tile_column_buffer;
     GenBuffer hvd_line_rowstore_buffer;
     GenBuffer hvd_tile_rowstore_buffer;
-    GenBuffer vp9_probability_buffer;
+    VP9_PROB_BUFFER vp9_prob_buffers[VP9_PROB_BUFFER_RING_SIZE];
+    int vp9_prob_buffer_index;  /* buffer used by the current frame */
     GenBuffer vp9_segment_id_buffer;
+    int vp9_segment_id_buffer_size;
     VP9_MV_BUFFER vp9_mv_temporal_buffer_curr;
     VP9_MV_BUFFER vp9_mv_temporal_buffer_last;
 
@@ -99,6 +118,10 @@ struct gen9_hcpd_context
 
     vp9_last_frame_status last_frame;
     FRAME_CONTEXT vp9_frame_ctx[FRAME_CONTEXTS];
+    unsigned int vp9_frame_ctx_serial[FRAME_CONTEXTS];
+
+    /* The adapted probabilities of the last frame, read back on the next one */
+    uint8_t vp9_prob_readback_pending;
     FRAME_CONTEXT vp9_fc_inter_default;
     FRAME_CONTEXT vp9_fc_key_default;
 };
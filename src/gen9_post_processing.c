@@ -614,10 +614,12 @@ gen9_add_dri_buffer_2d_gpe_surface(VADriverContextP ctx,
 
 static void
 gen9_run_kernel_media_object_walker(VADriverContextP ctx,
-                                    struct intel_batchbuffer *batch,
+                                    struct i965_post_processing_context *pp_context,
                                     struct i965_gpe_context *gpe_context,
                                     struct gpe_media_object_walker_parameter *param)
 {
+    struct intel_batchbuffer *batch = pp_context->batch;
+
     if (!batch || !gpe_context || !param)
         return;
 
@@ -633,7 +635,8 @@ gen9_run_kernel_media_object_walker(VADriverContextP ctx,
 
     intel_batchbuffer_end_atomic(batch);
 
-    intel_batchbuffer_flush(batch);
+    if (!pp_context->defer_flush)
+        intel_batchbuffer_flush(batch);
     return;
 }
 
@@ -950,7 +953,7 @@ gen9_p010_scaling_post_processing(
 
     intel_vpp_init_media_object_walker_parameter(&kernel_walker_param, &media_object_walker_param);
 
-    gen9_run_kernel_media_object_walker(ctx, pp_context->batch,
+    gen9_run_kernel_media_object_walker(ctx, pp_context,
                                         gpe_context,
                                         &media_object_walker_param);
 
@@ -1175,7 +1178,7 @@ gen9_yuv420p8_scaling_post_processing(
 
     intel_vpp_init_media_object_walker_parameter(&kernel_walker_param, &media_object_walker_param);
 
-    gen9_run_kernel_media_object_walker(ctx, pp_context->batch,
+    gen9_run_kernel_media_object_walker(ctx, pp_context,
                                         gpe_context,
                                         &media_object_walker_param);
 
@@ -894,6 +894,7 @@ gen9_vdenc_update_parameters(VADriverContextP ctx,
                              struct encode_state *encode_state,
                              struct intel_encoder_context *encoder_context)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct gen9_vdenc_context *vdenc_context = encoder_context->mfc_context;
     VAEncSequenceParameterBufferH264 *seq_param = (VAEncSequenceParameterBufferH264 *)encode_state->seq_param_ext->buffer;
     VAEncPictureParameterBufferH264 *pic_param = (VAEncPictureParameterBufferH264 *)encode_state->pic_param_ext->buffer;
@@ -903,20 +904,29 @@ gen9_vdenc_update_parameters(VADriverContextP ctx,
     else
         vdenc_context->transform_8x8_mode_enable = 0;
 
-    vdenc_context->frame_width_in_mbs = seq_param->picture_width_in_mbs;
-    vdenc_context->frame_height_in_mbs = seq_param->picture_height_in_mbs;
+    if (vdenc_context->frame_width_in_mbs != seq_param->picture_width_in_mbs ||
+        vdenc_context->frame_height_in_mbs != seq_param->picture_height_in_mbs) {
+        vdenc_context->frame_width_in_mbs = seq_param->picture_width_in_mbs;
+        vdenc_context->frame_height_in_mbs = seq_param->picture_height_in_mbs;
 
-    vdenc_context->frame_width = vdenc_context->frame_width_in_mbs * 16;
-    vdenc_context->frame_height = vdenc_context->frame_height_in_mbs * 16;
+        vdenc_context->frame_width = vdenc_context->frame_width_in_mbs * 16;
+        vdenc_context->frame_height = vdenc_context->frame_height_in_mbs * 16;
 
-    vdenc_context->down_scaled_width_in_mb4x = WIDTH_IN_MACROBLOCKS(vdenc_context->frame_width / SCALE_FACTOR_4X);
-    vdenc_context->down_scaled_height_in_mb4x = HEIGHT_IN_MACROBLOCKS(vdenc_context->frame_height / SCALE_FACTOR_4X);
-    vdenc_context->down_scaled_width_4x = vdenc_context->down_scaled_width_in_mb4x * 16;
-    vdenc_context->down_scaled_height_4x = ((vdenc_context->down_scaled_height_in_mb4x + 1) >> 1) * 16;
-    vdenc_context->down_scaled_height_4x = ALIGN(vdenc_context->down_scaled_height_4x, 32) << 1;
+        vdenc_context->down_scaled_width_in_mb4x = WIDTH_IN_MACROBLOCKS(vdenc_context->frame_width / SCALE_FACTOR_4X);
+        vdenc_context->down_scaled_height_in_mb4x = HEIGHT_IN_MACROBLOCKS(vdenc_context->frame_height / SCALE_FACTOR_4X);
+        vdenc_context->down_scaled_width_4x = vdenc_context->down_scaled_width_in_mb4x * 16;
+        vdenc_context->down_scaled_height_4x = ((vdenc_context->down_scaled_height_in_mb4x + 1) >> 1) * 16;
+        vdenc_context->down_scaled_height_4x = ALIGN(vdenc_context->down_scaled_height_4x, 32) << 1;
+    }
 
     gen9_vdenc_update_misc_parameters(ctx, encode_state, encoder_context);
 
+    /* BRC init/reset rewrites the whole BRC update DMEM and constant data */
+    if (!vdenc_context->brc_initted || vdenc_context->brc_need_reset) {
+        vdenc_context->brc_update_dmem_valid = 0;
+        vdenc_context->brc_constant_data_valid = 0;
+    }
+
     vdenc_context->current_pass = 0;
     vdenc_context->num_passes = 1;
 
@@ -944,6 +954,13 @@ gen9_vdenc_update_parameters(VADriverContextP ctx,
     } else {
         vdenc_context->num_passes = NUM_OF_BRC_PAK_PASSES;
     }
+
+    /* The slices of the first pass may already be on the wire, so never
+     * re-encode the frame in low latency mode */
+    vdenc_context->low_latency = !!i965->vdenc_low_latency;
+
+    if (vdenc_context->low_latency)
+        vdenc_context->num_passes = 1;
 }
 
 static void
@@ -1027,6 +1044,17 @@ gen9_vdenc_update_roi_in_streamin_state(VADriverContextP ctx,
     i965_unmap_gpe_resource(&vdenc_context->vdenc_streamin_res);
 }
 
+static int
+gen9_vdenc_num_slices(struct encode_state *encode_state)
+{
+    int i, num_slices = 0;
+
+    for (i = 0; i < encode_state->num_slice_params_ext; i++)
+        num_slices += encode_state->slice_params_ext[i]->num_elements;
+
+    return num_slices;
+}
+
 static VAStatus
 gen9_vdenc_avc_prepare(VADriverContextP ctx,
                        VAProfile profile,
@@ -1171,6 +1199,8 @@ gen9_vdenc_avc_prepare(VADriverContextP ctx,
     vdenc_context->status_bffuer.base_offset = offsetof(struct i965_coded_buffer_segment, codec_private_data);
     vdenc_context->status_bffuer.size = ALIGN(sizeof(struct gen9_vdenc_status), 64);
     vdenc_context->status_bffuer.bytes_per_frame_offset = offsetof(struct gen9_vdenc_status, bytes_per_frame);
+    vdenc_context->status_bffuer.num_slices_done_offset = offsetof(struct gen9_vdenc_status, num_slices_done);
+    vdenc_context->status_bffuer.slice_end_offset_offset = offsetof(struct gen9_vdenc_status, slice_end_offset);
     assert(vdenc_context->status_bffuer.base_offset + vdenc_context->status_bffuer.size <
            vdenc_context->compressed_bitstream.start_offset);
 
@@ -1180,11 +1210,22 @@ gen9_vdenc_avc_prepare(VADriverContextP ctx,
     coded_buffer_segment->mapped = 0;
     coded_buffer_segment->codec = encoder_context->codec;
     coded_buffer_segment->status_support = 1;
+    coded_buffer_segment->low_latency = vdenc_context->low_latency;
+    coded_buffer_segment->partial = 0;
 
     pbuffer = bo->virtual;
     pbuffer += vdenc_context->status_bffuer.base_offset;
     memset(pbuffer, 0, vdenc_context->status_bffuer.size);
 
+    if (vdenc_context->low_latency) {
+        struct gen9_vdenc_status *vdenc_status = (struct gen9_vdenc_status *)pbuffer;
+
+        if (vdenc_context->is_frame_level_vdenc)
+            vdenc_status->num_slices = 1;
+        else
+            vdenc_status->num_slices = MIN(gen9_vdenc_num_slices(encode_state), VDENC_LOW_LATENCY_MAX_SLICES);
+    }
+
     dri_bo_unmap(bo);
 
     i965_free_gpe_resource(&vdenc_context->mfx_intra_row_store_scratch_res);
@@ -1793,46 +1834,27 @@ gen9_vdenc_huc_brc_init_reset(VADriverContextP ctx,
     gen8_gpe_mi_flush_dw(ctx, batch, &mi_flush_dw_params);
 }
 
-static void
-gen9_vdenc_update_huc_update_dmem(VADriverContextP ctx, struct intel_encoder_context *encoder_context)
+void
+gen9_vdenc_init_huc_brc_update_dmem(struct gen9_vdenc_context *vdenc_context,
+                                    struct huc_brc_update_dmem *dmem,
+                                    int pass)
 {
-    struct gen9_vdenc_context *vdenc_context = encoder_context->mfc_context;
-    struct huc_brc_update_dmem *dmem;
     int i, num_p_in_gop = 0;
 
-    dmem = (struct huc_brc_update_dmem *)i965_map_gpe_resource(&vdenc_context->brc_update_dmem_res[vdenc_context->current_pass]);
-
-    if (!dmem)
-        return;
+    memset(dmem, 0, sizeof(*dmem));
 
     dmem->brc_func = 1;
 
-    if (vdenc_context->brc_initted && (vdenc_context->current_pass == 0)) {
-        vdenc_context->brc_init_previous_target_buf_full_in_bits =
-            (uint32_t)(vdenc_context->brc_init_current_target_buf_full_in_bits);
-        vdenc_context->brc_init_current_target_buf_full_in_bits += vdenc_context->brc_init_reset_input_bits_per_frame;
-        vdenc_context->brc_target_size += vdenc_context->brc_init_reset_input_bits_per_frame;
-    }
-
-    if (vdenc_context->brc_target_size > vdenc_context->vbv_buffer_size_in_bit)
-        vdenc_context->brc_target_size -= vdenc_context->vbv_buffer_size_in_bit;
-
-    dmem->target_size = vdenc_context->brc_target_size;
-
-    dmem->peak_tx_bits_per_frame = (uint32_t)(vdenc_context->brc_init_current_target_buf_full_in_bits - vdenc_context->brc_init_previous_target_buf_full_in_bits);
-
     dmem->target_slice_size = 0;        // TODO: add support for slice size control
 
     memcpy(dmem->start_global_adjust_frame, vdenc_brc_start_global_adjust_frame, sizeof(dmem->start_global_adjust_frame));
     memcpy(dmem->global_rate_ratio_threshold, vdenc_brc_global_rate_ratio_threshold, sizeof(dmem->global_rate_ratio_threshold));
 
-    dmem->current_frame_type = (vdenc_context->frame_type + 2) % 3;      // I frame:2, P frame:0, B frame:1
-
     memcpy(dmem->start_global_adjust_mult, vdenc_brc_start_global_adjust_mult, sizeof(dmem->start_global_adjust_mult));
     memcpy(dmem->start_global_adjust_div, vdenc_brc_start_global_adjust_div, sizeof(dmem->start_global_adjust_div));
     memcpy(dmem->global_rate_ratio_threshold_qp, vdenc_brc_global_rate_ratio_threshold_qp, sizeof(dmem->global_rate_ratio_threshold_qp));
 
-    dmem->current_pak_pass = vdenc_context->current_pass;
+    dmem->current_pak_pass = pass;
     dmem->max_num_passes = 2;
 
     dmem->scene_change_detect_enable = 1;
@@ -1858,8 +1880,94 @@ gen9_vdenc_update_huc_update_dmem(VADriverContextP ctx, struct intel_encoder_con
     dmem->hme_cost_enable = 1;
 
     dmem->second_level_batchbuffer_size = 228;
+}
+
+void
+gen9_vdenc_update_huc_brc_update_dmem(struct gen9_vdenc_context *vdenc_context,
+                                      struct huc_brc_update_dmem *dmem)
+{
+    if (vdenc_context->brc_initted && (vdenc_context->current_pass == 0)) {
+        vdenc_context->brc_init_previous_target_buf_full_in_bits =
+            (uint32_t)(vdenc_context->brc_init_current_target_buf_full_in_bits);
+        vdenc_context->brc_init_current_target_buf_full_in_bits += vdenc_context->brc_init_reset_input_bits_per_frame;
+        vdenc_context->brc_target_size += vdenc_context->brc_init_reset_input_bits_per_frame;
+    }
+
+    if (vdenc_context->brc_target_size > vdenc_context->vbv_buffer_size_in_bit)
+        vdenc_context->brc_target_size -= vdenc_context->vbv_buffer_size_in_bit;
+
+    dmem->target_size = vdenc_context->brc_target_size;
+
+    dmem->peak_tx_bits_per_frame = (uint32_t)(vdenc_context->brc_init_current_target_buf_full_in_bits - vdenc_context->brc_init_previous_target_buf_full_in_bits);
+
+    dmem->current_frame_type = (vdenc_context->frame_type + 2) % 3;      // I frame:2, P frame:0, B frame:1
+}
+
+int
+gen9_vdenc_sync_huc_brc_update_dmem(struct huc_brc_update_dmem *uploaded,
+                                    const struct huc_brc_update_dmem *dmem,
+                                    int *dw_index)
+{
+    uint32_t *dst = (uint32_t *)uploaded;
+    const uint32_t *src = (const uint32_t *)dmem;
+    int i, n = 0;
+
+    for (i = 0; i < sizeof(*dmem) / sizeof(uint32_t); i++) {
+        if (dst[i] != src[i]) {
+            dst[i] = src[i];
+            dw_index[n++] = i;
+        }
+    }
+
+    return n;
+}
 
-    i965_unmap_gpe_resource(&vdenc_context->brc_update_dmem_res[vdenc_context->current_pass]);
+static void
+gen9_vdenc_update_huc_update_dmem(VADriverContextP ctx, struct intel_encoder_context *encoder_context)
+{
+    struct intel_batchbuffer *batch = encoder_context->base.batch;
+    struct gen9_vdenc_context *vdenc_context = encoder_context->mfc_context;
+    struct i965_gpe_resource *dmem_res = &vdenc_context->brc_update_dmem_res[vdenc_context->current_pass];
+    struct huc_brc_update_dmem *uploaded = &vdenc_context->brc_update_dmem[vdenc_context->current_pass];
+    struct huc_brc_update_dmem *dmem, new_dmem;
+    struct gpe_mi_store_data_imm_parameter mi_store_data_imm_params;
+    int dw_index[sizeof(struct huc_brc_update_dmem) / sizeof(uint32_t)];
+    int i, n;
+
+    if (!(vdenc_context->brc_update_dmem_valid & (1 << vdenc_context->current_pass))) {
+        dmem = (struct huc_brc_update_dmem *)i965_map_gpe_resource(dmem_res);
+
+        if (!dmem)
+            return;
+
+        gen9_vdenc_init_huc_brc_update_dmem(vdenc_context, uploaded, vdenc_context->current_pass);
+        gen9_vdenc_update_huc_brc_update_dmem(vdenc_context, uploaded);
+
+        /* Stored by the batch of the previous frame */
+        uploaded->frame_byte_count = dmem->frame_byte_count;
+        uploaded->slice_size_violation = dmem->slice_size_violation;
+
+        memcpy(dmem, uploaded, sizeof(*dmem));
+
+        i965_unmap_gpe_resource(dmem_res);
+
+        vdenc_context->brc_update_dmem_valid |= (1 << vdenc_context->current_pass);
+
+        return;
+    }
+
+    new_dmem = *uploaded;
+    gen9_vdenc_update_huc_brc_update_dmem(vdenc_context, &new_dmem);
+    n = gen9_vdenc_sync_huc_brc_update_dmem(uploaded, &new_dmem, dw_index);
+
+    memset(&mi_store_data_imm_params, 0, sizeof(mi_store_data_imm_params));
+    mi_store_data_imm_params.bo = dmem_res->bo;
+
+    for (i = 0; i < n; i++) {
+        mi_store_data_imm_params.offset = dw_index[i] * sizeof(uint32_t);
+        mi_store_data_imm_params.dw0 = ((uint32_t *)uploaded)[dw_index[i]];
+        gen8_gpe_mi_store_data_imm(ctx, batch, &mi_store_data_imm_params);
+    }
 }
 
 static void
@@ -2164,6 +2272,10 @@ gen9_vdenc_huc_brc_update_constant_data(VADriverContextP ctx,
     struct gen9_vdenc_context *vdenc_context = encoder_context->mfc_context;
     struct huc_brc_update_constant_data *brc_buffer;
 
+    /* The tables only depend on the rate control mode */
+    if (vdenc_context->brc_constant_data_valid)
+        return;
+
     brc_buffer = (struct huc_brc_update_constant_data *)
         i965_map_gpe_resource(&vdenc_context->brc_constant_data_res);
 
@@ -2181,8 +2293,9 @@ gen9_vdenc_huc_brc_update_constant_data(VADriverContextP ctx,
         memcpy(brc_buffer->buf_rate_adj_tab_b, buf_rate_adj_tab_b_vbr, sizeof(buf_rate_adj_tab_b_vbr));
     }
 
-
     i965_unmap_gpe_resource(&vdenc_context->brc_constant_data_res);
+
+    vdenc_context->brc_constant_data_valid = 1;
 }
 
 static void
@@ -2204,6 +2317,9 @@ gen9_vdenc_huc_brc_update(VADriverContextP ctx,
     struct gpe_mi_store_data_imm_parameter mi_store_data_imm_params;
     struct gpe_mi_flush_dw_parameter mi_flush_dw_params;
 
+    /* The DMEM updates must land before HuC loads the DMEM */
+    gen9_vdenc_update_huc_update_dmem(ctx, encoder_context);
+
     memset(&mi_flush_dw_params, 0, sizeof(mi_flush_dw_params));
     mi_flush_dw_params.video_pipeline_cache_invalidate = 1;
     gen8_gpe_mi_flush_dw(ctx, batch, &mi_flush_dw_params);
@@ -2225,7 +2341,6 @@ gen9_vdenc_huc_brc_update(VADriverContextP ctx,
     memset(&pipe_mode_select_params, 0, sizeof(pipe_mode_select_params));
     gen9_vdenc_huc_pipe_mode_select(ctx, encoder_context, &pipe_mode_select_params);
 
-    gen9_vdenc_update_huc_update_dmem(ctx, encoder_context);
     memset(&dmem_state_params, 0, sizeof(dmem_state_params));
     dmem_state_params.huc_data_source_res = &vdenc_context->brc_update_dmem_res[vdenc_context->current_pass];
     dmem_state_params.huc_data_destination_base_address = HUC_DMEM_DATA_OFFSET;
@@ -3425,6 +3540,37 @@ gen9_vdenc_mfx_avc_single_slice(VADriverContextP ctx,
     }
 }
 
+/*
+ * Low latency mode: makes the coded data up to the end of the slice
+ * visible to i965_MapBuffer(). The byte count register is only final
+ * after a MI_FLUSH_DW.
+ */
+static void
+gen9_vdenc_store_slice_marker(VADriverContextP ctx,
+                              struct intel_encoder_context *encoder_context,
+                              int slice_index)
+{
+    struct gen9_vdenc_context *vdenc_context = encoder_context->mfc_context;
+    struct intel_batchbuffer *batch = encoder_context->base.batch;
+    struct gpe_mi_store_register_mem_parameter mi_store_register_mem_params;
+    struct gpe_mi_store_data_imm_parameter mi_store_data_imm_params;
+    unsigned int base_offset = vdenc_context->status_bffuer.base_offset;
+
+    memset(&mi_store_register_mem_params, 0, sizeof(mi_store_register_mem_params));
+    mi_store_register_mem_params.mmio_offset = MFC_BITSTREAM_BYTECOUNT_FRAME_REG; /* TODO: fix it if VDBOX2 is used */
+    mi_store_register_mem_params.bo = vdenc_context->status_bffuer.res.bo;
+    mi_store_register_mem_params.offset = base_offset +
+        vdenc_context->status_bffuer.slice_end_offset_offset +
+        slice_index * sizeof(uint32_t);
+    gen8_gpe_mi_store_register_mem(ctx, batch, &mi_store_register_mem_params);
+
+    memset(&mi_store_data_imm_params, 0, sizeof(mi_store_data_imm_params));
+    mi_store_data_imm_params.bo = vdenc_context->status_bffuer.res.bo;
+    mi_store_data_imm_params.offset = base_offset + vdenc_context->status_bffuer.num_slices_done_offset;
+    mi_store_data_imm_params.dw0 = slice_index + 1;
+    gen8_gpe_mi_store_data_imm(ctx, batch, &mi_store_data_imm_params);
+}
+
 static void
 gen9_vdenc_mfx_vdenc_avc_slices(VADriverContextP ctx,
                                 struct encode_state *encode_state,
@@ -3487,6 +3633,10 @@ gen9_vdenc_mfx_vdenc_avc_slices(VADriverContextP ctx,
                     memset(&mi_flush_dw_params, 0, sizeof(mi_flush_dw_params));
                     mi_flush_dw_params.video_pipeline_cache_invalidate = 0;
                     gen8_gpe_mi_flush_dw(ctx, batch, &mi_flush_dw_params);
+
+                    if (vdenc_context->low_latency &&
+                        slice_index < VDENC_LOW_LATENCY_MAX_SLICES - 1)
+                        gen9_vdenc_store_slice_marker(ctx, encoder_context, slice_index);
                 }
             }
 
@@ -3518,6 +3668,16 @@ gen9_vdenc_mfx_vdenc_avc_slices(VADriverContextP ctx,
     memset(&mi_flush_dw_params, 0, sizeof(mi_flush_dw_params));
     mi_flush_dw_params.video_pipeline_cache_invalidate = 1;
     gen8_gpe_mi_flush_dw(ctx, batch, &mi_flush_dw_params);
+
+    /* The last marker also covers the slices beyond VDENC_LOW_LATENCY_MAX_SLICES */
+    if (vdenc_context->low_latency) {
+        if (vdenc_context->is_frame_level_vdenc)
+            slice_index = 1;
+
+        gen9_vdenc_store_slice_marker(ctx,
+                                      encoder_context,
+                                      MIN(slice_index, VDENC_LOW_LATENCY_MAX_SLICES) - 1);
+    }
 }
 
 static void
@@ -3879,6 +4039,34 @@ vdenc_hw_interfaces_init(VADriverContextP ctx,
     }
 }
 
+int
+gen9_vdenc_chain_slice_segments(VACodedBufferSegment *segment,
+                                struct gen9_vdenc_status *status)
+{
+    unsigned char *buf = segment->buf;
+    uint32_t start = 0, end;
+    int i, num_slices_done = MIN(status->num_slices_done, status->num_slices);
+
+    segment->size = 0;
+    segment->next = NULL;
+
+    for (i = 0; i < num_slices_done; i++) {
+        end = MAX(status->slice_end_offset[i], start);
+
+        if (i) {
+            segment->next = &status->slice_segments[i - 1];
+            segment = segment->next;
+            memset(segment, 0, sizeof(*segment));
+        }
+
+        segment->buf = buf + start;
+        segment->size = end - start;
+        start = end;
+    }
+
+    return MAX(num_slices_done, 1);
+}
+
 static VAStatus
 gen9_vdenc_context_get_status(VADriverContextP ctx,
                               struct intel_encoder_context *encoder_context,
@@ -3886,6 +4074,14 @@ gen9_vdenc_context_get_status(VADriverContextP ctx,
 {
     struct gen9_vdenc_status *vdenc_status = (struct gen9_vdenc_status *)coded_buffer_segment->codec_private_data;
 
+    /* Low latency mode, the frame may still be being encoded */
+    if (vdenc_status->num_slices) {
+        gen9_vdenc_chain_slice_segments(&coded_buffer_segment->base, vdenc_status);
+        coded_buffer_segment->partial = (vdenc_status->num_slices_done < vdenc_status->num_slices);
+
+        return VA_STATUS_SUCCESS;
+    }
+
     coded_buffer_segment->base.size = vdenc_status->bytes_per_frame;
 
     return VA_STATUS_SUCCESS;
@@ -721,9 +721,23 @@ struct huc_brc_update_dmem
     uint8_t     pad1[63];
 };
 
+/* Max. number of slices with their own completion marker in low latency
+ * mode, the remaining slices are reported together with the last one */
+#define VDENC_LOW_LATENCY_MAX_SLICES    16
+
 struct gen9_vdenc_status
 {
     uint32_t    bytes_per_frame;
+
+    /* Low latency mode only. The CPU sets num_slices, the GPU stores the
+     * byte count at the end of every slice and then bumps
+     * num_slices_done. */
+    uint32_t    num_slices;
+    uint32_t    num_slices_done;
+    uint32_t    slice_end_offset[VDENC_LOW_LATENCY_MAX_SLICES];
+
+    /* Segments chained after the first one when the coded buffer is mapped */
+    VACodedBufferSegment slice_segments[VDENC_LOW_LATENCY_MAX_SLICES - 1];
 };
 
 struct gen9_vdenc_context
@@ -779,7 +793,16 @@ struct gen9_vdenc_context
     uint32_t    mb_brc_enabled:1;
     uint32_t    is_frame_level_vdenc:1;
     uint32_t    use_extended_pak_obj_cmd:1;
-    uint32_t    pad0:29;
+    uint32_t    brc_constant_data_valid:1;
+    uint32_t    low_latency:1;
+    uint32_t    pad0:27;
+
+    /* The BRC update DMEM as last written to brc_update_dmem_res[], one bit
+     * per pass in brc_update_dmem_valid. Later frames only store the
+     * dwords that changed from the batch instead of mapping the buffer,
+     * which is still used by the previous frame. */
+    struct huc_brc_update_dmem brc_update_dmem[NUM_OF_BRC_PAK_PASSES];
+    uint32_t    brc_update_dmem_valid;
 
     struct i965_gpe_resource brc_init_reset_dmem_res;
     struct i965_gpe_resource brc_history_buffer_res;
@@ -827,6 +850,8 @@ struct gen9_vdenc_context
         uint32_t base_offset;
         uint32_t size;
         uint32_t bytes_per_frame_offset;
+        uint32_t num_slices_done_offset;
+        uint32_t slice_end_offset_offset;
     } status_bffuer;
 };
 
@@ -905,4 +930,28 @@ struct vd_pipeline_flush_parameter
 extern Bool
 gen9_vdenc_context_init(VADriverContextP ctx, struct intel_encoder_context *encoder_context);
 
+/* Fills the fields of the BRC update DMEM which only change on BRC init/reset */
+void
+gen9_vdenc_init_huc_brc_update_dmem(struct gen9_vdenc_context *vdenc_context,
+                                    struct huc_brc_update_dmem *dmem,
+                                    int pass);
+
+/* Fills the per-frame fields of the BRC update DMEM for the current pass */
+void
+gen9_vdenc_update_huc_brc_update_dmem(struct gen9_vdenc_context *vdenc_context,
+                                      struct huc_brc_update_dmem *dmem);
+
+/* Copies the dwords of @dmem which differ from @uploaded to @uploaded and
+ * returns how many there are, their indices are stored to @dw_index */
+int
+gen9_vdenc_sync_huc_brc_update_dmem(struct huc_brc_update_dmem *uploaded,
+                                    const struct huc_brc_update_dmem *dmem,
+                                    int *dw_index);
+
+/* Splits the coded data described by @segment into one segment per slice
+ * reported done in @status and returns the number of segments. */
+int
+gen9_vdenc_chain_slice_segments(VACodedBufferSegment *segment,
+                                struct gen9_vdenc_status *status);
+
 #endif	/* GEN9_VDENC_H */
@@ -0,0 +1,287 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sysdeps.h"
+
+#include "i965_decode_queue.h"
+
+static void
+i965_decode_job_free(struct i965_decode_job *job)
+{
+    struct decode_state *decode_state = &job->codec_state.decode;
+    int i;
+
+    i965_release_buffer_store(&decode_state->pic_param);
+    i965_release_buffer_store(&decode_state->iq_matrix);
+    i965_release_buffer_store(&decode_state->bit_plane);
+    i965_release_buffer_store(&decode_state->huffman_table);
+    i965_release_buffer_store(&decode_state->probability_data);
+
+    for (i = 0; i < decode_state->num_slice_params; i++)
+        i965_release_buffer_store(&decode_state->slice_params[i]);
+
+    for (i = 0; i < decode_state->num_slice_datas; i++)
+        i965_release_buffer_store(&decode_state->slice_datas[i]);
+
+    free(decode_state->slice_params);
+    free(decode_state->slice_datas);
+    free(job);
+}
+
+static struct i965_decode_job *
+i965_decode_job_new(struct decode_state *src)
+{
+    struct i965_decode_job *job;
+    struct decode_state *dst;
+    int i;
+
+    job = calloc(1, sizeof(*job));
+
+    if (!job)
+        return NULL;
+
+    dst = &job->codec_state.decode;
+    dst->base = src->base;
+    dst->current_render_target = src->current_render_target;
+    dst->max_slice_params = MAX(src->num_slice_params, 1);
+    dst->max_slice_datas = MAX(src->num_slice_datas, 1);
+    dst->slice_params = calloc(dst->max_slice_params, sizeof(*dst->slice_params));
+    dst->slice_datas = calloc(dst->max_slice_datas, sizeof(*dst->slice_datas));
+
+    if (!dst->slice_params || !dst->slice_datas) {
+        i965_decode_job_free(job);
+        return NULL;
+    }
+
+    i965_reference_buffer_store(&dst->pic_param, src->pic_param);
+    i965_reference_buffer_store(&dst->iq_matrix, src->iq_matrix);
+    i965_reference_buffer_store(&dst->bit_plane, src->bit_plane);
+    i965_reference_buffer_store(&dst->huffman_table, src->huffman_table);
+    i965_reference_buffer_store(&dst->probability_data, src->probability_data);
+
+    for (i = 0; i < src->num_slice_params; i++)
+        i965_reference_buffer_store(&dst->slice_params[i], src->slice_params[i]);
+
+    for (i = 0; i < src->num_slice_datas; i++)
+        i965_reference_buffer_store(&dst->slice_datas[i], src->slice_datas[i]);
+
+    dst->num_slice_params = src->num_slice_params;
+    dst->num_slice_datas = src->num_slice_datas;
+
+    return job;
+}
+
+static struct i965_decode_job *
+i965_decode_queue_take_done_locked(struct i965_decode_queue *queue)
+{
+    struct i965_decode_job *done = queue->done_head;
+
+    queue->done_head = NULL;
+
+    return done;
+}
+
+static void
+i965_decode_queue_free_jobs(struct i965_decode_job *job)
+{
+    struct i965_decode_job *next;
+
+    for (; job; job = next) {
+        next = job->next;
+        i965_decode_job_free(job);
+    }
+}
+
+static void *
+i965_decode_queue_thread(void *data)
+{
+    struct i965_decode_queue *queue = data;
+    struct i965_decode_job *job;
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (1) {
+        job = queue->queued_head;
+
+        if (!job) {
+            if (queue->exit)
+                break;
+
+            pthread_cond_wait(&queue->cond, &queue->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+        queue->run(queue->ctx, queue->obj_context, &job->codec_state);
+        pthread_mutex_lock(&queue->lock);
+
+        queue->queued_head = job->next;
+
+        if (!queue->queued_head)
+            queue->queued_tail = NULL;
+
+        queue->num_queued--;
+
+        job->next = queue->done_head;
+        queue->done_head = job;
+
+        pthread_cond_broadcast(&queue->cond);
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+struct i965_decode_queue *
+i965_decode_queue_create(VADriverContextP ctx,
+                         struct object_context *obj_context,
+                         i965_decode_queue_run_func run,
+                         int max_depth)
+{
+    struct i965_decode_queue *queue;
+
+    queue = calloc(1, sizeof(*queue));
+
+    if (!queue)
+        return NULL;
+
+    queue->ctx = ctx;
+    queue->obj_context = obj_context;
+    queue->run = run;
+    queue->max_depth = CLAMP(1, I965_DECODE_QUEUE_MAX_DEPTH, max_depth);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+
+    if (pthread_create(&queue->thread, NULL, i965_decode_queue_thread, queue)) {
+        pthread_cond_destroy(&queue->cond);
+        pthread_mutex_destroy(&queue->lock);
+        free(queue);
+
+        return NULL;
+    }
+
+    return queue;
+}
+
+void
+i965_decode_queue_destroy(struct i965_decode_queue *queue)
+{
+    if (!queue)
+        return;
+
+    /* The worker drains the pending pictures before leaving */
+    pthread_mutex_lock(&queue->lock);
+    queue->exit = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_join(queue->thread, NULL);
+
+    assert(!queue->queued_head);
+    i965_decode_queue_free_jobs(i965_decode_queue_take_done_locked(queue));
+
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+VAStatus
+i965_decode_queue_submit(struct i965_decode_queue *queue,
+                         struct decode_state *decode_state)
+{
+    struct i965_decode_job *job, *done;
+
+    job = i965_decode_job_new(decode_state);
+
+    if (!job)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->num_queued >= queue->max_depth)
+        pthread_cond_wait(&queue->cond, &queue->lock);
+
+    if (queue->queued_tail)
+        queue->queued_tail->next = job;
+    else
+        queue->queued_head = job;
+
+    queue->queued_tail = job;
+    queue->num_queued++;
+    pthread_cond_broadcast(&queue->cond);
+
+    done = i965_decode_queue_take_done_locked(queue);
+
+    pthread_mutex_unlock(&queue->lock);
+
+    i965_decode_queue_free_jobs(done);
+
+    return VA_STATUS_SUCCESS;
+}
+
+static bool
+i965_decode_queue_has_surface_locked(struct i965_decode_queue *queue, VASurfaceID surface)
+{
+    struct i965_decode_job *job;
+
+    if (surface == VA_INVALID_SURFACE)
+        return !!queue->queued_head;
+
+    for (job = queue->queued_head; job; job = job->next) {
+        if (job->codec_state.decode.current_render_target == surface)
+            return true;
+    }
+
+    return false;
+}
+
+void
+i965_decode_queue_sync(struct i965_decode_queue *queue, VASurfaceID surface)
+{
+    struct i965_decode_job *done;
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (i965_decode_queue_has_surface_locked(queue, surface))
+        pthread_cond_wait(&queue->cond, &queue->lock);
+
+    done = i965_decode_queue_take_done_locked(queue);
+
+    pthread_mutex_unlock(&queue->lock);
+
+    i965_decode_queue_free_jobs(done);
+}
+
+bool
+i965_decode_queue_is_surface_pending(struct i965_decode_queue *queue, VASurfaceID surface)
+{
+    bool pending;
+
+    pthread_mutex_lock(&queue->lock);
+    pending = i965_decode_queue_has_surface_locked(queue, surface);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pending;
+}
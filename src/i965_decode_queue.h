@@ -0,0 +1,98 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_DECODE_QUEUE_H
+#define I965_DECODE_QUEUE_H
+
+#include <pthread.h>
+
+#include "i965_drv_video.h"
+
+/*
+ * Decode-ahead queue: vaEndPicture() takes a snapshot of the decode state
+ * and hands it over to a per-context worker thread, which runs the codec
+ * (sanity checks, frame store update and batch construction) and submits
+ * the batch. Pictures are always run in submission order. Once max_depth
+ * pictures are waiting for the worker, vaEndPicture() blocks.
+ *
+ * Buffer stores are only referenced and released on the application
+ * thread, the worker hands finished snapshots back through the done list.
+ * The run function reports the errors through the render target of the
+ * failed picture, see i965_run_queued_picture().
+ */
+#define I965_DECODE_QUEUE_MAX_DEPTH     16
+
+typedef VAStatus (*i965_decode_queue_run_func)(VADriverContextP ctx,
+                                               struct object_context *obj_context,
+                                               union codec_state *codec_state);
+
+struct i965_decode_job
+{
+    union codec_state codec_state;
+    struct i965_decode_job *next;
+};
+
+struct i965_decode_queue
+{
+    VADriverContextP ctx;
+    struct object_context *obj_context;
+    i965_decode_queue_run_func run;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+
+    int max_depth;
+    int num_queued;
+
+    /* The head job stays queued while the worker runs it */
+    struct i965_decode_job *queued_head;
+    struct i965_decode_job *queued_tail;
+    struct i965_decode_job *done_head;
+
+    unsigned int exit : 1;
+};
+
+struct i965_decode_queue *
+i965_decode_queue_create(VADriverContextP ctx,
+                         struct object_context *obj_context,
+                         i965_decode_queue_run_func run,
+                         int max_depth);
+
+void
+i965_decode_queue_destroy(struct i965_decode_queue *queue);
+
+VAStatus
+i965_decode_queue_submit(struct i965_decode_queue *queue,
+                         struct decode_state *decode_state);
+
+/* Waits until the pictures rendering into @surface were run, all of them
+ * for VA_INVALID_SURFACE */
+void
+i965_decode_queue_sync(struct i965_decode_queue *queue, VASurfaceID surface);
+
+bool
+i965_decode_queue_is_surface_pending(struct i965_decode_queue *queue, VASurfaceID surface);
+
+#endif /* I965_DECODE_QUEUE_H */
@@ -80,6 +80,16 @@ struct gen_buffer {
     int         valid;
 };
 
+/* Slice data buffers of one picture copied back to back into a single
+   buffer object, see intel_coalesce_slice_data() */
+typedef struct gen_slice_data_buffer GenSliceDataBuffer;
+struct gen_slice_data_buffer {
+    dri_bo       *bo;
+    int           valid;
+    unsigned int *offsets;      /* start of slice_datas[i] within bo */
+    int           max_offsets;
+};
+
 struct hw_context *
 gen75_dec_hw_context_init(VADriverContextP ctx, struct object_config *obj_config);
 
@@ -1510,6 +1510,103 @@ intel_ensure_vp8_segmentation_buffer(VADriverContextP ctx, GenBuffer *buf,
     return buf->valid;
 }
 
+/* Pictures whose slice data exceeds this are decoded in place */
+#define SLICE_DATA_COALESCE_MAX_SIZE    (512 * 1024)
+#define SLICE_DATA_COALESCE_ALIGNMENT   64
+
+/*
+ * Copies the slice data buffers of the picture into buf->bo, so that a
+ * single MFX_IND_OBJ_BASE_ADDR_STATE (and a single relocation) covers all
+ * the slices. Returns false if coalescing is off (VA_INTEL_COALESCE_SLICE_DATA),
+ * if the picture has a single slice data buffer or too much data, the
+ * caller then keeps using decode_state->slice_datas.
+ * On success, slice_datas[i] starts at buf->offsets[i] in buf->bo.
+ */
+bool
+intel_coalesce_slice_data(VADriverContextP ctx,
+                          struct decode_state *decode_state,
+                          GenSliceDataBuffer *buf)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    unsigned int total_size = 0, offset = 0;
+    unsigned int *offsets;
+    dri_bo *bo;
+    int i;
+
+    buf->valid = 0;
+
+    if (!i965->coalesce_slice_data || decode_state->num_slice_datas < 2)
+        return false;
+
+    for (i = 0; i < decode_state->num_slice_datas; i++) {
+        bo = decode_state->slice_datas[i]->bo;
+
+        if (!bo)
+            return false;
+
+        total_size += ALIGN(bo->size, SLICE_DATA_COALESCE_ALIGNMENT);
+
+        if (total_size > SLICE_DATA_COALESCE_MAX_SIZE)
+            return false;
+    }
+
+    if (buf->max_offsets < decode_state->num_slice_datas) {
+        offsets = realloc(buf->offsets,
+                          decode_state->num_slice_datas * sizeof(*offsets));
+
+        if (!offsets)
+            return false;
+
+        buf->offsets = offsets;
+        buf->max_offsets = decode_state->num_slice_datas;
+    }
+
+    /* Don't stall on the previous picture, let the bo cache recycle it */
+    if (buf->bo && drm_intel_bo_busy(buf->bo)) {
+        dri_bo_unreference(buf->bo);
+        buf->bo = NULL;
+    }
+
+    if (!buf->bo) {
+        buf->bo = dri_bo_alloc(i965->intel.bufmgr,
+                               "coalesced slice data",
+                               SLICE_DATA_COALESCE_MAX_SIZE,
+                               0x1000);
+
+        if (!buf->bo)
+            return false;
+    }
+
+    dri_bo_map(buf->bo, 1);
+
+    if (!buf->bo->virtual)
+        return false;
+
+    for (i = 0; i < decode_state->num_slice_datas; i++) {
+        bo = decode_state->slice_datas[i]->bo;
+        buf->offsets[i] = offset;
+        dri_bo_get_subdata(bo, 0, bo->size, (uint8_t *)buf->bo->virtual + offset);
+        offset += ALIGN(bo->size, SLICE_DATA_COALESCE_ALIGNMENT);
+    }
+
+    dri_bo_unmap(buf->bo);
+    buf->valid = 1;
+
+    return true;
+}
+
+void
+intel_free_coalesced_slice_data(GenSliceDataBuffer *buf)
+{
+    dri_bo_unreference(buf->bo);
+    buf->bo = NULL;
+    buf->valid = 0;
+
+    free(buf->offsets);
+    buf->offsets = NULL;
+    buf->max_offsets = 0;
+}
+
 void
 hevc_gen_default_iq_matrix(VAIQMatrixBufferHEVC *iq_matrix)
 {
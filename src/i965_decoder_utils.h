@@ -169,6 +169,14 @@ bool
 intel_ensure_vp8_segmentation_buffer(VADriverContextP ctx, GenBuffer *buf,
     unsigned int mb_width, unsigned int mb_height);
 
+bool
+intel_coalesce_slice_data(VADriverContextP ctx,
+                          struct decode_state *decode_state,
+                          GenSliceDataBuffer *buf);
+
+void
+intel_free_coalesced_slice_data(GenSliceDataBuffer *buf);
+
 void
 hevc_gen_default_iq_matrix(VAIQMatrixBufferHEVC *iq_matrix);
 
@@ -46,6 +46,11 @@
 #include "i965_defines.h"
 #include "i965_drv_video.h"
 #include "i965_decoder.h"
+#include "i965_decode_queue.h"
+#include "i965_jpeg_sw_decoder.h"
+#include "i965_trace.h"
+#include "i965_vpp_statistics.h"
+#include "i965_vpp_sw.h"
 #include "i965_encoder.h"
 
 #include "i965_post_processing.h"
@@ -338,6 +343,82 @@ is_surface_busy(struct i965_driver_data *i965,
     return false;
 }
 
+/*
+ * Waits until the decode-ahead workers have submitted all the queued
+ * pictures rendering into @surface, or all queued pictures if @surface
+ * is VA_INVALID_SURFACE. The walk holds decode_queue_mutex, so the queues
+ * are not destroyed under it by another application thread.
+ */
+static void
+i965_sync_decode_queues(VADriverContextP ctx, VASurfaceID surface)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct object_context *obj_context;
+    object_heap_iterator iter;
+
+    _i965LockMutex(&i965->decode_queue_mutex);
+    obj_context = (struct object_context *)object_heap_first(&i965->context_heap, &iter);
+
+    while (obj_context) {
+        if (obj_context->decode_queue)
+            i965_decode_queue_sync(obj_context->decode_queue, surface);
+
+        obj_context = (struct object_context *)object_heap_next(&i965->context_heap, &iter);
+    }
+
+    _i965UnlockMutex(&i965->decode_queue_mutex);
+}
+
+static bool
+i965_is_surface_pending_in_decode_queues(VADriverContextP ctx, VASurfaceID surface)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct object_context *obj_context;
+    object_heap_iterator iter;
+    bool pending = false;
+
+    _i965LockMutex(&i965->decode_queue_mutex);
+    obj_context = (struct object_context *)object_heap_first(&i965->context_heap, &iter);
+
+    while (obj_context && !pending) {
+        pending = (obj_context->decode_queue &&
+                   i965_decode_queue_is_surface_pending(obj_context->decode_queue, surface));
+        obj_context = (struct object_context *)object_heap_next(&i965->context_heap, &iter);
+    }
+
+    _i965UnlockMutex(&i965->decode_queue_mutex);
+
+    return pending;
+}
+
+/*
+ * Submits the JPEG pictures left in the encode batches, see
+ * VA_INTEL_JPEG_ENCODE_BATCH. Only the encoders ever keep commands in
+ * their batch between two API calls.
+ */
+static void
+i965_flush_encode_batches(VADriverContextP ctx, struct object_context *except)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct object_context *obj_context;
+    object_heap_iterator iter;
+
+    if (i965->jpeg_encode_batch_size <= 1)
+        return;
+
+    obj_context = (struct object_context *)object_heap_first(&i965->context_heap, &iter);
+
+    while (obj_context) {
+        if (obj_context != except &&
+            obj_context->codec_type == CODEC_ENC &&
+            obj_context->hw_context &&
+            obj_context->hw_context->batch)
+            intel_batchbuffer_flush(obj_context->hw_context->batch);
+
+        obj_context = (struct object_context *)object_heap_next(&i965->context_heap, &iter);
+    }
+}
+
 /* Checks whether the image is in busy state */
 static bool
 is_image_busy(struct i965_driver_data *i965, struct object_image *obj_image, VASurfaceID surface)
@@ -1060,7 +1141,9 @@ i965_GetConfigAttributes(VADriverContextP ctx,
         case VAConfigAttribEncRateControlExt:
             if ((profile == VAProfileH264ConstrainedBaseline ||
                  profile == VAProfileH264Main ||
-                 profile == VAProfileH264High) &&
+                 profile == VAProfileH264High ||
+                 profile == VAProfileHEVCMain ||
+                 profile == VAProfileHEVCMain10) &&
                 entrypoint == VAEntrypointEncSlice) {
                 VAConfigAttribValEncRateControlExt *val_config = (VAConfigAttribValEncRateControlExt *)&(attrib_list[i].value);
 
@@ -1206,6 +1289,10 @@ i965_CreateConfig(VADriverContextP ctx,
         i965_destroy_config(&i965->config_heap, (struct object_base *)obj_config);
     } else {
         *config_id = configID;
+
+        if (entrypoint == VAEntrypointVLD)
+            i965_trace_create_config(i965->trace, profile, entrypoint,
+                                     attrib_list, num_attribs, configID);
     }
 
     return vaStatus;
@@ -1231,6 +1318,9 @@ i965_DestroyConfig(VADriverContextP ctx, VAConfigID config_id)
         obj_config->wrapper_config = VA_INVALID_ID;
     }
 
+    if (obj_config->entrypoint == VAEntrypointVLD)
+        i965_trace_destroy_config(i965->trace, config_id);
+
     i965_destroy_config(&i965->config_heap, (struct object_base *)obj_config);
     return VA_STATUS_SUCCESS;
 }
@@ -1280,6 +1370,7 @@ i965_destroy_surface(struct object_heap *heap, struct object_base *obj)
     struct object_surface *obj_surface = (struct object_surface *)obj;
 
     i965_destroy_surface_storage(obj_surface);
+    intel_fence_unreference(&obj_surface->fence);
     object_heap_free(heap, obj);
 }
 
@@ -1616,6 +1707,7 @@ i965_CreateSurfaces2(
 
         obj_surface->wrapper_surface = VA_INVALID_ID;
         obj_surface->exported_primefd = -1;
+        obj_surface->fence = NULL;
 
         switch (memory_type) {
         case I965_SURFACE_MEM_NATIVE:
@@ -1678,6 +1770,9 @@ i965_CreateSurfaces2(
             assert(obj_surface);
             i965_destroy_surface(&i965->surface_heap, (struct object_base *)obj_surface);
         }
+    } else if (memory_type == I965_SURFACE_MEM_NATIVE) {
+        i965_trace_create_surfaces(i965->trace, format, width, height,
+                                   expected_fourcc, surfaces, num_surfaces);
     }
 
     return vaStatus;
@@ -1710,6 +1805,10 @@ i965_DestroySurfaces(VADriverContextP ctx,
     int i;
     VAStatus va_status = VA_STATUS_SUCCESS;
 
+    /* Queued pictures may still use the surfaces as reference */
+    i965_sync_decode_queues(ctx, VA_INVALID_SURFACE);
+    i965_trace_destroy_surfaces(i965->trace, surface_list, num_surfaces);
+
     for (i = num_surfaces; i--; ) {
         struct object_surface *obj_surface = SURFACE(surface_list[i]);
 
@@ -2064,13 +2163,30 @@ i965_destroy_context(struct object_heap *heap, struct object_base *obj)
     struct object_context *obj_context = (struct object_context *)obj;
     int i, j;
 
+    if (obj_context->decode_queue) {
+        struct i965_driver_data *i965 = i965_driver_data(obj_context->decode_queue->ctx);
+
+        _i965LockMutex(&i965->decode_queue_mutex);
+        i965_decode_queue_destroy(obj_context->decode_queue);
+        obj_context->decode_queue = NULL;
+        _i965UnlockMutex(&i965->decode_queue_mutex);
+    }
+
     if (obj_context->hw_context) {
+        /* JPEG pictures may still wait in the encode batch */
+        if (obj_context->codec_type == CODEC_ENC && obj_context->hw_context->batch)
+            intel_batchbuffer_flush(obj_context->hw_context->batch);
+
         obj_context->hw_context->destroy(obj_context->hw_context);
         obj_context->hw_context = NULL;
     }
 
     if (obj_context->codec_type == CODEC_PROC) {
         i965_release_buffer_store(&obj_context->codec_state.proc.pipeline_param);
+        i965_release_buffer_store(&obj_context->codec_state.proc.statistics);
+
+        for (i = 0; i < obj_context->codec_state.proc.num_layer_params; i++)
+            i965_release_buffer_store(&obj_context->codec_state.proc.layer_params[i]);
 
     } else if (obj_context->codec_type == CODEC_ENC) {
         i965_release_buffer_store(&obj_context->codec_state.encode.q_matrix);
@@ -2153,6 +2269,92 @@ max_resolution(struct i965_driver_data *i965,
     }
 }
 
+static struct object_surface *
+i965_fenced_render_target(VADriverContextP ctx,
+                          struct object_context *obj_context,
+                          union codec_state *codec_state)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    VASurfaceID render_target;
+
+    if (obj_context->codec_type == CODEC_DEC)
+        render_target = codec_state->decode.current_render_target;
+    else if (obj_context->codec_type == CODEC_PROC)
+        render_target = codec_state->proc.current_render_target;
+    else
+        return NULL;
+
+    return SURFACE(render_target);
+}
+
+/* Runs the picture, the caller holds run_mutex */
+static VAStatus
+i965_run_picture(VADriverContextP ctx,
+                 struct object_context *obj_context,
+                 union codec_state *codec_state)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct hw_context *hw_context = obj_context->hw_context;
+    struct object_surface *obj_surface;
+    struct intel_fence *encode_fence = NULL;
+    VAStatus va_status;
+
+    /*
+     * Every batch submitted for the picture goes to the fence of the render
+     * target, not only hw_context->batch: VPP pictures also write through
+     * the VEBOX and the shared post-processing batches
+     */
+    obj_surface = i965_fenced_render_target(ctx, obj_context, codec_state);
+
+    if (obj_surface)
+        intel_fence_collect_begin(&i965->intel, &obj_surface->fence);
+    else if (obj_context->codec_type == CODEC_ENC)
+        intel_fence_collect_begin(&i965->intel, &encode_fence);
+
+    va_status = hw_context->run(ctx, obj_context->obj_config->profile, codec_state, hw_context);
+
+    intel_fence_collect_end(&i965->intel);
+
+    /*
+     * The surface an encoder writes is the reconstructed picture, which is
+     * only looked up by the encoder itself. The batches of a deferred JPEG
+     * batch are not collected, they only write the coded buffer.
+     */
+    if (encode_fence) {
+        obj_surface = codec_state->encode.reconstructed_object;
+
+        if (va_status == VA_STATUS_SUCCESS && obj_surface)
+            intel_fence_add_fence(&i965->intel, &obj_surface->fence, encode_fence);
+
+        intel_fence_unreference(&encode_fence);
+    }
+
+    return va_status;
+}
+
+/* Runs a picture on the decode-ahead worker, see i965_decode_queue.h */
+static VAStatus
+i965_run_queued_picture(VADriverContextP ctx,
+                        struct object_context *obj_context,
+                        union codec_state *codec_state)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct object_surface *obj_surface;
+    VAStatus va_status;
+
+    _i965LockMutex(&i965->run_mutex);
+
+    va_status = i965_run_picture(ctx, obj_context, codec_state);
+    obj_surface = SURFACE(codec_state->decode.current_render_target);
+
+    if (obj_surface)
+        obj_surface->decode_status = va_status;
+
+    _i965UnlockMutex(&i965->run_mutex);
+
+    return va_status;
+}
+
 VAStatus
 i965_CreateContext(VADriverContextP ctx,
                    VAConfigID config_id,
@@ -2206,6 +2408,7 @@ i965_CreateContext(VADriverContextP ctx,
     obj_context->render_targets = 
         (VASurfaceID *)calloc(num_render_targets, sizeof(VASurfaceID));
     obj_context->hw_context = NULL;
+    obj_context->decode_queue = NULL;
     obj_context->wrapper_context = VA_INVALID_ID;
 
     if (!obj_context->render_targets)
@@ -2321,10 +2524,26 @@ i965_CreateContext(VADriverContextP ctx,
 
         if (vaStatus == VA_STATUS_SUCCESS)
             obj_context->wrapper_context = wrapper_context;
+    } else if (VA_STATUS_SUCCESS == vaStatus &&
+               obj_context->codec_type == CODEC_DEC &&
+               obj_context->hw_context &&
+               i965->decode_ahead_depth > 0) {
+        _i965LockMutex(&i965->decode_queue_mutex);
+        obj_context->decode_queue = i965_decode_queue_create(ctx,
+                                                             obj_context,
+                                                             i965_run_queued_picture,
+                                                             i965->decode_ahead_depth);
+        _i965UnlockMutex(&i965->decode_queue_mutex);
     }
+
     /* Error recovery */
     if (VA_STATUS_SUCCESS != vaStatus) {
         i965_destroy_context(&i965->context_heap, (struct object_base *)obj_context);
+    } else if (obj_context->codec_type == CODEC_DEC) {
+        i965_trace_create_context(i965->trace, config_id,
+                                  picture_width, picture_height, flag,
+                                  render_targets, num_render_targets,
+                                  contextID);
     }
 
     i965->current_context_id = contextID;
@@ -2353,6 +2572,9 @@ i965_DestroyContext(VADriverContextP ctx, VAContextID context)
         obj_context->wrapper_context = VA_INVALID_ID;
     }
 
+    if (obj_context->codec_type == CODEC_DEC)
+        i965_trace_destroy_context(i965->trace, context);
+
     i965_destroy_context(&i965->context_heap, (struct object_base *)obj_context);
 
     return va_status;
@@ -2386,8 +2608,8 @@ i965_create_buffer_internal(VADriverContextP ctx,
     struct object_context *obj_context = CONTEXT(context);
     int wrapper_flag = 0;
 
-    /* Validate type */
-    switch (type) {
+    /* Validate type, the driver private types are not in the enum */
+    switch ((int)type) {
     case VAPictureParameterBufferType:
     case VAIQMatrixBufferType:
     case VAQMatrixBufferType:
@@ -2411,6 +2633,7 @@ i965_create_buffer_internal(VADriverContextP ctx,
     case VAHuffmanTableBufferType:
     case VAProbabilityBufferType:
     case VAEncMacroblockMapBufferType:
+    case VAProcStatisticsBufferTypeIntel:
         /* Ok */
         break;
 
@@ -2430,6 +2653,10 @@ i965_create_buffer_internal(VADriverContextP ctx,
         size += 0x1000; /* for upper bound check */
     }
 
+    /* Grown by the VEBOX for the raw statistics of a picture */
+    if (type == VAProcStatisticsBufferTypeIntel)
+        size = MAX(size, I965_PROC_STATISTICS_HEADER_SIZE);
+
     obj_buffer->max_num_elements = num_elements;
     obj_buffer->num_elements = num_elements;
     obj_buffer->size_element = size;
@@ -2472,7 +2699,8 @@ i965_create_buffer_internal(VADriverContextP ctx,
                type == VAImageBufferType || 
                type == VAEncCodedBufferType ||
                type == VAEncMacroblockMapBufferType ||
-               type == VAProbabilityBufferType) {
+               type == VAProbabilityBufferType ||
+               type == VAProcStatisticsBufferTypeIntel) {
 
         /* If the buffer is wrapped, the bo/buffer of buffer_store is bogus.
          * So it is enough to allocate one 64 byte bo
@@ -2504,6 +2732,12 @@ i965_create_buffer_internal(VADriverContextP ctx,
             coded_buffer_segment->mapped = 0;
             coded_buffer_segment->codec = 0;
             coded_buffer_segment->status_support = 0;
+            coded_buffer_segment->low_latency = 0;
+            coded_buffer_segment->partial = 0;
+            dri_bo_unmap(buffer_store->bo);
+          } else if (type == VAProcStatisticsBufferTypeIntel) {
+            dri_bo_map(buffer_store->bo, 1);
+            i965_proc_statistics_init(buffer_store->bo->virtual, NULL, 0, 0, 0);
             dri_bo_unmap(buffer_store->bo);
           } else if (data) {
               dri_bo_subdata(buffer_store->bo, 0, size * num_elements, data);
@@ -2590,6 +2824,34 @@ i965_BufferSetNumElements(VADriverContextP ctx,
     return vaStatus;
 }
 
+/*
+ * Low latency VDEnc coded buffers are mapped without waiting for the batch
+ * still writing them, the finished slices can then be sent out before the
+ * whole frame is encoded.
+ */
+static bool
+i965_map_partial_coded_buffer(struct i965_driver_data *i965, struct object_buffer *obj_buffer)
+{
+    dri_bo *bo = obj_buffer->buffer_store->bo;
+    struct i965_coded_buffer_segment *coded_buffer_segment;
+
+    if (!i965->vdenc_low_latency ||
+        obj_buffer->type != VAEncCodedBufferType ||
+        !drm_intel_bo_busy(bo))
+        return false;
+
+    drm_intel_gem_bo_map_unsynchronized(bo);
+    coded_buffer_segment = (struct i965_coded_buffer_segment *)bo->virtual;
+
+    if (coded_buffer_segment && coded_buffer_segment->low_latency)
+        return true;
+
+    if (coded_buffer_segment)
+        drm_intel_gem_bo_unmap_gtt(bo);
+
+    return false;
+}
+
 VAStatus 
 i965_MapBuffer(VADriverContextP ctx,
                VABufferID buf_id,       /* in */
@@ -2622,6 +2884,10 @@ i965_MapBuffer(VADriverContextP ctx,
     if (obj_buffer->export_refcount > 0)
         return VA_STATUS_ERROR_INVALID_BUFFER;
 
+    /* Coded buffers and derived images may be written by a pending batch */
+    if (obj_buffer->buffer_store->bo)
+        i965_flush_encode_batches(ctx, NULL);
+
     if (NULL != obj_buffer->buffer_store->bo) {
         unsigned int tiling, swizzle;
 
@@ -2629,13 +2895,16 @@ i965_MapBuffer(VADriverContextP ctx,
 
         if (tiling != I915_TILING_NONE)
             drm_intel_gem_bo_map_gtt(obj_buffer->buffer_store->bo);
-        else
+        else if (!i965_map_partial_coded_buffer(i965, obj_buffer))
             dri_bo_map(obj_buffer->buffer_store->bo, 1);
 
         ASSERT_RET(obj_buffer->buffer_store->bo->virtual, VA_STATUS_ERROR_OPERATION_FAILED);
         *pbuf = obj_buffer->buffer_store->bo->virtual;
         vaStatus = VA_STATUS_SUCCESS;
 
+        if (obj_buffer->type == VAProcStatisticsBufferTypeIntel)
+            i965_proc_statistics_parse(obj_buffer->buffer_store->bo->virtual);
+
         if (obj_buffer->type == VAEncCodedBufferType) {
             int i;
             unsigned char *buffer = NULL;
@@ -2646,6 +2915,7 @@ i965_MapBuffer(VADriverContextP ctx,
                 unsigned char delimiter0, delimiter1, delimiter2, delimiter3, delimiter4;
 
                 coded_buffer_segment->base.buf = buffer = (unsigned char *)(obj_buffer->buffer_store->bo->virtual) + I965_CODEDBUFFER_HEADER_SIZE;
+                coded_buffer_segment->partial = 0;
 
                 if (obj_context &&
                     obj_context->hw_context &&
@@ -2712,7 +2982,8 @@ i965_MapBuffer(VADriverContextP ctx,
                     vaStatus = VA_STATUS_SUCCESS;
                 }
 
-                coded_buffer_segment->mapped = 1;
+                /* Partial segment lists are rebuilt on every map */
+                coded_buffer_segment->mapped = !coded_buffer_segment->partial;
             } else {
                 assert(coded_buffer_segment->base.buf);
                 vaStatus = VA_STATUS_SUCCESS;
@@ -2815,6 +3086,13 @@ i965_BeginPicture(VADriverContextP ctx,
 
     if (obj_context->codec_type == CODEC_PROC) {
         obj_context->codec_state.proc.current_render_target = render_target;
+        i965_release_buffer_store(&obj_context->codec_state.proc.statistics);
+
+        for (i = 0; i < obj_context->codec_state.proc.num_layer_params; i++)
+            i965_release_buffer_store(&obj_context->codec_state.proc.layer_params[i]);
+
+        obj_context->codec_state.proc.num_layer_params = 0;
+        obj_context->codec_state.proc.num_pipeline_params = 0;
     } else if (obj_context->codec_type == CODEC_ENC) {
         /* ext */
         i965_release_buffer_store(&obj_context->codec_state.encode.pic_param_ext);
@@ -2854,6 +3132,7 @@ i965_BeginPicture(VADriverContextP ctx,
         i965_release_buffer_store(&obj_context->codec_state.encode.encmb_map);
     } else {
         obj_context->codec_state.decode.current_render_target = render_target;
+        obj_surface->decode_status = VA_STATUS_SUCCESS;
         i965_release_buffer_store(&obj_context->codec_state.decode.pic_param);
         i965_release_buffer_store(&obj_context->codec_state.decode.iq_matrix);
         i965_release_buffer_store(&obj_context->codec_state.decode.bit_plane);
@@ -2867,6 +3146,8 @@ i965_BeginPicture(VADriverContextP ctx,
         obj_context->codec_state.decode.num_slice_params = 0;
         obj_context->codec_state.decode.num_slice_datas = 0;
 
+        i965_trace_begin_picture(i965->trace, context, render_target);
+
         if ((obj_context->wrapper_context != VA_INVALID_ID) &&
             i965->wrapper_pdrvctx) {
             if (obj_surface->wrapper_surface == VA_INVALID_ID)
@@ -3444,6 +3725,28 @@ i965_encoder_render_picture(VADriverContextP ctx,
 
 #define DEF_RENDER_PROC_SINGLE_BUFFER_FUNC(name, member) DEF_RENDER_SINGLE_BUFFER_FUNC(proc, name, member)
 DEF_RENDER_PROC_SINGLE_BUFFER_FUNC(pipeline_parameter, pipeline_param)    
+DEF_RENDER_PROC_SINGLE_BUFFER_FUNC(statistics, statistics)
+
+/* The first pipeline parameters of a picture replace those of the previous
+ * one, the others are layers composed on top of them */
+static VAStatus
+i965_render_proc_layer_buffer(VADriverContextP ctx,
+                              struct object_context *obj_context,
+                              struct object_buffer *obj_buffer)
+{
+    struct proc_state *proc = &obj_context->codec_state.proc;
+
+    if (proc->num_pipeline_params++ == 0)
+        return I965_RENDER_PROC_BUFFER(pipeline_parameter);
+
+    if (proc->num_layer_params == ARRAY_ELEMS(proc->layer_params))
+        return VA_STATUS_ERROR_MAX_NUM_EXCEEDED;
+
+    i965_reference_buffer_store(&proc->layer_params[proc->num_layer_params++],
+                                obj_buffer->buffer_store);
+
+    return VA_STATUS_SUCCESS;
+}
 
 static VAStatus 
 i965_proc_render_picture(VADriverContextP ctx,
@@ -3464,9 +3767,23 @@ i965_proc_render_picture(VADriverContextP ctx,
         if (!obj_buffer)
             return VA_STATUS_ERROR_INVALID_BUFFER;
 
-        switch (obj_buffer->type) {
+        switch ((int)obj_buffer->type) {
         case VAProcPipelineParameterBufferType:
-            vaStatus = I965_RENDER_PROC_BUFFER(pipeline_parameter);
+            vaStatus = i965_render_proc_layer_buffer(ctx, obj_context, obj_buffer);
+            break;
+
+        case VAProcStatisticsBufferTypeIntel:
+            vaStatus = I965_RENDER_PROC_BUFFER(statistics);
+
+            /* Nothing is left from a previous picture, only a VEBOX run of
+             * this one reports statistics */
+            if (vaStatus == VA_STATUS_SUCCESS && obj_buffer->buffer_store->bo) {
+                dri_bo_map(obj_buffer->buffer_store->bo, 1);
+                if (obj_buffer->buffer_store->bo->virtual)
+                    i965_proc_statistics_init(obj_buffer->buffer_store->bo->virtual,
+                                              NULL, 0, 0, 0);
+                dri_bo_unmap(obj_buffer->buffer_store->bo);
+            }
             break;
 
         default:
@@ -3488,6 +3805,7 @@ i965_RenderPicture(VADriverContextP ctx,
     struct object_context *obj_context;
     struct object_config *obj_config;
     VAStatus vaStatus = VA_STATUS_ERROR_UNKNOWN;
+    int i;
 
     obj_context = CONTEXT(context);
     ASSERT_RET(obj_context, VA_STATUS_ERROR_INVALID_CONTEXT);
@@ -3505,6 +3823,13 @@ i965_RenderPicture(VADriverContextP ctx,
                (VAEntrypointEncSliceLP == obj_config->entrypoint)) {
         vaStatus = i965_encoder_render_picture(ctx, context, buffers, num_buffers);
     } else {
+        for (i = 0; i < num_buffers && i965->trace; i++) {
+            struct object_buffer *obj_buffer = BUFFER(buffers[i]);
+
+            if (obj_buffer)
+                i965_trace_render_buffer(i965->trace, context, obj_buffer);
+        }
+
         vaStatus = i965_decoder_render_picture(ctx, context, buffers, num_buffers);
     }
 
@@ -3517,6 +3842,7 @@ i965_EndPicture(VADriverContextP ctx, VAContextID context)
     struct i965_driver_data *i965 = i965_driver_data(ctx); 
     struct object_context *obj_context = CONTEXT(context);
     struct object_config *obj_config;
+    VAStatus vaStatus;
 
     ASSERT_RET(obj_context, VA_STATUS_ERROR_INVALID_CONTEXT);
     obj_config = obj_context->obj_config;
@@ -3573,6 +3899,8 @@ i965_EndPicture(VADriverContextP ctx, VAContextID context)
             return VA_STATUS_ERROR_INVALID_PARAMETER;
         }
 
+        i965_trace_end_picture(i965->trace, context);
+
         if (obj_context->wrapper_context != VA_INVALID_ID) {
             /* call the vaEndPicture of wrapped driver */
             VADriverContextP pdrvctx;
@@ -3587,7 +3915,19 @@ i965_EndPicture(VADriverContextP ctx, VAContextID context)
     }
 
     ASSERT_RET(obj_context->hw_context->run, VA_STATUS_ERROR_OPERATION_FAILED);
-    return obj_context->hw_context->run(ctx, obj_config->profile, &obj_context->codec_state, obj_context->hw_context);
+
+    if (obj_context->decode_queue)
+        return i965_decode_queue_submit(obj_context->decode_queue, &obj_context->codec_state.decode);
+
+    /* The queued pictures may be read by this one, submit them first */
+    i965_sync_decode_queues(ctx, VA_INVALID_SURFACE);
+    i965_flush_encode_batches(ctx, obj_context);
+
+    _i965LockMutex(&i965->run_mutex);
+    vaStatus = i965_run_picture(ctx, obj_context, &obj_context->codec_state);
+    _i965UnlockMutex(&i965->run_mutex);
+
+    return vaStatus;
 }
 
 VAStatus 
@@ -3596,13 +3936,31 @@ i965_SyncSurface(VADriverContextP ctx,
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx); 
     struct object_surface *obj_surface = SURFACE(render_target);
+    struct intel_fence *fence;
+    VAStatus va_status;
 
     ASSERT_RET(obj_surface, VA_STATUS_ERROR_INVALID_SURFACE);
 
-    if(obj_surface->bo)
+    i965_sync_decode_queues(ctx, render_target);
+    i965_flush_encode_batches(ctx, NULL);
+
+    /* The fence stays with the surface once the worker created it */
+    _i965LockMutex(&i965->run_mutex);
+    fence = obj_surface->fence;
+    va_status = obj_surface->decode_status;
+    _i965UnlockMutex(&i965->run_mutex);
+
+    /*
+     * The fence only waits for the batches writing to the surface, not
+     * for later pictures which merely read from it as a reference. All
+     * the GPU writes to a surface are fenced, see i965_run_picture()
+     */
+    if (fence)
+        intel_fence_wait(fence);
+    else if (obj_surface->bo)
         drm_intel_bo_wait_rendering(obj_surface->bo);
 
-    return VA_STATUS_SUCCESS;
+    return va_status;
 }
 
 VAStatus 
@@ -3613,9 +3971,29 @@ i965_QuerySurfaceStatus(VADriverContextP ctx,
     struct i965_driver_data *i965 = i965_driver_data(ctx); 
     struct object_surface *obj_surface = SURFACE(render_target);
 
+    struct intel_fence *fence;
+    VAStatus va_status;
+
     ASSERT_RET(obj_surface, VA_STATUS_ERROR_INVALID_SURFACE);
 
-    if (obj_surface->bo) {
+    i965_flush_encode_batches(ctx, NULL);
+
+    if (i965_is_surface_pending_in_decode_queues(ctx, render_target)) {
+        *status = VASurfaceRendering;
+        return VA_STATUS_SUCCESS;
+    }
+
+    _i965LockMutex(&i965->run_mutex);
+    fence = obj_surface->fence;
+    va_status = obj_surface->decode_status;
+    _i965UnlockMutex(&i965->run_mutex);
+
+    if (fence) {
+        if (intel_fence_is_signaled(fence))
+            *status = VASurfaceReady;
+        else
+            *status = VASurfaceRendering;
+    } else if (obj_surface->bo) {
         if (drm_intel_bo_busy(obj_surface->bo)){
             *status = VASurfaceRendering;
         }
@@ -3626,7 +4004,29 @@ i965_QuerySurfaceStatus(VADriverContextP ctx,
         *status = VASurfaceReady;
     }
 
-    return VA_STATUS_SUCCESS;
+    return va_status;
+}
+
+/*
+ * Returns a pollable fd which becomes readable once all the pictures
+ * rendered into the surface so far have completed, or -1 if no picture
+ * was submitted to the surface yet. The fd belongs to the surface.
+ */
+int
+i965_get_surface_fence_fd(VADriverContextP ctx, VASurfaceID surface)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct object_surface *obj_surface = SURFACE(surface);
+    struct intel_fence *fence;
+
+    if (!obj_surface)
+        return -1;
+
+    _i965LockMutex(&i965->run_mutex);
+    fence = obj_surface->fence;
+    _i965UnlockMutex(&i965->run_mutex);
+
+    return fence ? intel_fence_get_fd(fence) : -1;
 }
 
 static VADisplayAttribute *
@@ -4301,15 +4701,25 @@ VAStatus i965_DeriveImage(VADriverContextP ctx,
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
 
+    i965_sync_decode_queues(ctx, surface);
+    i965_flush_encode_batches(ctx, NULL);
+
+    /* A queued picture may allocate the surface as a missing reference */
+    _i965LockMutex(&i965->run_mutex);
+
     if (!obj_surface->bo) {
         unsigned int is_tiled = 0;
         unsigned int fourcc = VA_FOURCC_YV12;
         i965_guess_surface_format(ctx, surface, &fourcc, &is_tiled);
         int sampling = get_sampling_from_fourcc(fourcc);
         va_status = i965_check_alloc_surface_bo(ctx, obj_surface, is_tiled, fourcc, sampling);
-        if (va_status != VA_STATUS_SUCCESS)
-            return va_status;
-    }
+    } else
+        va_status = VA_STATUS_SUCCESS;
+
+    _i965UnlockMutex(&i965->run_mutex);
+
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
 
     ASSERT_RET(obj_surface->fourcc, VA_STATUS_ERROR_INVALID_SURFACE);
 
@@ -4804,6 +5214,10 @@ i965_GetImage(VADriverContextP ctx,
 
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    i965_sync_decode_queues(ctx, surface);
+    i965_flush_encode_batches(ctx, NULL);
+
     if (!obj_surface->bo) /* don't get anything, keep previous data */
         return VA_STATUS_SUCCESS;
     if (is_surface_busy(i965, obj_surface))
@@ -4828,11 +5242,16 @@ i965_GetImage(VADriverContextP ctx,
     rect.width = width;
     rect.height = height;
 
+    /* The queued pictures may still read or set up the surface */
+    _i965LockMutex(&i965->run_mutex);
+
     if (HAS_ACCELERATED_GETIMAGE(i965))
         va_status = i965_hw_getimage(ctx, obj_surface, obj_image, &rect);
     else
         va_status = i965_sw_getimage(ctx, obj_surface, obj_image, &rect);
 
+    _i965UnlockMutex(&i965->run_mutex);
+
     return va_status;
 }
 
@@ -5117,6 +5536,10 @@ i965_PutImage(VADriverContextP ctx,
 
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    i965_sync_decode_queues(ctx, surface);
+    i965_flush_encode_batches(ctx, NULL);
+
     if (is_surface_busy(i965, obj_surface))
         return VA_STATUS_ERROR_SURFACE_BUSY;
 
@@ -5147,12 +5570,20 @@ i965_PutImage(VADriverContextP ctx,
     dst_rect.width  = dest_width;
     dst_rect.height = dest_height;
 
-    if (HAS_ACCELERATED_PUTIMAGE(i965))
+    /* The queued pictures may still read or set up the surface */
+    _i965LockMutex(&i965->run_mutex);
+
+    if (HAS_ACCELERATED_PUTIMAGE(i965)) {
+        intel_fence_collect_begin(&i965->intel, &obj_surface->fence);
         va_status = i965_hw_putimage(ctx, obj_surface, obj_image,
             &src_rect, &dst_rect);
-    else 
+        intel_fence_collect_end(&i965->intel);
+    } else {
         va_status = i965_sw_putimage(ctx, obj_surface, obj_image,
             &src_rect, &dst_rect);
+    }
+
+    _i965UnlockMutex(&i965->run_mutex);
 
     return va_status;
 }
@@ -5173,9 +5604,14 @@ i965_PutSurface(VADriverContextP ctx,
                 unsigned int number_cliprects, /* number of clip rects in the clip list */
                 unsigned int flags) /* de-interlacing flags */
 {
+    i965_sync_decode_queues(ctx, surface);
+    i965_flush_encode_batches(ctx, NULL);
+
 #ifdef HAVE_VA_X11
     if (IS_VA_X11(ctx)) {
+        struct i965_driver_data *i965 = i965_driver_data(ctx);
         VARectangle src_rect, dst_rect;
+        VAStatus va_status;
 
         src_rect.x      = srcx;
         src_rect.y      = srcy;
@@ -5187,8 +5623,12 @@ i965_PutSurface(VADriverContextP ctx,
         dst_rect.width  = destw;
         dst_rect.height = desth;
 
-        return i965_put_surface_dri(ctx, surface, draw, &src_rect, &dst_rect,
-                                    cliprects, number_cliprects, flags);
+        _i965LockMutex(&i965->run_mutex);
+        va_status = i965_put_surface_dri(ctx, surface, draw, &src_rect, &dst_rect,
+                                         cliprects, number_cliprects, flags);
+        _i965UnlockMutex(&i965->run_mutex);
+
+        return va_status;
     }
 #endif
     return VA_STATUS_ERROR_UNIMPLEMENTED;
@@ -6334,6 +6774,13 @@ VAStatus i965_QueryVideoProcPipelineCaps(
     pipeline_cap->input_color_standards = vpp_input_color_standards;
     pipeline_cap->num_output_color_standards = 1;
     pipeline_cap->output_color_standards = vpp_output_color_standards;
+    pipeline_cap->num_additional_outputs = 0;
+
+    /* Gen6 only scales NV12 to NV12, see i965_proc_picture() */
+    if (IS_GEN7(i965->intel.device_info) ||
+        IS_GEN8(i965->intel.device_info) ||
+        IS_GEN9(i965->intel.device_info))
+        pipeline_cap->num_additional_outputs = I965_PROC_MAX_ADDITIONAL_OUTPUTS;
 
     for (i = 0; i < num_filters; i++) {
         struct object_buffer *obj_buffer = BUFFER(filters[i]);
@@ -6374,12 +6821,48 @@ static bool
 i965_driver_data_init(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx); 
+    char *env_str = NULL;
 
     i965->codec_info = i965_get_codec_info(i965->intel.device_id);
 
     if (!i965->codec_info)
         return false;
 
+    i965->decode_ahead_depth = 0;
+
+    if ((env_str = getenv("VA_INTEL_DECODE_AHEAD")))
+        i965->decode_ahead_depth = CLAMP(0, I965_DECODE_QUEUE_MAX_DEPTH, atoi(env_str));
+
+    i965->coalesce_slice_data = 0;
+
+    if ((env_str = getenv("VA_INTEL_COALESCE_SLICE_DATA")))
+        i965->coalesce_slice_data = !!atoi(env_str);
+
+    i965->jpeg_encode_batch_size = 1;
+
+    if ((env_str = getenv("VA_INTEL_JPEG_ENCODE_BATCH")))
+        i965->jpeg_encode_batch_size = CLAMP(1, I965_JPEG_ENCODE_BATCH_MAX, atoi(env_str));
+
+    i965->jpeg_sw_decode = I965_JPEG_SW_DECODE_OFF;
+
+    if ((env_str = getenv("VA_INTEL_JPEG_SW_DECODE")))
+        i965->jpeg_sw_decode = CLAMP(I965_JPEG_SW_DECODE_OFF, I965_JPEG_SW_DECODE_ALWAYS, atoi(env_str));
+
+    i965->vdenc_low_latency = 0;
+
+    if ((env_str = getenv("VA_INTEL_VDENC_LOW_LATENCY")))
+        i965->vdenc_low_latency = !!atoi(env_str);
+
+    i965->encode_scene_cut = 0;
+
+    if ((env_str = getenv("VA_INTEL_ENCODE_SCENE_CUT")))
+        i965->encode_scene_cut = !!atoi(env_str);
+
+    i965->vpp_sw = I965_VPP_SW_OFF;
+
+    if ((env_str = getenv("VA_INTEL_VPP_SW")))
+        i965->vpp_sw = CLAMP(I965_VPP_SW_OFF, I965_VPP_SW_ALWAYS, atoi(env_str));
+
     if (object_heap_init(&i965->config_heap,
                          sizeof(struct object_config),
                          CONFIG_ID_OFFSET))
@@ -6410,6 +6893,13 @@ i965_driver_data_init(VADriverContextP ctx)
     i965->pp_batch = intel_batchbuffer_new(&i965->intel, I915_EXEC_RENDER, 0);
     _i965InitMutex(&i965->render_mutex);
     _i965InitMutex(&i965->pp_mutex);
+    _i965InitMutex(&i965->run_mutex);
+    _i965InitMutex(&i965->decode_queue_mutex);
+
+    i965->trace = NULL;
+
+    if ((env_str = getenv("VA_INTEL_TRACE")) && !(i965->trace = i965_trace_open(env_str)))
+        WARN_ONCE("failed to open the decode trace %s\n", env_str);
 
     return true;
 
@@ -6433,20 +6923,27 @@ i965_driver_data_terminate(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx); 
 
+    _i965DestroyMutex(&i965->decode_queue_mutex);
+    _i965DestroyMutex(&i965->run_mutex);
     _i965DestroyMutex(&i965->pp_mutex);
     _i965DestroyMutex(&i965->render_mutex);
 
+    i965_trace_close(i965->trace);
+    i965->trace = NULL;
+
     if (i965->batch)
         intel_batchbuffer_free(i965->batch);
 
     if (i965->pp_batch)
         intel_batchbuffer_free(i965->pp_batch);
 
+    /* Contexts first, they may still own surfaces (e.g. the VPP surface
+     * pool) or run pending pictures on them */
+    i965_destroy_heap(&i965->context_heap, i965_destroy_context);
     i965_destroy_heap(&i965->subpic_heap, i965_destroy_subpic);
     i965_destroy_heap(&i965->image_heap, i965_destroy_image);
     i965_destroy_heap(&i965->buffer_heap, i965_destroy_buffer);
     i965_destroy_heap(&i965->surface_heap, i965_destroy_surface);
-    i965_destroy_heap(&i965->context_heap, i965_destroy_context);
     i965_destroy_heap(&i965->config_heap, i965_destroy_config);
 }
 
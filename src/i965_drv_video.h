@@ -43,6 +43,7 @@
 #include "i965_mutext.h"
 #include "object_heap.h"
 #include "intel_driver.h"
+#include "intel_fence.h"
 #include "i965_fourcc.h"
 
 #define I965_MAX_PROFILES                       20
@@ -77,6 +78,9 @@
 
 #define ENCODER_LP_QUALITY_RANGE  8
 
+/* The encode batch is submitted anyway once it runs out of space */
+#define I965_JPEG_ENCODE_BATCH_MAX      64
+
 #define HAS_MPEG2_DECODING(ctx)  ((ctx)->codec_info->has_mpeg2_decoding && \
                                   (ctx)->intel.has_bsd)
 
@@ -281,11 +285,26 @@ struct encode_state
     struct object_surface *reference_objects[16]; /* Up to 2 reference surfaces are valid for MPEG-2,*/
 };
 
+/*
+ * A VPP picture may take several pipeline parameter buffers, e.g. the tiles
+ * of a video wall. They are composed onto the render target in submission
+ * order, see i965_proc_compose().
+ */
+#define I965_PROC_MAX_LAYERS    64
+
 struct proc_state
 {
     struct codec_state_base base;
     struct buffer_store *pipeline_param;
 
+    /* The pipeline parameters rendered after pipeline_param */
+    struct buffer_store *layer_params[I965_PROC_MAX_LAYERS - 1];
+    int num_layer_params;
+    int num_pipeline_params;    /* since vaBeginPicture() */
+
+    /* VAProcStatisticsBufferTypeIntel, for the current picture only */
+    struct buffer_store *statistics;
+
     VASurfaceID current_render_target;
 };
 
@@ -314,6 +333,9 @@ struct hw_context
     struct intel_batchbuffer *batch;
 };
 
+struct i965_decode_queue;
+struct i965_trace;
+
 struct object_context 
 {
     struct object_base base;
@@ -328,6 +350,9 @@ struct object_context
     union codec_state codec_state;
     struct hw_context *hw_context;
 
+    /* Optional decode-ahead worker, see i965_decode_queue.h */
+    struct i965_decode_queue *decode_queue;
+
     VAGenericID       wrapper_context;
 };
 
@@ -376,6 +401,13 @@ struct object_surface
     VAGenericID wrapper_surface;
 
     int exported_primefd;
+
+    /* Batches rendering into this surface, set up by vaEndPicture() */
+    struct intel_fence *fence;
+
+    /* Error of the decode-ahead picture rendering into this surface, it is
+     * returned by vaSyncSurface() and vaQuerySurfaceStatus() */
+    VAStatus decode_status;
 };
 
 struct object_buffer 
@@ -513,6 +545,13 @@ struct i965_driver_data
 
     _I965Mutex render_mutex;
     _I965Mutex pp_mutex;
+
+    /* Held by the decode-ahead workers around hw_context->run() and by the
+     * application thread while it uses the contexts and surfaces */
+    _I965Mutex run_mutex;
+
+    /* Protects the decode queues of the contexts, see i965_sync_decode_queues() */
+    _I965Mutex decode_queue_mutex;
     struct intel_batchbuffer *batch;
     struct intel_batchbuffer *pp_batch;
     struct i965_render_state render_state;
@@ -537,6 +576,30 @@ struct i965_driver_data
     VADriverContextP wrapper_pdrvctx;
 
     struct i965_gpe_table gpe_table;
+
+    /* Max. number of queued pictures per decode context, 0 to disable */
+    int decode_ahead_depth;
+
+    /* Copy small slice data buffers into one bo, see intel_coalesce_slice_data() */
+    int coalesce_slice_data;
+
+    /* Max. number of JPEG pictures sharing one encode batch, 1 to disable */
+    int jpeg_encode_batch_size;
+
+    /* I965_JPEG_SW_DECODE_*, see i965_jpeg_sw_decoder.h */
+    int jpeg_sw_decode;
+
+    /* VDEnc AVC per-slice output, enabled by VA_INTEL_VDENC_LOW_LATENCY */
+    int vdenc_low_latency;
+
+    /* Promote P pictures starting a new scene, see i965_scene_cut.h */
+    int encode_scene_cut;
+
+    /* I965_VPP_SW_*, see i965_vpp_sw.h */
+    int vpp_sw;
+
+    /* Decode session recorder, enabled by VA_INTEL_TRACE */
+    struct i965_trace *trace;
 };
 
 #define NEW_CONFIG_ID() object_heap_allocate(&i965->config_heap);
@@ -612,7 +675,9 @@ struct i965_coded_buffer_segment
     unsigned int mapped;
     unsigned int codec;
     unsigned int status_support;
-    unsigned int pad1;
+    unsigned int low_latency : 1;       /* may be mapped while the frame is encoded */
+    unsigned int partial : 1;           /* base only lists the slices done so far */
+    unsigned int pad1 : 30;
 
     unsigned int codec_private_data[512];       /* Store codec private data, must be 16-bytes aligned */
 };
@@ -643,4 +708,14 @@ extern VAStatus i965_CreateSurfaces(VADriverContextP ctx,
 void
 i965_destroy_surface_storage(struct object_surface *obj_surface);
 
+void
+i965_reference_buffer_store(struct buffer_store **ptr,
+                            struct buffer_store *buffer_store);
+
+void
+i965_release_buffer_store(struct buffer_store **ptr);
+
+int
+i965_get_surface_fence_fd(VADriverContextP ctx, VASurfaceID surface);
+
 #endif /* _I965_DRV_VIDEO_H_ */
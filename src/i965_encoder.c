@@ -41,6 +41,7 @@
 #include "gen6_mfc.h"
 
 #include "i965_post_processing.h"
+#include "i965_scene_cut.h"
 
 static struct intel_fraction
 reduce_fraction(struct intel_fraction f)
@@ -471,9 +472,9 @@ intel_encoder_check_brc_hevc_sequence_parameter(VADriverContextP ctx,
     }
     num_bframes_in_gop = gop_size - num_iframes_in_gop - num_pframes_in_gop;
 
-    if (encoder_context->brc.framerate[0].num != framerate.num ||
-        encoder_context->brc.framerate[0].den != framerate.den) {
-        encoder_context->brc.framerate[0] = framerate;
+    if (encoder_context->brc.framerate[encoder_context->layer.num_layers - 1].num != framerate.num ||
+        encoder_context->brc.framerate[encoder_context->layer.num_layers - 1].den != framerate.den) {
+        encoder_context->brc.framerate[encoder_context->layer.num_layers - 1] = framerate;
         encoder_context->brc.need_reset = 1;
     }
 
@@ -1294,6 +1295,205 @@ out:
     return vaStatus;
 }
  
+static void
+intel_encoder_free_scene_cut(struct intel_encoder_context *encoder_context)
+{
+    if (encoder_context->scene_cut_surface != VA_INVALID_SURFACE)
+        i965_DestroySurfaces(encoder_context->scene_cut_ctx, &encoder_context->scene_cut_surface, 1);
+
+    encoder_context->scene_cut_surface = VA_INVALID_SURFACE;
+    i965_scene_cut_free(encoder_context->scene_cut);
+    encoder_context->scene_cut = NULL;
+}
+
+/*
+ * Scales the input down to one sample per 4x4 block on the GPU, so only
+ * 1/16 of the luma plane is read back by the CPU. Returns NULL when the
+ * input can't be scaled, the detector reads the input itself then.
+ */
+static struct object_surface *
+intel_encoder_scale_scene_cut(VADriverContextP ctx,
+                              struct encode_state *encode_state,
+                              struct intel_encoder_context *encoder_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct object_surface *obj_surface = encode_state->input_yuv_object;
+    struct object_surface *scaled_surface;
+    VARectangle src_rect, dst_rect;
+
+    if (!HAS_VPP(i965) || obj_surface->fourcc != VA_FOURCC_NV12)
+        return NULL;
+
+    if (encoder_context->scene_cut_surface == VA_INVALID_SURFACE) {
+        if (i965_CreateSurfaces(ctx,
+                                encoder_context->scene_cut->width_in_mbs * 4,
+                                encoder_context->scene_cut->height_in_mbs * 4,
+                                VA_RT_FORMAT_YUV420,
+                                1,
+                                &encoder_context->scene_cut_surface) != VA_STATUS_SUCCESS) {
+            encoder_context->scene_cut_surface = VA_INVALID_SURFACE;
+            return NULL;
+        }
+
+        encoder_context->scene_cut_ctx = ctx;
+    }
+
+    scaled_surface = SURFACE(encoder_context->scene_cut_surface);
+
+    if (!scaled_surface)
+        return NULL;
+
+    /* linear, the samples are read through a CPU mapping */
+    i965_check_alloc_surface_bo(ctx, scaled_surface, 0, VA_FOURCC_NV12, SUBSAMPLE_YUV420);
+
+    if (!scaled_surface->bo)
+        return NULL;
+
+    src_rect.x = 0;
+    src_rect.y = 0;
+    src_rect.width = obj_surface->orig_width;
+    src_rect.height = obj_surface->orig_height;
+
+    dst_rect.x = 0;
+    dst_rect.y = 0;
+    dst_rect.width = scaled_surface->orig_width;
+    dst_rect.height = scaled_surface->orig_height;
+
+    if (i965_scaling_processing(ctx,
+                                obj_surface,
+                                &src_rect,
+                                scaled_surface,
+                                &dst_rect,
+                                VA_FILTER_SCALING_FAST) != VA_STATUS_SUCCESS)
+        return NULL;
+
+    return scaled_surface;
+}
+
+/*
+ * Codes a P picture starting a new scene as an I picture. Only for IP
+ * sequences, the reference order of B pictures doesn't match the order
+ * the pictures are analysed in, and only when the driver builds the
+ * slice headers. The slice types of the application are saved and
+ * restored once the picture is encoded.
+ */
+static void
+intel_encoder_detect_scene_cut(VADriverContextP ctx,
+                               struct encode_state *encode_state,
+                               struct intel_encoder_context *encoder_context)
+{
+    VAEncSequenceParameterBufferH264 *seq_param = (VAEncSequenceParameterBufferH264 *)encode_state->seq_param_ext->buffer;
+    VAEncSliceParameterBufferH264 *slice_param;
+    struct object_surface *obj_surface = encode_state->input_yuv_object;
+    struct object_surface *scaled_surface;
+    unsigned char *slice_types;
+    int i, j, n, slice_type, is_intra = 0, num_slices = 0;
+
+    encoder_context->is_scene_cut = 0;
+
+    if (seq_param->ip_period > 1 || !obj_surface || !obj_surface->bo)
+        return;
+
+    for (j = 0; j < encode_state->num_slice_params_ext; j++) {
+        slice_param = (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[j]->buffer;
+
+        if (encode_state->slice_header_index[j] & SLICE_PACKED_DATA_INDEX_TYPE)
+            return;
+
+        for (i = 0; i < encode_state->slice_params_ext[j]->num_elements; i++) {
+            slice_type = intel_avc_enc_slice_type_fixup(slice_param[i].slice_type);
+
+            if (slice_type == SLICE_TYPE_I)
+                is_intra = 1;
+            else if (slice_type != SLICE_TYPE_P)
+                return;
+        }
+
+        num_slices += encode_state->slice_params_ext[j]->num_elements;
+    }
+
+    if (!encoder_context->scene_cut ||
+        encoder_context->scene_cut->width_in_mbs != WIDTH_IN_MACROBLOCKS(encoder_context->frame_width_in_pixel) ||
+        encoder_context->scene_cut->height_in_mbs != HEIGHT_IN_MACROBLOCKS(encoder_context->frame_height_in_pixel)) {
+        intel_encoder_free_scene_cut(encoder_context);
+        encoder_context->scene_cut = i965_scene_cut_new(encoder_context->frame_width_in_pixel,
+                                                        encoder_context->frame_height_in_pixel);
+
+        if (!encoder_context->scene_cut)
+            return;
+    }
+
+    scaled_surface = intel_encoder_scale_scene_cut(ctx, encode_state, encoder_context);
+
+    if (scaled_surface) {
+        dri_bo_map(scaled_surface->bo, 0);
+
+        if (!scaled_surface->bo->virtual)
+            return;
+
+        encoder_context->is_scene_cut = i965_scene_cut_detect_scaled(encoder_context->scene_cut,
+                                                                     scaled_surface->bo->virtual,
+                                                                     scaled_surface->width,
+                                                                     is_intra);
+        dri_bo_unmap(scaled_surface->bo);
+    } else {
+        drm_intel_gem_bo_map_gtt(obj_surface->bo);
+
+        if (!obj_surface->bo->virtual)
+            return;
+
+        encoder_context->is_scene_cut = i965_scene_cut_detect(encoder_context->scene_cut,
+                                                              obj_surface->bo->virtual,
+                                                              obj_surface->width,
+                                                              is_intra);
+        drm_intel_gem_bo_unmap_gtt(obj_surface->bo);
+    }
+
+    if (!encoder_context->is_scene_cut)
+        return;
+
+    if (num_slices > encoder_context->num_scene_cut_slice_types) {
+        slice_types = realloc(encoder_context->scene_cut_slice_types, num_slices);
+
+        if (!slice_types) {
+            encoder_context->is_scene_cut = 0;
+            return;
+        }
+
+        encoder_context->scene_cut_slice_types = slice_types;
+        encoder_context->num_scene_cut_slice_types = num_slices;
+    }
+
+    for (j = 0, n = 0; j < encode_state->num_slice_params_ext; j++) {
+        slice_param = (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[j]->buffer;
+
+        for (i = 0; i < encode_state->slice_params_ext[j]->num_elements; i++, n++) {
+            encoder_context->scene_cut_slice_types[n] = slice_param[i].slice_type;
+            slice_param[i].slice_type = SLICE_TYPE_I;
+        }
+    }
+}
+
+static void
+intel_encoder_restore_scene_cut(struct encode_state *encode_state,
+                                struct intel_encoder_context *encoder_context)
+{
+    VAEncSliceParameterBufferH264 *slice_param;
+    int i, j, n;
+
+    if (!encoder_context->is_scene_cut)
+        return;
+
+    for (j = 0, n = 0; j < encode_state->num_slice_params_ext; j++) {
+        slice_param = (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[j]->buffer;
+
+        for (i = 0; i < encode_state->slice_params_ext[j]->num_elements; i++, n++)
+            slice_param[i].slice_type = encoder_context->scene_cut_slice_types[n];
+    }
+
+    encoder_context->is_scene_cut = 0;
+}
+
 static VAStatus
 intel_encoder_end_picture(VADriverContextP ctx, 
                           VAProfile profile, 
@@ -1309,15 +1509,21 @@ intel_encoder_end_picture(VADriverContextP ctx,
     if (vaStatus != VA_STATUS_SUCCESS)
         return vaStatus;
 
+    if (encoder_context->scene_cut_enabled)
+        intel_encoder_detect_scene_cut(ctx, encode_state, encoder_context);
+
     encoder_context->mfc_brc_prepare(encode_state, encoder_context);
 
     if((encoder_context->vme_context && encoder_context->vme_pipeline)) {
         vaStatus = encoder_context->vme_pipeline(ctx, profile, encode_state, encoder_context);
-        if (vaStatus != VA_STATUS_SUCCESS)
+        if (vaStatus != VA_STATUS_SUCCESS) {
+            intel_encoder_restore_scene_cut(encode_state, encoder_context);
             return vaStatus;
+        }
     }
 
     encoder_context->mfc_pipeline(ctx, profile, encode_state, encoder_context);
+    intel_encoder_restore_scene_cut(encode_state, encoder_context);
     encoder_context->num_frames_in_sequence++;
     encoder_context->brc.need_reset = 0;
     /*
@@ -1344,6 +1550,9 @@ intel_encoder_context_destroy(void *hw_context)
         encoder_context->enc_priv_state = NULL;
     }
 
+    intel_encoder_free_scene_cut(encoder_context);
+    free(encoder_context->scene_cut_slice_types);
+
     intel_batchbuffer_free(encoder_context->base.batch);
     free(encoder_context);
 }
@@ -1369,6 +1578,7 @@ intel_enc_hw_context_init(VADriverContextP ctx,
                           hw_init_func vme_context_init,
                           hw_init_func mfc_context_init)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_driver_data *intel = intel_driver_data(ctx);
     struct intel_encoder_context *encoder_context = calloc(1, sizeof(struct intel_encoder_context));
     int i;
@@ -1379,6 +1589,7 @@ intel_enc_hw_context_init(VADriverContextP ctx,
     encoder_context->base.get_status = intel_encoder_get_status;
     encoder_context->base.batch = intel_batchbuffer_new(intel, I915_EXEC_RENDER, 0);
     encoder_context->input_yuv_surface = VA_INVALID_SURFACE;
+    encoder_context->scene_cut_surface = VA_INVALID_SURFACE;
     encoder_context->is_tmp_id = 0;
     encoder_context->low_power_mode = 0;
     encoder_context->rate_control_mode = VA_RC_NONE;
@@ -1450,6 +1661,11 @@ intel_enc_hw_context_init(VADriverContextP ctx,
         }
     }
 
+    if (encoder_context->codec == CODEC_H264 &&
+        !encoder_context->low_power_mode &&
+        i965->encode_scene_cut)
+        encoder_context->scene_cut_enabled = 1;
+
     if (vme_context_init) {
         vme_context_init(ctx, encoder_context);
         assert(!encoder_context->vme_context ||
@@ -45,6 +45,8 @@
 #define HEIGHT_IN_MACROBLOCKS(height)   (ALIGN(height, 16) >> 4)
 #define MAX_TEMPORAL_LAYERS	        4
 
+struct i965_scene_cut;
+
 struct intel_roi
 {
     short left;
@@ -112,6 +114,15 @@ struct intel_encoder_context
     unsigned int soft_batch_force:1;
     unsigned int context_roi:1;
     unsigned int is_new_sequence:1; /* Currently only valid for H.264, TODO for other codecs */
+    unsigned int is_scene_cut:1;    /* the current P picture is coded as an I picture */
+
+    /* VME based H.264 only, enabled by VA_INTEL_ENCODE_SCENE_CUT */
+    int scene_cut_enabled;
+    struct i965_scene_cut *scene_cut;
+    VADriverContextP scene_cut_ctx;         /* to release scene_cut_surface */
+    VASurfaceID scene_cut_surface;          /* the input scaled down 4x */
+    unsigned char *scene_cut_slice_types;   /* of the promoted picture */
+    int num_scene_cut_slice_types;
 
     void (*vme_context_destroy)(void *vme_context);
     VAStatus (*vme_pipeline)(VADriverContextP ctx,
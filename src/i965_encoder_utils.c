@@ -1125,13 +1125,14 @@ int build_hevc_slice_header(VAEncSequenceParameterBufferHEVC *seq_param,
                        VAEncPictureParameterBufferHEVC *pic_param,
                        VAEncSliceParameterBufferHEVC *slice_param,
                        unsigned char **header_buffer,
-                       int slice_index)
+                       int slice_index,
+                       int temporal_id)
 {
     avc_bitstream bs;
 
     avc_bitstream_start(&bs);
     nal_start_code_prefix(&bs);
-    nal_header_hevc(&bs, get_hevc_slice_nalu_type(pic_param), 0);
+    nal_header_hevc(&bs, get_hevc_slice_nalu_type(pic_param), temporal_id);
     slice_rbsp(&bs, slice_index, seq_param,pic_param,slice_param);
     avc_bitstream_end(&bs);
 
@@ -40,7 +40,8 @@ build_hevc_slice_header(VAEncSequenceParameterBufferHEVC *seq_param,
                         VAEncPictureParameterBufferHEVC *pic_param,
                         VAEncSliceParameterBufferHEVC *slice_param,
                         unsigned char **header_buffer,
-                        int slice_index);
+                        int slice_index,
+                        int temporal_id);
 int
 build_hevc_sei_buffering_period(int cpb_removal_length,
                                 unsigned int init_cpb_removal_delay,
@@ -0,0 +1,1051 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sysdeps.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "i965_drv_video.h"
+#include "i965_jpeg_sw_decoder.h"
+
+#define JPEG_SW_FAST_BITS               9
+
+/* Below this the threads cost more than they save */
+#define JPEG_SW_MIN_MCUS_PER_THREAD     512
+
+/* islow IDCT from the IJG reference, 13 bit constants */
+#define JPEG_SW_CONST_BITS              13
+#define JPEG_SW_PASS1_BITS              2
+
+#define FIX_0_298631336                 2446
+#define FIX_0_390180644                 3196
+#define FIX_0_541196100                 4433
+#define FIX_0_765366865                 6270
+#define FIX_0_899976223                 7373
+#define FIX_1_175875602                 9633
+#define FIX_1_501321110                 12299
+#define FIX_1_847759065                 15137
+#define FIX_1_961570560                 16069
+#define FIX_2_053119869                 16819
+#define FIX_2_562915447                 20995
+#define FIX_3_072711026                 25172
+
+/* Natural order of the coefficients in zig-zag order, padded for bad run lengths */
+static const uint8_t jpeg_sw_natural_order[64 + 16] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+    63, 63, 63, 63, 63, 63, 63, 63,
+    63, 63, 63, 63, 63, 63, 63, 63,
+};
+
+struct jpeg_sw_huffman
+{
+    /* (length << 8) | value for the codes of up to JPEG_SW_FAST_BITS bits */
+    uint16_t fast[1 << JPEG_SW_FAST_BITS];
+    int32_t maxcode[17];                /* -1 if there is no code of that length */
+    int32_t valoffset[17];
+    uint8_t values[256];
+    bool valid;
+};
+
+struct jpeg_sw_scan_component
+{
+    struct i965_jpeg_sw_plane *plane;
+    const struct jpeg_sw_huffman *dc_table;
+    const struct jpeg_sw_huffman *ac_table;
+    int32_t qt[64];                     /* zig-zag order */
+    int h;                              /* blocks per MCU */
+    int v;
+};
+
+struct jpeg_sw_scan
+{
+    int num_components;
+    struct jpeg_sw_scan_component components[4];
+    int mcus_per_row;
+};
+
+/* A run of MCUs which starts with reset DC predictors on a byte boundary */
+struct jpeg_sw_segment
+{
+    const struct jpeg_sw_scan *scan;
+    const uint8_t *data;
+    const uint8_t *end;
+    int first_mcu;
+    int num_mcus;
+};
+
+struct jpeg_sw_bitstream
+{
+    const uint8_t *ptr;
+    const uint8_t *end;
+    uint64_t bits;                      /* MSB first */
+    int num_bits;
+    int num_padding_bits;               /* zeros fed past a marker or the end */
+};
+
+struct jpeg_sw_worker
+{
+    pthread_t thread;
+    bool started;
+    struct jpeg_sw_segment *segments;
+    int num_segments;
+    int num_errors;
+};
+
+static bool
+jpeg_sw_build_huffman(struct jpeg_sw_huffman *huffman,
+                      const uint8_t *num_codes,
+                      const uint8_t *values,
+                      int max_values)
+{
+    int len, i, k = 0, code = 0;
+
+    memset(huffman->fast, 0, sizeof(huffman->fast));
+    huffman->valid = false;
+
+    for (len = 1; len <= 16; len++) {
+        int n = num_codes[len - 1];
+
+        if (k + n > max_values)
+            return false;
+
+        huffman->valoffset[len] = k - code;
+
+        for (i = 0; i < n; i++, k++, code++) {
+            huffman->values[k] = values[k];
+
+            if (len <= JPEG_SW_FAST_BITS) {
+                int shift = JPEG_SW_FAST_BITS - len, j;
+
+                for (j = 0; j < (1 << shift); j++)
+                    huffman->fast[(code << shift) | j] = (len << 8) | values[k];
+            }
+        }
+
+        huffman->maxcode[len] = n ? code - 1 : -1;
+
+        /* Over-subscribed code lengths */
+        if (code > (1 << len))
+            return false;
+
+        code <<= 1;
+    }
+
+    huffman->valid = (k > 0);
+
+    return huffman->valid;
+}
+
+static void
+jpeg_sw_init_bitstream(struct jpeg_sw_bitstream *bs, const uint8_t *data, const uint8_t *end)
+{
+    bs->ptr = data;
+    bs->end = end;
+    bs->bits = 0;
+    bs->num_bits = 0;
+    bs->num_padding_bits = 0;
+}
+
+static inline void
+jpeg_sw_fill_bits(struct jpeg_sw_bitstream *bs)
+{
+    while (bs->num_bits <= 56) {
+        unsigned int byte = 0;
+
+        if (bs->ptr < bs->end) {
+            byte = *bs->ptr++;
+
+            if (byte == 0xff && bs->ptr < bs->end) {
+                if (*bs->ptr == 0x00) {
+                    bs->ptr++;
+                } else {
+                    /* A marker ends the entropy-coded data */
+                    bs->ptr = bs->end;
+                    byte = 0;
+                    bs->num_padding_bits += 8;
+                }
+            }
+        } else
+            bs->num_padding_bits += 8;
+
+        bs->bits |= (uint64_t)byte << (56 - bs->num_bits);
+        bs->num_bits += 8;
+    }
+}
+
+static inline void
+jpeg_sw_skip_bits(struct jpeg_sw_bitstream *bs, int n)
+{
+    bs->bits <<= n;
+    bs->num_bits -= n;
+}
+
+/* Some of the decoded bits were not part of the data */
+static inline bool
+jpeg_sw_is_overrun(struct jpeg_sw_bitstream *bs)
+{
+    return bs->num_padding_bits > bs->num_bits;
+}
+
+static inline int
+jpeg_sw_decode_huffman(struct jpeg_sw_bitstream *bs, const struct jpeg_sw_huffman *huffman)
+{
+    unsigned int entry;
+    int len;
+
+    entry = huffman->fast[bs->bits >> (64 - JPEG_SW_FAST_BITS)];
+
+    if (entry) {
+        jpeg_sw_skip_bits(bs, entry >> 8);
+
+        return entry & 0xff;
+    }
+
+    for (len = JPEG_SW_FAST_BITS + 1; len <= 16; len++) {
+        int32_t code = bs->bits >> (64 - len);
+
+        if (code <= huffman->maxcode[len]) {
+            jpeg_sw_skip_bits(bs, len);
+
+            return huffman->values[huffman->valoffset[len] + code];
+        }
+    }
+
+    return -1;
+}
+
+static inline int
+jpeg_sw_get_value(struct jpeg_sw_bitstream *bs, int size)
+{
+    int value;
+
+    if (!size)
+        return 0;
+
+    value = bs->bits >> (64 - size);
+    jpeg_sw_skip_bits(bs, size);
+
+    if (value < (1 << (size - 1)))
+        value += 1 - (1 << size);
+
+    return value;
+}
+
+/* Returns the index of the last coefficient in zig-zag order, -1 on errors */
+static int
+jpeg_sw_decode_block(struct jpeg_sw_bitstream *bs,
+                     const struct jpeg_sw_scan_component *component,
+                     int *dc_pred,
+                     int32_t *coefs)
+{
+    int k, last = 0, symbol;
+
+    /* The longest code plus the longest value fit in 32 bits */
+    if (bs->num_bits < 32)
+        jpeg_sw_fill_bits(bs);
+
+    symbol = jpeg_sw_decode_huffman(bs, component->dc_table);
+
+    if (symbol < 0 || symbol > 11)
+        return -1;
+
+    *dc_pred += jpeg_sw_get_value(bs, symbol);
+    coefs[0] = *dc_pred * component->qt[0];
+
+    for (k = 1; k < 64; k++) {
+        int run, size;
+
+        if (bs->num_bits < 32)
+            jpeg_sw_fill_bits(bs);
+
+        symbol = jpeg_sw_decode_huffman(bs, component->ac_table);
+
+        if (symbol < 0)
+            return -1;
+
+        run = symbol >> 4;
+        size = symbol & 15;
+
+        if (size == 0) {
+            if (run != 15)
+                break;                  /* EOB */
+
+            k += 15;                    /* ZRL */
+            continue;
+        }
+
+        k += run;
+
+        if (k > 63 || size > 10)
+            return -1;
+
+        coefs[jpeg_sw_natural_order[k]] = jpeg_sw_get_value(bs, size) * component->qt[k];
+        last = k;
+    }
+
+    if (k > 64)
+        return -1;
+
+    return last;
+}
+
+/*
+ * One 1-D pass over the 8 columns of @in. The columns are independent
+ * and both the loads and the stores are contiguous across them, so the
+ * compiler turns the loop into SIMD code.
+ */
+static void
+jpeg_sw_idct_columns(const int32_t *in, int32_t *out, int shift)
+{
+    const int32_t round = 1 << (shift - 1);
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        int32_t tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13;
+        int32_t z1, z2, z3, z4, z5;
+
+        /* Even part */
+        z2 = in[2 * 8 + i];
+        z3 = in[6 * 8 + i];
+        z1 = (z2 + z3) * FIX_0_541196100;
+        tmp2 = z1 - z3 * FIX_1_847759065;
+        tmp3 = z1 + z2 * FIX_0_765366865;
+
+        z2 = in[0 * 8 + i];
+        z3 = in[4 * 8 + i];
+        tmp0 = (z2 + z3) * (1 << JPEG_SW_CONST_BITS);
+        tmp1 = (z2 - z3) * (1 << JPEG_SW_CONST_BITS);
+
+        tmp10 = tmp0 + tmp3;
+        tmp13 = tmp0 - tmp3;
+        tmp11 = tmp1 + tmp2;
+        tmp12 = tmp1 - tmp2;
+
+        /* Odd part */
+        tmp0 = in[7 * 8 + i];
+        tmp1 = in[5 * 8 + i];
+        tmp2 = in[3 * 8 + i];
+        tmp3 = in[1 * 8 + i];
+
+        z1 = tmp0 + tmp3;
+        z2 = tmp1 + tmp2;
+        z3 = tmp0 + tmp2;
+        z4 = tmp1 + tmp3;
+        z5 = (z3 + z4) * FIX_1_175875602;
+
+        tmp0 *= FIX_0_298631336;
+        tmp1 *= FIX_2_053119869;
+        tmp2 *= FIX_3_072711026;
+        tmp3 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+
+        tmp0 += z1 + z3;
+        tmp1 += z2 + z4;
+        tmp2 += z2 + z3;
+        tmp3 += z1 + z4;
+
+        out[0 * 8 + i] = (tmp10 + tmp3 + round) >> shift;
+        out[7 * 8 + i] = (tmp10 - tmp3 + round) >> shift;
+        out[1 * 8 + i] = (tmp11 + tmp2 + round) >> shift;
+        out[6 * 8 + i] = (tmp11 - tmp2 + round) >> shift;
+        out[2 * 8 + i] = (tmp12 + tmp1 + round) >> shift;
+        out[5 * 8 + i] = (tmp12 - tmp1 + round) >> shift;
+        out[3 * 8 + i] = (tmp13 + tmp0 + round) >> shift;
+        out[4 * 8 + i] = (tmp13 - tmp0 + round) >> shift;
+    }
+}
+
+static inline uint8_t
+jpeg_sw_clamp(int32_t value)
+{
+    value += 128;
+
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static void
+jpeg_sw_put_pixels(struct i965_jpeg_sw_plane *plane, int x, int y, const uint8_t *pixels)
+{
+    int w = MIN(8, plane->width - x);
+    int h = MIN(8, plane->height - y);
+    uint8_t *dst;
+    int i;
+
+    if (w <= 0 || h <= 0)
+        return;
+
+    dst = plane->data + y * plane->pitch + x;
+
+    for (i = 0; i < h; i++, dst += plane->pitch)
+        memcpy(dst, pixels + i * 8, w);
+}
+
+static void
+jpeg_sw_put_flat(struct i965_jpeg_sw_plane *plane, int x, int y, int32_t dc)
+{
+    uint8_t pixels[64];
+
+    memset(pixels, jpeg_sw_clamp((dc + 4) >> 3), sizeof(pixels));
+    jpeg_sw_put_pixels(plane, x, y, pixels);
+}
+
+static void
+jpeg_sw_put_block(struct i965_jpeg_sw_plane *plane, int x, int y, int32_t *coefs, int last)
+{
+    int32_t tmp[64], tr[64];
+    uint8_t pixels[64];
+    int i, j;
+
+    /* DC only blocks are frequent, they are flat */
+    if (last == 0) {
+        jpeg_sw_put_flat(plane, x, y, coefs[0]);
+        return;
+    }
+
+    jpeg_sw_idct_columns(coefs, tmp, JPEG_SW_CONST_BITS - JPEG_SW_PASS1_BITS);
+
+    for (i = 0; i < 8; i++) {
+        for (j = 0; j < 8; j++)
+            tr[j * 8 + i] = tmp[i * 8 + j];
+    }
+
+    jpeg_sw_idct_columns(tr, tmp, JPEG_SW_CONST_BITS + JPEG_SW_PASS1_BITS + 3);
+
+    /* The second pass left the block transposed */
+    for (i = 0; i < 8; i++) {
+        for (j = 0; j < 8; j++)
+            pixels[j * 8 + i] = jpeg_sw_clamp(tmp[i * 8 + j]);
+    }
+
+    jpeg_sw_put_pixels(plane, x, y, pixels);
+}
+
+/* Returns 1 if the segment had to be concealed */
+static int
+jpeg_sw_decode_segment(const struct jpeg_sw_segment *segment)
+{
+    const struct jpeg_sw_scan *scan = segment->scan;
+    const struct jpeg_sw_scan_component *component;
+    struct jpeg_sw_bitstream bs;
+    int dc_pred[4] = { 0, 0, 0, 0 };
+    int32_t coefs[64];
+    int end_mcu = segment->first_mcu + segment->num_mcus;
+    int mcu, c, bx, by, last;
+
+    jpeg_sw_init_bitstream(&bs, segment->data, segment->end);
+
+    for (mcu = segment->first_mcu; mcu < end_mcu; mcu++) {
+        int mcu_x = mcu % scan->mcus_per_row;
+        int mcu_y = mcu / scan->mcus_per_row;
+
+        for (c = 0; c < scan->num_components; c++) {
+            component = &scan->components[c];
+
+            for (by = 0; by < component->v; by++) {
+                for (bx = 0; bx < component->h; bx++) {
+                    memset(coefs, 0, sizeof(coefs));
+                    last = jpeg_sw_decode_block(&bs, component, &dc_pred[c], coefs);
+
+                    if (last < 0)
+                        goto conceal;
+
+                    jpeg_sw_put_block(component->plane,
+                                      (mcu_x * component->h + bx) * 8,
+                                      (mcu_y * component->v + by) * 8,
+                                      coefs,
+                                      last);
+                }
+            }
+        }
+
+        if (jpeg_sw_is_overrun(&bs))
+            goto conceal;
+    }
+
+    return 0;
+
+conceal:
+    /* Flat blocks at the last known DC level up to the next restart marker */
+    for (; mcu < end_mcu; mcu++) {
+        int mcu_x = mcu % scan->mcus_per_row;
+        int mcu_y = mcu / scan->mcus_per_row;
+
+        for (c = 0; c < scan->num_components; c++) {
+            component = &scan->components[c];
+
+            for (by = 0; by < component->v; by++) {
+                for (bx = 0; bx < component->h; bx++)
+                    jpeg_sw_put_flat(component->plane,
+                                     (mcu_x * component->h + bx) * 8,
+                                     (mcu_y * component->v + by) * 8,
+                                     dc_pred[c] * component->qt[0]);
+            }
+        }
+    }
+
+    return 1;
+}
+
+static void *
+jpeg_sw_worker_thread(void *data)
+{
+    struct jpeg_sw_worker *worker = data;
+    int i;
+
+    for (i = 0; i < worker->num_segments; i++)
+        worker->num_errors += jpeg_sw_decode_segment(&worker->segments[i]);
+
+    return NULL;
+}
+
+/*
+ * Splits the data of a slice at its restart markers. A lost marker only
+ * costs the intervals in between, the others are found by their number.
+ */
+static int
+jpeg_sw_split_slice(const struct jpeg_sw_scan *scan,
+                    const VASliceParameterBufferJPEGBaseline *slice_param,
+                    const uint8_t *data,
+                    const uint8_t *end,
+                    int first_mcu,
+                    struct jpeg_sw_segment *segments)
+{
+    int interval = slice_param->restart_interval;
+    int num_intervals, cur = 0, i;
+    const uint8_t *ptr = data;
+
+    if (!interval || interval >= slice_param->num_mcus)
+        interval = slice_param->num_mcus;
+
+    num_intervals = (slice_param->num_mcus + interval - 1) / interval;
+
+    for (i = 0; i < num_intervals; i++) {
+        segments[i].scan = scan;
+        segments[i].data = end;
+        segments[i].end = end;
+        segments[i].first_mcu = first_mcu + i * interval;
+        segments[i].num_mcus = MIN(interval, slice_param->num_mcus - i * interval);
+    }
+
+    segments[0].data = data;
+
+    while (ptr + 1 < end && cur < num_intervals - 1) {
+        const uint8_t *marker = memchr(ptr, 0xff, end - ptr - 1);
+        int next;
+
+        if (!marker)
+            break;
+
+        ptr = marker + 1;
+
+        if (*ptr == 0x00 || *ptr == 0xff)
+            continue;
+
+        if (*ptr < 0xd0 || *ptr > 0xd7)
+            break;
+
+        next = cur + 1 + ((*ptr - 0xd0 - cur) & 7);
+        ptr++;
+
+        if (next >= num_intervals)
+            break;
+
+        segments[cur].end = marker;
+        segments[next].data = ptr;
+        cur = next;
+    }
+
+    return num_intervals;
+}
+
+static int
+jpeg_sw_find_component(const VAPictureParameterBufferJPEGBaseline *pic_param, int id)
+{
+    int i;
+
+    for (i = 0; i < pic_param->num_components; i++) {
+        if (pic_param->components[i].component_id == id)
+            return i;
+    }
+
+    return -1;
+}
+
+static bool
+jpeg_sw_init_scan(struct jpeg_sw_scan *scan,
+                  const VAPictureParameterBufferJPEGBaseline *pic_param,
+                  const VAIQMatrixBufferJPEGBaseline *iq_matrix,
+                  const VASliceParameterBufferJPEGBaseline *slice_param,
+                  const struct jpeg_sw_huffman *dc_tables,
+                  const struct jpeg_sw_huffman *ac_tables,
+                  struct i965_jpeg_sw_plane *planes,
+                  int max_h)
+{
+    int i, j;
+
+    if (slice_param->num_components < 1 || slice_param->num_components > 4 ||
+        slice_param->num_mcus == 0)
+        return false;
+
+    scan->num_components = slice_param->num_components;
+
+    for (i = 0; i < scan->num_components; i++) {
+        struct jpeg_sw_scan_component *component = &scan->components[i];
+        int dc = slice_param->components[i].dc_table_selector;
+        int ac = slice_param->components[i].ac_table_selector;
+        int index, qt;
+
+        index = jpeg_sw_find_component(pic_param, slice_param->components[i].component_selector);
+
+        if (index < 0 || dc > 1 || ac > 1 || !dc_tables[dc].valid || !ac_tables[ac].valid)
+            return false;
+
+        qt = pic_param->components[index].quantiser_table_selector;
+
+        if (qt > 3)
+            return false;
+
+        component->plane = &planes[index];
+        component->dc_table = &dc_tables[dc];
+        component->ac_table = &ac_tables[ac];
+
+        for (j = 0; j < 64; j++)
+            component->qt[j] = iq_matrix->quantiser_table[qt][j];
+
+        /* One block per MCU in non-interleaved scans */
+        if (scan->num_components == 1) {
+            int width = (pic_param->picture_width * pic_param->components[index].h_sampling_factor + max_h - 1) / max_h;
+
+            component->h = 1;
+            component->v = 1;
+            scan->mcus_per_row = (width + 7) / 8;
+        } else {
+            component->h = pic_param->components[index].h_sampling_factor;
+            component->v = pic_param->components[index].v_sampling_factor;
+            scan->mcus_per_row = (pic_param->picture_width + max_h * 8 - 1) / (max_h * 8);
+        }
+    }
+
+    return true;
+}
+
+int
+i965_jpeg_sw_decode(const VAPictureParameterBufferJPEGBaseline *pic_param,
+                    const VAIQMatrixBufferJPEGBaseline *iq_matrix,
+                    const VAHuffmanTableBufferJPEGBaseline *huffman_table,
+                    const struct i965_jpeg_sw_slice *slices,
+                    int num_slices,
+                    struct i965_jpeg_sw_plane *planes,
+                    int max_threads)
+{
+    struct jpeg_sw_huffman dc_tables[2], ac_tables[2];
+    struct jpeg_sw_scan *scans = NULL;
+    struct jpeg_sw_segment *segments = NULL;
+    struct jpeg_sw_worker workers[I965_JPEG_SW_MAX_THREADS];
+    int max_h = 1, num_segments = 0, total_mcus = 0;
+    int num_workers, num_errors = -1;
+    int i;
+
+    if (pic_param->num_components < 1 || pic_param->num_components > 4 ||
+        !pic_param->picture_width || !pic_param->picture_height)
+        return -1;
+
+    for (i = 0; i < pic_param->num_components; i++) {
+        int h = pic_param->components[i].h_sampling_factor;
+        int v = pic_param->components[i].v_sampling_factor;
+
+        if (h < 1 || h > 4 || v < 1 || v > 4)
+            return -1;
+
+        max_h = MAX(max_h, h);
+    }
+
+    for (i = 0; i < 2; i++) {
+        jpeg_sw_build_huffman(&dc_tables[i],
+                              huffman_table->huffman_table[i].num_dc_codes,
+                              huffman_table->huffman_table[i].dc_values,
+                              sizeof(huffman_table->huffman_table[i].dc_values));
+        jpeg_sw_build_huffman(&ac_tables[i],
+                              huffman_table->huffman_table[i].num_ac_codes,
+                              huffman_table->huffman_table[i].ac_values,
+                              sizeof(huffman_table->huffman_table[i].ac_values));
+    }
+
+    scans = calloc(num_slices, sizeof(*scans));
+
+    if (!scans)
+        goto out;
+
+    for (i = 0; i < num_slices; i++) {
+        const VASliceParameterBufferJPEGBaseline *slice_param = slices[i].slice_param;
+        int interval = slice_param->restart_interval;
+
+        if (!jpeg_sw_init_scan(&scans[i], pic_param, iq_matrix, slice_param,
+                               dc_tables, ac_tables, planes, max_h))
+            goto out;
+
+        if (!interval || interval >= slice_param->num_mcus)
+            interval = slice_param->num_mcus;
+
+        num_segments += (slice_param->num_mcus + interval - 1) / interval;
+        total_mcus += slice_param->num_mcus;
+    }
+
+    segments = calloc(num_segments, sizeof(*segments));
+
+    if (!segments)
+        goto out;
+
+    for (i = 0, num_segments = 0; i < num_slices; i++) {
+        const VASliceParameterBufferJPEGBaseline *slice_param = slices[i].slice_param;
+        unsigned int offset = MIN(slice_param->slice_data_offset, slices[i].data_size);
+        unsigned int size = MIN(slice_param->slice_data_size, slices[i].data_size - offset);
+        int first_mcu = slice_param->slice_vertical_position * scans[i].mcus_per_row +
+            slice_param->slice_horizontal_position;
+
+        num_segments += jpeg_sw_split_slice(&scans[i], slice_param,
+                                            slices[i].data + offset,
+                                            slices[i].data + offset + size,
+                                            first_mcu,
+                                            segments + num_segments);
+    }
+
+    num_workers = MIN(max_threads, total_mcus / JPEG_SW_MIN_MCUS_PER_THREAD);
+    num_workers = CLAMP(1, MIN(num_segments, I965_JPEG_SW_MAX_THREADS), num_workers);
+
+    for (i = 0; i < num_workers; i++) {
+        int first = num_segments * i / num_workers;
+
+        workers[i].segments = segments + first;
+        workers[i].num_segments = num_segments * (i + 1) / num_workers - first;
+        workers[i].num_errors = 0;
+
+        /* The calling thread takes the first share */
+        workers[i].started = (i > 0 &&
+                              !pthread_create(&workers[i].thread, NULL,
+                                              jpeg_sw_worker_thread, &workers[i]));
+    }
+
+    jpeg_sw_worker_thread(&workers[0]);
+    num_errors = workers[0].num_errors;
+
+    for (i = 1; i < num_workers; i++) {
+        if (workers[i].started)
+            pthread_join(workers[i].thread, NULL);
+        else
+            jpeg_sw_worker_thread(&workers[i]);
+
+        num_errors += workers[i].num_errors;
+    }
+
+out:
+    free(segments);
+    free(scans);
+
+    return num_errors;
+}
+
+static bool
+jpeg_sw_get_surface_format(const VAPictureParameterBufferJPEGBaseline *pic_param,
+                           unsigned int *fourcc,
+                           unsigned int *subsampling)
+{
+    int h1, h2, h3, v1, v2, v3;
+
+    if (pic_param->num_components == 1) {
+        *subsampling = SUBSAMPLE_YUV400;
+        *fourcc = VA_FOURCC_Y800;
+
+        return true;
+    }
+
+    if (pic_param->num_components != 3)
+        return false;
+
+    h1 = pic_param->components[0].h_sampling_factor;
+    h2 = pic_param->components[1].h_sampling_factor;
+    h3 = pic_param->components[2].h_sampling_factor;
+    v1 = pic_param->components[0].v_sampling_factor;
+    v2 = pic_param->components[1].v_sampling_factor;
+    v3 = pic_param->components[2].v_sampling_factor;
+
+    /* Same layouts as the hardware path */
+    if (h1 == 2 && h2 == 1 && h3 == 1 &&
+        v1 == 2 && v2 == 1 && v3 == 1) {
+        *subsampling = SUBSAMPLE_YUV420;
+        *fourcc = VA_FOURCC_IMC3;
+    } else if (h1 == 2 && h2 == 1 && h3 == 1 &&
+               v1 == 1 && v2 == 1 && v3 == 1) {
+        *subsampling = SUBSAMPLE_YUV422H;
+        *fourcc = VA_FOURCC_422H;
+    } else if (h1 == 1 && h2 == 1 && h3 == 1 &&
+               v1 == 1 && v2 == 1 && v3 == 1) {
+        *subsampling = SUBSAMPLE_YUV444;
+        *fourcc = VA_FOURCC_444P;
+    } else if (h1 == 4 && h2 == 1 && h3 == 1 &&
+               v1 == 1 && v2 == 1 && v3 == 1) {
+        *subsampling = SUBSAMPLE_YUV411;
+        *fourcc = VA_FOURCC_411P;
+    } else if (h1 == 1 && h2 == 1 && h3 == 1 &&
+               v1 == 2 && v2 == 1 && v3 == 1) {
+        *subsampling = SUBSAMPLE_YUV422V;
+        *fourcc = VA_FOURCC_422V;
+    } else if (h1 == 2 && h2 == 1 && h3 == 1 &&
+               v1 == 2 && v2 == 2 && v3 == 2) {
+        *subsampling = SUBSAMPLE_YUV422H;
+        *fourcc = VA_FOURCC_422H;
+    } else if (h1 == 2 && h2 == 2 && h3 == 2 &&
+               v1 == 2 && v2 == 1 && v3 == 1) {
+        *subsampling = SUBSAMPLE_YUV422V;
+        *fourcc = VA_FOURCC_422V;
+    } else
+        return false;
+
+    return true;
+}
+
+/* Whether the restart markers of a slice are all there and in order */
+static bool
+jpeg_sw_check_restart_markers(const uint8_t *ptr, const uint8_t *end, int num_markers)
+{
+    int n = 0;
+
+    while (ptr + 1 < end) {
+        const uint8_t *marker = memchr(ptr, 0xff, end - ptr - 1);
+
+        if (!marker)
+            break;
+
+        ptr = marker + 1;
+
+        if (*ptr == 0x00 || *ptr == 0xff)
+            continue;
+
+        /* Any other marker ends the entropy-coded data */
+        if (*ptr < 0xd0 || *ptr > 0xd7)
+            break;
+
+        if (n == num_markers || (*ptr & 7) != (n & 7))
+            return false;
+
+        n++;
+        ptr++;
+    }
+
+    return n == num_markers;
+}
+
+/* Whether the layout and the table selectors are ones i965_jpeg_sw_decode() takes */
+static bool
+jpeg_sw_can_decode(struct decode_state *decode_state)
+{
+    VAPictureParameterBufferJPEGBaseline *pic_param;
+    VASliceParameterBufferJPEGBaseline *slice_param;
+    unsigned int fourcc, subsampling;
+    int i, j, c;
+
+    pic_param = (VAPictureParameterBufferJPEGBaseline *)decode_state->pic_param->buffer;
+
+    if (!jpeg_sw_get_surface_format(pic_param, &fourcc, &subsampling))
+        return false;
+
+    for (j = 0; j < decode_state->num_slice_params; j++) {
+        slice_param = (VASliceParameterBufferJPEGBaseline *)decode_state->slice_params[j]->buffer;
+
+        for (i = 0; i < decode_state->slice_params[j]->num_elements; i++, slice_param++) {
+            for (c = 0; c < slice_param->num_components; c++) {
+                if (slice_param->components[c].dc_table_selector > 1 ||
+                    slice_param->components[c].ac_table_selector > 1)
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Catches entropy-coded data the MFX engine would decode into garbage */
+static bool
+jpeg_sw_hw_can_decode(struct decode_state *decode_state)
+{
+    VASliceParameterBufferJPEGBaseline *slice_param;
+    dri_bo *bo;
+    bool ok = true;
+    int i, j;
+
+    for (j = 0; j < decode_state->num_slice_params && ok; j++) {
+        slice_param = (VASliceParameterBufferJPEGBaseline *)decode_state->slice_params[j]->buffer;
+        bo = decode_state->slice_datas[j]->bo;
+
+        if (!bo || dri_bo_map(bo, 0))
+            return false;
+
+        for (i = 0; i < decode_state->slice_params[j]->num_elements && ok; i++, slice_param++) {
+            int interval = slice_param->restart_interval;
+            int num_markers = 0;
+
+            if (slice_param->slice_data_flag != VA_SLICE_DATA_FLAG_ALL ||
+                slice_param->slice_data_offset > bo->size ||
+                slice_param->slice_data_size > bo->size - slice_param->slice_data_offset) {
+                ok = false;
+                break;
+            }
+
+            if (interval && slice_param->num_mcus > interval)
+                num_markers = (slice_param->num_mcus - 1) / interval;
+
+            if (ok)
+                ok = jpeg_sw_check_restart_markers((uint8_t *)bo->virtual + slice_param->slice_data_offset,
+                                                   (uint8_t *)bo->virtual + slice_param->slice_data_offset +
+                                                   slice_param->slice_data_size,
+                                                   num_markers);
+        }
+
+        dri_bo_unmap(bo);
+    }
+
+    return ok;
+}
+
+bool
+i965_jpeg_sw_decode_wanted(VADriverContextP ctx, struct decode_state *decode_state)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+
+    switch (i965->jpeg_sw_decode) {
+    case I965_JPEG_SW_DECODE_ALWAYS:
+        return true;
+
+    case I965_JPEG_SW_DECODE_FALLBACK:
+        /* Pictures neither path takes still fail in the hardware path */
+        return (jpeg_sw_can_decode(decode_state) &&
+                !jpeg_sw_hw_can_decode(decode_state));
+
+    default:
+        return false;
+    }
+}
+
+VAStatus
+i965_jpeg_sw_decode_picture(VADriverContextP ctx, struct decode_state *decode_state)
+{
+    struct object_surface *obj_surface = decode_state->render_object;
+    VAPictureParameterBufferJPEGBaseline *pic_param;
+    VASliceParameterBufferJPEGBaseline *slice_param;
+    struct i965_jpeg_sw_slice *slices;
+    struct i965_jpeg_sw_plane planes[3];
+    unsigned int fourcc, subsampling;
+    uint8_t *data;
+    int num_slices = 0, num_threads, num_errors = -1;
+    int i, j;
+
+    if (!decode_state->pic_param || !decode_state->iq_matrix || !decode_state->huffman_table)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    pic_param = (VAPictureParameterBufferJPEGBaseline *)decode_state->pic_param->buffer;
+
+    if (!jpeg_sw_get_surface_format(pic_param, &fourcc, &subsampling))
+        return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+
+    i965_check_alloc_surface_bo(ctx, obj_surface, 1, fourcc, subsampling);
+
+    if (!obj_surface->bo)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    for (j = 0; j < decode_state->num_slice_params; j++)
+        num_slices += decode_state->slice_params[j]->num_elements;
+
+    slices = calloc(num_slices, sizeof(*slices));
+
+    if (!slices)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    for (j = 0, num_slices = 0; j < decode_state->num_slice_params; j++) {
+        dri_bo *bo = decode_state->slice_datas[j]->bo;
+
+        slice_param = (VASliceParameterBufferJPEGBaseline *)decode_state->slice_params[j]->buffer;
+        dri_bo_map(bo, 0);
+
+        for (i = 0; i < decode_state->slice_params[j]->num_elements; i++) {
+            slices[num_slices].slice_param = slice_param++;
+            slices[num_slices].data = bo->virtual;
+            slices[num_slices].data_size = bo->virtual ? bo->size : 0;
+            num_slices++;
+        }
+    }
+
+    /* Same layout as the surfaces the hardware decodes into */
+    drm_intel_gem_bo_map_gtt(obj_surface->bo);
+    data = obj_surface->bo->virtual;
+
+    if (data) {
+        planes[0].data = data;
+        planes[0].pitch = obj_surface->width;
+        planes[0].width = obj_surface->width;
+        planes[0].height = obj_surface->height;
+
+        planes[1].data = data + obj_surface->y_cb_offset * obj_surface->width;
+        planes[1].pitch = obj_surface->cb_cr_pitch;
+        planes[1].width = obj_surface->cb_cr_pitch;
+        planes[1].height = obj_surface->y_cr_offset - obj_surface->y_cb_offset;
+
+        planes[2] = planes[1];
+        planes[2].data = data + obj_surface->y_cr_offset * obj_surface->width;
+
+        num_threads = CLAMP(1, I965_JPEG_SW_MAX_THREADS, sysconf(_SC_NPROCESSORS_ONLN));
+        num_errors = i965_jpeg_sw_decode(pic_param,
+                                         (VAIQMatrixBufferJPEGBaseline *)decode_state->iq_matrix->buffer,
+                                         (VAHuffmanTableBufferJPEGBaseline *)decode_state->huffman_table->buffer,
+                                         slices,
+                                         num_slices,
+                                         planes,
+                                         num_threads);
+    }
+
+    drm_intel_gem_bo_unmap_gtt(obj_surface->bo);
+
+    for (j = 0; j < decode_state->num_slice_params; j++)
+        dri_bo_unmap(decode_state->slice_datas[j]->bo);
+
+    free(slices);
+
+    if (num_errors < 0)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    if (num_errors > 0)
+        WARN_ONCE("concealed damaged restart intervals in a JPEG picture\n");
+
+    return VA_STATUS_SUCCESS;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_JPEG_SW_DECODER_H
+#define I965_JPEG_SW_DECODER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <va/va.h>
+#include <va/va_backend.h>
+#include <va/va_dec_jpeg.h>
+
+/*
+ * CPU decoder for baseline JPEG pictures. VA_INTEL_JPEG_SW_DECODE=1 uses
+ * it for the pictures the MFX engine would decode into garbage: damaged
+ * or truncated entropy-coded data, missing or out of order restart
+ * markers. VA_INTEL_JPEG_SW_DECODE=2 uses it for every picture. It takes
+ * the same layouts and table selectors as the hardware path, consumes
+ * the same VA buffers and writes the components straight into the
+ * planes of the render target.
+ *
+ * Restart intervals are byte aligned and reset the DC predictors, so
+ * they are decoded independently, on several threads for big pictures.
+ * An interval with an invalid code is concealed with flat blocks and
+ * decoding resumes at the next restart marker.
+ */
+#define I965_JPEG_SW_DECODE_OFF         0
+#define I965_JPEG_SW_DECODE_FALLBACK    1       /* when the hardware can't decode the picture */
+#define I965_JPEG_SW_DECODE_ALWAYS      2
+
+#define I965_JPEG_SW_MAX_THREADS        8
+
+struct decode_state;
+
+struct i965_jpeg_sw_plane
+{
+    uint8_t *data;
+    int pitch;
+    int width;                  /* the writable area, blocks are clipped to it */
+    int height;
+};
+
+struct i965_jpeg_sw_slice
+{
+    const VASliceParameterBufferJPEGBaseline *slice_param;
+    const uint8_t *data;        /* slice_data_offset is relative to this */
+    unsigned int data_size;
+};
+
+/*
+ * Decodes a picture into @planes, one per component of @pic_param.
+ * Returns the number of concealed restart intervals, or -1 if the
+ * parameters can't describe a baseline picture.
+ */
+int
+i965_jpeg_sw_decode(const VAPictureParameterBufferJPEGBaseline *pic_param,
+                    const VAIQMatrixBufferJPEGBaseline *iq_matrix,
+                    const VAHuffmanTableBufferJPEGBaseline *huffman_table,
+                    const struct i965_jpeg_sw_slice *slices,
+                    int num_slices,
+                    struct i965_jpeg_sw_plane *planes,
+                    int max_threads);
+
+bool
+i965_jpeg_sw_decode_wanted(VADriverContextP ctx, struct decode_state *decode_state);
+
+VAStatus
+i965_jpeg_sw_decode_picture(VADriverContextP ctx, struct decode_state *decode_state);
+
+#endif /* I965_JPEG_SW_DECODER_H */
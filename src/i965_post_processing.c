@@ -39,9 +39,12 @@
 #include "i965_post_processing.h"
 #include "i965_render.h"
 #include "i965_yuv_coefs.h"
+#include "i965_vpp_field_rate.h"
+#include "i965_vpp_sw.h"
 #include "intel_media.h"
 
 #include "gen75_picture_process.h"
+#include "intel_gen_vppapi.h"
 
 extern VAStatus
 vpp_surface_convert(VADriverContextP ctx,
@@ -4784,7 +4787,7 @@ rgb_to_yuv(unsigned int argb,
     *a = ((argb >> 24) & 0xff);
 }
 
-static void 
+static VAStatus
 i965_vpp_clear_surface(VADriverContextP ctx,
                        struct i965_post_processing_context *pp_context,
                        struct object_surface *obj_surface,
@@ -4797,18 +4800,20 @@ i965_vpp_clear_surface(VADriverContextP ctx,
     int pitch;
     unsigned char y, u, v, a = 0;
     int region_width, region_height;
+    int use_reloc64 = (IS_GEN8(i965->intel.device_info) ||
+                       IS_GEN9(i965->intel.device_info));
 
     /* Currently only support NV12 surface */
     if (!obj_surface || obj_surface->fourcc != VA_FOURCC_NV12)
-        return;
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
 
     rgb_to_yuv(color, &y, &u, &v, &a);
 
     if (a == 0)
-        return;
+        return VA_STATUS_SUCCESS;
 
     dri_bo_get_tiling(obj_surface->bo, &tiling, &swizzle);
-    blt_cmd = XY_COLOR_BLT_CMD;
+    blt_cmd = use_reloc64 ? GEN8_XY_COLOR_BLT_CMD : XY_COLOR_BLT_CMD;
     pitch = obj_surface->width;
 
     if (tiling != I915_TILING_NONE) {
@@ -4824,6 +4829,9 @@ i965_vpp_clear_surface(VADriverContextP ctx,
     if (IS_IRONLAKE(i965->intel.device_info)) {
         intel_batchbuffer_start_atomic(batch, 48);
         BEGIN_BATCH(batch, 12);
+    } else if (use_reloc64) {
+        intel_batchbuffer_start_atomic_blt(batch, 56);
+        BEGIN_BLT_BATCH(batch, 14);
     } else {
         /* Will double-check the command if the new chipset is added */
         intel_batchbuffer_start_atomic_blt(batch, 48);
@@ -4841,9 +4849,14 @@ i965_vpp_clear_surface(VADriverContextP ctx,
     OUT_BATCH(batch,
               region_height << 16 |
               region_width);
-    OUT_RELOC(batch, obj_surface->bo, 
-              I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
-              0);
+    if (use_reloc64)
+        OUT_RELOC64(batch, obj_surface->bo,
+                    I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
+                    0);
+    else
+        OUT_RELOC(batch, obj_surface->bo, 
+                  I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
+                  0);
     OUT_BATCH(batch, y);
 
     br13 = 0xf0 << 16;
@@ -4865,13 +4878,20 @@ i965_vpp_clear_surface(VADriverContextP ctx,
     OUT_BATCH(batch,
               region_height << 16 |
               region_width);
-    OUT_RELOC(batch, obj_surface->bo, 
-              I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
-              obj_surface->width * obj_surface->y_cb_offset);
+    if (use_reloc64)
+        OUT_RELOC64(batch, obj_surface->bo,
+                    I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
+                    obj_surface->width * obj_surface->y_cb_offset);
+    else
+        OUT_RELOC(batch, obj_surface->bo, 
+                  I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
+                  obj_surface->width * obj_surface->y_cb_offset);
     OUT_BATCH(batch, v << 8 | u);
 
     ADVANCE_BATCH(batch);
     intel_batchbuffer_end_atomic(batch);
+
+    return VA_STATUS_SUCCESS;
 }
 
 VAStatus
@@ -5485,6 +5505,9 @@ i965_image_processing(VADriverContextP ctx,
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     VAStatus status = VA_STATUS_ERROR_UNIMPLEMENTED;
 
+    if (i965->vpp_sw == I965_VPP_SW_ALWAYS)
+        return i965_vpp_sw_image_processing(ctx, src_surface, src_rect, dst_surface, dst_rect);
+
     if (HAS_VPP(i965)) {
         int fourcc = pp_get_surface_fourcc(ctx, src_surface);
 
@@ -5547,9 +5570,43 @@ i965_image_processing(VADriverContextP ctx,
         _i965UnlockMutex(&i965->pp_mutex);
     }
 
+    if (status == VA_STATUS_ERROR_UNIMPLEMENTED && i965->vpp_sw == I965_VPP_SW_FALLBACK)
+        status = i965_vpp_sw_image_processing(ctx, src_surface, src_rect, dst_surface, dst_rect);
+
     return status;
 }       
 
+void
+i965_post_processing_prepare_avs(VADriverContextP ctx,
+                                 const VARectangle *src_rect,
+                                 const VARectangle *dst_rects,
+                                 int num_rects,
+                                 unsigned int filter_flags)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_post_processing_context *pp_context = i965->pp_context;
+    AVSState *avs;
+    int i;
+
+    if (!pp_context || !avs_is_needed(filter_flags))
+        return;
+
+    avs = &pp_context->pp_avs_context.state;
+
+    if (!avs->config)
+        return;
+
+    _i965LockMutex(&i965->pp_mutex);
+
+    for (i = 0; i < num_rects; i++)
+        avs_prepare_coefficients(avs,
+                                 (float)dst_rects[i].width / src_rect->width,
+                                 (float)dst_rects[i].height / src_rect->height,
+                                 filter_flags);
+
+    _i965UnlockMutex(&i965->pp_mutex);
+}
+
 static void
 i965_post_processing_context_finalize(VADriverContextP ctx,
     struct i965_post_processing_context *pp_context)
@@ -5719,6 +5776,17 @@ static const int procfilter_to_pp_flag[VAProcFilterCount] = {
     PP_NULL,    /* VAProcFilterColorBalance */
 };
 
+/* The kernel of a filter type, PP_NULL for the types the driver doesn't
+ * run here, -1 for types outside of VAProcFilterType, e.g. private ones */
+static int
+i965_proc_filter_kernel(VAProcFilterType type)
+{
+    if ((unsigned int)type >= ARRAY_ELEMS(procfilter_to_pp_flag))
+        return -1;
+
+    return procfilter_to_pp_flag[type];
+}
+
 static const int proc_frame_to_pp_frame[3] = {
     I965_SURFACE_FLAG_FRAME,
     I965_SURFACE_FLAG_TOP_FIELD_FIRST,
@@ -5843,6 +5911,9 @@ i965_proc_picture_fast(VADriverContextP ctx,
     if (pipeline_param->num_filters > 0 && !pipeline_param->filters)
         return VA_STATUS_ERROR_INVALID_PARAMETER;
 
+    if (pipeline_param->num_additional_outputs > 0)
+        return VA_STATUS_ERROR_UNIMPLEMENTED; // full pipeline is needed
+
     for (i = 0; i < pipeline_param->num_filters; i++) {
         const VAProcFilterParameterBuffer *filter;
         struct object_buffer * const obj_buffer =
@@ -5963,6 +6034,445 @@ i965_proc_picture_fast(VADriverContextP ctx,
     return status;
 }
 
+VAStatus
+i965_proc_surface_pool_get(VADriverContextP ctx,
+                           struct i965_proc_surface_pool *pool,
+                           int width,
+                           int height,
+                           unsigned int fourcc,
+                           int tiled,
+                           struct object_surface **out_surface)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_proc_surface_pool_entry *entry, *free_entry = NULL;
+    struct object_surface *obj_surface;
+    VAStatus status;
+    int i;
+
+    for (i = 0; i < I965_PROC_SURFACE_POOL_SIZE; i++) {
+        entry = &pool->entries[i];
+
+        if (entry->in_use)
+            continue;
+
+        if (entry->surface_id != VA_INVALID_ID &&
+            entry->fourcc == fourcc &&
+            entry->width == width &&
+            entry->height == height &&
+            entry->tiled == tiled) {
+            entry->in_use = 1;
+            entry->last_frame = pool->frame;
+            pool->num_reuses++;
+            *out_surface = SURFACE(entry->surface_id);
+
+            return VA_STATUS_SUCCESS;
+        }
+
+        /* An empty slot, or else the least recently used surface */
+        if (!free_entry ||
+            (free_entry->surface_id != VA_INVALID_ID &&
+             (entry->surface_id == VA_INVALID_ID || entry->last_frame < free_entry->last_frame)))
+            free_entry = entry;
+    }
+
+    if (!free_entry)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    if (free_entry->surface_id != VA_INVALID_ID) {
+        i965_DestroySurfaces(ctx, &free_entry->surface_id, 1);
+        free_entry->surface_id = VA_INVALID_ID;
+        pool->num_releases++;
+    }
+
+    status = i965_CreateSurfaces(ctx,
+                                 width,
+                                 height,
+                                 VA_RT_FORMAT_YUV420,
+                                 1,
+                                 &free_entry->surface_id);
+
+    if (status != VA_STATUS_SUCCESS) {
+        free_entry->surface_id = VA_INVALID_ID;
+        return status;
+    }
+
+    obj_surface = SURFACE(free_entry->surface_id);
+    assert(obj_surface);
+    i965_check_alloc_surface_bo(ctx, obj_surface, tiled, fourcc, SUBSAMPLE_YUV420);
+
+    if (!obj_surface->bo) {
+        i965_DestroySurfaces(ctx, &free_entry->surface_id, 1);
+        free_entry->surface_id = VA_INVALID_ID;
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    free_entry->fourcc = fourcc;
+    free_entry->width = width;
+    free_entry->height = height;
+    free_entry->tiled = tiled;
+    free_entry->in_use = 1;
+    free_entry->last_frame = pool->frame;
+    pool->num_allocations++;
+    *out_surface = obj_surface;
+
+    return VA_STATUS_SUCCESS;
+}
+
+void
+i965_proc_surface_pool_release(VADriverContextP ctx,
+                               struct i965_proc_surface_pool *pool)
+{
+    struct i965_proc_surface_pool_entry *entry;
+    int i;
+
+    pool->frame++;
+
+    for (i = 0; i < I965_PROC_SURFACE_POOL_SIZE; i++) {
+        entry = &pool->entries[i];
+        entry->in_use = 0;
+
+        if (entry->surface_id != VA_INVALID_ID &&
+            pool->frame - entry->last_frame > I965_PROC_SURFACE_POOL_IDLE_FRAMES) {
+            i965_DestroySurfaces(ctx, &entry->surface_id, 1);
+            entry->surface_id = VA_INVALID_ID;
+            pool->num_releases++;
+        }
+    }
+}
+
+void
+i965_proc_surface_pool_init(struct i965_proc_surface_pool *pool)
+{
+    int i;
+
+    memset(pool, 0, sizeof(*pool));
+
+    for (i = 0; i < I965_PROC_SURFACE_POOL_SIZE; i++)
+        pool->entries[i].surface_id = VA_INVALID_ID;
+}
+
+void
+i965_proc_surface_pool_destroy(VADriverContextP ctx,
+                               struct i965_proc_surface_pool *pool)
+{
+    int i;
+
+    for (i = 0; i < I965_PROC_SURFACE_POOL_SIZE; i++) {
+        if (pool->entries[i].surface_id != VA_INVALID_ID)
+            i965_DestroySurfaces(ctx, &pool->entries[i].surface_id, 1);
+    }
+
+    i965_proc_surface_pool_init(pool);
+}
+
+/*
+ * The load/save kernels of Gen7+ convert and scale in the same walk, so
+ * the input only goes through an intermediate NV12 surface when a filter
+ * kernel has to read it. The background fill is dropped when the output
+ * region covers the whole target.
+ */
+void
+i965_proc_picture_plan(VADriverContextP ctx,
+                       struct i965_proc_context *proc_context,
+                       VAProcPipelineParameterBuffer *pipeline_param,
+                       struct object_surface *src_obj_surface,
+                       struct object_surface *dst_obj_surface,
+                       struct i965_proc_plan *plan)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    const VARectangle *output_region = pipeline_param->output_region;
+    int i;
+
+    memset(plan, 0, sizeof(*plan));
+
+    for (i = 0; i < pipeline_param->num_filters; i++) {
+        struct object_buffer *obj_buffer = BUFFER(pipeline_param->filters[i]);
+        VAProcFilterParameterBufferBase *filter_param;
+        int kernel_index;
+
+        /* Rejected when the filters are run */
+        if (!obj_buffer ||
+            !obj_buffer->buffer_store ||
+            !obj_buffer->buffer_store->buffer)
+            continue;
+
+        filter_param = (VAProcFilterParameterBufferBase *)obj_buffer->buffer_store->buffer;
+        kernel_index = i965_proc_filter_kernel(filter_param->type);
+
+        if (kernel_index > PP_NULL &&
+            proc_context->pp_context.pp_modules[kernel_index].kernel.bo != NULL)
+            plan->num_filter_passes++;
+    }
+
+    plan->convert_input = (src_obj_surface->fourcc != VA_FOURCC_NV12);
+
+    if (plan->convert_input &&
+        plan->num_filter_passes == 0 &&
+        !(pipeline_param->filter_flags & (VA_TOP_FIELD | VA_BOTTOM_FIELD)) &&
+        (IS_GEN7(i965->intel.device_info) ||
+         IS_GEN8(i965->intel.device_info) ||
+         IS_GEN9(i965->intel.device_info)))
+        plan->convert_input = 0;
+
+    plan->clear_output = 1;
+
+    if (!output_region ||
+        (output_region->x <= 0 &&
+         output_region->y <= 0 &&
+         output_region->x + output_region->width >= dst_obj_surface->orig_width &&
+         output_region->y + output_region->height >= dst_obj_surface->orig_height))
+        plan->clear_output = 0;
+}
+
+static void
+i965_proc_picture_count_passes(struct i965_proc_context *proc_context,
+                               unsigned int num_passes)
+{
+    proc_context->num_pictures++;
+    proc_context->num_passes += num_passes;
+    proc_context->last_num_passes = num_passes;
+}
+
+static int
+i965_proc_layer_is_hidden(const VAProcPipelineParameterBuffer *layer)
+{
+    const VABlendState *blend_state = layer->blend_state;
+
+    return (blend_state &&
+            (blend_state->flags & VA_BLEND_GLOBAL_ALPHA) &&
+            blend_state->global_alpha <= 0.0f);
+}
+
+static int
+i965_proc_layer_is_opaque(const VAProcPipelineParameterBuffer *layer)
+{
+    const VABlendState *blend_state = layer->blend_state;
+
+    if (!blend_state || !blend_state->flags)
+        return 1;
+
+    return (blend_state->flags == VA_BLEND_GLOBAL_ALPHA &&
+            blend_state->global_alpha >= 1.0f);
+}
+
+static int
+i965_proc_is_yuv420p8(unsigned int fourcc)
+{
+    return (fourcc == VA_FOURCC_NV12 || fourcc == VA_FOURCC_I420);
+}
+
+VAStatus
+i965_proc_compose(VADriverContextP ctx,
+                  struct i965_post_processing_context *pp_context,
+                  struct proc_state *proc_state)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    const VAProcPipelineParameterBuffer *layers[I965_PROC_MAX_LAYERS];
+    struct object_surface *obj_src_surfaces[I965_PROC_MAX_LAYERS];
+    VARectangle src_rects[I965_PROC_MAX_LAYERS], dst_rects[I965_PROC_MAX_LAYERS];
+    struct object_surface *obj_dst_surface;
+    struct i965_surface src_surface, dst_surface;
+    VAStatus status = VA_STATUS_SUCCESS;
+    int i, num_layers, covered = 0, pending = 0;
+
+    obj_dst_surface = SURFACE(proc_state->current_render_target);
+
+    if (!obj_dst_surface)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    if (!obj_dst_surface->bo) {
+        unsigned int fourcc = VA_FOURCC_NV12;
+
+        if (obj_dst_surface->expected_format == VA_RT_FORMAT_YUV420_10BPP)
+            fourcc = VA_FOURCC_P010;
+
+        i965_check_alloc_surface_bo(ctx, obj_dst_surface, 1, fourcc, SUBSAMPLE_YUV420);
+    }
+
+    num_layers = 1 + proc_state->num_layer_params;
+    layers[0] = (VAProcPipelineParameterBuffer *)proc_state->pipeline_param->buffer;
+
+    for (i = 1; i < num_layers; i++)
+        layers[i] = (VAProcPipelineParameterBuffer *)proc_state->layer_params[i - 1]->buffer;
+
+    /* Check every layer before anything is written to the target */
+    for (i = 0; i < num_layers; i++) {
+        const VAProcPipelineParameterBuffer *layer = layers[i];
+        struct object_surface *obj_src_surface;
+
+        if (layer->num_filters > 0 || layer->num_additional_outputs > 0)
+            return VA_STATUS_ERROR_UNIMPLEMENTED;
+
+        /* No blending kernel, a layer is either drawn or skipped */
+        if (!i965_proc_layer_is_opaque(layer) && !i965_proc_layer_is_hidden(layer))
+            return VA_STATUS_ERROR_UNIMPLEMENTED;
+
+        obj_src_surface = SURFACE(layer->surface);
+
+        if (!obj_src_surface || !obj_src_surface->bo)
+            return VA_STATUS_ERROR_INVALID_SURFACE;
+
+        if (layer->surface_region) {
+            src_rects[i] = *layer->surface_region;
+        } else {
+            src_rects[i].x = 0;
+            src_rects[i].y = 0;
+            src_rects[i].width = obj_src_surface->orig_width;
+            src_rects[i].height = obj_src_surface->orig_height;
+        }
+
+        if (layer->output_region) {
+            dst_rects[i] = *layer->output_region;
+        } else {
+            dst_rects[i].x = 0;
+            dst_rects[i].y = 0;
+            dst_rects[i].width = obj_dst_surface->orig_width;
+            dst_rects[i].height = obj_dst_surface->orig_height;
+        }
+
+        if (dst_rects[i].x < 0 || dst_rects[i].y < 0 ||
+            dst_rects[i].x + dst_rects[i].width > obj_dst_surface->orig_width ||
+            dst_rects[i].y + dst_rects[i].height > obj_dst_surface->orig_height)
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+        if (!i965_proc_layer_is_hidden(layer) &&
+            dst_rects[i].x == 0 && dst_rects[i].y == 0 &&
+            dst_rects[i].width == obj_dst_surface->orig_width &&
+            dst_rects[i].height == obj_dst_surface->orig_height)
+            covered = 1;
+
+        obj_src_surfaces[i] = obj_src_surface;
+    }
+
+    /* The fill comes first, a target it can't fill is left untouched */
+    if (!covered) {
+        status = i965_vpp_clear_surface(ctx, pp_context, obj_dst_surface,
+                                        layers[0]->output_background_color);
+
+        if (status != VA_STATUS_SUCCESS)
+            return status;
+
+        pending = 1;
+    }
+
+    dst_surface.base = (struct object_base *)obj_dst_surface;
+    dst_surface.type = I965_SURFACE_TYPE_SURFACE;
+    dst_surface.flags = I965_SURFACE_FLAG_FRAME;
+
+    /*
+     * 8-bit 4:2:0 layers go through the GPE scaling kernel: all their walks
+     * share one batch, the sampler state and the kernel. Its writes are 4
+     * pixel aligned, so layers starting elsewhere would spill over their
+     * left neighbours and take the post processing kernels instead.
+     */
+    for (i = 0; i < num_layers && status == VA_STATUS_SUCCESS; i++) {
+        if (i965_proc_layer_is_hidden(layers[i]))
+            continue;
+
+        src_surface.base = (struct object_base *)obj_src_surfaces[i];
+        src_surface.type = I965_SURFACE_TYPE_SURFACE;
+        src_surface.flags = I965_SURFACE_FLAG_FRAME;
+
+        if (pp_context->scaling_context_initialized &&
+            i965_proc_is_yuv420p8(obj_src_surfaces[i]->fourcc) &&
+            i965_proc_is_yuv420p8(obj_dst_surface->fourcc) &&
+            (dst_rects[i].x % 4) == 0) {
+            pp_context->defer_flush = 1;
+            status = intel_yuv420p8_scaling_post_processing(ctx, pp_context,
+                                                            &src_surface, &src_rects[i],
+                                                            &dst_surface, &dst_rects[i]);
+            pp_context->defer_flush = 0;
+            pending = 1;
+            continue;
+        }
+
+        /* Keep the layers in order on the target */
+        if (pending) {
+            intel_batchbuffer_flush(pp_context->batch);
+            pending = 0;
+        }
+
+        status = i965_image_processing(ctx, &src_surface, &src_rects[i],
+                                       &dst_surface, &dst_rects[i]);
+    }
+
+    intel_batchbuffer_flush(pp_context->batch);
+
+    return status;
+}
+
+int
+i965_proc_field_rate_filter(VADriverContextP ctx,
+                            const VAProcPipelineParameterBuffer *pipeline_param,
+                            struct object_surface *obj_dst_surf)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    const VAProcFilterParameterBufferDeinterlacing *deint_params = NULL;
+    struct object_surface *obj_field_surf;
+    unsigned int tff, is_top_field, fourcc, field_fourcc;
+    int i, index = -1, width, height;
+
+    if (pipeline_param->num_additional_outputs != 1 ||
+        !pipeline_param->additional_outputs ||
+        !pipeline_param->filters ||
+        !obj_dst_surf)
+        return -1;
+
+    for (i = 0; i < pipeline_param->num_filters; i++) {
+        struct object_buffer *obj_buffer = BUFFER(pipeline_param->filters[i]);
+        VAProcFilterParameterBufferBase *filter_param;
+
+        if (!obj_buffer ||
+            !obj_buffer->buffer_store ||
+            !obj_buffer->buffer_store->buffer)
+            return -1;
+
+        filter_param = (VAProcFilterParameterBufferBase *)obj_buffer->buffer_store->buffer;
+
+        if (filter_param->type == VAProcFilterDeinterlacing) {
+            deint_params = (VAProcFilterParameterBufferDeinterlacing *)filter_param;
+            index = i;
+        }
+    }
+
+    if (!deint_params ||
+        !(deint_params->flags & VA_DEINTERLACING_FIELD_RATE_INTEL) ||
+        (deint_params->algorithm != VAProcDeinterlacingMotionAdaptive &&
+         deint_params->algorithm != VAProcDeinterlacingMotionCompensated) ||
+        (deint_params->flags & VA_DEINTERLACING_ONE_FIELD))
+        return -1;
+
+    tff = !(deint_params->flags & VA_DEINTERLACING_BOTTOM_FIELD_FIRST);
+    is_top_field = !(deint_params->flags & VA_DEINTERLACING_BOTTOM_FIELD);
+
+    if (tff != is_top_field)
+        return -1;
+
+    obj_field_surf = SURFACE(pipeline_param->additional_outputs[0]);
+
+    if (!obj_field_surf)
+        return -1;
+
+    /* Surfaces without storage yet get NV12 */
+    fourcc = obj_dst_surf->fourcc ? obj_dst_surf->fourcc : VA_FOURCC_NV12;
+    field_fourcc = obj_field_surf->fourcc ? obj_field_surf->fourcc : VA_FOURCC_NV12;
+
+    if (pipeline_param->output_region) {
+        width = pipeline_param->output_region->width;
+        height = pipeline_param->output_region->height;
+    } else {
+        width = obj_dst_surf->orig_width;
+        height = obj_dst_surf->orig_height;
+    }
+
+    if (fourcc != field_fourcc ||
+        obj_field_surf->orig_width != width ||
+        obj_field_surf->orig_height != height)
+        return -1;
+
+    return index;
+}
+
 VAStatus 
 i965_proc_picture(VADriverContextP ctx, 
                   VAProfile profile, 
@@ -5975,17 +6485,26 @@ i965_proc_picture(VADriverContextP ctx,
     VAProcPipelineParameterBuffer *pipeline_param = (VAProcPipelineParameterBuffer *)proc_state->pipeline_param->buffer;
     struct object_surface *obj_surface;
     struct i965_surface src_surface, dst_surface;
+    struct i965_surface di_src_surface, field_surface;
     VARectangle src_rect, dst_rect;
+    struct i965_proc_plan plan;
     VAStatus status;
     int i;
-    VASurfaceID tmp_surfaces[VAProcFilterCount + 4];
-    int num_tmp_surfaces = 0;
     unsigned int tiling = 0, swizzle = 0;
+    unsigned int num_passes = 0;
     int in_width, in_height;
+    int field_rate = -1, di_done = 0;
+
+    if (proc_state->num_layer_params > 0)
+        return i965_proc_compose(ctx, &proc_context->pp_context, proc_state);
 
     status = i965_proc_picture_fast(ctx, proc_context, proc_state);
-    if (status != VA_STATUS_ERROR_UNIMPLEMENTED)
+    if (status != VA_STATUS_ERROR_UNIMPLEMENTED) {
+        if (status == VA_STATUS_SUCCESS)
+            i965_proc_picture_count_passes(proc_context, 1);
+
         return status;
+    }
 
     if (pipeline_param->surface == VA_INVALID_ID ||
         proc_state->current_render_target == VA_INVALID_ID) {
@@ -6010,6 +6529,49 @@ i965_proc_picture(VADriverContextP ctx,
         goto error;
     }
 
+    if (!SURFACE(proc_state->current_render_target)) {
+        status = VA_STATUS_ERROR_INVALID_SURFACE;
+        goto error;
+    }
+
+    if (pipeline_param->num_additional_outputs > 0) {
+        /* The Gen6 scaling kernels can't write the final format directly */
+        if (!IS_GEN7(i965->intel.device_info) &&
+            !IS_GEN8(i965->intel.device_info) &&
+            !IS_GEN9(i965->intel.device_info)) {
+            status = VA_STATUS_ERROR_UNIMPLEMENTED;
+            goto error;
+        }
+
+        if (pipeline_param->num_additional_outputs > I965_PROC_MAX_ADDITIONAL_OUTPUTS ||
+            !pipeline_param->additional_outputs) {
+            status = VA_STATUS_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+
+        for (i = 0; i < pipeline_param->num_additional_outputs; i++) {
+            if (!SURFACE(pipeline_param->additional_outputs[i])) {
+                status = VA_STATUS_ERROR_INVALID_SURFACE;
+                goto error;
+            }
+        }
+
+        /* The second field is taken from the DNDI pass, so no other
+         * filter may come after it when it is asked for */
+        field_rate = i965_proc_field_rate_filter(ctx, pipeline_param,
+                                                 SURFACE(proc_state->current_render_target));
+
+        if (field_rate >= 0 && field_rate != pipeline_param->num_filters - 1) {
+            status = VA_STATUS_ERROR_UNIMPLEMENTED;
+            goto error;
+        }
+    }
+
+    i965_proc_picture_plan(ctx, proc_context, pipeline_param,
+                           obj_surface,
+                           SURFACE(proc_state->current_render_target),
+                           &plan);
+
     in_width = obj_surface->orig_width;
     in_height = obj_surface->orig_height;
     dri_bo_get_tiling(obj_surface->bo, &tiling, &swizzle);
@@ -6018,8 +6580,7 @@ i965_proc_picture(VADriverContextP ctx,
     src_surface.type = I965_SURFACE_TYPE_SURFACE;
     src_surface.flags = proc_frame_to_pp_frame[pipeline_param->filter_flags & 0x3];
 
-    VASurfaceID out_surface_id = VA_INVALID_ID;
-    if (obj_surface->fourcc != VA_FOURCC_NV12) {
+    if (plan.convert_input) {
         src_surface.base = (struct object_base *)obj_surface;
         src_surface.type = I965_SURFACE_TYPE_SURFACE;
         src_surface.flags = I965_SURFACE_FLAG_FRAME;
@@ -6028,18 +6589,15 @@ i965_proc_picture(VADriverContextP ctx,
         src_rect.width = in_width;
         src_rect.height = in_height;
 
-        status = i965_CreateSurfaces(ctx,
-                                     in_width,
-                                     in_height,
-                                     VA_RT_FORMAT_YUV420,
-                                     1,
-                                     &out_surface_id);
+        status = i965_proc_surface_pool_get(ctx,
+                                            &proc_context->surface_pool,
+                                            in_width,
+                                            in_height,
+                                            VA_FOURCC_NV12,
+                                            !!tiling,
+                                            &obj_surface);
         if (status != VA_STATUS_SUCCESS)
             goto error;
-        tmp_surfaces[num_tmp_surfaces++] = out_surface_id;
-        obj_surface = SURFACE(out_surface_id);
-        assert(obj_surface);
-        i965_check_alloc_surface_bo(ctx, obj_surface, !!tiling, VA_FOURCC_NV12, SUBSAMPLE_YUV420);
 
         dst_surface.base = (struct object_base *)obj_surface;
         dst_surface.type = I965_SURFACE_TYPE_SURFACE;
@@ -6057,6 +6615,7 @@ i965_proc_picture(VADriverContextP ctx,
         if (status != VA_STATUS_SUCCESS)
             goto error;
 
+        num_passes++;
         src_surface.base = (struct object_base *)obj_surface;
         src_surface.type = I965_SURFACE_TYPE_SURFACE;
         src_surface.flags = proc_frame_to_pp_frame[pipeline_param->filter_flags & 0x3];
@@ -6089,24 +6648,26 @@ i965_proc_picture(VADriverContextP ctx,
             goto error;
         }
 
-        out_surface_id = VA_INVALID_ID;
         filter_param = (VAProcFilterParameterBufferBase *)obj_buffer->buffer_store->buffer;
         filter_type = filter_param->type;
-        kernel_index = procfilter_to_pp_flag[filter_type];
+        kernel_index = i965_proc_filter_kernel(filter_type);
+
+        if (kernel_index < 0) {
+            status = VA_STATUS_ERROR_UNSUPPORTED_FILTER;
+            goto error;
+        }
 
         if (kernel_index != PP_NULL &&
             proc_context->pp_context.pp_modules[kernel_index].kernel.bo != NULL) {
-            status = i965_CreateSurfaces(ctx,
-                                         in_width,
-                                         in_height,
-                                         VA_RT_FORMAT_YUV420,
-                                         1,
-                                         &out_surface_id);
-            assert(status == VA_STATUS_SUCCESS);
-            tmp_surfaces[num_tmp_surfaces++] = out_surface_id;
-            obj_surface = SURFACE(out_surface_id);
-            assert(obj_surface);
-            i965_check_alloc_surface_bo(ctx, obj_surface, !!tiling, VA_FOURCC_NV12, SUBSAMPLE_YUV420);
+            status = i965_proc_surface_pool_get(ctx,
+                                                &proc_context->surface_pool,
+                                                in_width,
+                                                in_height,
+                                                VA_FOURCC_NV12,
+                                                !!tiling,
+                                                &obj_surface);
+            if (status != VA_STATUS_SUCCESS)
+                goto error;
             dst_surface.base = (struct object_base *)obj_surface;
             dst_surface.type = I965_SURFACE_TYPE_SURFACE;
             status = i965_post_processing_internal(ctx, &proc_context->pp_context,
@@ -6118,13 +6679,62 @@ i965_proc_picture(VADriverContextP ctx,
                                                    filter_param);
 
             if (status == VA_STATUS_SUCCESS) {
+                if (i == field_rate) {
+                    di_src_surface = src_surface;
+                    di_done = 1;
+                }
+
                 src_surface.base = dst_surface.base;
                 src_surface.type = dst_surface.type;
                 src_surface.flags = dst_surface.flags;
+                num_passes++;
             }
         }
     }
 
+    field_surface = src_surface;
+
+    if (field_rate >= 0 && di_done) {
+        struct pp_dndi_context * const dndi_ctx = &proc_context->pp_context.pp_dndi_context;
+
+        if (dndi_ctx->is_di_adv_enabled && !dndi_ctx->is_first_frame) {
+            /* The motion adaptive pass wrote both fields */
+            field_surface.base = (struct object_base *)dndi_ctx->frame_store[DNDI_FRAME_OUT_CURRENT].obj_surface;
+        } else {
+            /* Nothing to interpolate from yet, the same frame again for the
+             * other field */
+            struct object_buffer *obj_buffer = BUFFER(pipeline_param->filters[field_rate]);
+            VAProcFilterParameterBufferDeinterlacing deint_params =
+                *(VAProcFilterParameterBufferDeinterlacing *)obj_buffer->buffer_store->buffer;
+
+            deint_params.flags ^= VA_DEINTERLACING_BOTTOM_FIELD;
+
+            status = i965_proc_surface_pool_get(ctx,
+                                                &proc_context->surface_pool,
+                                                in_width,
+                                                in_height,
+                                                VA_FOURCC_NV12,
+                                                !!tiling,
+                                                &obj_surface);
+            if (status != VA_STATUS_SUCCESS)
+                goto error;
+
+            field_surface.base = (struct object_base *)obj_surface;
+            field_surface.type = I965_SURFACE_TYPE_SURFACE;
+            status = i965_post_processing_internal(ctx, &proc_context->pp_context,
+                                                   &di_src_surface,
+                                                   &src_rect,
+                                                   &field_surface,
+                                                   &src_rect,
+                                                   PP_NV12_DNDI,
+                                                   &deint_params);
+            if (status != VA_STATUS_SUCCESS)
+                goto error;
+
+            num_passes++;
+        }
+    }
+
     proc_context->pp_context.pipeline_param = NULL;
     obj_surface = SURFACE(proc_state->current_render_target);
     
@@ -6150,6 +6760,23 @@ i965_proc_picture(VADriverContextP ctx,
         IS_GEN9(i965->intel.device_info)) {
         unsigned int saved_filter_flag;
         struct i965_post_processing_context *i965pp_context = i965->pp_context;
+        VARectangle output_rects[1 + I965_PROC_MAX_ADDITIONAL_OUTPUTS];
+
+        /* The additional outputs take the whole surface */
+        output_rects[0] = dst_rect;
+
+        for (i = 0; i < pipeline_param->num_additional_outputs; i++) {
+            struct object_surface *obj_output = SURFACE(pipeline_param->additional_outputs[i]);
+
+            output_rects[i + 1].x = 0;
+            output_rects[i + 1].y = 0;
+            output_rects[i + 1].width = obj_output->orig_width;
+            output_rects[i + 1].height = obj_output->orig_height;
+        }
+
+        i965_post_processing_prepare_avs(ctx, &src_rect, output_rects,
+                                         1 + pipeline_param->num_additional_outputs,
+                                         pipeline_param->filter_flags);
 
         if (obj_surface->fourcc == 0) {
             i965_check_alloc_surface_bo(ctx, obj_surface, 1,
@@ -6157,10 +6784,15 @@ i965_proc_picture(VADriverContextP ctx,
                                         SUBSAMPLE_YUV420);
         }
 
-        i965_vpp_clear_surface(ctx, &proc_context->pp_context,
-                               obj_surface,
-                               pipeline_param->output_background_color);
+        if (plan.clear_output) {
+            i965_vpp_clear_surface(ctx, &proc_context->pp_context,
+                                   obj_surface,
+                                   pipeline_param->output_background_color);
+            num_passes++;
+        }
 
+        /* The final walks go through the batch of i965->pp_context, the
+         * conversion, the filters and the fill above have to run first */
         intel_batchbuffer_flush(hw_context->batch);
 
         saved_filter_flag = i965pp_context->filter_flags;
@@ -6169,32 +6801,48 @@ i965_proc_picture(VADriverContextP ctx,
         dst_surface.base = (struct object_base *)obj_surface;
         dst_surface.type = I965_SURFACE_TYPE_SURFACE;
         i965_image_processing(ctx, &src_surface, &src_rect, &dst_surface, &dst_rect);
+        num_passes++;
+
+        /* The filters and the input conversion above are shared by all the
+         * outputs, only the final walk is done per output */
+        for (i = 0; i < pipeline_param->num_additional_outputs; i++) {
+            obj_surface = SURFACE(pipeline_param->additional_outputs[i]);
+
+            if (obj_surface->fourcc == 0) {
+                i965_check_alloc_surface_bo(ctx, obj_surface, 1,
+                                            VA_FOURCC_NV12,
+                                            SUBSAMPLE_YUV420);
+            }
+
+            dst_surface.base = (struct object_base *)obj_surface;
+            dst_surface.type = I965_SURFACE_TYPE_SURFACE;
+            i965_image_processing(ctx, field_rate >= 0 ? &field_surface : &src_surface,
+                                  &src_rect, &dst_surface, &output_rects[i + 1]);
+            num_passes++;
+        }
 
         i965pp_context->filter_flags = saved_filter_flag;
 
-        if (num_tmp_surfaces)
-            i965_DestroySurfaces(ctx,
-                             tmp_surfaces,
-                             num_tmp_surfaces);
+        i965_proc_surface_pool_release(ctx, &proc_context->surface_pool);
+        i965_proc_picture_count_passes(proc_context, num_passes);
 
         return VA_STATUS_SUCCESS;
     }
 
     int csc_needed = 0;
     if (obj_surface->fourcc && obj_surface->fourcc !=  VA_FOURCC_NV12){
+        struct object_surface *csc_surface;
+
         csc_needed = 1;
-        out_surface_id = VA_INVALID_ID;
-        status = i965_CreateSurfaces(ctx,
-                                     obj_surface->orig_width,
-                                     obj_surface->orig_height,
-                                     VA_RT_FORMAT_YUV420, 
-                                     1,
-                                     &out_surface_id);
-        assert(status == VA_STATUS_SUCCESS);
-        tmp_surfaces[num_tmp_surfaces++] = out_surface_id;
-        struct object_surface *csc_surface = SURFACE(out_surface_id);
-        assert(csc_surface);
-        i965_check_alloc_surface_bo(ctx, csc_surface, !!tiling, VA_FOURCC_NV12, SUBSAMPLE_YUV420);
+        status = i965_proc_surface_pool_get(ctx,
+                                            &proc_context->surface_pool,
+                                            obj_surface->orig_width,
+                                            obj_surface->orig_height,
+                                            VA_FOURCC_NV12,
+                                            !!tiling,
+                                            &csc_surface);
+        if (status != VA_STATUS_SUCCESS)
+            goto error;
         dst_surface.base = (struct object_base *)csc_surface;
     } else {
         i965_check_alloc_surface_bo(ctx, obj_surface, !!tiling, VA_FOURCC_NV12, SUBSAMPLE_YUV420);
@@ -6202,7 +6850,11 @@ i965_proc_picture(VADriverContextP ctx,
     }
 
     dst_surface.type = I965_SURFACE_TYPE_SURFACE;
-    i965_vpp_clear_surface(ctx, &proc_context->pp_context, obj_surface, pipeline_param->output_background_color); 
+
+    if (plan.clear_output) {
+        i965_vpp_clear_surface(ctx, &proc_context->pp_context, obj_surface, pipeline_param->output_background_color);
+        num_passes++;
+    }
 
     // load/save doesn't support different origin offset for src and dst surface
     if (src_rect.width == dst_rect.width &&
@@ -6228,29 +6880,32 @@ i965_proc_picture(VADriverContextP ctx,
                                       NULL);
     }
 
+    num_passes++;
+
     if (csc_needed) {
+        /* The conversion reads the surface written above, through the
+         * batch of i965->pp_context or on the CPU */
+        intel_batchbuffer_flush(hw_context->batch);
+
         src_surface.base = dst_surface.base;
         src_surface.type = dst_surface.type;
         src_surface.flags = dst_surface.flags;
         dst_surface.base = (struct object_base *)obj_surface;
         dst_surface.type = I965_SURFACE_TYPE_SURFACE;
         i965_image_processing(ctx, &src_surface, &dst_rect, &dst_surface, &dst_rect);
+        num_passes++;
     }
     
-    if (num_tmp_surfaces)
-        i965_DestroySurfaces(ctx,
-                             tmp_surfaces,
-                             num_tmp_surfaces);
-
     intel_batchbuffer_flush(hw_context->batch);
 
+    i965_proc_surface_pool_release(ctx, &proc_context->surface_pool);
+    i965_proc_picture_count_passes(proc_context, num_passes);
+
     return VA_STATUS_SUCCESS;
 
 error:
-    if (num_tmp_surfaces)
-        i965_DestroySurfaces(ctx,
-                             tmp_surfaces,
-                             num_tmp_surfaces);
+    i965_proc_surface_pool_release(ctx, &proc_context->surface_pool);
+    i965_proc_picture_count_passes(proc_context, num_passes);
 
     return status;
 }
@@ -6261,6 +6916,7 @@ i965_proc_context_destroy(void *hw_context)
     struct i965_proc_context * const proc_context = hw_context;
     VADriverContextP const ctx = proc_context->driver_context;
 
+    i965_proc_surface_pool_destroy(ctx, &proc_context->surface_pool);
     proc_context->pp_context.finalize(ctx, &proc_context->pp_context);
     intel_batchbuffer_free(proc_context->base.batch);
     free(proc_context);
@@ -6280,6 +6936,7 @@ i965_proc_context_init(VADriverContextP ctx, struct object_config *obj_config)
     proc_context->base.run = i965_proc_picture;
     proc_context->base.batch = intel_batchbuffer_new(intel, I915_EXEC_RENDER, 0);
     proc_context->driver_context = ctx;
+    i965_proc_surface_pool_init(&proc_context->surface_pool);
     i965->codec_info->post_processing_context_init(ctx, &proc_context->pp_context, proc_context->base.batch);
 
     return (struct hw_context *)proc_context;
@@ -605,6 +605,51 @@ struct i965_post_processing_context
 #define VPPGPE_8BIT_422    (1 << 1)
 #define VPPGPE_8BIT_444    (1 << 2)
     unsigned int scaling_8bit_initialized;
+
+    /* Set while the walks of several outputs are queued in one batch, the
+     * caller flushes it once they are all in */
+    unsigned int defer_flush;
+};
+
+/*
+ * The intermediate surfaces of i965_proc_picture() (input conversion and
+ * filter outputs) are kept across pictures, keyed by fourcc, size and
+ * tiling. A surface not used for I965_PROC_SURFACE_POOL_IDLE_FRAMES
+ * pictures is released.
+ */
+#define I965_PROC_SURFACE_POOL_SIZE             (VAProcFilterCount + 4)
+#define I965_PROC_SURFACE_POOL_IDLE_FRAMES      64
+
+/* VAProcPipelineParameterBuffer::additional_outputs, e.g. the renditions
+ * of an ABR ladder scaled from the same input */
+#define I965_PROC_MAX_ADDITIONAL_OUTPUTS        8
+
+struct i965_proc_surface_pool_entry
+{
+    VASurfaceID surface_id;
+    unsigned int fourcc;
+    int width;
+    int height;
+    int tiled;
+    int in_use;
+    unsigned int last_frame;
+};
+
+struct i965_proc_surface_pool
+{
+    struct i965_proc_surface_pool_entry entries[I965_PROC_SURFACE_POOL_SIZE];
+    unsigned int frame;
+
+    unsigned int num_allocations;       /* surfaces created */
+    unsigned int num_reuses;            /* allocations avoided */
+    unsigned int num_releases;          /* idle or evicted surfaces destroyed */
+};
+
+struct i965_proc_plan
+{
+    int num_filter_passes;
+    unsigned int convert_input : 1;     /* separate CSC walk to NV12 ahead of the filters */
+    unsigned int clear_output : 1;      /* background fill of the target */
 };
 
 struct i965_proc_context
@@ -612,6 +657,13 @@ struct i965_proc_context
     struct hw_context base;
     void *driver_context;
     struct i965_post_processing_context pp_context;
+    struct i965_proc_surface_pool surface_pool;
+
+    /* Kernel walks and blits issued by i965_proc_picture(). A walk done
+     * through i965_image_processing() counts as one */
+    unsigned int num_pictures;
+    unsigned int num_passes;
+    unsigned int last_num_passes;
 };
 
 VASurfaceID
@@ -642,11 +694,71 @@ i965_image_processing(VADriverContextP ctx,
                       struct i965_surface *dst_surface,
                       const VARectangle *dst_rect);
 
+/* Generates the AVS coefficients of several scaling ratios ahead of the
+ * walks that use them */
+void
+i965_post_processing_prepare_avs(VADriverContextP ctx,
+                                 const VARectangle *src_rect,
+                                 const VARectangle *dst_rects,
+                                 int num_rects,
+                                 unsigned int filter_flags);
+
 void
 i965_post_processing_terminate(VADriverContextP ctx);
 bool
 i965_post_processing_init(VADriverContextP ctx);
 
+void
+i965_proc_surface_pool_init(struct i965_proc_surface_pool *pool);
+
+void
+i965_proc_surface_pool_destroy(VADriverContextP ctx,
+                               struct i965_proc_surface_pool *pool);
+
+/* A surface of the pool not in use by the current picture, reused when one
+ * of that fourcc, size and tiling is idle */
+VAStatus
+i965_proc_surface_pool_get(VADriverContextP ctx,
+                           struct i965_proc_surface_pool *pool,
+                           int width,
+                           int height,
+                           unsigned int fourcc,
+                           int tiled,
+                           struct object_surface **out_surface);
+
+/* Called once the picture is submitted, the batches of the next pictures
+ * are executed after it so the surfaces can be written again */
+void
+i965_proc_surface_pool_release(VADriverContextP ctx,
+                               struct i965_proc_surface_pool *pool);
+
+/* Works out which stages of i965_proc_picture() need a walk of their own */
+void
+i965_proc_picture_plan(VADriverContextP ctx,
+                       struct i965_proc_context *proc_context,
+                       VAProcPipelineParameterBuffer *pipeline_param,
+                       struct object_surface *src_obj_surface,
+                       struct object_surface *dst_obj_surface,
+                       struct i965_proc_plan *plan);
+
+/* Draws the layers of a picture with several pipeline parameter buffers
+ * onto the render target. The first layer gives the background color of
+ * the areas no layer covers, only NV12 targets can be filled */
+VAStatus
+i965_proc_compose(VADriverContextP ctx,
+                  struct i965_post_processing_context *pp_context,
+                  struct proc_state *proc_state);
+
+/* Field rate deinterlacing: a first field picture with motion adaptive or
+ * compensated deinterlacing flagged VA_DEINTERLACING_FIELD_RATE_INTEL and
+ * a single additional output, of the same size and format as the output
+ * region, gets the second field in that additional output. Returns the
+ * index of the deinterlacing filter of such a picture, -1 for any other
+ * picture */
+int
+i965_proc_field_rate_filter(VADriverContextP ctx,
+                            const VAProcPipelineParameterBuffer *pipeline_param,
+                            struct object_surface *obj_dst_surf);
 
 extern VAStatus
 i965_proc_picture(VADriverContextP ctx,
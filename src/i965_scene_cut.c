@@ -0,0 +1,216 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "i965_scene_cut.h"
+
+/* Pictures this flat have no scene to cut, whatever their P cost */
+#define I965_SCENE_CUT_MIN_INTRA_COST   2       /* per sample */
+
+struct i965_scene_cut *
+i965_scene_cut_new(int width, int height)
+{
+    struct i965_scene_cut *scene_cut;
+    int size;
+
+    scene_cut = calloc(1, sizeof(*scene_cut));
+
+    if (!scene_cut)
+        return NULL;
+
+    scene_cut->width_in_mbs = (width + 15) / 16;
+    scene_cut->height_in_mbs = (height + 15) / 16;
+    scene_cut->pitch = scene_cut->width_in_mbs * 4;
+    scene_cut->threshold = I965_SCENE_CUT_THRESHOLD;
+    scene_cut->min_distance = I965_SCENE_CUT_MIN_DISTANCE;
+
+    size = scene_cut->pitch * scene_cut->height_in_mbs * 4;
+    scene_cut->cur = malloc(size);
+    scene_cut->prev = malloc(size);
+
+    if (!scene_cut->cur || !scene_cut->prev) {
+        i965_scene_cut_free(scene_cut);
+        return NULL;
+    }
+
+    return scene_cut;
+}
+
+void
+i965_scene_cut_free(struct i965_scene_cut *scene_cut)
+{
+    if (!scene_cut)
+        return;
+
+    free(scene_cut->cur);
+    free(scene_cut->prev);
+    free(scene_cut);
+}
+
+/*
+ * One sample per 4x4 block. Only the second row of the block is read,
+ * the luma plane is mapped through the GTT when the GPU can't scale it
+ * and reading it all would cost more than the analysis.
+ */
+static void
+i965_scene_cut_downscale(struct i965_scene_cut *scene_cut, const uint8_t *luma, int pitch)
+{
+    const uint8_t *src;
+    uint8_t *dst;
+    int x, y;
+
+    for (y = 0; y < scene_cut->height_in_mbs * 4; y++) {
+        src = luma + (y * 4 + 1) * pitch;
+        dst = scene_cut->cur + y * scene_cut->pitch;
+
+        for (x = 0; x < scene_cut->pitch; x++, src += 4)
+            dst[x] = (src[0] + src[1] + src[2] + src[3] + 2) >> 2;
+    }
+}
+
+static int
+i965_scene_cut_intra_cost(const uint8_t *mb, int pitch)
+{
+    int x, y, dc = 0, cost = 0;
+
+    for (y = 0; y < 4; y++)
+        for (x = 0; x < 4; x++)
+            dc += mb[y * pitch + x];
+
+    dc = (dc + 8) >> 4;
+
+    for (y = 0; y < 4; y++)
+        for (x = 0; x < 4; x++)
+            cost += abs(mb[y * pitch + x] - dc);
+
+    return cost;
+}
+
+static int
+i965_scene_cut_inter_cost(struct i965_scene_cut *scene_cut, int mb_x, int mb_y)
+{
+    const uint8_t *mb = scene_cut->cur + mb_y * 4 * scene_cut->pitch + mb_x * 4;
+    const uint8_t *ref;
+    int width = scene_cut->width_in_mbs * 4;
+    int height = scene_cut->height_in_mbs * 4;
+    int x, y, dx, dy, ref_x, ref_y, sad, best = INT_MAX;
+
+    for (dy = -I965_SCENE_CUT_SEARCH_RANGE; dy <= I965_SCENE_CUT_SEARCH_RANGE; dy++) {
+        ref_y = mb_y * 4 + dy;
+
+        if (ref_y < 0 || ref_y + 4 > height)
+            continue;
+
+        for (dx = -I965_SCENE_CUT_SEARCH_RANGE; dx <= I965_SCENE_CUT_SEARCH_RANGE; dx++) {
+            ref_x = mb_x * 4 + dx;
+
+            if (ref_x < 0 || ref_x + 4 > width)
+                continue;
+
+            ref = scene_cut->prev + ref_y * scene_cut->pitch + ref_x;
+            sad = 0;
+
+            for (y = 0; y < 4 && sad < best; y++)
+                for (x = 0; x < 4; x++)
+                    sad += abs(mb[y * scene_cut->pitch + x] - ref[y * scene_cut->pitch + x]);
+
+            if (sad < best)
+                best = sad;
+        }
+    }
+
+    return best;
+}
+
+static int
+i965_scene_cut_analyse(struct i965_scene_cut *scene_cut, int is_intra)
+{
+    int64_t intra_cost = 0, p_cost = 0;
+    int mb_x, mb_y, intra, inter;
+    int is_scene_cut = 0;
+    uint8_t *tmp;
+
+    if (is_intra)
+        scene_cut->frames_since_intra = 0;
+    else
+        scene_cut->frames_since_intra++;
+
+    if (!is_intra &&
+        scene_cut->has_prev &&
+        scene_cut->frames_since_intra >= scene_cut->min_distance) {
+        for (mb_y = 0; mb_y < scene_cut->height_in_mbs; mb_y++) {
+            for (mb_x = 0; mb_x < scene_cut->width_in_mbs; mb_x++) {
+                intra = i965_scene_cut_intra_cost(scene_cut->cur + mb_y * 4 * scene_cut->pitch + mb_x * 4,
+                                                  scene_cut->pitch);
+                inter = i965_scene_cut_inter_cost(scene_cut, mb_x, mb_y);
+
+                intra_cost += intra;
+                p_cost += (inter < intra) ? inter : intra;
+            }
+        }
+
+        if (intra_cost >= (int64_t)I965_SCENE_CUT_MIN_INTRA_COST * 16 * scene_cut->width_in_mbs * scene_cut->height_in_mbs &&
+            p_cost * 100 >= intra_cost * scene_cut->threshold)
+            is_scene_cut = 1;
+    }
+
+    if (is_scene_cut)
+        scene_cut->frames_since_intra = 0;
+
+    tmp = scene_cut->prev;
+    scene_cut->prev = scene_cut->cur;
+    scene_cut->cur = tmp;
+    scene_cut->has_prev = 1;
+
+    return is_scene_cut;
+}
+
+int
+i965_scene_cut_detect(struct i965_scene_cut *scene_cut,
+                      const uint8_t *luma,
+                      int pitch,
+                      int is_intra)
+{
+    i965_scene_cut_downscale(scene_cut, luma, pitch);
+
+    return i965_scene_cut_analyse(scene_cut, is_intra);
+}
+
+int
+i965_scene_cut_detect_scaled(struct i965_scene_cut *scene_cut,
+                             const uint8_t *samples,
+                             int pitch,
+                             int is_intra)
+{
+    int y;
+
+    for (y = 0; y < scene_cut->height_in_mbs * 4; y++)
+        memcpy(scene_cut->cur + y * scene_cut->pitch, samples + y * pitch, scene_cut->pitch);
+
+    return i965_scene_cut_analyse(scene_cut, is_intra);
+}
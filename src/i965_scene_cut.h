@@ -0,0 +1,91 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef I965_SCENE_CUT_H
+#define I965_SCENE_CUT_H
+
+#include <stdint.h>
+
+/*
+ * Scene cut detection for the VME based H.264 encoders, enabled by
+ * VA_INTEL_ENCODE_SCENE_CUT. Every input picture is reduced to one luma
+ * sample per 4x4 block, i.e. 4x4 samples per macroblock, by the GPU when
+ * it can scale the input, by i965_scene_cut_detect() otherwise. The cost
+ * of a macroblock is the smaller of its DC (intra) cost and the best SAD
+ * against the previous picture over a +/-8 pixels search (inter cost).
+ * A P picture whose total cost gets close to its intra cost is worth
+ * coding as an I picture.
+ */
+#define I965_SCENE_CUT_SEARCH_RANGE     2       /* in samples */
+
+/* P cost vs I cost, in percent, above which a P picture is promoted */
+#define I965_SCENE_CUT_THRESHOLD        60
+
+/* Min. distance between two I pictures for a promotion */
+#define I965_SCENE_CUT_MIN_DISTANCE     8
+
+struct i965_scene_cut
+{
+    int width_in_mbs;
+    int height_in_mbs;
+    int pitch;                  /* of the sample planes */
+
+    uint8_t *cur;
+    uint8_t *prev;
+    int has_prev;
+
+    int frames_since_intra;
+    int threshold;
+    int min_distance;
+};
+
+struct i965_scene_cut *
+i965_scene_cut_new(int width, int height);
+
+void
+i965_scene_cut_free(struct i965_scene_cut *scene_cut);
+
+/*
+ * Feeds the luma plane of the next picture in coding order. @is_intra
+ * tells that the application already codes it as an I picture. Returns
+ * non-zero if a P picture should be coded as an I picture.
+ */
+int
+i965_scene_cut_detect(struct i965_scene_cut *scene_cut,
+                      const uint8_t *luma,
+                      int pitch,
+                      int is_intra);
+
+/*
+ * Same as i965_scene_cut_detect() for a picture already reduced to one
+ * luma sample per 4x4 block, @pitch is the one of the reduced plane
+ */
+int
+i965_scene_cut_detect_scaled(struct i965_scene_cut *scene_cut,
+                             const uint8_t *samples,
+                             int pitch,
+                             int is_intra);
+
+#endif /* I965_SCENE_CUT_H */
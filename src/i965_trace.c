@@ -0,0 +1,777 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "sysdeps.h"
+
+#include <time.h>
+
+#include "i965_drv_video.h"
+#include "i965_trace.h"
+
+struct i965_trace *
+i965_trace_open(const char *filename)
+{
+    struct i965_trace_header header;
+    struct i965_trace *trace;
+
+    trace = calloc(1, sizeof(*trace));
+
+    if (!trace)
+        return NULL;
+
+    trace->fp = fopen(filename, "wb");
+
+    if (!trace->fp) {
+        free(trace);
+
+        return NULL;
+    }
+
+    header.magic = I965_TRACE_MAGIC;
+    header.version = I965_TRACE_VERSION;
+
+    if (fwrite(&header, sizeof(header), 1, trace->fp) != 1) {
+        fclose(trace->fp);
+        free(trace);
+
+        return NULL;
+    }
+
+    pthread_mutex_init(&trace->lock, NULL);
+
+    return trace;
+}
+
+void
+i965_trace_close(struct i965_trace *trace)
+{
+    if (!trace)
+        return;
+
+    fclose(trace->fp);
+    pthread_mutex_destroy(&trace->lock);
+    free(trace);
+}
+
+static void
+i965_trace_write(struct i965_trace *trace,
+                 uint32_t type,
+                 const uint32_t *words,
+                 unsigned int num_words,
+                 const uint32_t *ids,
+                 unsigned int num_ids,
+                 const void *data,
+                 unsigned int data_size)
+{
+    struct i965_trace_record record;
+
+    record.type = type;
+    record.size = (num_words + num_ids) * sizeof(uint32_t) + data_size;
+
+    pthread_mutex_lock(&trace->lock);
+
+    if (fwrite(&record, sizeof(record), 1, trace->fp) != 1 ||
+        fwrite(words, sizeof(uint32_t), num_words, trace->fp) != num_words ||
+        (num_ids && fwrite(ids, sizeof(uint32_t), num_ids, trace->fp) != num_ids) ||
+        (data_size && fwrite(data, 1, data_size, trace->fp) != data_size))
+        WARN_ONCE("failed to write the decode trace\n");
+
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void
+i965_trace_create_config(struct i965_trace *trace,
+                         VAProfile profile,
+                         VAEntrypoint entrypoint,
+                         VAConfigAttrib *attrib_list,
+                         int num_attribs,
+                         VAConfigID config)
+{
+    uint32_t words[4];
+    uint32_t *attribs;
+    int i;
+
+    if (!trace)
+        return;
+
+    if (num_attribs < 0 || !attrib_list)
+        num_attribs = 0;
+
+    attribs = malloc(MAX(num_attribs, 1) * 2 * sizeof(uint32_t));
+
+    if (!attribs) {
+        WARN_ONCE("failed to allocate memory for the decode trace\n");
+        return;
+    }
+
+    for (i = 0; i < num_attribs; i++) {
+        attribs[i * 2 + 0] = attrib_list[i].type;
+        attribs[i * 2 + 1] = attrib_list[i].value;
+    }
+
+    words[0] = profile;
+    words[1] = entrypoint;
+    words[2] = config;
+    words[3] = num_attribs;
+    i965_trace_write(trace, I965_TRACE_CREATE_CONFIG,
+                     words, ARRAY_ELEMS(words),
+                     attribs, num_attribs * 2,
+                     NULL, 0);
+    free(attribs);
+}
+
+void
+i965_trace_destroy_config(struct i965_trace *trace, VAConfigID config)
+{
+    uint32_t words[1];
+
+    if (!trace)
+        return;
+
+    words[0] = config;
+    i965_trace_write(trace, I965_TRACE_DESTROY_CONFIG,
+                     words, ARRAY_ELEMS(words),
+                     NULL, 0,
+                     NULL, 0);
+}
+
+void
+i965_trace_create_surfaces(struct i965_trace *trace,
+                           unsigned int format,
+                           unsigned int width,
+                           unsigned int height,
+                           unsigned int fourcc,
+                           VASurfaceID *surfaces,
+                           unsigned int num_surfaces)
+{
+    uint32_t words[5];
+
+    if (!trace)
+        return;
+
+    words[0] = format;
+    words[1] = width;
+    words[2] = height;
+    words[3] = fourcc;
+    words[4] = num_surfaces;
+    i965_trace_write(trace, I965_TRACE_CREATE_SURFACES,
+                     words, ARRAY_ELEMS(words),
+                     surfaces, num_surfaces,
+                     NULL, 0);
+}
+
+void
+i965_trace_destroy_surfaces(struct i965_trace *trace,
+                            VASurfaceID *surfaces,
+                            unsigned int num_surfaces)
+{
+    uint32_t words[1];
+
+    if (!trace)
+        return;
+
+    words[0] = num_surfaces;
+    i965_trace_write(trace, I965_TRACE_DESTROY_SURFACES,
+                     words, ARRAY_ELEMS(words),
+                     surfaces, num_surfaces,
+                     NULL, 0);
+}
+
+void
+i965_trace_create_context(struct i965_trace *trace,
+                          VAConfigID config,
+                          int width,
+                          int height,
+                          int flag,
+                          VASurfaceID *render_targets,
+                          int num_render_targets,
+                          VAContextID context)
+{
+    uint32_t words[6];
+
+    if (!trace)
+        return;
+
+    if (num_render_targets < 0 || !render_targets)
+        num_render_targets = 0;
+
+    words[0] = config;
+    words[1] = width;
+    words[2] = height;
+    words[3] = flag;
+    words[4] = context;
+    words[5] = num_render_targets;
+    i965_trace_write(trace, I965_TRACE_CREATE_CONTEXT,
+                     words, ARRAY_ELEMS(words),
+                     render_targets, num_render_targets,
+                     NULL, 0);
+}
+
+void
+i965_trace_destroy_context(struct i965_trace *trace, VAContextID context)
+{
+    uint32_t words[1];
+
+    if (!trace)
+        return;
+
+    words[0] = context;
+    i965_trace_write(trace, I965_TRACE_DESTROY_CONTEXT,
+                     words, ARRAY_ELEMS(words),
+                     NULL, 0,
+                     NULL, 0);
+}
+
+void
+i965_trace_begin_picture(struct i965_trace *trace,
+                         VAContextID context,
+                         VASurfaceID render_target)
+{
+    uint32_t words[2];
+
+    if (!trace)
+        return;
+
+    words[0] = context;
+    words[1] = render_target;
+    i965_trace_write(trace, I965_TRACE_BEGIN_PICTURE,
+                     words, ARRAY_ELEMS(words),
+                     NULL, 0,
+                     NULL, 0);
+}
+
+void
+i965_trace_render_buffer(struct i965_trace *trace,
+                         VAContextID context,
+                         struct object_buffer *obj_buffer)
+{
+    struct buffer_store *buffer_store = obj_buffer->buffer_store;
+    unsigned int data_size = obj_buffer->size_element * obj_buffer->num_elements;
+    uint32_t words[4];
+    void *data;
+
+    if (!trace || !buffer_store)
+        return;
+
+    words[0] = context;
+    words[1] = obj_buffer->type;
+    words[2] = obj_buffer->size_element;
+    words[3] = obj_buffer->num_elements;
+
+    if (buffer_store->buffer) {
+        i965_trace_write(trace, I965_TRACE_RENDER_BUFFER,
+                         words, ARRAY_ELEMS(words),
+                         NULL, 0,
+                         buffer_store->buffer, data_size);
+    } else if (buffer_store->bo) {
+        data = malloc(data_size);
+
+        if (!data) {
+            WARN_ONCE("failed to allocate memory for the decode trace\n");
+            return;
+        }
+
+        dri_bo_get_subdata(buffer_store->bo, 0, data_size, data);
+        i965_trace_write(trace, I965_TRACE_RENDER_BUFFER,
+                         words, ARRAY_ELEMS(words),
+                         NULL, 0,
+                         data, data_size);
+        free(data);
+    }
+}
+
+void
+i965_trace_end_picture(struct i965_trace *trace, VAContextID context)
+{
+    uint32_t words[1];
+
+    if (!trace)
+        return;
+
+    words[0] = context;
+    i965_trace_write(trace, I965_TRACE_END_PICTURE,
+                     words, ARRAY_ELEMS(words),
+                     NULL, 0,
+                     NULL, 0);
+}
+
+/* Translates the IDs of the recorded session to the IDs of the replay */
+struct i965_trace_id_map
+{
+    VAGenericID *from;
+    VAGenericID *to;
+    unsigned int num_ids;
+    unsigned int max_ids;
+};
+
+static VAGenericID
+i965_trace_id_lookup(struct i965_trace_id_map *map, VAGenericID from)
+{
+    unsigned int i;
+
+    for (i = 0; i < map->num_ids; i++) {
+        if (map->from[i] == from)
+            return map->to[i];
+    }
+
+    return VA_INVALID_ID;
+}
+
+static bool
+i965_trace_id_insert(struct i965_trace_id_map *map, VAGenericID from, VAGenericID to)
+{
+    unsigned int i;
+
+    /* The recorded session may have reused a destroyed ID */
+    for (i = 0; i < map->num_ids; i++) {
+        if (map->from[i] == from) {
+            map->to[i] = to;
+            return true;
+        }
+    }
+
+    if (map->num_ids == map->max_ids) {
+        unsigned int max_ids = MAX(map->max_ids * 2, 16);
+        VAGenericID *from_ids, *to_ids;
+
+        from_ids = realloc(map->from, max_ids * sizeof(*from_ids));
+
+        if (!from_ids)
+            return false;
+
+        map->from = from_ids;
+        to_ids = realloc(map->to, max_ids * sizeof(*to_ids));
+
+        if (!to_ids)
+            return false;
+
+        map->to = to_ids;
+        map->max_ids = max_ids;
+    }
+
+    map->from[map->num_ids] = from;
+    map->to[map->num_ids] = to;
+    map->num_ids++;
+
+    return true;
+}
+
+static VAGenericID
+i965_trace_id_remove(struct i965_trace_id_map *map, VAGenericID from)
+{
+    unsigned int i;
+    VAGenericID to;
+
+    for (i = 0; i < map->num_ids; i++) {
+        if (map->from[i] == from) {
+            to = map->to[i];
+            map->num_ids--;
+            map->from[i] = map->from[map->num_ids];
+            map->to[i] = map->to[map->num_ids];
+
+            return to;
+        }
+    }
+
+    return VA_INVALID_ID;
+}
+
+static void
+i965_trace_id_map_free(struct i965_trace_id_map *map)
+{
+    free(map->from);
+    free(map->to);
+}
+
+struct i965_trace_replay
+{
+    VADriverContextP ctx;
+    struct i965_trace_id_map configs;
+    struct i965_trace_id_map surfaces;
+    struct i965_trace_id_map contexts;
+    struct i965_trace_replay_stats *stats;
+};
+
+static uint64_t
+i965_trace_get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static VAStatus
+i965_trace_replay_create_config(struct i965_trace_replay *replay,
+                                const uint32_t *words,
+                                unsigned int num_words)
+{
+    VADriverContextP ctx = replay->ctx;
+    VAConfigAttrib *attribs;
+    VAConfigID config;
+    VAStatus va_status;
+    unsigned int i, num_attribs;
+
+    if (num_words < 4 || (num_words - 4) / 2 < words[3])
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    num_attribs = words[3];
+    attribs = malloc(MAX(num_attribs, 1) * sizeof(*attribs));
+
+    if (!attribs)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    for (i = 0; i < num_attribs; i++) {
+        attribs[i].type = words[4 + i * 2 + 0];
+        attribs[i].value = words[4 + i * 2 + 1];
+    }
+
+    va_status = ctx->vtable->vaCreateConfig(ctx, words[0], words[1],
+                                            attribs, num_attribs, &config);
+    free(attribs);
+
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
+
+    if (!i965_trace_id_insert(&replay->configs, words[2], config)) {
+        ctx->vtable->vaDestroyConfig(ctx, config);
+
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+i965_trace_replay_create_surfaces(struct i965_trace_replay *replay,
+                                  const uint32_t *words,
+                                  unsigned int num_words)
+{
+    VADriverContextP ctx = replay->ctx;
+    VASurfaceAttrib attrib;
+    VASurfaceID *surfaces;
+    VAStatus va_status;
+    unsigned int i, num_surfaces;
+
+    if (num_words < 5 || num_words - 5 < words[4])
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    num_surfaces = words[4];
+    surfaces = malloc(MAX(num_surfaces, 1) * sizeof(*surfaces));
+
+    if (!surfaces)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    attrib.type = VASurfaceAttribPixelFormat;
+    attrib.flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attrib.value.type = VAGenericValueTypeInteger;
+    attrib.value.value.i = words[3];
+
+    va_status = ctx->vtable->vaCreateSurfaces2(ctx, words[0], words[1], words[2],
+                                               surfaces, num_surfaces,
+                                               words[3] ? &attrib : NULL,
+                                               words[3] ? 1 : 0);
+
+    for (i = 0; va_status == VA_STATUS_SUCCESS && i < num_surfaces; i++) {
+        if (!i965_trace_id_insert(&replay->surfaces, words[5 + i], surfaces[i])) {
+            ctx->vtable->vaDestroySurfaces(ctx, &surfaces[i], num_surfaces - i);
+            va_status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+        }
+    }
+
+    free(surfaces);
+
+    return va_status;
+}
+
+static VAStatus
+i965_trace_replay_destroy_surfaces(struct i965_trace_replay *replay,
+                                   const uint32_t *words,
+                                   unsigned int num_words)
+{
+    VADriverContextP ctx = replay->ctx;
+    VASurfaceID surface;
+    unsigned int i;
+
+    if (num_words < 1 || num_words - 1 < words[0])
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    for (i = 0; i < words[0]; i++) {
+        surface = i965_trace_id_remove(&replay->surfaces, words[1 + i]);
+
+        if (surface != VA_INVALID_SURFACE)
+            ctx->vtable->vaDestroySurfaces(ctx, &surface, 1);
+    }
+
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+i965_trace_replay_create_context(struct i965_trace_replay *replay,
+                                 const uint32_t *words,
+                                 unsigned int num_words)
+{
+    VADriverContextP ctx = replay->ctx;
+    VASurfaceID *render_targets;
+    VAContextID context;
+    VAStatus va_status;
+    unsigned int i, num_render_targets;
+
+    if (num_words < 6 || num_words - 6 < words[5])
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    num_render_targets = words[5];
+    render_targets = malloc(MAX(num_render_targets, 1) * sizeof(*render_targets));
+
+    if (!render_targets)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    for (i = 0; i < num_render_targets; i++)
+        render_targets[i] = i965_trace_id_lookup(&replay->surfaces, words[6 + i]);
+
+    va_status = ctx->vtable->vaCreateContext(ctx,
+                                             i965_trace_id_lookup(&replay->configs, words[0]),
+                                             words[1], words[2], words[3],
+                                             num_render_targets ? render_targets : NULL,
+                                             num_render_targets,
+                                             &context);
+    free(render_targets);
+
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
+
+    if (!i965_trace_id_insert(&replay->contexts, words[4], context)) {
+        ctx->vtable->vaDestroyContext(ctx, context);
+
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+i965_trace_replay_render_buffer(struct i965_trace_replay *replay,
+                                const uint32_t *words,
+                                unsigned int size)
+{
+    VADriverContextP ctx = replay->ctx;
+    VABufferID buffer;
+    VAStatus va_status;
+    uint64_t start;
+
+    if (size < 4 * sizeof(uint32_t) ||
+        size - 4 * sizeof(uint32_t) != (uint64_t)words[2] * words[3])
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    va_status = ctx->vtable->vaCreateBuffer(ctx,
+                                            i965_trace_id_lookup(&replay->contexts, words[0]),
+                                            words[1], words[2], words[3],
+                                            (void *)&words[4],
+                                            &buffer);
+
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
+
+    start = i965_trace_get_time_ns();
+    va_status = ctx->vtable->vaRenderPicture(ctx,
+                                             i965_trace_id_lookup(&replay->contexts, words[0]),
+                                             &buffer, 1);
+    replay->stats->render_time_ns += i965_trace_get_time_ns() - start;
+    replay->stats->num_buffers++;
+
+    ctx->vtable->vaDestroyBuffer(ctx, buffer);
+
+    return va_status;
+}
+
+static VAStatus
+i965_trace_replay_record(struct i965_trace_replay *replay,
+                         uint32_t type,
+                         const uint32_t *words,
+                         unsigned int size)
+{
+    VADriverContextP ctx = replay->ctx;
+    unsigned int num_words = size / sizeof(uint32_t);
+    VAGenericID id;
+    VAStatus va_status;
+    uint64_t start;
+
+    switch (type) {
+    case I965_TRACE_CREATE_CONFIG:
+        return i965_trace_replay_create_config(replay, words, num_words);
+
+    case I965_TRACE_DESTROY_CONFIG:
+        if (num_words < 1)
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+        id = i965_trace_id_remove(&replay->configs, words[0]);
+
+        if (id == VA_INVALID_ID)
+            return VA_STATUS_SUCCESS;
+
+        return ctx->vtable->vaDestroyConfig(ctx, id);
+
+    case I965_TRACE_CREATE_SURFACES:
+        return i965_trace_replay_create_surfaces(replay, words, num_words);
+
+    case I965_TRACE_DESTROY_SURFACES:
+        return i965_trace_replay_destroy_surfaces(replay, words, num_words);
+
+    case I965_TRACE_CREATE_CONTEXT:
+        return i965_trace_replay_create_context(replay, words, num_words);
+
+    case I965_TRACE_DESTROY_CONTEXT:
+        if (num_words < 1)
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+        id = i965_trace_id_remove(&replay->contexts, words[0]);
+
+        if (id == VA_INVALID_ID)
+            return VA_STATUS_SUCCESS;
+
+        return ctx->vtable->vaDestroyContext(ctx, id);
+
+    case I965_TRACE_BEGIN_PICTURE:
+        if (num_words < 2)
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+        return ctx->vtable->vaBeginPicture(ctx,
+                                           i965_trace_id_lookup(&replay->contexts, words[0]),
+                                           i965_trace_id_lookup(&replay->surfaces, words[1]));
+
+    case I965_TRACE_RENDER_BUFFER:
+        return i965_trace_replay_render_buffer(replay, words, size);
+
+    case I965_TRACE_END_PICTURE:
+        if (num_words < 1)
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+        start = i965_trace_get_time_ns();
+        va_status = ctx->vtable->vaEndPicture(ctx,
+                                              i965_trace_id_lookup(&replay->contexts, words[0]));
+        replay->stats->render_time_ns += i965_trace_get_time_ns() - start;
+        replay->stats->num_pictures++;
+
+        return va_status;
+
+    default:
+        /* Newer record types are skipped */
+        return VA_STATUS_SUCCESS;
+    }
+}
+
+VAStatus
+i965_trace_replay(VADriverContextP ctx,
+                  const char *filename,
+                  struct i965_trace_replay_stats *stats)
+{
+    struct i965_trace_replay replay;
+    struct i965_trace_replay_stats dummy_stats;
+    struct i965_trace_header header;
+    struct i965_trace_record record;
+    uint32_t *payload = NULL;
+    unsigned int max_size = 0;
+    VAStatus va_status = VA_STATUS_SUCCESS;
+    FILE *fp;
+    long remaining;
+    unsigned int i;
+
+    fp = fopen(filename, "rb");
+
+    if (!fp)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    /* The record sizes are checked against what is left in the file */
+    if (fseek(fp, 0, SEEK_END) ||
+        (remaining = ftell(fp)) < (long)sizeof(header) ||
+        fseek(fp, 0, SEEK_SET) ||
+        fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != I965_TRACE_MAGIC ||
+        header.version != I965_TRACE_VERSION) {
+        fclose(fp);
+
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    memset(&replay, 0, sizeof(replay));
+    replay.ctx = ctx;
+    replay.stats = stats ? stats : &dummy_stats;
+    memset(replay.stats, 0, sizeof(*replay.stats));
+
+    remaining -= sizeof(header);
+
+    while (fread(&record, sizeof(record), 1, fp) == 1) {
+        remaining -= sizeof(record);
+
+        if (record.size > remaining) {
+            va_status = VA_STATUS_ERROR_INVALID_PARAMETER;
+            break;
+        }
+
+        remaining -= record.size;
+
+        if (record.size > max_size) {
+            uint32_t *new_payload = realloc(payload, ALIGN(record.size, sizeof(uint32_t)));
+
+            if (!new_payload) {
+                va_status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+                break;
+            }
+
+            payload = new_payload;
+            max_size = record.size;
+        }
+
+        if (record.size && fread(payload, record.size, 1, fp) != 1) {
+            va_status = VA_STATUS_ERROR_INVALID_PARAMETER;
+            break;
+        }
+
+        va_status = i965_trace_replay_record(&replay, record.type, payload, record.size);
+
+        if (va_status != VA_STATUS_SUCCESS)
+            break;
+    }
+
+    for (i = 0; i < replay.contexts.num_ids; i++)
+        ctx->vtable->vaDestroyContext(ctx, replay.contexts.to[i]);
+
+    for (i = 0; i < replay.surfaces.num_ids; i++) {
+        ctx->vtable->vaSyncSurface(ctx, replay.surfaces.to[i]);
+        ctx->vtable->vaDestroySurfaces(ctx, &replay.surfaces.to[i], 1);
+    }
+
+    for (i = 0; i < replay.configs.num_ids; i++)
+        ctx->vtable->vaDestroyConfig(ctx, replay.configs.to[i]);
+
+    i965_trace_id_map_free(&replay.contexts);
+    i965_trace_id_map_free(&replay.surfaces);
+    i965_trace_id_map_free(&replay.configs);
+    free(payload);
+    fclose(fp);
+
+    return va_status;
+}
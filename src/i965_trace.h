@@ -0,0 +1,156 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_TRACE_H
+#define I965_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <va/va.h>
+#include <va/va_backend.h>
+
+/*
+ * Decode session recorder. When VA_INTEL_TRACE names a file, the driver
+ * appends every decode config, surface and context creation, along with
+ * the buffers passed to vaRenderPicture() for VLD contexts, to that file.
+ * i965_trace_replay() feeds such a trace back through the driver vtable,
+ * which exercises the whole CPU side of the decoders up to batch
+ * submission without the application.
+ *
+ * The file is a small header followed by records. Each record is a
+ * struct i965_trace_record and @size bytes of payload: 32-bit words as
+ * listed next to the record types below, then the buffer data if any.
+ * Everything is in host byte order.
+ */
+#define I965_TRACE_MAGIC                0x43525449      /* "ITRC" */
+#define I965_TRACE_VERSION              1
+
+enum {
+    I965_TRACE_CREATE_CONFIG = 1,       /* profile, entrypoint, config, num_attribs, { type, value }... */
+    I965_TRACE_DESTROY_CONFIG,          /* config */
+    I965_TRACE_CREATE_SURFACES,         /* format, width, height, fourcc, num_surfaces, surfaces... */
+    I965_TRACE_DESTROY_SURFACES,        /* num_surfaces, surfaces... */
+    I965_TRACE_CREATE_CONTEXT,          /* config, width, height, flag, context, num_render_targets, surfaces... */
+    I965_TRACE_DESTROY_CONTEXT,         /* context */
+    I965_TRACE_BEGIN_PICTURE,           /* context, render_target */
+    I965_TRACE_RENDER_BUFFER,           /* context, type, size, num_elements, data */
+    I965_TRACE_END_PICTURE,             /* context */
+};
+
+struct i965_trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct i965_trace_record
+{
+    uint32_t type;
+    uint32_t size;
+};
+
+struct i965_trace
+{
+    FILE *fp;
+    pthread_mutex_t lock;
+};
+
+struct i965_trace_replay_stats
+{
+    unsigned int num_pictures;
+    unsigned int num_buffers;
+
+    /* CPU time spent in vaRenderPicture() and vaEndPicture() */
+    uint64_t render_time_ns;
+};
+
+struct object_buffer;
+
+struct i965_trace *
+i965_trace_open(const char *filename);
+
+void
+i965_trace_close(struct i965_trace *trace);
+
+/* All the recording functions accept a NULL trace */
+void
+i965_trace_create_config(struct i965_trace *trace,
+                         VAProfile profile,
+                         VAEntrypoint entrypoint,
+                         VAConfigAttrib *attrib_list,
+                         int num_attribs,
+                         VAConfigID config);
+
+void
+i965_trace_destroy_config(struct i965_trace *trace, VAConfigID config);
+
+void
+i965_trace_create_surfaces(struct i965_trace *trace,
+                           unsigned int format,
+                           unsigned int width,
+                           unsigned int height,
+                           unsigned int fourcc,
+                           VASurfaceID *surfaces,
+                           unsigned int num_surfaces);
+
+void
+i965_trace_destroy_surfaces(struct i965_trace *trace,
+                            VASurfaceID *surfaces,
+                            unsigned int num_surfaces);
+
+void
+i965_trace_create_context(struct i965_trace *trace,
+                          VAConfigID config,
+                          int width,
+                          int height,
+                          int flag,
+                          VASurfaceID *render_targets,
+                          int num_render_targets,
+                          VAContextID context);
+
+void
+i965_trace_destroy_context(struct i965_trace *trace, VAContextID context);
+
+void
+i965_trace_begin_picture(struct i965_trace *trace,
+                         VAContextID context,
+                         VASurfaceID render_target);
+
+void
+i965_trace_render_buffer(struct i965_trace *trace,
+                         VAContextID context,
+                         struct object_buffer *obj_buffer);
+
+void
+i965_trace_end_picture(struct i965_trace *trace, VAContextID context);
+
+/* Replays @filename on @ctx, the objects it creates are destroyed on return */
+VAStatus
+i965_trace_replay(VADriverContextP ctx,
+                  const char *filename,
+                  struct i965_trace_replay_stats *stats);
+
+#endif /* I965_TRACE_H */
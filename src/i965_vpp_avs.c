@@ -189,13 +189,14 @@ avs_gen_coeffs_lanczos(float *coeffs, int num_coeffs, int phase, int num_phases,
 
 /* Generate coefficients with the supplied scaler */
 static bool
-avs_gen_coeffs(AVSState *avs, float sx, float sy, AVSGenCoeffsFunc gen_coeffs)
+avs_gen_coeffs(AVSState *avs, AVSCoeffs *coeffs_table, float sx, float sy,
+    AVSGenCoeffsFunc gen_coeffs)
 {
     const AVSConfig * const config = avs->config;
     int i;
 
     for (i = 0; i <= config->num_phases; i++) {
-        AVSCoeffs * const coeffs = &avs->coeffs[i];
+        AVSCoeffs * const coeffs = &coeffs_table[i];
 
         gen_coeffs(coeffs->y_k_h, config->num_luma_coeffs,
             i, config->num_phases, sx);
@@ -221,6 +222,46 @@ avs_init_state(AVSState *avs, const AVSConfig *config)
     avs->flags = 0;
     avs->scale_x = 0.0f;
     avs->scale_y = 0.0f;
+    avs->num_cached = 0;
+    avs->next_cached = 0;
+}
+
+/* Looks up the high-quality coefficients for the supplied factors */
+static AVSCacheEntry *
+avs_cache_lookup(AVSState *avs, float sx, float sy)
+{
+    int i;
+
+    for (i = 0; i < avs->num_cached; i++) {
+        if (avs->cache[i].scale_x == sx && avs->cache[i].scale_y == sy)
+            return &avs->cache[i];
+    }
+    return NULL;
+}
+
+/* Generates high-quality coefficients into a new cache entry */
+static AVSCacheEntry *
+avs_cache_insert(AVSState *avs, float sx, float sy)
+{
+    AVSCacheEntry *entry;
+
+    if (avs->num_cached < AVS_CACHE_SIZE)
+        entry = &avs->cache[avs->num_cached++];
+    else {
+        entry = &avs->cache[avs->next_cached];
+        avs->next_cached = (avs->next_cached + 1) % AVS_CACHE_SIZE;
+    }
+
+    if (!avs_gen_coeffs(avs, entry->coeffs, sx, sy, avs_gen_coeffs_lanczos)) {
+        /* Don't keep a half generated entry around */
+        entry->scale_x = 0.0f;
+        entry->scale_y = 0.0f;
+        return NULL;
+    }
+
+    entry->scale_x = sx;
+    entry->scale_y = sy;
+    return entry;
 }
 
 /* Checks whether the AVS scaling parameters changed */
@@ -245,7 +286,7 @@ avs_params_changed(AVSState *avs, float sx, float sy, uint32_t flags)
 bool
 avs_update_coefficients(AVSState *avs, float sx, float sy, uint32_t flags)
 {
-    AVSGenCoeffsFunc gen_coeffs;
+    AVSCacheEntry *entry;
 
     flags &= VA_FILTER_SCALING_MASK;
     if (!avs_params_changed(avs, sx, sy, flags))
@@ -253,19 +294,40 @@ avs_update_coefficients(AVSState *avs, float sx, float sy, uint32_t flags)
 
     switch (flags) {
     case VA_FILTER_SCALING_HQ:
-        gen_coeffs = avs_gen_coeffs_lanczos;
+        entry = avs_cache_lookup(avs, sx, sy);
+        if (!entry)
+            entry = avs_cache_insert(avs, sx, sy);
+        if (!entry) {
+            assert(0 && "invalid set of coefficients generated");
+            return false;
+        }
+        memcpy(avs->coeffs, entry->coeffs,
+            (avs->config->num_phases + 1) * sizeof(avs->coeffs[0]));
         break;
     default:
-        gen_coeffs = avs_gen_coeffs_linear;
+        if (!avs_gen_coeffs(avs, avs->coeffs, sx, sy, avs_gen_coeffs_linear)) {
+            assert(0 && "invalid set of coefficients generated");
+            return false;
+        }
         break;
     }
-    if (!avs_gen_coeffs(avs, sx, sy, gen_coeffs)) {
-        assert(0 && "invalid set of coefficients generated");
-        return false;
-    }
 
     avs->flags = flags;
     avs->scale_x = sx;
     avs->scale_y = sy;
     return true;
 }
+
+/* Generates the coefficients for the supplied factors ahead of time */
+bool
+avs_prepare_coefficients(AVSState *avs, float sx, float sy, uint32_t flags)
+{
+    /* Only the high-quality coefficients depend on the factors */
+    if ((flags & VA_FILTER_SCALING_MASK) != VA_FILTER_SCALING_HQ)
+        return true;
+
+    if (avs_cache_lookup(avs, sx, sy))
+        return true;
+
+    return avs_cache_insert(avs, sx, sy) != NULL;
+}
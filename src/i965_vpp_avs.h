@@ -40,10 +40,14 @@
 /** Maximum number of coefficients for chroma samples */
 #define AVS_MAX_CHROMA_COEFFS 4
 
+/** Number of high-quality coefficient sets kept for reuse */
+#define AVS_CACHE_SIZE 8
+
 typedef struct avs_coeffs               AVSCoeffs;
 typedef struct avs_coeffs_range         AVSCoeffsRange;
 typedef struct avs_config               AVSConfig;
 typedef struct avs_state                AVSState;
+typedef struct avs_cache_entry          AVSCacheEntry;
 
 /** AVS coefficients for one phase */
 struct avs_coeffs {
@@ -81,6 +85,16 @@ struct avs_config {
     int num_chroma_coeffs;
 };
 
+/** High-quality coefficients generated for one set of scaling factors */
+struct avs_cache_entry {
+    /** Scaling factor on the X-axis (horizontal) */
+    float scale_x;
+    /** Scaling factor on the Y-axis (vertical) */
+    float scale_y;
+    /** Coefficients for the polyphase scaler */
+    AVSCoeffs coeffs[AVS_MAX_PHASES + 1];
+};
+
 /** AVS block state */
 struct avs_state {
     /** Per-generation configuration parameters */
@@ -93,6 +107,12 @@ struct avs_state {
     float scale_y;
     /** Coefficients for the polyphase scaler */
     AVSCoeffs coeffs[AVS_MAX_PHASES + 1];
+    /** Recently generated high-quality coefficients */
+    AVSCacheEntry cache[AVS_CACHE_SIZE];
+    /** Number of valid cache entries */
+    int num_cached;
+    /** Next cache entry to replace once the cache is full */
+    int next_cached;
 };
 
 /** Initializes AVS state with the supplied configuration */
@@ -103,6 +123,14 @@ avs_init_state(AVSState *avs, const AVSConfig *config);
 bool
 avs_update_coefficients(AVSState *avs, float sx, float sy, uint32_t flags);
 
+/**
+ * Generates the coefficients for the supplied factors ahead of time, e.g.
+ * for every output of a multi-output picture, without changing the
+ * current ones. Later updates with these factors hit the cache.
+ */
+bool
+avs_prepare_coefficients(AVSState *avs, float sx, float sy, uint32_t flags);
+
 /** Checks whether AVS is needed, e.g. if high-quality scaling is requested */
 static inline bool
 avs_is_needed(uint32_t flags)
@@ -0,0 +1,42 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_VPP_FIELD_RATE_H
+#define I965_VPP_FIELD_RATE_H
+
+#include <va/va.h>
+#include <va/va_vpp.h>
+
+/*
+ * Field rate deinterlacing. An application sets this bit in the flags of
+ * a motion adaptive or motion compensated VAProcFilterDeinterlacing filter
+ * of a first field picture and passes a single additional output, of the
+ * same size and format as the output region. The render target then gets
+ * the first field and the additional output the second one, from the same
+ * deinterlacing run. Without the bit, additional outputs are always scaled
+ * copies of the render target.
+ */
+#define VA_DEINTERLACING_FIELD_RATE_INTEL       0x00010000
+
+#endif /* I965_VPP_FIELD_RATE_H */
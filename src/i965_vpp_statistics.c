@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sysdeps.h"
+
+#include "i965_drv_video.h"
+#include "i965_vpp_statistics.h"
+
+/*
+ * The VEBOX writes one row of per-block statistics per 4 lines, the pitch
+ * being the 64 aligned width, then the per-frame statistics: the film mode
+ * detection counters, the global noise estimate and the skin tone counters
+ * (twice as many on Gen9, one set per slice). The ACE histogram follows.
+ */
+#define VEB_STAT_PER_FRAME_SIZE         (32 * 4)
+#define VEB_STAT_PER_FRAME_SIZE_GEN9    (32 * 8)
+#define VEB_STAT_HISTOGRAM_SIZE         (256 * 4)
+
+#define VEB_STAT_FMD_DIFF_OFFSET        0x00
+#define VEB_STAT_GNE_SUM_OFFSET         0x2c
+#define VEB_STAT_GNE_COUNT_OFFSET       0x30
+
+static unsigned int
+i965_proc_statistics_per_frame_offset(int width, int height)
+{
+    return ALIGN(width, 64) * (ALIGN(height, 4) / 4);
+}
+
+static unsigned int
+i965_proc_statistics_per_frame_size(const struct intel_device_info *info)
+{
+    if (IS_GEN9(info))
+        return VEB_STAT_PER_FRAME_SIZE_GEN9;
+
+    return VEB_STAT_PER_FRAME_SIZE;
+}
+
+unsigned int
+i965_proc_statistics_size(const struct intel_device_info *info,
+                          int width,
+                          int height)
+{
+    return i965_proc_statistics_per_frame_offset(width, height) +
+        i965_proc_statistics_per_frame_size(info) +
+        VEB_STAT_HISTOGRAM_SIZE;
+}
+
+void
+i965_proc_statistics_init(struct i965_proc_statistics_segment *segment,
+                          const struct intel_device_info *info,
+                          int width,
+                          int height,
+                          unsigned int flags)
+{
+    memset(segment, 0, sizeof(*segment));
+
+    if (!info)
+        return;
+
+    segment->flags = flags;
+    segment->per_frame_offset = i965_proc_statistics_per_frame_offset(width, height);
+    segment->histogram_offset = segment->per_frame_offset +
+        i965_proc_statistics_per_frame_size(info);
+}
+
+static unsigned int
+i965_proc_statistics_read(const uint8_t *raw, unsigned int offset)
+{
+    uint32_t value;
+
+    memcpy(&value, raw + offset, sizeof(value));
+
+    return value;
+}
+
+void
+i965_proc_statistics_parse(struct i965_proc_statistics_segment *segment)
+{
+    const uint8_t * const raw = (const uint8_t *)segment + I965_PROC_STATISTICS_HEADER_SIZE;
+    const uint8_t * const per_frame = raw + segment->per_frame_offset;
+    VAProcStatisticsIntel * const stats = &segment->base;
+
+    if (segment->mapped)
+        return;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->flags = segment->flags;
+
+    if (stats->flags & VA_PROC_STATISTICS_HISTOGRAM)
+        memcpy(stats->histogram, raw + segment->histogram_offset,
+               sizeof(stats->histogram));
+
+    if (stats->flags & VA_PROC_STATISTICS_NOISE) {
+        stats->noise_sum = i965_proc_statistics_read(per_frame, VEB_STAT_GNE_SUM_OFFSET);
+        stats->noise_count = i965_proc_statistics_read(per_frame, VEB_STAT_GNE_COUNT_OFFSET);
+    }
+
+    if (stats->flags & VA_PROC_STATISTICS_MOTION)
+        stats->motion_sum = i965_proc_statistics_read(per_frame, VEB_STAT_FMD_DIFF_OFFSET);
+
+    segment->mapped = 1;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_VPP_STATISTICS_H
+#define I965_VPP_STATISTICS_H
+
+#include <va/va.h>
+
+/*
+ * Frame statistics of the VEBOX. An application that wants them creates a
+ * buffer of VAProcStatisticsBufferTypeIntel on its VPP context and renders
+ * it along with the pipeline parameters of a picture. The VEBOX writes its
+ * statistics straight into the buffer and vaMapBuffer() waits for them and
+ * returns a VAProcStatisticsIntel. The buffer is reset when it is rendered,
+ * so pictures that don't run on the VEBOX, i.e. without a denoise,
+ * deinterlacing or color balance filter, report no statistics.
+ */
+#define VAProcStatisticsBufferTypeIntel         ((VABufferType)0x7f00)
+
+#define VA_PROC_STATISTICS_HISTOGRAM            0x0001
+#define VA_PROC_STATISTICS_NOISE                0x0002
+#define VA_PROC_STATISTICS_MOTION               0x0004
+
+typedef struct _VAProcStatisticsIntel
+{
+    /* VA_PROC_STATISTICS_*, the statistics available for the picture */
+    unsigned int flags;
+
+    /* Luma histogram, number of pixels per 8 bit value (color balance) */
+    unsigned int histogram[256];
+
+    /* Global noise estimate, the luma noise summed over noise_count
+     * blocks (denoise) */
+    unsigned int noise_sum;
+    unsigned int noise_count;
+
+    /* Sum of the differences between this picture and the previous one
+     * seen by the motion detector (deinterlacing, not on a first frame) */
+    unsigned int motion_sum;
+
+    unsigned int reserved[8];
+} VAProcStatisticsIntel;
+
+struct intel_device_info;
+
+/*
+ * Layout of the buffer object. The raw VEBOX statistics follow the header
+ * at I965_PROC_STATISTICS_HEADER_SIZE, the per-block statistics first and
+ * the per-frame ones at the end.
+ */
+#define I965_PROC_STATISTICS_HEADER_SIZE        0x1000
+
+struct i965_proc_statistics_segment
+{
+    VAProcStatisticsIntel base;
+
+    unsigned int flags;                 /* written by the VEBOX */
+    unsigned int per_frame_offset;      /* in the raw statistics */
+    unsigned int histogram_offset;      /* in the raw statistics */
+    unsigned int mapped;
+};
+
+/* Size of the raw statistics of a @width x @height picture */
+unsigned int
+i965_proc_statistics_size(const struct intel_device_info *info,
+                          int width,
+                          int height);
+
+/* Resets @segment for a picture, @flags tells what the VEBOX will write.
+ * @info is NULL for a buffer no picture was rendered to yet. */
+void
+i965_proc_statistics_init(struct i965_proc_statistics_segment *segment,
+                          const struct intel_device_info *info,
+                          int width,
+                          int height,
+                          unsigned int flags);
+
+/* Fills the public part of @segment from the raw statistics following it */
+void
+i965_proc_statistics_parse(struct i965_proc_statistics_segment *segment);
+
+#endif /* I965_VPP_STATISTICS_H */
@@ -0,0 +1,714 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "sysdeps.h"
+
+#include <math.h>
+
+#include "intel_batchbuffer.h"
+#include "i965_drv_video.h"
+#include "i965_post_processing.h"
+#include "i965_yuv_coefs.h"
+#include "i965_vpp_sw.h"
+
+/* Fractional bits of the fixed point filter weights */
+#define VPP_SW_WEIGHT_BITS      14
+
+/* Fractional bits kept between the horizontal and the vertical pass */
+#define VPP_SW_INTER_BITS       6
+
+/* One 8 bit component plane, either of the source or of the output */
+struct vpp_sw_plane
+{
+    uint8_t *data;
+    int pitch;
+    int width;
+    int height;
+};
+
+/* Filter taps for one output column or row */
+struct vpp_sw_taps
+{
+    int num_taps;
+    int *start;                 /* first source sample, may be out of the plane */
+    int32_t *weights;           /* num_taps per output sample */
+};
+
+static bool
+vpp_sw_get_subsampling(unsigned int fourcc, int *h_sub, int *v_sub)
+{
+    switch (fourcc) {
+    case VA_FOURCC_NV12:
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+        *h_sub = 2;
+        *v_sub = 2;
+        return true;
+
+    case VA_FOURCC_YUY2:
+    case VA_FOURCC_UYVY:
+        *h_sub = 2;
+        *v_sub = 1;
+        return true;
+
+    case VA_FOURCC_RGBA:
+    case VA_FOURCC_RGBX:
+    case VA_FOURCC_BGRA:
+    case VA_FOURCC_BGRX:
+        *h_sub = 1;
+        *v_sub = 1;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+bool
+i965_vpp_sw_supports_format(unsigned int fourcc)
+{
+    int h_sub, v_sub;
+
+    return vpp_sw_get_subsampling(fourcc, &h_sub, &v_sub);
+}
+
+static bool
+vpp_sw_is_rgb(unsigned int fourcc)
+{
+    return (fourcc == VA_FOURCC_RGBA ||
+            fourcc == VA_FOURCC_RGBX ||
+            fourcc == VA_FOURCC_BGRA ||
+            fourcc == VA_FOURCC_BGRX);
+}
+
+static bool
+vpp_sw_plane_alloc(struct vpp_sw_plane *plane, int width, int height)
+{
+    plane->width = MAX(width, 1);
+    plane->height = MAX(height, 1);
+    plane->pitch = plane->width;
+    plane->data = malloc(plane->pitch * plane->height);
+
+    return !!plane->data;
+}
+
+static void
+vpp_sw_planes_free(struct vpp_sw_plane planes[3])
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        free(planes[i].data);
+        planes[i].data = NULL;
+    }
+}
+
+static inline uint8_t
+vpp_sw_clamp(int value)
+{
+    return (uint8_t)CLAMP(0, 255, value);
+}
+
+/* Same integer BT.601 conversion as the RGB load kernels */
+static inline void
+vpp_sw_rgb_to_yuv(int r, int g, int b, uint8_t *y, uint8_t *u, uint8_t *v)
+{
+    *y = vpp_sw_clamp((257 * r + 504 * g + 98 * b) / 1000 + 16);
+    *u = vpp_sw_clamp((-148 * r - 291 * g + 439 * b) / 1000 + 128);
+    *v = vpp_sw_clamp((439 * r - 368 * g - 71 * b) / 1000 + 128);
+}
+
+/* Splits the whole source picture into Y, U and V planes */
+static bool
+vpp_sw_unpack(const struct i965_vpp_sw_image *src,
+              int h_sub,
+              int v_sub,
+              struct vpp_sw_plane planes[3])
+{
+    int cw = (src->width + h_sub - 1) / h_sub;
+    int ch = (src->height + v_sub - 1) / v_sub;
+    int x, y, r_offset, b_offset;
+
+    if (!vpp_sw_plane_alloc(&planes[0], src->width, src->height) ||
+        !vpp_sw_plane_alloc(&planes[1], cw, ch) ||
+        !vpp_sw_plane_alloc(&planes[2], cw, ch))
+        return false;
+
+    switch (src->fourcc) {
+    case VA_FOURCC_NV12:
+        for (y = 0; y < src->height; y++)
+            memcpy(planes[0].data + y * planes[0].pitch, src->planes[0] + y * src->pitches[0], src->width);
+
+        for (y = 0; y < ch; y++) {
+            const uint8_t *uv = src->planes[1] + y * src->pitches[1];
+
+            for (x = 0; x < cw; x++) {
+                planes[1].data[y * planes[1].pitch + x] = uv[2 * x];
+                planes[2].data[y * planes[2].pitch + x] = uv[2 * x + 1];
+            }
+        }
+
+        break;
+
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+        for (y = 0; y < src->height; y++)
+            memcpy(planes[0].data + y * planes[0].pitch, src->planes[0] + y * src->pitches[0], src->width);
+
+        for (y = 0; y < ch; y++) {
+            memcpy(planes[1].data + y * planes[1].pitch, src->planes[1] + y * src->pitches[1], cw);
+            memcpy(planes[2].data + y * planes[2].pitch, src->planes[2] + y * src->pitches[2], cw);
+        }
+
+        break;
+
+    case VA_FOURCC_YUY2:
+    case VA_FOURCC_UYVY: {
+        int y_offset = (src->fourcc == VA_FOURCC_YUY2) ? 0 : 1;
+        int u_offset = (src->fourcc == VA_FOURCC_YUY2) ? 1 : 0;
+
+        for (y = 0; y < src->height; y++) {
+            const uint8_t *p = src->planes[0] + y * src->pitches[0];
+
+            for (x = 0; x < src->width; x++)
+                planes[0].data[y * planes[0].pitch + x] = p[2 * x + y_offset];
+
+            for (x = 0; x < cw; x++) {
+                planes[1].data[y * planes[1].pitch + x] = p[4 * x + u_offset];
+                planes[2].data[y * planes[2].pitch + x] = p[4 * x + u_offset + 2];
+            }
+        }
+
+        break;
+    }
+
+    case VA_FOURCC_RGBA:
+    case VA_FOURCC_RGBX:
+    case VA_FOURCC_BGRA:
+    case VA_FOURCC_BGRX:
+        r_offset = (src->fourcc == VA_FOURCC_RGBA || src->fourcc == VA_FOURCC_RGBX) ? 0 : 2;
+        b_offset = 2 - r_offset;
+
+        for (y = 0; y < src->height; y++) {
+            const uint8_t *p = src->planes[0] + y * src->pitches[0];
+
+            for (x = 0; x < src->width; x++, p += 4)
+                vpp_sw_rgb_to_yuv(p[r_offset], p[1], p[b_offset],
+                                  &planes[0].data[y * planes[0].pitch + x],
+                                  &planes[1].data[y * planes[1].pitch + x],
+                                  &planes[2].data[y * planes[2].pitch + x]);
+        }
+
+        break;
+
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+/* Writes the Y, U and V planes into @rect of the output picture */
+static void
+vpp_sw_pack(struct i965_vpp_sw_image *dst,
+            const VARectangle *rect,
+            int h_sub,
+            int v_sub,
+            const struct vpp_sw_plane planes[3],
+            const float *coefs)
+{
+    int cx = rect->x / h_sub, cy = rect->y / v_sub;
+    int x, y, r_offset, b_offset;
+
+    switch (dst->fourcc) {
+    case VA_FOURCC_NV12:
+        for (y = 0; y < planes[0].height; y++)
+            memcpy(dst->planes[0] + (rect->y + y) * dst->pitches[0] + rect->x,
+                   planes[0].data + y * planes[0].pitch,
+                   planes[0].width);
+
+        for (y = 0; y < planes[1].height; y++) {
+            uint8_t *uv = dst->planes[1] + (cy + y) * dst->pitches[1] + cx * 2;
+
+            for (x = 0; x < planes[1].width; x++) {
+                uv[2 * x] = planes[1].data[y * planes[1].pitch + x];
+                uv[2 * x + 1] = planes[2].data[y * planes[2].pitch + x];
+            }
+        }
+
+        break;
+
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+        for (y = 0; y < planes[0].height; y++)
+            memcpy(dst->planes[0] + (rect->y + y) * dst->pitches[0] + rect->x,
+                   planes[0].data + y * planes[0].pitch,
+                   planes[0].width);
+
+        for (y = 0; y < planes[1].height; y++) {
+            memcpy(dst->planes[1] + (cy + y) * dst->pitches[1] + cx,
+                   planes[1].data + y * planes[1].pitch,
+                   planes[1].width);
+            memcpy(dst->planes[2] + (cy + y) * dst->pitches[2] + cx,
+                   planes[2].data + y * planes[2].pitch,
+                   planes[2].width);
+        }
+
+        break;
+
+    case VA_FOURCC_YUY2:
+    case VA_FOURCC_UYVY: {
+        int y_offset = (dst->fourcc == VA_FOURCC_YUY2) ? 0 : 1;
+        int u_offset = (dst->fourcc == VA_FOURCC_YUY2) ? 1 : 0;
+
+        for (y = 0; y < planes[0].height; y++) {
+            uint8_t *p = dst->planes[0] + (rect->y + y) * dst->pitches[0];
+
+            for (x = 0; x < planes[0].width; x++)
+                p[2 * (rect->x + x) + y_offset] = planes[0].data[y * planes[0].pitch + x];
+
+            for (x = 0; x < planes[1].width; x++) {
+                p[4 * (cx + x) + u_offset] = planes[1].data[y * planes[1].pitch + x];
+                p[4 * (cx + x) + u_offset + 2] = planes[2].data[y * planes[2].pitch + x];
+            }
+        }
+
+        break;
+    }
+
+    case VA_FOURCC_RGBA:
+    case VA_FOURCC_RGBX:
+    case VA_FOURCC_BGRA:
+    case VA_FOURCC_BGRX:
+        r_offset = (dst->fourcc == VA_FOURCC_RGBA || dst->fourcc == VA_FOURCC_RGBX) ? 0 : 2;
+        b_offset = 2 - r_offset;
+
+        for (y = 0; y < planes[0].height; y++) {
+            uint8_t *p = dst->planes[0] + (rect->y + y) * dst->pitches[0] + rect->x * 4;
+
+            for (x = 0; x < planes[0].width; x++, p += 4) {
+                float yf = planes[0].data[y * planes[0].pitch + x] / 255.0f + coefs[3];
+                float uf = planes[1].data[y * planes[1].pitch + x] / 255.0f + coefs[7];
+                float vf = planes[2].data[y * planes[2].pitch + x] / 255.0f + coefs[11];
+
+                p[r_offset] = vpp_sw_clamp(lrintf((coefs[0] * yf + coefs[1] * uf + coefs[2] * vf) * 255.0f));
+                p[1] = vpp_sw_clamp(lrintf((coefs[4] * yf + coefs[5] * uf + coefs[6] * vf) * 255.0f));
+                p[b_offset] = vpp_sw_clamp(lrintf((coefs[8] * yf + coefs[9] * uf + coefs[10] * vf) * 255.0f));
+                p[3] = 0xff;
+            }
+        }
+
+        break;
+
+    default:
+        assert(0);
+        break;
+    }
+}
+
+static void
+vpp_sw_taps_free(struct vpp_sw_taps *taps)
+{
+    free(taps->start);
+    free(taps->weights);
+}
+
+/*
+ * Maps @dst_size output samples onto [@src_origin, @src_origin + @src_size)
+ * and picks the weights for each of them. The AVS tables only cover the
+ * phases up to half a sample, the other half uses the mirrored filter of
+ * the next sample, like the hardware does. The taps cover the same source
+ * samples either way since the filters have an even length.
+ */
+static bool
+vpp_sw_taps_init(struct vpp_sw_taps *taps,
+                 float src_origin,
+                 float src_size,
+                 int dst_size,
+                 const AVSState *avs,
+                 bool luma,
+                 bool horizontal)
+{
+    const float step = src_size / dst_size;
+    int i, k, n, c, phase;
+
+    taps->num_taps = n = avs ? (luma ? avs->config->num_luma_coeffs : avs->config->num_chroma_coeffs) : 2;
+    taps->start = malloc(dst_size * sizeof(*taps->start));
+    taps->weights = malloc(dst_size * n * sizeof(*taps->weights));
+
+    if (!taps->start || !taps->weights) {
+        vpp_sw_taps_free(taps);
+        return false;
+    }
+
+    c = n / 2 - 1;
+
+    for (i = 0; i < dst_size; i++) {
+        float pos = src_origin + (i + 0.5f) * step - 0.5f;
+        int x0 = (int)floorf(pos);
+        float f = pos - x0;
+        int32_t *w = &taps->weights[i * n];
+        int32_t sum = 0, largest = 0;
+        const AVSCoeffs *coeffs;
+        const float *table;
+        bool mirrored;
+
+        if (!avs) {
+            taps->start[i] = x0;
+            w[0] = lrintf((1.0f - f) * (1 << VPP_SW_WEIGHT_BITS));
+            w[1] = (1 << VPP_SW_WEIGHT_BITS) - w[0];
+            continue;
+        }
+
+        mirrored = (f > 0.5f);
+        phase = lrintf((mirrored ? 1.0f - f : f) * 2 * avs->config->num_phases);
+        coeffs = &avs->coeffs[phase];
+        table = luma ? (horizontal ? coeffs->y_k_h : coeffs->y_k_v) :
+            (horizontal ? coeffs->uv_k_h : coeffs->uv_k_v);
+        taps->start[i] = x0 - c;
+
+        for (k = 0; k < n; k++)
+            w[k] = lrintf(table[mirrored ? n - 1 - k : k] * (1 << VPP_SW_WEIGHT_BITS));
+
+        /* Keep flat areas flat despite the rounding */
+        for (k = 0; k < n; k++) {
+            sum += w[k];
+
+            if (w[k] > w[largest])
+                largest = k;
+        }
+
+        w[largest] += (1 << VPP_SW_WEIGHT_BITS) - sum;
+    }
+
+    return true;
+}
+
+/*
+ * Separable filter of @src into @dst, horizontal pass first. The inner
+ * loops are plain dot products over clamped indices so that the compiler
+ * can vectorize them.
+ */
+static bool
+vpp_sw_scale_plane(const struct vpp_sw_plane *src,
+                   struct vpp_sw_plane *dst,
+                   const struct vpp_sw_taps *h_taps,
+                   const struct vpp_sw_taps *v_taps)
+{
+    const int h_shift = VPP_SW_WEIGHT_BITS - VPP_SW_INTER_BITS;
+    const int v_shift = VPP_SW_WEIGHT_BITS + VPP_SW_INTER_BITS;
+    int32_t *inter;
+    int x, y, k;
+
+    inter = malloc(src->height * dst->width * sizeof(*inter));
+
+    if (!inter)
+        return false;
+
+    for (y = 0; y < src->height; y++) {
+        const uint8_t *s = src->data + y * src->pitch;
+        int32_t *d = inter + y * dst->width;
+
+        for (x = 0; x < dst->width; x++) {
+            const int32_t *w = &h_taps->weights[x * h_taps->num_taps];
+            int32_t acc = 0;
+
+            for (k = 0; k < h_taps->num_taps; k++)
+                acc += w[k] * s[CLAMP(0, src->width - 1, h_taps->start[x] + k)];
+
+            d[x] = (acc + (1 << (h_shift - 1))) >> h_shift;
+        }
+    }
+
+    for (y = 0; y < dst->height; y++) {
+        const int32_t *w = &v_taps->weights[y * v_taps->num_taps];
+        uint8_t *d = dst->data + y * dst->pitch;
+
+        for (x = 0; x < dst->width; x++) {
+            int32_t acc = 0;
+
+            for (k = 0; k < v_taps->num_taps; k++)
+                acc += w[k] * inter[CLAMP(0, src->height - 1, v_taps->start[y] + k) * dst->width + x];
+
+            d[x] = vpp_sw_clamp((acc + (1 << (v_shift - 1))) >> v_shift);
+        }
+    }
+
+    free(inter);
+
+    return true;
+}
+
+bool
+i965_vpp_sw_process(const struct i965_vpp_sw_image *src,
+                    const VARectangle *src_rect,
+                    struct i965_vpp_sw_image *dst,
+                    const VARectangle *dst_rect,
+                    const AVSState *avs,
+                    const float *yuv_to_rgb)
+{
+    struct vpp_sw_plane src_planes[3] = { { 0 } }, dst_planes[3] = { { 0 } };
+    struct vpp_sw_taps h_taps, v_taps;
+    int src_h_sub, src_v_sub, dst_h_sub, dst_v_sub;
+    int i, sh, sv;
+    size_t length;
+    bool success = false;
+
+    if (!vpp_sw_get_subsampling(src->fourcc, &src_h_sub, &src_v_sub) ||
+        !vpp_sw_get_subsampling(dst->fourcc, &dst_h_sub, &dst_v_sub))
+        return false;
+
+    if (!src_rect->width || !src_rect->height ||
+        !dst_rect->width || !dst_rect->height ||
+        dst_rect->x < 0 || dst_rect->y < 0 ||
+        dst_rect->x + dst_rect->width > dst->width ||
+        dst_rect->y + dst_rect->height > dst->height)
+        return false;
+
+    /* RGB sources are converted to YUV 4:4:4 */
+    if (vpp_sw_is_rgb(src->fourcc))
+        src_h_sub = src_v_sub = 1;
+
+    if (!yuv_to_rgb)
+        yuv_to_rgb = i915_color_standard_to_coefs(VAProcColorStandardBT601, &length);
+
+    if (!vpp_sw_unpack(src, src_h_sub, src_v_sub, src_planes))
+        goto out;
+
+    for (i = 0; i < 3; i++) {
+        bool luma = (i == 0);
+
+        /* RGB outputs need every component at full resolution */
+        sh = (luma || vpp_sw_is_rgb(dst->fourcc)) ? 1 : dst_h_sub;
+        sv = (luma || vpp_sw_is_rgb(dst->fourcc)) ? 1 : dst_v_sub;
+
+        if (!vpp_sw_plane_alloc(&dst_planes[i],
+                                (dst_rect->width + sh - 1) / sh,
+                                (dst_rect->height + sv - 1) / sv))
+            goto out;
+
+        sh = luma ? 1 : src_h_sub;
+        sv = luma ? 1 : src_v_sub;
+
+        if (!vpp_sw_taps_init(&h_taps, (float)src_rect->x / sh, (float)src_rect->width / sh,
+                              dst_planes[i].width, avs, luma, true))
+            goto out;
+
+        if (!vpp_sw_taps_init(&v_taps, (float)src_rect->y / sv, (float)src_rect->height / sv,
+                              dst_planes[i].height, avs, luma, false)) {
+            vpp_sw_taps_free(&h_taps);
+            goto out;
+        }
+
+        success = vpp_sw_scale_plane(&src_planes[i], &dst_planes[i], &h_taps, &v_taps);
+        vpp_sw_taps_free(&h_taps);
+        vpp_sw_taps_free(&v_taps);
+
+        if (!success)
+            goto out;
+    }
+
+    vpp_sw_pack(dst, dst_rect, dst_h_sub, dst_v_sub, dst_planes, yuv_to_rgb);
+
+out:
+    vpp_sw_planes_free(src_planes);
+    vpp_sw_planes_free(dst_planes);
+
+    return success;
+}
+
+static unsigned int
+vpp_sw_get_fourcc(const struct i965_surface *surface)
+{
+    if (surface->type == I965_SURFACE_TYPE_IMAGE)
+        return ((struct object_image *)surface->base)->image.format.fourcc;
+    else
+        return ((struct object_surface *)surface->base)->fourcc;
+}
+
+/* Maps the buffer of @surface and describes its planes in @image */
+static dri_bo *
+vpp_sw_map_surface(const struct i965_surface *surface, struct i965_vpp_sw_image *image)
+{
+    uint8_t *data;
+    dri_bo *bo;
+
+    memset(image, 0, sizeof(*image));
+
+    if (surface->type == I965_SURFACE_TYPE_IMAGE) {
+        struct object_image *obj_image = (struct object_image *)surface->base;
+        int i, u_index = 1, v_index = 2;
+
+        bo = obj_image->bo;
+
+        if (!bo || dri_bo_map(bo, 1) || !bo->virtual)
+            return NULL;
+
+        data = bo->virtual;
+        image->fourcc = obj_image->image.format.fourcc;
+        image->width = obj_image->image.width;
+        image->height = obj_image->image.height;
+
+        /* VAImage keeps the planes in memory order, V comes first in YV12 */
+        if (image->fourcc == VA_FOURCC_YV12) {
+            u_index = 2;
+            v_index = 1;
+        }
+
+        for (i = 0; i < obj_image->image.num_planes && i < 3; i++) {
+            int j = (i == 1) ? u_index : (i == 2) ? v_index : 0;
+
+            image->planes[i] = data + obj_image->image.offsets[j];
+            image->pitches[i] = obj_image->image.pitches[j];
+        }
+    } else {
+        struct object_surface *obj_surface = (struct object_surface *)surface->base;
+        unsigned int tiling, swizzle;
+
+        bo = obj_surface->bo;
+
+        if (!bo)
+            return NULL;
+
+        dri_bo_get_tiling(bo, &tiling, &swizzle);
+
+        /* Tiled surfaces are only linear through the aperture */
+        if (tiling != I915_TILING_NONE)
+            drm_intel_gem_bo_map_gtt(bo);
+        else
+            dri_bo_map(bo, 1);
+
+        if (!bo->virtual)
+            return NULL;
+
+        data = bo->virtual;
+        image->fourcc = obj_surface->fourcc;
+        image->width = obj_surface->orig_width;
+        image->height = obj_surface->orig_height;
+        image->planes[0] = data;
+        image->pitches[0] = obj_surface->width;
+
+        if (image->fourcc == VA_FOURCC_NV12) {
+            image->planes[1] = data + obj_surface->y_cb_offset * obj_surface->width;
+            image->pitches[1] = obj_surface->width;
+        } else if (image->fourcc == VA_FOURCC_I420 || image->fourcc == VA_FOURCC_YV12) {
+            image->planes[1] = data + obj_surface->y_cb_offset * obj_surface->width;
+            image->planes[2] = data + obj_surface->y_cr_offset * obj_surface->width;
+            image->pitches[1] = image->pitches[2] = obj_surface->cb_cr_pitch;
+        }
+    }
+
+    return bo;
+}
+
+static void
+vpp_sw_unmap_surface(const struct i965_surface *surface, dri_bo *bo)
+{
+    unsigned int tiling, swizzle;
+
+    if (!bo)
+        return;
+
+    if (surface->type == I965_SURFACE_TYPE_SURFACE) {
+        dri_bo_get_tiling(bo, &tiling, &swizzle);
+
+        if (tiling != I915_TILING_NONE) {
+            drm_intel_gem_bo_unmap_gtt(bo);
+            return;
+        }
+    }
+
+    dri_bo_unmap(bo);
+}
+
+VAStatus
+i965_vpp_sw_image_processing(VADriverContextP ctx,
+                             const struct i965_surface *src_surface,
+                             const VARectangle *src_rect,
+                             struct i965_surface *dst_surface,
+                             const VARectangle *dst_rect)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_post_processing_context *pp_context = i965->pp_context;
+    struct i965_vpp_sw_image src, dst;
+    AVSState *avs = NULL;
+    dri_bo *src_bo, *dst_bo;
+    const float *coefs;
+    size_t length;
+    VAStatus status = VA_STATUS_ERROR_UNIMPLEMENTED;
+
+    if (!i965_vpp_sw_supports_format(vpp_sw_get_fourcc(src_surface)) ||
+        !i965_vpp_sw_supports_format(vpp_sw_get_fourcc(dst_surface)))
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
+
+    _i965LockMutex(&i965->pp_mutex);
+
+    /* Same coefficients as the kernels of this generation would use */
+    if (pp_context &&
+        pp_context->pp_avs_context.state.config &&
+        avs_is_needed(pp_context->filter_flags)) {
+        avs = malloc(sizeof(*avs));
+
+        if (!avs) {
+            _i965UnlockMutex(&i965->pp_mutex);
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        }
+
+        avs_init_state(avs, pp_context->pp_avs_context.state.config);
+
+        if (!avs_update_coefficients(avs,
+                                     (float)dst_rect->width / src_rect->width,
+                                     (float)dst_rect->height / src_rect->height,
+                                     pp_context->filter_flags)) {
+            free(avs);
+            avs = NULL;
+        }
+    }
+
+    coefs = i915_color_standard_to_coefs(i915_filter_to_color_standard(src_surface->flags &
+                                                                       VA_SRC_COLOR_MASK),
+                                         &length);
+
+    /* The mappings below only wait for the batches already submitted,
+     * walks deferred in the post processing batch have to go first. The
+     * callers flush the batches of their own contexts */
+    if (pp_context)
+        intel_batchbuffer_flush(pp_context->batch);
+
+    src_bo = vpp_sw_map_surface(src_surface, &src);
+    dst_bo = vpp_sw_map_surface(dst_surface, &dst);
+
+    if (src_bo && dst_bo &&
+        i965_vpp_sw_process(&src, src_rect, &dst, dst_rect, avs, coefs))
+        status = VA_STATUS_SUCCESS;
+
+    vpp_sw_unmap_surface(dst_surface, dst_bo);
+    vpp_sw_unmap_surface(src_surface, src_bo);
+    free(avs);
+
+    _i965UnlockMutex(&i965->pp_mutex);
+
+    return status;
+}
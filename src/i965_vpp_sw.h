@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef I965_VPP_SW_H
+#define I965_VPP_SW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <va/va.h>
+#include <va/va_backend.h>
+
+#include "i965_vpp_avs.h"
+
+/*
+ * CPU reference of the post processing kernels: load/save of the packed,
+ * semi-planar, planar and RGB layouts, YUV to RGB conversion with the
+ * i965_yuv_coefs.c matrices and polyphase scaling with the AVS tables of
+ * i965_vpp_avs.c. It takes the same rectangles and AVS state as the GPU
+ * path, so tests can use it as the expected output, and it stands in for
+ * the kernels with VA_INTEL_VPP_SW, either for the conversions no kernel
+ * handles (1) or for every one (2).
+ *
+ * Chroma is scaled on its own grid, sample centers aligned with luma, and
+ * sources are clamped at the picture edges like the sampler does.
+ */
+#define I965_VPP_SW_OFF                 0
+#define I965_VPP_SW_FALLBACK            1       /* when no kernel handles the conversion */
+#define I965_VPP_SW_ALWAYS              2
+
+struct i965_surface;
+
+/*
+ * One picture in CPU memory. planes[0] is luma, or the whole picture for
+ * packed YUV and RGB, planes[1] the interleaved UV plane of NV12 or the
+ * U plane of I420/YV12 and planes[2] the V plane.
+ */
+struct i965_vpp_sw_image
+{
+    unsigned int fourcc;
+    int width;
+    int height;
+    uint8_t *planes[3];
+    int pitches[3];
+};
+
+bool
+i965_vpp_sw_supports_format(unsigned int fourcc);
+
+/*
+ * Converts and scales @src_rect of @src into @dst_rect of @dst. @avs holds
+ * the polyphase coefficients for the scaling factors of the rectangles,
+ * NULL scales bilinearly. @yuv_to_rgb is the 3x4 matrix of i965_yuv_coefs.c
+ * used for RGB outputs, NULL picks BT.601.
+ */
+bool
+i965_vpp_sw_process(const struct i965_vpp_sw_image *src,
+                    const VARectangle *src_rect,
+                    struct i965_vpp_sw_image *dst,
+                    const VARectangle *dst_rect,
+                    const AVSState *avs,
+                    const float *yuv_to_rgb);
+
+/* Same interface as i965_image_processing(), run on mapped buffers */
+VAStatus
+i965_vpp_sw_image_processing(VADriverContextP ctx,
+                             const struct i965_surface *src_surface,
+                             const VARectangle *src_rect,
+                             struct i965_surface *dst_surface,
+                             const VARectangle *dst_rect);
+
+#endif /* I965_VPP_SW_H */
@@ -0,0 +1,411 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sysdeps.h"
+
+#include <math.h>
+
+#include "i965_drv_video.h"
+#include "i965_vpp_sw.h"
+#include "i965_vpp_tone_map.h"
+
+/* ST 2084 constants */
+#define PQ_M1           (2610.0 / 16384)
+#define PQ_M2           (2523.0 / 4096 * 128)
+#define PQ_C1           (3424.0 / 4096)
+#define PQ_C2           (2413.0 / 4096 * 32)
+#define PQ_C3           (2392.0 / 4096 * 32)
+#define PQ_PEAK         10000.0
+
+/* STD-B67 constants */
+#define HLG_A           0.17883277
+#define HLG_B           0.28466892
+#define HLG_C           0.55991073
+
+/* Fractional bits of the LUT entries and of the interpolation weights */
+#define TONE_MAP_LUT_BITS       8
+#define TONE_MAP_WEIGHT_BITS    10
+
+/* Linear BT.2020 to BT.709 RGB, BT.2087 */
+static const double bt2020_to_bt709[3][3] = {
+    {  1.6605, -0.5876, -0.0728 },
+    { -0.1246,  1.1329, -0.0083 },
+    { -0.0182, -0.1006,  1.1187 },
+};
+
+static bool
+tone_map_normalize_param(const VAProcFilterParameterBufferToneMappingIntel *in,
+                         VAProcFilterParameterBufferToneMappingIntel *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->type = VAProcFilterToneMappingIntel;
+    out->transfer = in->transfer;
+    out->max_luminance = in->max_luminance ? in->max_luminance : 1000;
+    out->target_luminance = in->target_luminance ? in->target_luminance : 100;
+    out->lut_size = in->lut_size ? in->lut_size : I965_TONE_MAP_DEFAULT_LUT_SIZE;
+    out->lut = in->lut;
+    out->lut_generation = in->lut ? in->lut_generation : 0;
+
+    /* The transfer only matters to a LUT built here */
+    return ((out->lut ||
+             out->transfer == VA_TONE_MAPPING_TRANSFER_PQ ||
+             out->transfer == VA_TONE_MAPPING_TRANSFER_HLG) &&
+            out->max_luminance <= PQ_PEAK &&
+            out->target_luminance <= PQ_PEAK &&
+            out->lut_size >= 2 &&
+            out->lut_size <= I965_TONE_MAP_MAX_LUT_SIZE);
+}
+
+/* Nits of a PQ signal */
+static double
+tone_map_pq_eotf(double e)
+{
+    double p = pow(MAX(e, 0.0), 1 / PQ_M2);
+
+    return PQ_PEAK * pow(MAX(p - PQ_C1, 0.0) / (PQ_C2 - PQ_C3 * p), 1 / PQ_M1);
+}
+
+/* PQ signal of some nits */
+static double
+tone_map_pq_inverse_eotf(double nits)
+{
+    double y = pow(MAX(nits, 0.0) / PQ_PEAK, PQ_M1);
+
+    return pow((PQ_C1 + PQ_C2 * y) / (1 + PQ_C3 * y), PQ_M2);
+}
+
+/* Relative scene light of an HLG signal */
+static double
+tone_map_hlg_inverse_oetf(double e)
+{
+    if (e <= 0.5)
+        return e * e / 3;
+
+    return (exp((e - HLG_C) / HLG_A) + HLG_B) / 12;
+}
+
+/* BT.2390 EETF: rolls @nits off above a knee so that @source_peak lands
+ * on @target_peak, in the PQ domain */
+static double
+tone_map_eetf(double nits, double source_peak, double target_peak)
+{
+    double source_pq, max_lum, ks, e, t, t2, t3;
+
+    if (source_peak <= target_peak)
+        return MIN(nits, target_peak);
+
+    source_pq = tone_map_pq_inverse_eotf(source_peak);
+    max_lum = tone_map_pq_inverse_eotf(target_peak) / source_pq;
+    ks = 1.5 * max_lum - 0.5;
+    e = MIN(tone_map_pq_inverse_eotf(nits) / source_pq, 1.0);
+
+    if (e > ks) {
+        t = (e - ks) / (1 - ks);
+        t2 = t * t;
+        t3 = t2 * t;
+        e = (2 * t3 - 3 * t2 + 1) * ks +
+            (t3 - 2 * t2 + t) * (1 - ks) +
+            (-2 * t3 + 3 * t2) * max_lum;
+    }
+
+    return tone_map_pq_eotf(e * source_pq);
+}
+
+/* The whole chain for one normalized parameter set, 10 bit codes in and
+ * 8 bit codes out */
+static void
+tone_map_sample(const VAProcFilterParameterBufferToneMappingIntel *param,
+                double y, double cb, double cr,
+                double ycbcr[3])
+{
+    const double peak = param->max_luminance;
+    const double target = param->target_luminance;
+    double rgb[3], lin[3], out[3], luma, scale;
+    int i;
+
+    /* Limited range BT.2020 non constant luminance Y'CbCr to R'G'B' */
+    y = (y - 64) / 876;
+    cb = (cb - 512) / 896;
+    cr = (cr - 512) / 896;
+
+    rgb[0] = y + 1.4746 * cr;
+    rgb[2] = y + 1.8814 * cb;
+    rgb[1] = (y - 0.2627 * rgb[0] - 0.0593 * rgb[2]) / 0.6780;
+
+    for (i = 0; i < 3; i++)
+        rgb[i] = CLAMP(0.0, 1.0, rgb[i]);
+
+    /* Display light in nits */
+    if (param->transfer == VA_TONE_MAPPING_TRANSFER_PQ) {
+        for (i = 0; i < 3; i++)
+            lin[i] = tone_map_pq_eotf(rgb[i]);
+    } else {
+        /* HLG OOTF, BT.2100 system gamma for the nominal peak */
+        const double gamma = 1.2 + 0.42 * log10(peak / 1000);
+
+        for (i = 0; i < 3; i++)
+            lin[i] = tone_map_hlg_inverse_oetf(rgb[i]);
+
+        luma = 0.2627 * lin[0] + 0.6780 * lin[1] + 0.0593 * lin[2];
+        scale = luma > 0 ? peak * pow(luma, gamma - 1) : 0;
+
+        for (i = 0; i < 3; i++)
+            lin[i] *= scale;
+    }
+
+    /* BT.709 primaries, out of gamut colors are clipped */
+    for (i = 0; i < 3; i++)
+        out[i] = MAX(0.0, bt2020_to_bt709[i][0] * lin[0] +
+                          bt2020_to_bt709[i][1] * lin[1] +
+                          bt2020_to_bt709[i][2] * lin[2]);
+
+    /* Rolled off per component as BT.2390 allows, which keeps the chain
+     * smooth enough for the LUT to interpolate across the neutral axis */
+    for (i = 0; i < 3; i++)
+        out[i] = pow(CLAMP(0.0, 1.0, tone_map_eetf(out[i], peak, target) / target),
+                     1 / 2.4);
+
+    /* Limited range BT.709 Y'CbCr */
+    luma = 0.2126 * out[0] + 0.7152 * out[1] + 0.0722 * out[2];
+    ycbcr[0] = 16 + 219 * luma;
+    ycbcr[1] = 128 + 224 * (out[2] - luma) / 1.8556;
+    ycbcr[2] = 128 + 224 * (out[0] - luma) / 1.5748;
+}
+
+bool
+i965_tone_map_reference(const VAProcFilterParameterBufferToneMappingIntel *param,
+                        int y, int cb, int cr,
+                        float ycbcr[3])
+{
+    VAProcFilterParameterBufferToneMappingIntel norm;
+    double out[3];
+    int i;
+
+    if (!tone_map_normalize_param(param, &norm) ||
+        (norm.transfer != VA_TONE_MAPPING_TRANSFER_PQ &&
+         norm.transfer != VA_TONE_MAPPING_TRANSFER_HLG))
+        return false;
+
+    tone_map_sample(&norm, y, cb, cr, out);
+
+    for (i = 0; i < 3; i++)
+        ycbcr[i] = out[i];
+
+    return true;
+}
+
+/* Samples the chain of @param on the lut_size^3 grid */
+static void
+tone_map_build_lut(const VAProcFilterParameterBufferToneMappingIntel *param,
+                   uint16_t *lut)
+{
+    const int n = param->lut_size;
+    uint16_t *entry = lut;
+    double out[3];
+    int y, cb, cr, i;
+
+    for (cr = 0; cr < n; cr++) {
+        for (cb = 0; cb < n; cb++) {
+            for (y = 0; y < n; y++) {
+                tone_map_sample(param,
+                                1023.0 * y / (n - 1),
+                                1023.0 * cb / (n - 1),
+                                1023.0 * cr / (n - 1),
+                                out);
+
+                for (i = 0; i < 3; i++)
+                    *entry++ = (uint16_t)CLAMP(0, 255 << TONE_MAP_LUT_BITS,
+                                               (int)lround(out[i] * (1 << TONE_MAP_LUT_BITS)));
+            }
+        }
+    }
+}
+
+bool
+i965_tone_map_update(struct i965_tone_map *tone_map,
+                     const VAProcFilterParameterBufferToneMappingIntel *param)
+{
+    VAProcFilterParameterBufferToneMappingIntel norm;
+    uint16_t *lut;
+    size_t size;
+    int n;
+
+    if (!tone_map_normalize_param(param, &norm))
+        return false;
+
+    n = norm.lut_size;
+    size = n * n * n * 3 * sizeof(*lut);
+
+    if (norm.lut) {
+        /* Copied again only when the application says it changed, the
+         * LUT may weigh over a MB */
+        if (tone_map->app_lut == norm.lut &&
+            tone_map->param.lut_generation == norm.lut_generation &&
+            tone_map->lut_size == n)
+            return true;
+    } else if (tone_map->lut && !memcmp(&norm, &tone_map->param, sizeof(norm)))
+        return true;
+
+    lut = malloc(size);
+
+    if (!lut)
+        return false;
+
+    tone_map->app_lut = norm.lut;
+
+    if (norm.lut) {
+        memcpy(lut, norm.lut, size);
+        norm.lut = lut;
+    } else
+        tone_map_build_lut(&norm, lut);
+
+    free(tone_map->lut);
+    tone_map->lut = lut;
+    tone_map->lut_size = n;
+    /* With its padding, for the comparison above */
+    memcpy(&tone_map->param, &norm, sizeof(norm));
+    tone_map->num_builds++;
+
+    return true;
+}
+
+void
+i965_tone_map_free(struct i965_tone_map *tone_map)
+{
+    free(tone_map->lut);
+    memset(tone_map, 0, sizeof(*tone_map));
+}
+
+/* Grid cell and weight of a 10 bit code along one axis */
+static inline void
+tone_map_axis(const struct i965_tone_map *tone_map, int code, int *index, int *weight)
+{
+    const int pos = code * (tone_map->lut_size - 1) * (1 << TONE_MAP_WEIGHT_BITS) / 1023;
+
+    *index = MIN(pos >> TONE_MAP_WEIGHT_BITS, tone_map->lut_size - 2);
+    *weight = pos - (*index << TONE_MAP_WEIGHT_BITS);
+}
+
+/* Trilinear lookup, @out in 8 bit codes with TONE_MAP_LUT_BITS fractional
+ * bits */
+static void
+tone_map_lookup(const struct i965_tone_map *tone_map, int y, int cb, int cr, int out[3])
+{
+    const int n = tone_map->lut_size;
+    const int one = 1 << TONE_MAP_WEIGHT_BITS;
+    const uint16_t *base;
+    int iy, icb, icr, wy, wcb, wcr;
+    int64_t acc[3] = { 0, 0, 0 };
+    int corner, i;
+
+    tone_map_axis(tone_map, y, &iy, &wy);
+    tone_map_axis(tone_map, cb, &icb, &wcb);
+    tone_map_axis(tone_map, cr, &icr, &wcr);
+
+    base = tone_map->lut + ((icr * n + icb) * n + iy) * 3;
+
+    for (corner = 0; corner < 8; corner++) {
+        const int dy = corner & 1, dcb = (corner >> 1) & 1, dcr = corner >> 2;
+        const int64_t w = (int64_t)(dy ? wy : one - wy) *
+            (dcb ? wcb : one - wcb) *
+            (dcr ? wcr : one - wcr);
+        const uint16_t *entry = base + ((dcr * n + dcb) * n + dy) * 3;
+
+        for (i = 0; i < 3; i++)
+            acc[i] += w * entry[i];
+    }
+
+    for (i = 0; i < 3; i++)
+        out[i] = (int)((acc[i] + ((int64_t)1 << (3 * TONE_MAP_WEIGHT_BITS - 1))) >>
+                       (3 * TONE_MAP_WEIGHT_BITS));
+}
+
+static inline int
+tone_map_load(const struct i965_vpp_sw_image *image, int plane, int x, int y)
+{
+    const uint8_t * const p = image->planes[plane] + y * image->pitches[plane] + x * 2;
+
+    /* P010 keeps the 10 bits in the MSBs of little endian words */
+    return (p[0] | (p[1] << 8)) >> 6;
+}
+
+static inline uint8_t
+tone_map_round(int value, int shift)
+{
+    return (uint8_t)CLAMP(0, 255, (value + (1 << (shift - 1))) >> shift);
+}
+
+bool
+i965_tone_map_process(const struct i965_tone_map *tone_map,
+                      const struct i965_vpp_sw_image *src,
+                      const VARectangle *src_rect,
+                      struct i965_vpp_sw_image *dst,
+                      const VARectangle *dst_rect)
+{
+    int bx, by, dx, dy;
+
+    if (!tone_map->lut ||
+        src->fourcc != VA_FOURCC_P010 || dst->fourcc != VA_FOURCC_NV12 ||
+        src_rect->width != dst_rect->width || src_rect->height != dst_rect->height ||
+        ((src_rect->x | src_rect->y | dst_rect->x | dst_rect->y) & 1) ||
+        src_rect->x + src_rect->width > src->width ||
+        src_rect->y + src_rect->height > src->height ||
+        dst_rect->x + dst_rect->width > dst->width ||
+        dst_rect->y + dst_rect->height > dst->height)
+        return false;
+
+    for (by = 0; by < src_rect->height; by += 2) {
+        for (bx = 0; bx < src_rect->width; bx += 2) {
+            const int cx = (src_rect->x + bx) / 2, cy = (src_rect->y + by) / 2;
+            const int cb = tone_map_load(src, 1, cx * 2, cy);
+            const int cr = tone_map_load(src, 1, cx * 2 + 1, cy);
+            int sum_cb = 0, sum_cr = 0, count = 0;
+            uint8_t *uv;
+
+            for (dy = 0; dy < 2 && by + dy < src_rect->height; dy++) {
+                for (dx = 0; dx < 2 && bx + dx < src_rect->width; dx++) {
+                    const int y = tone_map_load(src, 0, src_rect->x + bx + dx,
+                                                src_rect->y + by + dy);
+                    int out[3];
+
+                    tone_map_lookup(tone_map, y, cb, cr, out);
+
+                    dst->planes[0][(dst_rect->y + by + dy) * dst->pitches[0] +
+                                   dst_rect->x + bx + dx] =
+                        tone_map_round(out[0], TONE_MAP_LUT_BITS);
+                    sum_cb += out[1];
+                    sum_cr += out[2];
+                    count++;
+                }
+            }
+
+            uv = dst->planes[1] + (dst_rect->y + by) / 2 * dst->pitches[1] +
+                dst_rect->x + bx;
+            uv[0] = tone_map_round(sum_cb / count, TONE_MAP_LUT_BITS);
+            uv[1] = tone_map_round(sum_cr / count, TONE_MAP_LUT_BITS);
+        }
+    }
+
+    return true;
+}
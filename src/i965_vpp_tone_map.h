@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_VPP_TONE_MAP_H
+#define I965_VPP_TONE_MAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <va/va.h>
+#include <va/va_vpp.h>
+
+/*
+ * HDR10/HLG to SDR tone mapping of P010 BT.2020 pictures into NV12 BT.709
+ * ones, requested with a filter buffer of the driver private type below.
+ * The input goes through the PQ or HLG EOTF, is mapped from the BT.2020 to
+ * the BT.709 primaries and its peak is rolled off to the target with the
+ * BT.2390 EETF, then it is encoded with the BT.1886 inverse EOTF.
+ *
+ * The whole chain is baked into a 3D LUT indexed by the 10 bit Y'CbCr
+ * samples, built once per stream, i.e. whenever the parameters change,
+ * and applied with trilinear interpolation while the samples are reduced
+ * to 8 bits. An application with a grading of its own passes its LUT
+ * instead, it is copied again only when it says the LUT changed.
+ *
+ * There is no kernel to apply the LUT yet, so the filter is not part of
+ * the VPP pipeline and no device lists it. This is the CPU implementation
+ * and reference such a kernel is to be checked against.
+ */
+#define VAProcFilterToneMappingIntel            ((VAProcFilterType)0x7f00)
+
+#define VA_TONE_MAPPING_TRANSFER_PQ             1       /* SMPTE ST 2084 */
+#define VA_TONE_MAPPING_TRANSFER_HLG            2       /* ARIB STD-B67 */
+
+typedef struct _VAProcFilterParameterBufferToneMappingIntel
+{
+    VAProcFilterType type;              /* VAProcFilterToneMappingIntel */
+    unsigned int transfer;              /* VA_TONE_MAPPING_TRANSFER_* */
+
+    /* Peak of the mastering display for PQ, of the nominal display for HLG,
+     * in cd/m2, 1000 if 0 */
+    unsigned int max_luminance;
+
+    /* Peak of the SDR output, in cd/m2, 100 if 0 */
+    unsigned int target_luminance;
+
+    /* Points of the LUT along each axis, 2 to I965_TONE_MAP_MAX_LUT_SIZE,
+     * I965_TONE_MAP_DEFAULT_LUT_SIZE if 0 */
+    unsigned int lut_size;
+
+    /* LUT of the application, NULL to build it from the fields above which
+     * it replaces but lut_size. lut_size^3 triplets of 8 bit Y'CbCr code
+     * values with 8 fractional bits, Cr major then Cb then Y, the grid
+     * points spread evenly over the 10 bit codes 0 to 1023. Read during
+     * vaEndPicture() only. */
+    const uint16_t *lut;
+
+    /* To be changed along with the content of lut, the driver copies the
+     * LUT again only when lut or lut_generation changes */
+    unsigned int lut_generation;
+} VAProcFilterParameterBufferToneMappingIntel;
+
+#define I965_TONE_MAP_DEFAULT_LUT_SIZE          33
+#define I965_TONE_MAP_MAX_LUT_SIZE              65
+
+struct i965_vpp_sw_image;
+
+struct i965_tone_map
+{
+    VAProcFilterParameterBufferToneMappingIntel param;
+
+    /* lut_size^3 Y'CbCr triplets, Cr major, in 8 bit code values with 8
+     * fractional bits. param.lut points to it for a LUT of the application,
+     * it is NULL for a built one */
+    int lut_size;
+    uint16_t *lut;
+
+    /* The LUT of the application @lut is a copy of, NULL for a built one */
+    const uint16_t *app_lut;
+
+    unsigned int num_builds;
+};
+
+/* Rebuilds the LUT of @tone_map if @param differs from the current one,
+ * or copies the LUT of the application if its pointer or generation
+ * changed */
+bool
+i965_tone_map_update(struct i965_tone_map *tone_map,
+                     const VAProcFilterParameterBufferToneMappingIntel *param);
+
+void
+i965_tone_map_free(struct i965_tone_map *tone_map);
+
+/* CPU reference: the 8 bit Y'CbCr of one 10 bit sample, without the LUT */
+bool
+i965_tone_map_reference(const VAProcFilterParameterBufferToneMappingIntel *param,
+                        int y, int cb, int cr,
+                        float ycbcr[3]);
+
+/*
+ * Tone maps @src_rect of a P010 @src into the same size @dst_rect of an
+ * NV12 @dst. The chroma of each 2x2 block is the mean of the chroma of its
+ * four mapped pixels.
+ */
+bool
+i965_tone_map_process(const struct i965_tone_map *tone_map,
+                      const struct i965_vpp_sw_image *src,
+                      const VARectangle *src_rect,
+                      struct i965_vpp_sw_image *dst,
+                      const VARectangle *dst_rect);
+
+#endif /* I965_VPP_TONE_MAP_H */
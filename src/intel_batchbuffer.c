@@ -30,6 +30,7 @@
 #include <assert.h>
 
 #include "intel_batchbuffer.h"
+#include "intel_fence.h"
 
 #define MAX_BATCH_SIZE		0x400000
 
@@ -145,6 +146,9 @@ intel_batchbuffer_flush(struct intel_batchbuffer *batch)
     dri_bo_unmap(batch->buffer);
     used = batch->ptr - batch->map;
     batch->run(batch->buffer, used, 0, 0, 0, batch->flag);
+    intel_fence_collect_batch(batch->intel, batch->buffer);
+    batch->submit_count++;
+
     intel_batchbuffer_reset(batch, batch->size);
 }
 
@@ -25,6 +25,8 @@ struct intel_batchbuffer
                drm_clip_rect_t *cliprects, int num_cliprects,
                int DR4, unsigned int ring_flag);
 
+    unsigned int submit_count;
+
     /* Used for Sandybdrige workaround */
     dri_bo *wa_render_bo;
 };
@@ -34,6 +34,7 @@
 #include "intel_batchbuffer.h"
 #include "intel_memman.h"
 #include "intel_driver.h"
+#include "intel_fence.h"
 uint32_t g_intel_debug_option_flags = 0;
 
 #ifdef I915_PARAM_HAS_BSD2
@@ -61,6 +62,9 @@ intel_driver_get_param(struct intel_driver_data *intel, int param, int *value)
 {
    struct drm_i915_getparam gp;
 
+   if (g_intel_mock_bufmgr)
+       return intel_mock_get_param(param, value) == 0;
+
    gp.param = param;
    gp.value = value;
 
@@ -106,14 +110,23 @@ intel_driver_init(VADriverContextP ctx)
     if (g_intel_debug_option_flags)
         fprintf(stderr, "g_intel_debug_option_flags:%x\n", g_intel_debug_option_flags);
 
+    g_intel_mock_bufmgr = !!getenv("VA_INTEL_MOCK_BUFMGR");
+
     assert(drm_state);
-    assert(VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_DRI1) ||
-           VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_DRI2) ||
-           VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_CUSTOM));
 
     intel->fd = drm_state->fd;
-    intel->dri2Enabled = (VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_DRI2) ||
-                          VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_CUSTOM));
+
+    /* The mock buffer manager never talks to the kernel, so any fd will do */
+    if (g_intel_mock_bufmgr) {
+        intel->dri2Enabled = 1;
+    } else {
+        assert(VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_DRI1) ||
+               VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_DRI2) ||
+               VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_CUSTOM));
+
+        intel->dri2Enabled = (VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_DRI2) ||
+                              VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_CUSTOM));
+    }
 
     if (!intel->dri2Enabled) {
         return false;
@@ -123,11 +136,19 @@ intel_driver_init(VADriverContextP ctx)
     pthread_mutex_init(&intel->ctxmutex, NULL);
 
     intel_memman_init(intel);
+
+    if (!intel_fence_monitor_init(intel)) {
+        intel_driver_terminate(ctx);
+        return false;
+    }
+
     intel->device_id = drm_intel_bufmgr_gem_get_devid(intel->bufmgr);
     intel->device_info = i965_get_device_info(intel->device_id);
 
-    if (!intel->device_info)
+    if (!intel->device_info) {
+        intel_driver_terminate(ctx);
         return false;
+    }
 
     if (intel_driver_get_param(intel, I915_PARAM_HAS_EXECBUF2, &has_exec2))
         intel->has_exec2 = has_exec2;
@@ -169,6 +190,7 @@ intel_driver_terminate(VADriverContextP ctx)
 {
     struct intel_driver_data *intel = intel_driver_data(ctx);
 
+    intel_fence_monitor_terminate(intel);
     intel_memman_terminate(intel);
     pthread_mutex_destroy(&intel->ctxmutex);
 }
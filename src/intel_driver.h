@@ -14,6 +14,7 @@
 #include "va_backend_compat.h"
 
 #include "intel_compiler.h"
+#include "intel_mock_bufmgr.h"
 
 #define BATCH_SIZE      0x80000
 #define BATCH_RESERVED  0x10
@@ -90,6 +91,7 @@
 #define CMD_PIPE_CONTROL_SC_INVALIDATION_GEN8   (1 << 2)
 
 struct intel_batchbuffer;
+struct intel_fence_monitor;
 
 #define ALIGN(i, n)    (((i) + (n) - 1) & ~((n) - 1))
 #define IS_ALIGNED(i, n) (((i) & ((n)-1)) == 0)
@@ -193,6 +195,8 @@ struct intel_driver_data
 
     const struct intel_device_info *device_info;
     unsigned int mocs_state;
+
+    struct intel_fence_monitor *fence_monitor;
 };
 
 bool intel_driver_init(VADriverContextP ctx);
@@ -0,0 +1,438 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sysdeps.h"
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "intel_fence.h"
+
+static void
+intel_fence_retire_locked(struct intel_fence *fence)
+{
+    int i, j;
+
+    for (i = 0, j = 0; i < fence->num_batches; i++) {
+        if (drm_intel_bo_busy(fence->batch_bo[i]))
+            fence->batch_bo[j++] = fence->batch_bo[i];
+        else
+            dri_bo_unreference(fence->batch_bo[i]);
+    }
+
+    fence->num_batches = j;
+}
+
+static void
+intel_fence_signal_locked(struct intel_fence *fence)
+{
+    uint64_t value = 1;
+
+    if (fence->event_fd < 0)
+        return;
+
+    if (write(fence->event_fd, &value, sizeof(value)) != sizeof(value))
+        WARN_ONCE("failed to signal the fence eventfd\n");
+}
+
+static void
+intel_fence_rearm_locked(struct intel_fence *fence)
+{
+    uint64_t value;
+    ssize_t ret;
+
+    if (fence->event_fd < 0)
+        return;
+
+    /* The fd is non-blocking, a single read resets the counter */
+    ret = read(fence->event_fd, &value, sizeof(value));
+    (void)ret;
+}
+
+static void
+intel_fence_put_locked(struct intel_fence *fence)
+{
+    int i;
+
+    if (--fence->ref_count > 0)
+        return;
+
+    for (i = 0; i < fence->num_batches; i++)
+        dri_bo_unreference(fence->batch_bo[i]);
+
+    if (fence->event_fd >= 0)
+        close(fence->event_fd);
+
+    free(fence);
+}
+
+static void
+intel_fence_queue_locked(struct intel_fence_monitor *monitor,
+                         struct intel_fence *fence)
+{
+    if (fence->pending)
+        return;
+
+    fence->ref_count++;
+    fence->pending = 1;
+    fence->next = NULL;
+
+    if (monitor->tail)
+        monitor->tail->next = fence;
+    else
+        monitor->head = fence;
+
+    monitor->tail = fence;
+    pthread_cond_signal(&monitor->cond);
+}
+
+static struct intel_fence *
+intel_fence_dequeue_locked(struct intel_fence_monitor *monitor)
+{
+    struct intel_fence *fence = monitor->head;
+
+    if (fence) {
+        monitor->head = fence->next;
+
+        if (!monitor->head)
+            monitor->tail = NULL;
+
+        fence->next = NULL;
+    }
+
+    return fence;
+}
+
+static void *
+intel_fence_monitor_thread(void *data)
+{
+    struct intel_fence_monitor *monitor = data;
+    struct intel_fence *fence;
+    dri_bo *bo;
+
+    pthread_mutex_lock(&monitor->lock);
+
+    while (!monitor->exit) {
+        fence = intel_fence_dequeue_locked(monitor);
+
+        if (!fence) {
+            pthread_cond_wait(&monitor->cond, &monitor->lock);
+            continue;
+        }
+
+        intel_fence_retire_locked(fence);
+
+        /* Signaled, or nobody but the monitor holds the fence any more */
+        if (fence->num_batches == 0 || fence->ref_count == 1) {
+            if (fence->num_batches == 0)
+                intel_fence_signal_locked(fence);
+
+            fence->pending = 0;
+            intel_fence_put_locked(fence);
+            continue;
+        }
+
+        /* Put it back to the tail so that other fences get a chance too */
+        if (monitor->tail)
+            monitor->tail->next = fence;
+        else
+            monitor->head = fence;
+
+        monitor->tail = fence;
+
+        bo = fence->batch_bo[0];
+        dri_bo_reference(bo);
+        pthread_mutex_unlock(&monitor->lock);
+
+        drm_intel_gem_bo_wait(bo, INTEL_FENCE_POLL_TIMEOUT_NS);
+
+        pthread_mutex_lock(&monitor->lock);
+        dri_bo_unreference(bo);
+    }
+
+    pthread_mutex_unlock(&monitor->lock);
+
+    return NULL;
+}
+
+bool
+intel_fence_monitor_init(struct intel_driver_data *intel)
+{
+    struct intel_fence_monitor *monitor;
+
+    monitor = calloc(1, sizeof(*monitor));
+
+    if (!monitor)
+        return false;
+
+    if (pthread_key_create(&monitor->collect_key, NULL)) {
+        free(monitor);
+        return false;
+    }
+
+    pthread_mutex_init(&monitor->lock, NULL);
+    pthread_cond_init(&monitor->cond, NULL);
+    intel->fence_monitor = monitor;
+
+    return true;
+}
+
+void
+intel_fence_monitor_terminate(struct intel_driver_data *intel)
+{
+    struct intel_fence_monitor *monitor = intel->fence_monitor;
+    struct intel_fence *fence;
+
+    if (!monitor)
+        return;
+
+    pthread_mutex_lock(&monitor->lock);
+    monitor->exit = 1;
+    pthread_cond_broadcast(&monitor->cond);
+    pthread_mutex_unlock(&monitor->lock);
+
+    if (monitor->thread_started)
+        pthread_join(monitor->thread, NULL);
+
+    while ((fence = intel_fence_dequeue_locked(monitor))) {
+        fence->pending = 0;
+        intel_fence_put_locked(fence);
+    }
+
+    pthread_key_delete(monitor->collect_key);
+    pthread_cond_destroy(&monitor->cond);
+    pthread_mutex_destroy(&monitor->lock);
+    free(monitor);
+    intel->fence_monitor = NULL;
+}
+
+struct intel_fence *
+intel_fence_new(struct intel_driver_data *intel)
+{
+    struct intel_fence *fence;
+
+    fence = calloc(1, sizeof(*fence));
+
+    if (!fence)
+        return NULL;
+
+    fence->monitor = intel->fence_monitor;
+    fence->ref_count = 1;
+    fence->event_fd = -1;
+
+    return fence;
+}
+
+void
+intel_fence_unreference(struct intel_fence **fence)
+{
+    struct intel_fence_monitor *monitor;
+
+    if (!*fence)
+        return;
+
+    monitor = (*fence)->monitor;
+
+    pthread_mutex_lock(&monitor->lock);
+    intel_fence_put_locked(*fence);
+    pthread_mutex_unlock(&monitor->lock);
+
+    *fence = NULL;
+}
+
+void
+intel_fence_add_batch(struct intel_fence *fence, dri_bo *batch_bo)
+{
+    struct intel_fence_monitor *monitor = fence->monitor;
+    dri_bo *oldest;
+
+    pthread_mutex_lock(&monitor->lock);
+    intel_fence_retire_locked(fence);
+
+    /* Too many batches in flight for one target, wait for the oldest */
+    while (fence->num_batches == INTEL_FENCE_MAX_BATCHES) {
+        oldest = fence->batch_bo[0];
+        dri_bo_reference(oldest);
+        pthread_mutex_unlock(&monitor->lock);
+
+        drm_intel_bo_wait_rendering(oldest);
+
+        pthread_mutex_lock(&monitor->lock);
+        dri_bo_unreference(oldest);
+        intel_fence_retire_locked(fence);
+    }
+
+    dri_bo_reference(batch_bo);
+    fence->batch_bo[fence->num_batches++] = batch_bo;
+
+    if (fence->event_fd >= 0) {
+        intel_fence_rearm_locked(fence);
+        intel_fence_queue_locked(monitor, fence);
+    }
+
+    pthread_mutex_unlock(&monitor->lock);
+}
+
+void
+intel_fence_add_fence(struct intel_driver_data *intel,
+                      struct intel_fence **fence,
+                      struct intel_fence *src)
+{
+    struct intel_fence_monitor *monitor = src->monitor;
+    dri_bo *batch_bo[INTEL_FENCE_MAX_BATCHES];
+    int i, num_batches;
+
+    pthread_mutex_lock(&monitor->lock);
+    intel_fence_retire_locked(src);
+    num_batches = src->num_batches;
+
+    for (i = 0; i < num_batches; i++) {
+        batch_bo[i] = src->batch_bo[i];
+        dri_bo_reference(batch_bo[i]);
+    }
+
+    pthread_mutex_unlock(&monitor->lock);
+
+    for (i = 0; i < num_batches; i++) {
+        if (!*fence)
+            *fence = intel_fence_new(intel);
+
+        if (*fence)
+            intel_fence_add_batch(*fence, batch_bo[i]);
+
+        dri_bo_unreference(batch_bo[i]);
+    }
+}
+
+bool
+intel_fence_is_signaled(struct intel_fence *fence)
+{
+    struct intel_fence_monitor *monitor = fence->monitor;
+    bool signaled;
+
+    pthread_mutex_lock(&monitor->lock);
+    intel_fence_retire_locked(fence);
+    signaled = (fence->num_batches == 0);
+    pthread_mutex_unlock(&monitor->lock);
+
+    return signaled;
+}
+
+void
+intel_fence_wait(struct intel_fence *fence)
+{
+    struct intel_fence_monitor *monitor = fence->monitor;
+    dri_bo *batch_bo[INTEL_FENCE_MAX_BATCHES];
+    int i, num_batches;
+
+    pthread_mutex_lock(&monitor->lock);
+    intel_fence_retire_locked(fence);
+    num_batches = fence->num_batches;
+
+    for (i = 0; i < num_batches; i++) {
+        batch_bo[i] = fence->batch_bo[i];
+        dri_bo_reference(batch_bo[i]);
+    }
+
+    pthread_mutex_unlock(&monitor->lock);
+
+    for (i = 0; i < num_batches; i++) {
+        drm_intel_bo_wait_rendering(batch_bo[i]);
+        dri_bo_unreference(batch_bo[i]);
+    }
+}
+
+int
+intel_fence_get_fd(struct intel_fence *fence)
+{
+    struct intel_fence_monitor *monitor = fence->monitor;
+    int fd;
+
+    pthread_mutex_lock(&monitor->lock);
+
+    if (fence->event_fd < 0)
+        fence->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    fd = fence->event_fd;
+
+    if (fd < 0)
+        goto out;
+
+    intel_fence_retire_locked(fence);
+
+    if (fence->num_batches == 0) {
+        intel_fence_signal_locked(fence);
+        goto out;
+    }
+
+    if (!monitor->thread_started) {
+        if (pthread_create(&monitor->thread, NULL, intel_fence_monitor_thread, monitor)) {
+            /* Without the monitor nobody would ever signal the fd */
+            close(fence->event_fd);
+            fence->event_fd = fd = -1;
+            goto out;
+        }
+
+        monitor->thread_started = 1;
+    }
+
+    intel_fence_queue_locked(monitor, fence);
+
+out:
+    pthread_mutex_unlock(&monitor->lock);
+
+    return fd;
+}
+
+void
+intel_fence_collect_begin(struct intel_driver_data *intel, struct intel_fence **fence)
+{
+    pthread_setspecific(intel->fence_monitor->collect_key, fence);
+}
+
+void
+intel_fence_collect_end(struct intel_driver_data *intel)
+{
+    pthread_setspecific(intel->fence_monitor->collect_key, NULL);
+}
+
+void
+intel_fence_collect_batch(struct intel_driver_data *intel, dri_bo *batch_bo)
+{
+    struct intel_fence **fence;
+
+    if (!intel->fence_monitor)
+        return;
+
+    fence = pthread_getspecific(intel->fence_monitor->collect_key);
+
+    if (!fence)
+        return;
+
+    if (!*fence)
+        *fence = intel_fence_new(intel);
+
+    if (*fence)
+        intel_fence_add_batch(*fence, batch_bo);
+}
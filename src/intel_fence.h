@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _INTEL_FENCE_H_
+#define _INTEL_FENCE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "intel_driver.h"
+
+/*
+ * A fence aggregates the batch buffers submitted for one target (e.g. the
+ * render target of a decode or VPP picture). It is signaled once every
+ * batch it holds has retired. Batches that retire are dropped lazily, so
+ * the array never grows beyond a handful of entries even when the same
+ * surface is written by several pictures (e.g. two fields) back to back.
+ */
+#define INTEL_FENCE_MAX_BATCHES         4
+
+/* How long the monitor thread waits on one batch before moving on */
+#define INTEL_FENCE_POLL_TIMEOUT_NS     (1000 * 1000)
+
+struct intel_fence_monitor;
+
+struct intel_fence
+{
+    struct intel_fence_monitor *monitor;
+    int ref_count;
+    int num_batches;
+    dri_bo *batch_bo[INTEL_FENCE_MAX_BATCHES];
+
+    /* eventfd, created on demand by intel_fence_get_fd() */
+    int event_fd;
+    unsigned int pending : 1;   /* queued on the monitor thread */
+
+    struct intel_fence *next;
+};
+
+struct intel_fence_monitor
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    unsigned int thread_started : 1;
+    unsigned int exit : 1;
+
+    /* Fences with an eventfd that are not signaled yet */
+    struct intel_fence *head;
+    struct intel_fence *tail;
+
+    /* Per thread struct intel_fence ** the flushed batches go to */
+    pthread_key_t collect_key;
+};
+
+bool intel_fence_monitor_init(struct intel_driver_data *intel);
+void intel_fence_monitor_terminate(struct intel_driver_data *intel);
+
+struct intel_fence *intel_fence_new(struct intel_driver_data *intel);
+void intel_fence_unreference(struct intel_fence **fence);
+
+void intel_fence_add_batch(struct intel_fence *fence, dri_bo *batch_bo);
+
+/*
+ * Adds the batches of src that are still in flight to *fence, which is
+ * created if needed. Used when the target is only known after the batches
+ * were collected, e.g. the reconstructed surface of an encoder.
+ */
+void intel_fence_add_fence(struct intel_driver_data *intel, struct intel_fence **fence,
+                           struct intel_fence *src);
+bool intel_fence_is_signaled(struct intel_fence *fence);
+void intel_fence_wait(struct intel_fence *fence);
+
+/*
+ * Returns an eventfd (owned by the fence) that becomes readable once the
+ * fence is signaled. The fd is re-armed each time a new batch is added, so
+ * callers can keep it in their poll set across frames.
+ */
+int intel_fence_get_fd(struct intel_fence *fence);
+
+/*
+ * Every batch the calling thread flushes between intel_fence_collect_begin()
+ * and intel_fence_collect_end() is added to *fence, whichever batchbuffer it
+ * comes from, e.g. the VEBOX batch and the shared post-processing batch of a
+ * VPP picture. The fence is created with the first batch.
+ */
+void intel_fence_collect_begin(struct intel_driver_data *intel, struct intel_fence **fence);
+void intel_fence_collect_end(struct intel_driver_data *intel);
+void intel_fence_collect_batch(struct intel_driver_data *intel, dri_bo *batch_bo);
+
+#endif /* _INTEL_FENCE_H_ */
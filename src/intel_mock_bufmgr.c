@@ -0,0 +1,536 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sysdeps.h"
+
+#include <errno.h>
+#include <time.h>
+
+#include "intel_driver.h"
+#include "intel_mock_bufmgr.h"
+
+int g_intel_mock_bufmgr = 0;
+
+struct intel_mock_bufmgr
+{
+    pthread_mutex_t lock;
+    int device_id;
+    uint64_t delay_ns;
+
+    uint64_t next_offset;
+    int next_handle;
+    unsigned int exec_serial;
+
+    intel_mock_exec_func exec_func;
+    void *exec_data;
+
+    struct intel_mock_bufmgr_stats stats;
+};
+
+struct intel_mock_bo
+{
+    drm_intel_bo base;          /* must be the first member */
+
+    int ref_count;
+    int map_count;
+    void *data;
+    uint32_t tiling_mode;
+
+    /* GPU completion time of the last execbuf that used the bo */
+    uint64_t busy_until;
+    unsigned int exec_serial;
+
+    struct intel_mock_bo **reloc_targets;
+    int num_relocs;
+    int max_relocs;
+};
+
+static inline struct intel_mock_bufmgr *
+intel_mock_bufmgr(drm_intel_bufmgr *bufmgr)
+{
+    return (struct intel_mock_bufmgr *)bufmgr;
+}
+
+static inline struct intel_mock_bo *
+intel_mock_bo(drm_intel_bo *bo)
+{
+    return (struct intel_mock_bo *)bo;
+}
+
+static uint64_t
+intel_mock_get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+intel_mock_sleep_ns(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000ull;
+    ts.tv_nsec = ns % 1000000000ull;
+
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+int
+intel_mock_get_param(int param, int *value)
+{
+    switch (param) {
+    case I915_PARAM_HAS_EXECBUF2:
+    case I915_PARAM_HAS_BSD:
+    case I915_PARAM_HAS_BLT:
+    case I915_PARAM_HAS_VEBOX:
+        *value = 1;
+        return 0;
+
+    default:
+        return -EINVAL;
+    }
+}
+
+drm_intel_bufmgr *
+intel_mock_bufmgr_gem_init(int fd, int batch_size)
+{
+    struct intel_mock_bufmgr *mock;
+    char *env_str;
+
+    mock = calloc(1, sizeof(*mock));
+
+    if (!mock)
+        return NULL;
+
+    pthread_mutex_init(&mock->lock, NULL);
+
+    if ((env_str = getenv("VA_INTEL_MOCK_BUFMGR")))
+        mock->device_id = strtol(env_str, NULL, 0);
+
+    if ((env_str = getenv("VA_INTEL_MOCK_BUFMGR_DELAY")))
+        mock->delay_ns = strtoull(env_str, NULL, 0) * 1000;
+
+    /* Keep the fake GTT offsets away from 0 */
+    mock->next_offset = 0x100000;
+    mock->next_handle = 1;
+
+    return (drm_intel_bufmgr *)mock;
+}
+
+void
+intel_mock_bufmgr_destroy(drm_intel_bufmgr *bufmgr)
+{
+    struct intel_mock_bufmgr *mock = intel_mock_bufmgr(bufmgr);
+
+    if (!mock)
+        return;
+
+    if (mock->stats.num_bos)
+        WARN_ONCE("%u buffer objects leaked by the driver\n", mock->stats.num_bos);
+
+    pthread_mutex_destroy(&mock->lock);
+    free(mock);
+}
+
+int
+intel_mock_bufmgr_gem_get_devid(drm_intel_bufmgr *bufmgr)
+{
+    return intel_mock_bufmgr(bufmgr)->device_id;
+}
+
+void
+intel_mock_bufmgr_get_stats(drm_intel_bufmgr *bufmgr,
+                            struct intel_mock_bufmgr_stats *stats)
+{
+    struct intel_mock_bufmgr *mock = intel_mock_bufmgr(bufmgr);
+
+    pthread_mutex_lock(&mock->lock);
+    *stats = mock->stats;
+    pthread_mutex_unlock(&mock->lock);
+}
+
+void
+intel_mock_bufmgr_set_exec_callback(drm_intel_bufmgr *bufmgr,
+                                    intel_mock_exec_func func,
+                                    void *data)
+{
+    struct intel_mock_bufmgr *mock = intel_mock_bufmgr(bufmgr);
+
+    pthread_mutex_lock(&mock->lock);
+    mock->exec_func = func;
+    mock->exec_data = data;
+    pthread_mutex_unlock(&mock->lock);
+}
+
+void
+intel_mock_bufmgr_set_delay(drm_intel_bufmgr *bufmgr, unsigned int delay_us)
+{
+    struct intel_mock_bufmgr *mock = intel_mock_bufmgr(bufmgr);
+
+    pthread_mutex_lock(&mock->lock);
+    mock->delay_ns = (uint64_t)delay_us * 1000;
+    pthread_mutex_unlock(&mock->lock);
+}
+
+static drm_intel_bo *
+intel_mock_bo_new(struct intel_mock_bufmgr *mock,
+                  unsigned long size,
+                  unsigned int alignment,
+                  uint32_t tiling_mode)
+{
+    struct intel_mock_bo *bo;
+
+    if (size == 0)
+        return NULL;
+
+    bo = calloc(1, sizeof(*bo));
+
+    if (!bo)
+        return NULL;
+
+    size = ALIGN(size, 4096);
+
+    /* GEM objects are zero filled */
+    bo->data = calloc(1, size);
+
+    if (!bo->data) {
+        free(bo);
+
+        return NULL;
+    }
+
+    bo->ref_count = 1;
+    bo->tiling_mode = tiling_mode;
+    bo->base.size = size;
+    bo->base.align = alignment;
+    bo->base.bufmgr = (drm_intel_bufmgr *)mock;
+
+    pthread_mutex_lock(&mock->lock);
+    bo->base.handle = mock->next_handle++;
+    bo->base.offset64 = ALIGN(mock->next_offset, MAX(alignment, 4096));
+    bo->base.offset = bo->base.offset64;
+    mock->next_offset = bo->base.offset64 + size;
+    mock->stats.num_bos++;
+    pthread_mutex_unlock(&mock->lock);
+
+    return &bo->base;
+}
+
+drm_intel_bo *
+intel_mock_bo_alloc(drm_intel_bufmgr *bufmgr, const char *name,
+                    unsigned long size, unsigned int alignment)
+{
+    return intel_mock_bo_new(intel_mock_bufmgr(bufmgr), size, alignment, I915_TILING_NONE);
+}
+
+drm_intel_bo *
+intel_mock_bo_alloc_tiled(drm_intel_bufmgr *bufmgr, const char *name,
+                          int x, int y, int cpp, uint32_t *tiling_mode,
+                          unsigned long *pitch, unsigned long flags)
+{
+    unsigned long stride, height;
+
+    /* Same tile geometry as the GEM buffer manager */
+    switch (*tiling_mode) {
+    case I915_TILING_X:
+        stride = ALIGN(x * cpp, 512);
+        height = ALIGN(y, 8);
+        break;
+
+    case I915_TILING_Y:
+        stride = ALIGN(x * cpp, 128);
+        height = ALIGN(y, 32);
+        break;
+
+    default:
+        *tiling_mode = I915_TILING_NONE;
+        stride = ALIGN(x * cpp, 64);
+        height = ALIGN(y, 2);
+        break;
+    }
+
+    *pitch = stride;
+
+    return intel_mock_bo_new(intel_mock_bufmgr(bufmgr), stride * height, 4096, *tiling_mode);
+}
+
+void
+intel_mock_bo_reference(drm_intel_bo *bo)
+{
+    struct intel_mock_bufmgr *mock = intel_mock_bufmgr(bo->bufmgr);
+
+    pthread_mutex_lock(&mock->lock);
+    intel_mock_bo(bo)->ref_count++;
+    pthread_mutex_unlock(&mock->lock);
+}
+
+static void
+intel_mock_bo_unreference_locked(struct intel_mock_bufmgr *mock, struct intel_mock_bo *bo)
+{
+    int i;
+
+    assert(bo->ref_count > 0);
+
+    if (--bo->ref_count > 0)
+        return;
+
+    for (i = 0; i < bo->num_relocs; i++)
+        intel_mock_bo_unreference_locked(mock, bo->reloc_targets[i]);
+
+    mock->stats.num_bos--;
+    free(bo->reloc_targets);
+    free(bo->data);
+    free(bo);
+}
+
+void
+intel_mock_bo_unreference(drm_intel_bo *bo)
+{
+    struct intel_mock_bufmgr *mock;
+
+    if (!bo)
+        return;
+
+    mock = intel_mock_bufmgr(bo->bufmgr);
+
+    pthread_mutex_lock(&mock->lock);
+    intel_mock_bo_unreference_locked(mock, intel_mock_bo(bo));
+    pthread_mutex_unlock(&mock->lock);
+}
+
+int
+intel_mock_bo_map(drm_intel_bo *bo, int write_enable)
+{
+    struct intel_mock_bo *mock_bo = intel_mock_bo(bo);
+
+    /* Like the kernel, a CPU mapping waits for the GPU */
+    intel_mock_bo_wait(bo, -1);
+
+    mock_bo->map_count++;
+    bo->virtual = mock_bo->data;
+
+    return 0;
+}
+
+/* Doesn't wait, the caller reads what the GPU has written so far */
+int
+intel_mock_bo_map_unsynchronized(drm_intel_bo *bo)
+{
+    struct intel_mock_bo *mock_bo = intel_mock_bo(bo);
+
+    mock_bo->map_count++;
+    bo->virtual = mock_bo->data;
+
+    return 0;
+}
+
+int
+intel_mock_bo_unmap(drm_intel_bo *bo)
+{
+    struct intel_mock_bo *mock_bo = intel_mock_bo(bo);
+
+    if (mock_bo->map_count <= 0)
+        return -EINVAL;
+
+    if (--mock_bo->map_count == 0)
+        bo->virtual = NULL;
+
+    return 0;
+}
+
+int
+intel_mock_bo_subdata(drm_intel_bo *bo, unsigned long offset,
+                      unsigned long size, const void *data)
+{
+    if (offset > bo->size || size > bo->size - offset)
+        return -EINVAL;
+
+    intel_mock_bo_wait(bo, -1);
+    memcpy((uint8_t *)intel_mock_bo(bo)->data + offset, data, size);
+
+    return 0;
+}
+
+int
+intel_mock_bo_get_subdata(drm_intel_bo *bo, unsigned long offset,
+                          unsigned long size, void *data)
+{
+    if (offset > bo->size || size > bo->size - offset)
+        return -EINVAL;
+
+    intel_mock_bo_wait(bo, -1);
+    memcpy(data, (uint8_t *)intel_mock_bo(bo)->data + offset, size);
+
+    return 0;
+}
+
+static uint64_t
+intel_mock_bo_get_busy_until(drm_intel_bo *bo)
+{
+    struct intel_mock_bufmgr *mock = intel_mock_bufmgr(bo->bufmgr);
+    uint64_t busy_until;
+
+    pthread_mutex_lock(&mock->lock);
+    busy_until = intel_mock_bo(bo)->busy_until;
+    pthread_mutex_unlock(&mock->lock);
+
+    return busy_until;
+}
+
+int
+intel_mock_bo_busy(drm_intel_bo *bo)
+{
+    return intel_mock_get_time_ns() < intel_mock_bo_get_busy_until(bo);
+}
+
+/* A negative timeout waits until the bo is idle */
+int
+intel_mock_bo_wait(drm_intel_bo *bo, int64_t timeout_ns)
+{
+    uint64_t busy_until = intel_mock_bo_get_busy_until(bo);
+    uint64_t now = intel_mock_get_time_ns();
+
+    if (now >= busy_until)
+        return 0;
+
+    if (timeout_ns >= 0 && busy_until - now > (uint64_t)timeout_ns) {
+        intel_mock_sleep_ns(timeout_ns);
+
+        return -ETIME;
+    }
+
+    intel_mock_sleep_ns(busy_until - now);
+
+    return 0;
+}
+
+int
+intel_mock_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
+                         drm_intel_bo *target_bo, uint32_t target_offset,
+                         uint32_t read_domains, uint32_t write_domain)
+{
+    struct intel_mock_bufmgr *mock = intel_mock_bufmgr(bo->bufmgr);
+    struct intel_mock_bo *mock_bo = intel_mock_bo(bo);
+    struct intel_mock_bo **targets;
+    int ret = 0;
+
+    if (offset > bo->size - 4)
+        return -EINVAL;
+
+    pthread_mutex_lock(&mock->lock);
+
+    if (mock_bo->num_relocs == mock_bo->max_relocs) {
+        int max_relocs = MAX(mock_bo->max_relocs * 2, 64);
+
+        targets = realloc(mock_bo->reloc_targets, max_relocs * sizeof(*targets));
+
+        if (!targets) {
+            ret = -ENOMEM;
+            goto out;
+        }
+
+        mock_bo->reloc_targets = targets;
+        mock_bo->max_relocs = max_relocs;
+    }
+
+    intel_mock_bo(target_bo)->ref_count++;
+    mock_bo->reloc_targets[mock_bo->num_relocs++] = intel_mock_bo(target_bo);
+
+out:
+    pthread_mutex_unlock(&mock->lock);
+
+    return ret;
+}
+
+int
+intel_mock_bo_get_tiling(drm_intel_bo *bo, uint32_t *tiling_mode,
+                         uint32_t *swizzle_mode)
+{
+    *tiling_mode = intel_mock_bo(bo)->tiling_mode;
+    *swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+
+    return 0;
+}
+
+int
+intel_mock_bo_flink(drm_intel_bo *bo, uint32_t *name)
+{
+    *name = bo->handle;
+
+    return 0;
+}
+
+static void
+intel_mock_bo_mark_busy_locked(struct intel_mock_bufmgr *mock,
+                               struct intel_mock_bo *bo,
+                               uint64_t busy_until)
+{
+    int i;
+
+    if (bo->exec_serial == mock->exec_serial)
+        return;
+
+    bo->exec_serial = mock->exec_serial;
+    bo->busy_until = MAX(bo->busy_until, busy_until);
+
+    for (i = 0; i < bo->num_relocs; i++)
+        intel_mock_bo_mark_busy_locked(mock, bo->reloc_targets[i], busy_until);
+}
+
+int
+intel_mock_bo_exec(drm_intel_bo *bo, int used, unsigned int flags)
+{
+    struct intel_mock_bufmgr *mock = intel_mock_bufmgr(bo->bufmgr);
+    struct intel_mock_bo *mock_bo = intel_mock_bo(bo);
+    intel_mock_exec_func exec_func;
+    void *exec_data;
+
+    if (used <= 0 || used > bo->size)
+        return -EINVAL;
+
+    pthread_mutex_lock(&mock->lock);
+
+    mock->exec_serial++;
+    intel_mock_bo_mark_busy_locked(mock, mock_bo,
+                                   intel_mock_get_time_ns() + mock->delay_ns);
+
+    mock->stats.num_execs++;
+    mock->stats.num_relocs += mock_bo->num_relocs;
+    mock->stats.last_exec_flags = flags;
+    mock->stats.last_exec_used = used;
+
+    exec_func = mock->exec_func;
+    exec_data = mock->exec_data;
+
+    pthread_mutex_unlock(&mock->lock);
+
+    if (exec_func)
+        exec_func(exec_data, mock_bo->data, used, flags);
+
+    return 0;
+}
@@ -0,0 +1,426 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _INTEL_MOCK_BUFMGR_H_
+#define _INTEL_MOCK_BUFMGR_H_
+
+#include <stdint.h>
+#include <intel_bufmgr.h>
+
+#include "intel_compiler.h"
+
+/*
+ * Host memory stand-in for the libdrm GEM buffer manager, so that the whole
+ * CPU side of the driver (batch construction included) can run on machines
+ * without an Intel GPU, e.g. for tests, profiling or fuzzing.
+ *
+ * It is selected by setting VA_INTEL_MOCK_BUFMGR to the PCI id of the
+ * device to mimic (e.g. VA_INTEL_MOCK_BUFMGR=0x1912). Buffer objects are
+ * backed by malloc'ed memory and execbufs are only recorded: the batch and
+ * every buffer it relocates stay busy for VA_INTEL_MOCK_BUFMGR_DELAY
+ * microseconds (0 by default) after the submission.
+ *
+ * The libdrm entry points the driver uses are redirected at the end of this
+ * file to inline wrappers, which pick the mock or the real implementation
+ * depending on g_intel_mock_bufmgr, so call sites are left untouched.
+ */
+extern int g_intel_mock_bufmgr;
+
+struct intel_mock_bufmgr_stats
+{
+    unsigned int num_bos;               /* currently allocated */
+    unsigned int num_execs;
+    unsigned int num_relocs;            /* emitted into executed batches */
+    unsigned int last_exec_flags;
+    int last_exec_used;
+};
+
+/* Called for each execbuf with the (unmapped) batch contents */
+typedef void (*intel_mock_exec_func)(void *data,
+                                     const uint32_t *batch,
+                                     int used,
+                                     unsigned int flags);
+
+void
+intel_mock_bufmgr_get_stats(drm_intel_bufmgr *bufmgr,
+                            struct intel_mock_bufmgr_stats *stats);
+
+void
+intel_mock_bufmgr_set_exec_callback(drm_intel_bufmgr *bufmgr,
+                                    intel_mock_exec_func func,
+                                    void *data);
+
+/* Overrides VA_INTEL_MOCK_BUFMGR_DELAY for the following execbufs */
+void
+intel_mock_bufmgr_set_delay(drm_intel_bufmgr *bufmgr, unsigned int delay_us);
+
+/* Replacement for the I915_GETPARAM ioctl */
+int
+intel_mock_get_param(int param, int *value);
+
+drm_intel_bufmgr *
+intel_mock_bufmgr_gem_init(int fd, int batch_size);
+
+void
+intel_mock_bufmgr_destroy(drm_intel_bufmgr *bufmgr);
+
+int
+intel_mock_bufmgr_gem_get_devid(drm_intel_bufmgr *bufmgr);
+
+drm_intel_bo *
+intel_mock_bo_alloc(drm_intel_bufmgr *bufmgr, const char *name,
+                    unsigned long size, unsigned int alignment);
+
+drm_intel_bo *
+intel_mock_bo_alloc_tiled(drm_intel_bufmgr *bufmgr, const char *name,
+                          int x, int y, int cpp, uint32_t *tiling_mode,
+                          unsigned long *pitch, unsigned long flags);
+
+void
+intel_mock_bo_reference(drm_intel_bo *bo);
+
+void
+intel_mock_bo_unreference(drm_intel_bo *bo);
+
+int
+intel_mock_bo_map(drm_intel_bo *bo, int write_enable);
+
+int
+intel_mock_bo_map_unsynchronized(drm_intel_bo *bo);
+
+int
+intel_mock_bo_unmap(drm_intel_bo *bo);
+
+int
+intel_mock_bo_subdata(drm_intel_bo *bo, unsigned long offset,
+                      unsigned long size, const void *data);
+
+int
+intel_mock_bo_get_subdata(drm_intel_bo *bo, unsigned long offset,
+                          unsigned long size, void *data);
+
+int
+intel_mock_bo_busy(drm_intel_bo *bo);
+
+int
+intel_mock_bo_wait(drm_intel_bo *bo, int64_t timeout_ns);
+
+int
+intel_mock_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
+                         drm_intel_bo *target_bo, uint32_t target_offset,
+                         uint32_t read_domains, uint32_t write_domain);
+
+int
+intel_mock_bo_get_tiling(drm_intel_bo *bo, uint32_t *tiling_mode,
+                         uint32_t *swizzle_mode);
+
+int
+intel_mock_bo_flink(drm_intel_bo *bo, uint32_t *name);
+
+int
+intel_mock_bo_exec(drm_intel_bo *bo, int used, unsigned int flags);
+
+static INLINE drm_intel_bufmgr *
+intel_shim_bufmgr_gem_init(int fd, int batch_size)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bufmgr_gem_init(fd, batch_size);
+
+    return drm_intel_bufmgr_gem_init(fd, batch_size);
+}
+
+static INLINE void
+intel_shim_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr)
+{
+    if (!g_intel_mock_bufmgr)
+        drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+}
+
+static INLINE void
+intel_shim_bufmgr_gem_set_aub_filename(drm_intel_bufmgr *bufmgr, const char *filename)
+{
+    if (!g_intel_mock_bufmgr)
+        drm_intel_bufmgr_gem_set_aub_filename(bufmgr, filename);
+}
+
+static INLINE void
+intel_shim_bufmgr_gem_set_aub_dump(drm_intel_bufmgr *bufmgr, int enable)
+{
+    if (!g_intel_mock_bufmgr)
+        drm_intel_bufmgr_gem_set_aub_dump(bufmgr, enable);
+}
+
+static INLINE void
+intel_shim_bufmgr_destroy(drm_intel_bufmgr *bufmgr)
+{
+    if (g_intel_mock_bufmgr)
+        intel_mock_bufmgr_destroy(bufmgr);
+    else
+        drm_intel_bufmgr_destroy(bufmgr);
+}
+
+static INLINE int
+intel_shim_bufmgr_gem_get_devid(drm_intel_bufmgr *bufmgr)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bufmgr_gem_get_devid(bufmgr);
+
+    return drm_intel_bufmgr_gem_get_devid(bufmgr);
+}
+
+static INLINE drm_intel_bo *
+intel_shim_bo_alloc(drm_intel_bufmgr *bufmgr, const char *name,
+                    unsigned long size, unsigned int alignment)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_alloc(bufmgr, name, size, alignment);
+
+    return drm_intel_bo_alloc(bufmgr, name, size, alignment);
+}
+
+static INLINE drm_intel_bo *
+intel_shim_bo_alloc_tiled(drm_intel_bufmgr *bufmgr, const char *name,
+                          int x, int y, int cpp, uint32_t *tiling_mode,
+                          unsigned long *pitch, unsigned long flags)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_alloc_tiled(bufmgr, name, x, y, cpp,
+                                         tiling_mode, pitch, flags);
+
+    return drm_intel_bo_alloc_tiled(bufmgr, name, x, y, cpp,
+                                    tiling_mode, pitch, flags);
+}
+
+static INLINE void
+intel_shim_bo_reference(drm_intel_bo *bo)
+{
+    if (g_intel_mock_bufmgr)
+        intel_mock_bo_reference(bo);
+    else
+        drm_intel_bo_reference(bo);
+}
+
+static INLINE void
+intel_shim_bo_unreference(drm_intel_bo *bo)
+{
+    if (g_intel_mock_bufmgr)
+        intel_mock_bo_unreference(bo);
+    else
+        drm_intel_bo_unreference(bo);
+}
+
+static INLINE int
+intel_shim_bo_map(drm_intel_bo *bo, int write_enable)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_map(bo, write_enable);
+
+    return drm_intel_bo_map(bo, write_enable);
+}
+
+static INLINE int
+intel_shim_bo_unmap(drm_intel_bo *bo)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_unmap(bo);
+
+    return drm_intel_bo_unmap(bo);
+}
+
+static INLINE int
+intel_shim_gem_bo_map_gtt(drm_intel_bo *bo)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_map(bo, 1);
+
+    return drm_intel_gem_bo_map_gtt(bo);
+}
+
+static INLINE int
+intel_shim_gem_bo_map_unsynchronized(drm_intel_bo *bo)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_map_unsynchronized(bo);
+
+    return drm_intel_gem_bo_map_unsynchronized(bo);
+}
+
+static INLINE int
+intel_shim_gem_bo_unmap_gtt(drm_intel_bo *bo)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_unmap(bo);
+
+    return drm_intel_gem_bo_unmap_gtt(bo);
+}
+
+static INLINE int
+intel_shim_bo_subdata(drm_intel_bo *bo, unsigned long offset,
+                      unsigned long size, const void *data)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_subdata(bo, offset, size, data);
+
+    return drm_intel_bo_subdata(bo, offset, size, data);
+}
+
+static INLINE int
+intel_shim_bo_get_subdata(drm_intel_bo *bo, unsigned long offset,
+                          unsigned long size, void *data)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_get_subdata(bo, offset, size, data);
+
+    return drm_intel_bo_get_subdata(bo, offset, size, data);
+}
+
+static INLINE void
+intel_shim_bo_wait_rendering(drm_intel_bo *bo)
+{
+    if (g_intel_mock_bufmgr)
+        intel_mock_bo_wait(bo, -1);
+    else
+        drm_intel_bo_wait_rendering(bo);
+}
+
+static INLINE int
+intel_shim_bo_busy(drm_intel_bo *bo)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_busy(bo);
+
+    return drm_intel_bo_busy(bo);
+}
+
+static INLINE int
+intel_shim_gem_bo_wait(drm_intel_bo *bo, int64_t timeout_ns)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_wait(bo, timeout_ns);
+
+    return drm_intel_gem_bo_wait(bo, timeout_ns);
+}
+
+static INLINE int
+intel_shim_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
+                         drm_intel_bo *target_bo, uint32_t target_offset,
+                         uint32_t read_domains, uint32_t write_domain)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_emit_reloc(bo, offset, target_bo, target_offset,
+                                        read_domains, write_domain);
+
+    return drm_intel_bo_emit_reloc(bo, offset, target_bo, target_offset,
+                                   read_domains, write_domain);
+}
+
+static INLINE int
+intel_shim_bo_get_tiling(drm_intel_bo *bo, uint32_t *tiling_mode,
+                         uint32_t *swizzle_mode)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_get_tiling(bo, tiling_mode, swizzle_mode);
+
+    return drm_intel_bo_get_tiling(bo, tiling_mode, swizzle_mode);
+}
+
+static INLINE int
+intel_shim_bo_flink(drm_intel_bo *bo, uint32_t *name)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_flink(bo, name);
+
+    return drm_intel_bo_flink(bo, name);
+}
+
+static INLINE int
+intel_shim_bo_mrb_exec(drm_intel_bo *bo, int used,
+                       drm_clip_rect_t *cliprects, int num_cliprects,
+                       int DR4, unsigned int flags)
+{
+    if (g_intel_mock_bufmgr)
+        return intel_mock_bo_exec(bo, used, flags);
+
+    return drm_intel_bo_mrb_exec(bo, used, cliprects, num_cliprects, DR4, flags);
+}
+
+/* Buffer sharing is not available with the mock buffer manager */
+static INLINE int
+intel_shim_bo_gem_export_to_prime(drm_intel_bo *bo, int *prime_fd)
+{
+    if (g_intel_mock_bufmgr)
+        return -1;
+
+    return drm_intel_bo_gem_export_to_prime(bo, prime_fd);
+}
+
+static INLINE drm_intel_bo *
+intel_shim_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int size)
+{
+    if (g_intel_mock_bufmgr)
+        return NULL;
+
+    return drm_intel_bo_gem_create_from_prime(bufmgr, prime_fd, size);
+}
+
+static INLINE drm_intel_bo *
+intel_shim_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr, const char *name,
+                                   unsigned int handle)
+{
+    if (g_intel_mock_bufmgr)
+        return NULL;
+
+    return drm_intel_bo_gem_create_from_name(bufmgr, name, handle);
+}
+
+#define drm_intel_bufmgr_gem_init               intel_shim_bufmgr_gem_init
+#define drm_intel_bufmgr_gem_enable_reuse       intel_shim_bufmgr_gem_enable_reuse
+#define drm_intel_bufmgr_gem_set_aub_filename   intel_shim_bufmgr_gem_set_aub_filename
+#define drm_intel_bufmgr_gem_set_aub_dump       intel_shim_bufmgr_gem_set_aub_dump
+#define drm_intel_bufmgr_destroy                intel_shim_bufmgr_destroy
+#define drm_intel_bufmgr_gem_get_devid          intel_shim_bufmgr_gem_get_devid
+#define drm_intel_bo_alloc                      intel_shim_bo_alloc
+#define drm_intel_bo_alloc_tiled                intel_shim_bo_alloc_tiled
+#define drm_intel_bo_reference                  intel_shim_bo_reference
+#define drm_intel_bo_unreference                intel_shim_bo_unreference
+#define drm_intel_bo_map                        intel_shim_bo_map
+#define drm_intel_bo_unmap                      intel_shim_bo_unmap
+#define drm_intel_gem_bo_map_gtt                intel_shim_gem_bo_map_gtt
+#define drm_intel_gem_bo_map_unsynchronized     intel_shim_gem_bo_map_unsynchronized
+#define drm_intel_gem_bo_unmap_gtt              intel_shim_gem_bo_unmap_gtt
+#define drm_intel_bo_subdata                    intel_shim_bo_subdata
+#define drm_intel_bo_get_subdata                intel_shim_bo_get_subdata
+#define drm_intel_bo_wait_rendering             intel_shim_bo_wait_rendering
+#define drm_intel_bo_busy                       intel_shim_bo_busy
+#define drm_intel_gem_bo_wait                   intel_shim_gem_bo_wait
+#define drm_intel_bo_emit_reloc                 intel_shim_bo_emit_reloc
+#define drm_intel_bo_get_tiling                 intel_shim_bo_get_tiling
+#define drm_intel_bo_flink                      intel_shim_bo_flink
+#define drm_intel_bo_mrb_exec                   intel_shim_bo_mrb_exec
+#define drm_intel_bo_gem_export_to_prime        intel_shim_bo_gem_export_to_prime
+#define drm_intel_bo_gem_create_from_prime      intel_shim_bo_gem_create_from_prime
+#define drm_intel_bo_gem_create_from_name       intel_shim_bo_gem_create_from_name
+
+#endif /* _INTEL_MOCK_BUFMGR_H_ */
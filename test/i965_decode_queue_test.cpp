@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "i965_jpegd_test_common.h"
+
+#include <unistd.h>
+#include <vector>
+
+namespace DecodeQueue {
+
+using namespace JPEG::Decode;
+
+/* Records the pictures the worker ran, optionally failing some of them */
+struct Runs
+{
+    pthread_mutex_t lock;
+    std::vector<VASurfaceID> targets;
+    VASurfaceID failing;
+    unsigned delay_us;
+};
+
+static Runs *g_runs(NULL);
+
+static VAStatus
+recordRun(VADriverContextP, struct object_context *, union codec_state *state)
+{
+    usleep(g_runs->delay_us);
+
+    pthread_mutex_lock(&g_runs->lock);
+    g_runs->targets.push_back(state->decode.current_render_target);
+    pthread_mutex_unlock(&g_runs->lock);
+
+    if (state->decode.current_render_target == g_runs->failing)
+        return VA_STATUS_ERROR_DECODING_ERROR;
+
+    return VA_STATUS_SUCCESS;
+}
+
+class DecodeQueueTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        pthread_mutex_init(&runs.lock, NULL);
+        runs.failing = VA_INVALID_SURFACE;
+        runs.delay_us = 10 * 1000;
+        g_runs = &runs;
+    }
+
+    virtual void TearDown()
+    {
+        g_runs = NULL;
+        pthread_mutex_destroy(&runs.lock);
+    }
+
+    void submit(struct i965_decode_queue *queue, VASurfaceID surface)
+    {
+        struct decode_state decode_state;
+
+        memset(&decode_state, 0, sizeof(decode_state));
+        decode_state.current_render_target = surface;
+
+        EXPECT_STATUS(i965_decode_queue_submit(queue, &decode_state));
+    }
+
+    std::vector<VASurfaceID> targets()
+    {
+        pthread_mutex_lock(&runs.lock);
+        std::vector<VASurfaceID> result(runs.targets);
+        pthread_mutex_unlock(&runs.lock);
+
+        return result;
+    }
+
+    Runs runs;
+};
+
+TEST_F(DecodeQueueTest, RunsInOrder)
+{
+    struct i965_decode_queue *queue =
+        i965_decode_queue_create(NULL, NULL, recordRun, 2);
+    ASSERT_PTR(queue);
+
+    // the third picture waits for the first one to be run
+    for (VASurfaceID surface(1); surface <= 4; ++surface)
+        submit(queue, surface);
+
+    i965_decode_queue_sync(queue, VA_INVALID_SURFACE);
+    EXPECT_FALSE(i965_decode_queue_is_surface_pending(queue, 4));
+
+    std::vector<VASurfaceID> expected;
+    for (VASurfaceID surface(1); surface <= 4; ++surface)
+        expected.push_back(surface);
+    EXPECT_EQ(expected, targets());
+
+    i965_decode_queue_destroy(queue);
+}
+
+TEST_F(DecodeQueueTest, SyncSurface)
+{
+    struct i965_decode_queue *queue =
+        i965_decode_queue_create(NULL, NULL, recordRun, 4);
+    ASSERT_PTR(queue);
+
+    runs.delay_us = 50 * 1000;
+
+    submit(queue, 1);
+    submit(queue, 2);
+    submit(queue, 3);
+    EXPECT_TRUE(i965_decode_queue_is_surface_pending(queue, 2));
+
+    // only waits for the pictures up to the one rendering into 2
+    i965_decode_queue_sync(queue, 2);
+    EXPECT_FALSE(i965_decode_queue_is_surface_pending(queue, 2));
+    EXPECT_LE(2u, targets().size());
+
+    // pictures still queued are run before the worker leaves
+    i965_decode_queue_destroy(queue);
+    EXPECT_EQ(3u, targets().size());
+}
+
+class DecodeQueueErrorTest : public PictureDecodeFixture
+{
+protected:
+    static VAStatus failingRun(VADriverContextP ctx, VAProfile,
+        union codec_state *, struct hw_context *)
+    {
+        struct i965_driver_data *i965(i965_driver_data(ctx));
+
+        // the worker runs the picture with the application thread locked out
+        runMutexHeld = pthread_mutex_trylock(&i965->run_mutex) != 0;
+        if (not runMutexHeld)
+            pthread_mutex_unlock(&i965->run_mutex);
+
+        return VA_STATUS_ERROR_DECODING_ERROR;
+    }
+
+    static bool runMutexHeld;
+};
+
+bool DecodeQueueErrorTest::runMutexHeld(false);
+
+TEST_F(DecodeQueueErrorTest, ReportedOnTarget)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (not HAS_JPEG_DECODING(i965)) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is not supported on this hardware" << std::endl;
+        return;
+    }
+
+    TestPattern::SharedConst testPattern(new TestPatternData<1>);
+    PictureData::SharedConst pd = testPattern->encoded(VA_FOURCC_IMC3);
+    ASSERT_PTR(pd.get());
+
+    VAConfigAttrib a = { type:VAConfigAttribRTFormat, value:pd->format };
+    ConfigAttribs attribs(1, a);
+
+    Surfaces surfaces = createSurfaces(
+        pd->pparam.picture_width, pd->pparam.picture_height, pd->format, 2);
+    ASSERT_EQ(2u, surfaces.size());
+
+    const int depth(i965->decode_ahead_depth);
+    i965->decode_ahead_depth = 2;
+
+    VAConfigID config = createConfig(
+        VAProfileJPEGBaseline, VAEntrypointVLD, attribs);
+    VAContextID context = createContext(
+        config, pd->pparam.picture_width, pd->pparam.picture_height, 0,
+        surfaces);
+
+    i965->decode_ahead_depth = depth;
+
+    struct object_context *obj_context = CONTEXT(context);
+    ASSERT_PTR(obj_context);
+    ASSERT_PTR(obj_context->decode_queue);
+
+    decltype(obj_context->hw_context->run) run(obj_context->hw_context->run);
+    obj_context->hw_context->run = failingRun;
+
+    VABufferID buffers[] = {
+        createBuffer(context, VAPictureParameterBufferType,
+            sizeof(pd->pparam), 1, &pd->pparam),
+        createBuffer(context, VASliceParameterBufferType,
+            sizeof(pd->sparam), 1, &pd->sparam),
+        createBuffer(context, VASliceDataBufferType,
+            pd->sparam.slice_data_size, 1, pd->slice.data()),
+    };
+
+    // the error is not known yet when the picture is queued
+    beginPicture(context, surfaces.front());
+    for (size_t i(0); i < sizeof(buffers) / sizeof(buffers[0]); ++i)
+        renderPicture(context, &buffers[i]);
+    endPicture(context);
+
+    EXPECT_EQ(VA_STATUS_ERROR_DECODING_ERROR,
+        i965_SyncSurface(*this, surfaces.front()));
+    EXPECT_TRUE(runMutexHeld);
+
+    VASurfaceStatus status(VASurfaceRendering);
+    EXPECT_EQ(VA_STATUS_ERROR_DECODING_ERROR,
+        i965_QuerySurfaceStatus(*this, surfaces.front(), &status));
+    EXPECT_EQ(VASurfaceReady, status);
+
+    // the other target is not affected
+    EXPECT_STATUS(i965_SyncSurface(*this, surfaces.back()));
+
+    // a new picture clears the error
+    beginPicture(context, surfaces.front());
+    EXPECT_STATUS(i965_QuerySurfaceStatus(*this, surfaces.front(), &status));
+
+    obj_context->hw_context->run = run;
+
+    for (size_t i(0); i < sizeof(buffers) / sizeof(buffers[0]); ++i)
+        destroyBuffer(buffers[i]);
+    destroyContext(context);
+    destroyConfig(config);
+    destroySurfaces(surfaces);
+}
+
+} // namespace DecodeQueue
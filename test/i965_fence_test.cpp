@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_jpegd_test_common.h"
+
+#include <poll.h>
+
+namespace Fence {
+
+using namespace JPEG::Decode;
+
+/* Long enough for the checks between the submission and the completion */
+static const unsigned delay_us = 200 * 1000;
+
+class FenceTest : public PictureDecodeFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        PictureDecodeFixture::SetUp();
+
+        struct i965_driver_data *i965(*this);
+        supported = i965 and g_intel_mock_bufmgr;
+
+        if (supported)
+            intel_mock_bufmgr_set_delay(i965->intel.bufmgr, delay_us);
+    }
+
+    virtual void TearDown()
+    {
+        struct i965_driver_data *i965(*this);
+
+        if (supported)
+            intel_mock_bufmgr_set_delay(i965->intel.bufmgr, 0);
+
+        PictureDecodeFixture::TearDown();
+    }
+
+    bool skip(bool hw_supported = true)
+    {
+        if (supported and hw_supported)
+            return false;
+
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " needs VA_INTEL_MOCK_BUFMGR" << std::endl;
+
+        return true;
+    }
+
+    VASurfaceStatus surfaceStatus(VASurfaceID surface)
+    {
+        VASurfaceStatus status(VASurfaceReady);
+
+        EXPECT_STATUS(i965_QuerySurfaceStatus(*this, surface, &status));
+
+        return status;
+    }
+
+    bool supported;
+};
+
+TEST_F(FenceTest, DelayedDecode)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (skip(HAS_JPEG_DECODING(i965)))
+        return;
+
+    TestPattern::SharedConst testPattern(new TestPatternData<1>);
+    PictureData::SharedConst pd = testPattern->encoded(VA_FOURCC_IMC3);
+    ASSERT_PTR(pd.get());
+
+    Surfaces surfaces = decodePicture(pd);
+    ASSERT_EQ(1u, surfaces.size());
+
+    EXPECT_EQ(VASurfaceRendering, surfaceStatus(surfaces.front()));
+
+    int fd = i965_get_surface_fence_fd(*this, surfaces.front());
+    ASSERT_NE(-1, fd);
+
+    struct pollfd pfd = { fd:fd, events:POLLIN, revents:0 };
+
+    EXPECT_EQ(0, poll(&pfd, 1, 0));
+    EXPECT_EQ(1, poll(&pfd, 1, 10 * delay_us / 1000));
+    EXPECT_EQ(VASurfaceReady, surfaceStatus(surfaces.front()));
+
+    destroySurfaces(surfaces);
+}
+
+TEST_F(FenceTest, PutImage)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (skip(HAS_ACCELERATED_PUTIMAGE(i965)))
+        return;
+
+    VADriverContextP ctx(*this);
+    Surfaces surfaces = createSurfaces(64, 64, VA_RT_FORMAT_YUV420);
+    ASSERT_EQ(1u, surfaces.size());
+
+    VAImageFormat format = { fourcc:VA_FOURCC_NV12, byte_order:VA_LSB_FIRST,
+        bits_per_pixel:12 };
+    VAImage image;
+
+    ASSERT_STATUS(ctx->vtable->vaCreateImage(ctx, &format, 64, 64, &image));
+
+    // the copy only goes through the shared post-processing batch
+    EXPECT_STATUS(ctx->vtable->vaPutImage(ctx, surfaces.front(), image.image_id,
+        0, 0, 64, 64, 0, 0, 64, 64));
+    EXPECT_EQ(VASurfaceRendering, surfaceStatus(surfaces.front()));
+
+    syncSurface(surfaces.front());
+    EXPECT_EQ(VASurfaceReady, surfaceStatus(surfaces.front()));
+
+    destroyImage(image);
+    destroySurfaces(surfaces);
+}
+
+TEST_F(FenceTest, CollectsEveryBatch)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (skip())
+        return;
+
+    struct intel_batchbuffer *batches[] = {
+        intel_batchbuffer_new(&i965->intel, I915_EXEC_RENDER, 0),
+        intel_batchbuffer_new(&i965->intel, I915_EXEC_RENDER, 0),
+    };
+    struct intel_fence *fence(NULL);
+
+    ASSERT_PTR(batches[0]);
+    ASSERT_PTR(batches[1]);
+
+    intel_fence_collect_begin(&i965->intel, &fence);
+    for (size_t i(0); i < 2; ++i) {
+        intel_batchbuffer_emit_dword(batches[i], MI_NOOP);
+        intel_batchbuffer_flush(batches[i]);
+    }
+    intel_fence_collect_end(&i965->intel);
+
+    ASSERT_PTR(fence);
+    EXPECT_EQ(2, fence->num_batches);
+    EXPECT_FALSE(intel_fence_is_signaled(fence));
+
+    // batches of other targets are left alone
+    intel_batchbuffer_emit_dword(batches[0], MI_NOOP);
+    intel_batchbuffer_flush(batches[0]);
+    EXPECT_EQ(2, fence->num_batches);
+
+    intel_fence_wait(fence);
+    EXPECT_TRUE(intel_fence_is_signaled(fence));
+
+    intel_fence_unreference(&fence);
+    intel_batchbuffer_free(batches[0]);
+    intel_batchbuffer_free(batches[1]);
+}
+
+TEST_F(FenceTest, AddFence)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (skip())
+        return;
+
+    struct intel_batchbuffer *batch =
+        intel_batchbuffer_new(&i965->intel, I915_EXEC_RENDER, 0);
+    struct intel_fence *src(NULL), *fence(NULL);
+
+    ASSERT_PTR(batch);
+
+    // what an encoder picture submits before its target is known
+    intel_fence_collect_begin(&i965->intel, &src);
+    for (size_t i(0); i < 2; ++i) {
+        intel_batchbuffer_emit_dword(batch, MI_NOOP);
+        intel_batchbuffer_flush(batch);
+    }
+    intel_fence_collect_end(&i965->intel);
+    ASSERT_PTR(src);
+
+    intel_fence_add_fence(&i965->intel, &fence, src);
+    intel_fence_unreference(&src);
+
+    ASSERT_PTR(fence);
+    EXPECT_EQ(2, fence->num_batches);
+    EXPECT_FALSE(intel_fence_is_signaled(fence));
+
+    intel_fence_wait(fence);
+    EXPECT_TRUE(intel_fence_is_signaled(fence));
+
+    // nothing left in flight, nothing to add
+    src = intel_fence_new(&i965->intel);
+    ASSERT_PTR(src);
+    intel_fence_unreference(&fence);
+    intel_fence_add_fence(&i965->intel, &fence, src);
+    EXPECT_TRUE(fence == NULL);
+
+    intel_fence_unreference(&src);
+    intel_batchbuffer_free(batch);
+}
+
+} // namespace Fence
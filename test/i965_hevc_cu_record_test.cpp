@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+#include "i965_internal_decl.h"
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace HEVC {
+namespace Encode {
+
+// The CU record conversion as it was written before it was flattened into
+// gen9_hcpe_hevc_fill_ctb_cu_records(). It works on a copy of the VME output
+// since it patches the messages in place. The only change is the "& 31" on
+// the NxN shift: shifting by 32 or more is undefined, the shifter wrapped it
+// around.
+namespace Reference {
+
+static const int intra_mode_8x8_avc2hevc[9] = {26, 10, 1, 34, 18, 24, 13, 28, 8};
+static const int intra_mode_16x16_avc2hevc[4] = {26, 10, 1, 34};
+
+void fillIntra(unsigned int *cu_msg, int qp, unsigned int *msg, int index)
+{
+    static const int chroma_mode_remap[4] = {5, 4, 3, 2};
+    const int intraMbMode((msg[0] & 0x30) >> 4);
+    const int intra_chroma_mode(chroma_mode_remap[msg[3] & 0x3]);
+    int cu_part_mode(0), cu_size(1), tu_size(0x55);
+    int intraMode[4];
+
+    if (intraMbMode == 0) {
+        for (unsigned i(0); i < 4; ++i)
+            intraMode[i] = intra_mode_16x16_avc2hevc[msg[1] & 0xf];
+    } else if (intraMbMode == 1) {
+        cu_size = 0;
+        tu_size = 0;
+        for (unsigned i(0); i < 4; ++i)
+            intraMode[i] = intra_mode_8x8_avc2hevc[msg[1] >> (index << 2) & 0xf];
+    } else {
+        cu_part_mode = 3;
+        cu_size = 0;
+        tu_size = 0;
+        intraMode[0] = intra_mode_8x8_avc2hevc[msg[1] >> (((index << 4) + 0) & 31) & 0xf];
+        intraMode[1] = intra_mode_8x8_avc2hevc[msg[1] >> (((index << 4) + 4) & 31) & 0xf];
+        intraMode[2] = intra_mode_8x8_avc2hevc[msg[1] >> (((index << 4) + 8) & 31) & 0xf];
+        intraMode[3] = intra_mode_8x8_avc2hevc[msg[1] >> (((index << 4) + 12) & 31) & 0xf];
+    }
+
+    std::memset(cu_msg, 0, 16 * sizeof(unsigned int));
+    cu_msg[0] = 0xff << 24 | qp << 16 | intra_chroma_mode << 8
+        | cu_part_mode << 4 | cu_size;
+    cu_msg[1] = intraMode[3] << 24 | intraMode[2] << 16 | intraMode[1] << 8
+        | intraMode[0];
+    cu_msg[11] = tu_size;
+    cu_msg[12] = 3 << 28;
+}
+
+void fillInter(unsigned int *cu_msg, int qp, unsigned int *msg, int index,
+    const unsigned int ref_index_in_mb[2])
+{
+    const int inter_mode(msg[0] & 0x3);
+    const int submb_pre_mode((msg[1] & 0x00ff0000) >> 16);
+    unsigned int *mv_ptr(msg + 4);
+    int cu_part_mode(0), cu_size(1), tu_size(0x55);
+
+    if (inter_mode == 0) {
+        mv_ptr[4] = mv_ptr[0]; mv_ptr[5] = mv_ptr[1];
+        mv_ptr[2] = mv_ptr[0]; mv_ptr[3] = mv_ptr[1];
+        mv_ptr[6] = mv_ptr[0]; mv_ptr[7] = mv_ptr[1];
+    } else if (inter_mode == 2) {
+        mv_ptr[4] = mv_ptr[0]; mv_ptr[5] = mv_ptr[1];
+        mv_ptr[2] = mv_ptr[8]; mv_ptr[3] = mv_ptr[9];
+        mv_ptr[6] = mv_ptr[8]; mv_ptr[7] = mv_ptr[9];
+        cu_part_mode = 1;
+    } else if (inter_mode == 1) {
+        mv_ptr[2] = mv_ptr[0]; mv_ptr[3] = mv_ptr[1];
+        mv_ptr[4] = mv_ptr[16]; mv_ptr[5] = mv_ptr[17];
+        mv_ptr[6] = mv_ptr[24]; mv_ptr[7] = mv_ptr[25];
+        cu_part_mode = 2;
+    } else {
+        for (unsigned i(0); i < 8; i += 2) {
+            mv_ptr[i] = mv_ptr[index * 8 + 0];
+            mv_ptr[i + 1] = mv_ptr[index * 8 + 1];
+        }
+        cu_size = 0;
+        tu_size = 0;
+    }
+
+    std::memset(cu_msg, 0, 16 * sizeof(unsigned int));
+    cu_msg[0] = submb_pre_mode << 24 | qp << 16 | 5 << 8 | cu_part_mode << 4
+        | 1 << 2 | cu_size;
+    cu_msg[2] = (mv_ptr[2] & 0xffff) << 16 | (mv_ptr[0] & 0xffff);
+    cu_msg[3] = (mv_ptr[6] & 0xffff) << 16 | (mv_ptr[4] & 0xffff);
+    cu_msg[4] = (mv_ptr[2] & 0xffff0000) | (mv_ptr[0] & 0xffff0000) >> 16;
+    cu_msg[5] = (mv_ptr[6] & 0xffff0000) | (mv_ptr[4] & 0xffff0000) >> 16;
+    cu_msg[6] = (mv_ptr[3] & 0xffff) << 16 | (mv_ptr[1] & 0xffff);
+    cu_msg[7] = (mv_ptr[7] & 0xffff) << 16 | (mv_ptr[5] & 0xffff);
+    cu_msg[8] = (mv_ptr[3] & 0xffff0000) | (mv_ptr[1] & 0xffff0000) >> 16;
+    cu_msg[9] = (mv_ptr[7] & 0xffff0000) | (mv_ptr[5] & 0xffff0000) >> 16;
+
+    for (unsigned i(0); i < 4; ++i) {
+        cu_msg[10] |= ((ref_index_in_mb[1] >> (i * 8)) & 0xf) << (16 + i * 4);
+        cu_msg[10] |= ((ref_index_in_mb[0] >> (i * 8)) & 0xf) << (i * 4);
+    }
+    cu_msg[11] = tu_size;
+    cu_msg[12] = 3 << 28;
+}
+
+int fillCTB(const gen9_hcpe_ctb_vme_output& vme, unsigned char *msg_ptr,
+    unsigned int *cu_records, unsigned int *split)
+{
+    int cu_index(0);
+
+    *split = (vme.ctb_width_in_mb == 2) ? 0x1 << 20 : 0;
+
+    for (int mb_y(0); mb_y < vme.height_in_mb; ++mb_y) {
+        for (int mb_x(0); mb_x < vme.width_in_mb; ++mb_x) {
+            int max_cu_num_in_mb(4);
+            if (vme.drop_cu_row and mb_y == vme.height_in_mb - 1)
+                max_cu_num_in_mb /= 2;
+            if (vme.drop_cu_column and mb_x == vme.width_in_mb - 1)
+                max_cu_num_in_mb /= 2;
+
+            unsigned int *msg = reinterpret_cast<unsigned int *>(
+                msg_ptr + (mb_y * vme.width_in_mbs + mb_x) * vme.msg_size);
+            const int inter_rdo(msg[10] & 0xffff);
+            const int intra_rdo(msg[4] & 0xffff);
+            const unsigned int splitBit(vme.ctb_width_in_mb == 2 ?
+                0x1 << (mb_x + mb_y * 2 + 16) :
+                (vme.ctb_width_in_mb == 1 ? 0x1 << 20 : 0));
+
+            if (vme.is_intra or intra_rdo < inter_rdo) {
+                int mode((msg[0] & 0x30) >> 4);
+                if (max_cu_num_in_mb < 4) {
+                    if (mode == 0)
+                        msg[0] = 1 << 4;
+                    fillIntra(cu_records + 16 * cu_index++, vme.qp, msg, 0);
+                    if (--max_cu_num_in_mb > 0)
+                        fillIntra(cu_records + 16 * cu_index++, vme.qp, msg, 2);
+                    *split |= splitBit;
+                } else if (mode == 0) {
+                    fillIntra(cu_records + 16 * cu_index++, vme.qp, msg, 0);
+                } else {
+                    for (int i(0); i < 4; ++i)
+                        fillIntra(cu_records + 16 * cu_index++, vme.qp, msg, i);
+                    *split |= splitBit;
+                }
+            } else {
+                msg += 8;
+                int mode(msg[0] & 0x3);
+                if (max_cu_num_in_mb < 4) {
+                    if (mode != 3)
+                        msg[0] = 3;
+                    fillInter(cu_records + 16 * cu_index++, vme.qp, msg, 0,
+                        vme.ref_index_in_mb);
+                    if (--max_cu_num_in_mb > 0)
+                        fillInter(cu_records + 16 * cu_index++, vme.qp, msg, 1,
+                            vme.ref_index_in_mb);
+                    *split |= splitBit;
+                } else if (mode == 3) {
+                    for (int i(0); i < 4; ++i)
+                        fillInter(cu_records + 16 * cu_index++, vme.qp, msg, i,
+                            vme.ref_index_in_mb);
+                    *split |= splitBit;
+                } else {
+                    fillInter(cu_records + 16 * cu_index++, vme.qp, msg, 0,
+                        vme.ref_index_in_mb);
+                }
+            }
+        }
+    }
+
+    return cu_index;
+}
+
+} // namespace Reference
+
+struct CURecordParam
+{
+    unsigned width;
+    unsigned height;
+    unsigned log2_ctb_size;
+    bool is_intra;
+};
+
+class HEVCCURecordTest
+    : public ::testing::TestWithParam<CURecordParam>
+{ };
+
+TEST_P(HEVCCURecordTest, BitExact)
+{
+    const CURecordParam& p = GetParam();
+    const int msg_size(64 * sizeof(unsigned int));
+    const int ctb_size(1 << p.log2_ctb_size);
+    const int ctb_width_in_mb(ctb_size / 16);
+    const int width_in_mbs((p.width + 15) / 16);
+    const int height_in_mbs((p.height + 15) / 16);
+    const int width_in_ctb((p.width + ctb_size - 1) / ctb_size);
+    const int height_in_ctb((p.height + ctb_size - 1) / ctb_size);
+
+    std::mt19937 rng(p.width * p.height + p.log2_ctb_size);
+    std::vector<unsigned int> vmeOutput(
+        width_in_mbs * (height_in_mbs + ctb_width_in_mb) * msg_size / 4);
+
+    // valid prediction modes, random everything else
+    for (int mb(0); mb < width_in_mbs * height_in_mbs; ++mb) {
+        unsigned int *msg = &vmeOutput[mb * msg_size / 4];
+        for (int i(0); i < msg_size / 4; ++i)
+            msg[i] = rng();
+
+        msg[0] = (msg[0] & ~0x30) | (rng() % 3) << 4;
+        msg[1] = msg[2] = 0;
+        for (int i(0); i < 8; ++i) {
+            msg[1] |= (rng() % 9) << (i * 4);
+            msg[2] |= (rng() % 9) << (i * 4);
+        }
+        if (((msg[0] & 0x30) >> 4) == 0)
+            msg[1] = (msg[1] & ~0xf) | (rng() % 4);
+
+        // the reference takes the NxN modes of the 8x8 blocks 2 and 3 from
+        // msg[1] as well, NxNModes checks where they really come from
+        if (((msg[0] & 0x30) >> 4) == 2)
+            msg[2] = msg[1];
+    }
+
+    gen9_hcpe_ctb_vme_output vme;
+    vme.msg_size = msg_size;
+    vme.width_in_mbs = width_in_mbs;
+    vme.ctb_width_in_mb = ctb_width_in_mb;
+    vme.is_intra = p.is_intra;
+    vme.qp = 26;
+    vme.ref_index_in_mb[0] = 0x01020304;
+    vme.ref_index_in_mb[1] = 0x05060708;
+
+    std::vector<unsigned int> reference(64 * 16), records(64 * 16);
+    std::vector<unsigned int> scratch(vmeOutput);
+    unsigned numCTBs(0);
+
+    for (int ctb_y(0); ctb_y < height_in_ctb; ++ctb_y) {
+        for (int ctb_x(0); ctb_x < width_in_ctb; ++ctb_x) {
+            vme.width_in_mb = std::min(ctb_width_in_mb,
+                width_in_mbs - ctb_x * ctb_width_in_mb);
+            vme.height_in_mb = std::min(ctb_width_in_mb,
+                height_in_mbs - ctb_y * ctb_width_in_mb);
+            vme.drop_cu_row = ctb_y == height_in_ctb - 1
+                and p.height % 16 and p.height % 16 <= 8;
+            vme.drop_cu_column = ctb_x == width_in_ctb - 1
+                and p.width % 16 and p.width % 16 <= 8;
+
+            const int offset((ctb_y * width_in_mbs + ctb_x) * ctb_width_in_mb
+                * msg_size);
+            vme.msg = reinterpret_cast<const unsigned char *>(
+                vmeOutput.data()) + offset;
+
+            unsigned int split, referenceSplit;
+            std::fill(reference.begin(), reference.end(), 0xdeadbeef);
+            std::fill(records.begin(), records.end(), 0xdeadbeef);
+
+            const int count = gen9_hcpe_hevc_fill_ctb_cu_records(&vme,
+                records.data(), &split);
+            const int referenceCount = Reference::fillCTB(vme,
+                reinterpret_cast<unsigned char *>(scratch.data()) + offset,
+                reference.data(), &referenceSplit);
+
+            ASSERT_EQ(referenceCount, count)
+                << "CTB " << ctb_x << "x" << ctb_y;
+            EXPECT_EQ(referenceSplit, split)
+                << "CTB " << ctb_x << "x" << ctb_y;
+            EXPECT_TRUE(std::equal(reference.begin(), reference.end(),
+                records.begin())) << "CTB " << ctb_x << "x" << ctb_y;
+
+            ++numCTBs;
+        }
+    }
+
+    EXPECT_EQ(unsigned(width_in_ctb * height_in_ctb), numCTBs);
+}
+
+// One intra NxN MB, the four modes of each 8x8 block are in a 16 bit half
+// of msg[1] for the blocks 0 and 1, of msg[2] for the blocks 2 and 3
+TEST(HEVCCURecordNxNTest, NxNModes)
+{
+    std::vector<unsigned int> msg(64, 0);
+
+    msg[0] = 2 << 4;
+    msg[1] = 0x76543210;
+    msg[2] = 0x12345678;
+
+    gen9_hcpe_ctb_vme_output vme;
+    std::memset(&vme, 0, sizeof(vme));
+    vme.msg = reinterpret_cast<const unsigned char *>(msg.data());
+    vme.msg_size = msg.size() * sizeof(unsigned int);
+    vme.width_in_mbs = 1;
+    vme.ctb_width_in_mb = 1;
+    vme.width_in_mb = 1;
+    vme.height_in_mb = 1;
+    vme.is_intra = true;
+    vme.qp = 26;
+
+    std::vector<unsigned int> records(4 * 16, 0xdeadbeef);
+    unsigned int split;
+
+    ASSERT_EQ(4, gen9_hcpe_hevc_fill_ctb_cu_records(&vme, records.data(),
+        &split));
+
+    // HEVC modes of the 4x4 blocks 3 to 0, one per byte
+    EXPECT_EQ(0x22010a1au, records[0 * 16 + 1]);    // 34, 1, 10, 26
+    EXPECT_EQ(0x1c0d1812u, records[1 * 16 + 1]);    // 28, 13, 24, 18
+    EXPECT_EQ(0x180d1c08u, records[2 * 16 + 1]);    // 24, 13, 28, 8
+    EXPECT_EQ(0x0a012212u, records[3 * 16 + 1]);    // 10, 1, 34, 18
+}
+
+INSTANTIATE_TEST_CASE_P(
+    CURecord, HEVCCURecordTest, ::testing::Values(
+        CURecordParam{1920, 1080, 4, true},
+        CURecordParam{1920, 1080, 5, false},
+        CURecordParam{1920, 1080, 6, false},
+        CURecordParam{356, 200, 5, false},
+        CURecordParam{356, 200, 5, true},
+        CURecordParam{ 76,  44, 4, false},
+        CURecordParam{ 76,  44, 6, false}
+    )
+);
+
+} // namespace Encode
+} // namespace HEVC
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+#include "i965_internal_decl.h"
+
+#include <cstring>
+
+namespace HEVC {
+namespace Encode {
+
+// Two temporal layers: the base layer at 1 Mbps and 15 fps, both layers
+// together at 3 Mbps and 30 fps, i.e. the second layer adds 2 Mbps at 15 fps
+class LayerBRCTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        std::memset(&seq, 0, sizeof(seq));
+        seq.pic_width_in_luma_samples = 320;
+        seq.pic_height_in_luma_samples = 240;
+        seq.intra_period = 30;
+        seq.ip_period = 1;
+
+        std::memset(&slice, 0, sizeof(slice));
+        slice.slice_type = HEVC_SLICE_P;
+
+        std::memset(stores, 0, sizeof(stores));
+        stores[0].buffer = reinterpret_cast<unsigned char *>(&seq);
+        stores[1].buffer = reinterpret_cast<unsigned char *>(&slice);
+        slices[0] = &stores[1];
+
+        std::memset(&encode_state, 0, sizeof(encode_state));
+        encode_state.seq_param_ext = &stores[0];
+        encode_state.slice_params_ext = slices;
+        encode_state.num_slice_params_ext = 1;
+
+        mfc_context = static_cast<gen9_hcpe_context *>(
+            calloc(1, sizeof(gen9_hcpe_context)));
+        encoder_context = static_cast<intel_encoder_context *>(
+            calloc(1, sizeof(intel_encoder_context)));
+        ASSERT_PTR(mfc_context);
+        ASSERT_PTR(encoder_context);
+
+        encoder_context->codec = CODEC_HEVC;
+        encoder_context->rate_control_mode = VA_RC_CBR;
+        encoder_context->mfc_context = mfc_context;
+        encoder_context->layer.num_layers = 2;
+        encoder_context->layer.size_frame_layer_ids = 2;
+        encoder_context->layer.frame_layer_ids[0] = 0;
+        encoder_context->layer.frame_layer_ids[1] = 1;
+        encoder_context->brc.bits_per_second[0] = 1000000;
+        encoder_context->brc.bits_per_second[1] = 3000000;
+        encoder_context->brc.framerate[0].num = 15;
+        encoder_context->brc.framerate[0].den = 1;
+        encoder_context->brc.framerate[1].num = 30;
+        encoder_context->brc.framerate[1].den = 1;
+        encoder_context->brc.need_reset = 1;
+    }
+
+    virtual void TearDown()
+    {
+        free(encoder_context);
+        free(mfc_context);
+    }
+
+    /* Reports the size of a frame of the current layer to the BRC */
+    int postpack(unsigned layer_id, int frame_bits)
+    {
+        encoder_context->layer.curr_frame_layer_id = layer_id;
+        encoder_context->num_frames_in_sequence++;
+
+        return intel_hcpe_brc_postpack(&encode_state, encoder_context,
+            frame_bits);
+    }
+
+    VAEncSequenceParameterBufferHEVC seq;
+    VAEncSliceParameterBufferHEVC slice;
+    struct buffer_store stores[2];
+    struct buffer_store *slices[1];
+    struct encode_state encode_state;
+    struct gen9_hcpe_context *mfc_context;
+    struct intel_encoder_context *encoder_context;
+};
+
+TEST_F(LayerBRCTest, Init)
+{
+    intel_hcpe_brc_prepare(&encode_state, encoder_context);
+
+    // each layer gets the bits and frames it adds to the lower layers
+    EXPECT_DOUBLE_EQ(1000000 / 15., mfc_context->brc.bits_per_frame[0]);
+    EXPECT_DOUBLE_EQ(2000000 / 15., mfc_context->brc.bits_per_frame[1]);
+
+    // and its share of the 8 s HRD buffer of the stream, half full
+    EXPECT_EQ(8000000u, mfc_context->hrd.buffer_size[0]);
+    EXPECT_EQ(16000000u, mfc_context->hrd.buffer_size[1]);
+    EXPECT_DOUBLE_EQ(4000000., mfc_context->hrd.current_buffer_fullness[0]);
+    EXPECT_DOUBLE_EQ(8000000., mfc_context->hrd.current_buffer_fullness[1]);
+
+    // the intra period is split by frame rate, the I frame is on layer 0
+    EXPECT_EQ(1, mfc_context->brc.gop_nums[0][HEVC_SLICE_I]);
+    EXPECT_EQ(14, mfc_context->brc.gop_nums[0][HEVC_SLICE_P]);
+    EXPECT_EQ(0, mfc_context->brc.gop_nums[0][HEVC_SLICE_B]);
+    EXPECT_EQ(0, mfc_context->brc.gop_nums[1][HEVC_SLICE_I]);
+    EXPECT_EQ(15, mfc_context->brc.gop_nums[1][HEVC_SLICE_P]);
+    EXPECT_EQ(0, mfc_context->brc.gop_nums[1][HEVC_SLICE_B]);
+
+    // 1 Mbit over 1 + 0.6 * 14 weighted frames, 2 Mbit over 0.6 * 15
+    EXPECT_EQ(106382, mfc_context->brc.target_frame_size[0][HEVC_SLICE_I]);
+    EXPECT_EQ(63829, mfc_context->brc.target_frame_size[0][HEVC_SLICE_P]);
+    EXPECT_EQ(222222, mfc_context->brc.target_frame_size[1][HEVC_SLICE_I]);
+    EXPECT_EQ(133333, mfc_context->brc.target_frame_size[1][HEVC_SLICE_P]);
+
+    // the richer layer starts at a lower QP
+    EXPECT_EQ(27, mfc_context->brc.qp_prime_y[0][HEVC_SLICE_P]);
+    EXPECT_EQ(2, mfc_context->brc.qp_prime_y[1][HEVC_SLICE_P]);
+}
+
+TEST_F(LayerBRCTest, PostPack)
+{
+    intel_hcpe_brc_prepare(&encode_state, encoder_context);
+
+    const int qp0(mfc_context->brc.qp_prime_y[0][HEVC_SLICE_P]);
+    const int qp1(mfc_context->brc.qp_prime_y[1][HEVC_SLICE_P]);
+
+    // a base layer frame only drains the base layer buffer. The next frame
+    // is the first one of layer 1, which keeps its initial QP
+    EXPECT_EQ(BRC_NO_HRD_VIOLATION, postpack(0, 100000));
+    EXPECT_DOUBLE_EQ(4000000. - 100000 + 1000000 / 15.,
+        mfc_context->hrd.current_buffer_fullness[0]);
+    EXPECT_DOUBLE_EQ(8000000., mfc_context->hrd.current_buffer_fullness[1]);
+    EXPECT_EQ(100000, mfc_context->brc.bits_prev_frame[0]);
+    EXPECT_EQ(0, mfc_context->brc.bits_prev_frame[1]);
+    EXPECT_EQ(qp0, mfc_context->brc.qp_prime_y[0][HEVC_SLICE_P]);
+    EXPECT_EQ(qp1, mfc_context->brc.qp_prime_y[1][HEVC_SLICE_P]);
+
+    // the next base layer frame is predicted from the last one on layer 0:
+    // 100000 bits is above the P target, so its QP goes up
+    EXPECT_EQ(BRC_NO_HRD_VIOLATION, postpack(1, 133333));
+    EXPECT_DOUBLE_EQ(8000000. - 133333 + 2000000 / 15.,
+        mfc_context->hrd.current_buffer_fullness[1]);
+    EXPECT_EQ(133333, mfc_context->brc.bits_prev_frame[1]);
+    EXPECT_LT(qp0, mfc_context->brc.qp_prime_y[0][HEVC_SLICE_P]);
+    EXPECT_EQ(qp1, mfc_context->brc.qp_prime_y[1][HEVC_SLICE_P]);
+}
+
+} // namespace Encode
+} // namespace HEVC
@@ -29,6 +29,22 @@ extern "C" {
     #include "sysdeps.h"
     #include "i965_drv_video.h"
     #include "i965_encoder.h"
+    #include "gen6_mfc.h"
+    #include "gen9_mfc.h"
+    #include "gen9_mfd.h"
+    #include "gen75_vpp_vebox.h"
+    #include "gen9_vdenc.h"
+    #include "i965_decode_queue.h"
+    #include "i965_jpeg_sw_decoder.h"
+    #include "i965_post_processing.h"
+    #include "i965_scene_cut.h"
+    #include "i965_trace.h"
+    #include "i965_vpp_avs.h"
+    #include "i965_vpp_field_rate.h"
+    #include "i965_vpp_statistics.h"
+    #include "i965_vpp_sw.h"
+    #include "i965_vpp_tone_map.h"
+    #include "intel_batchbuffer.h"
 
     extern VAStatus i965_CreateConfig(
         VADriverContextP, VAProfile, VAEntrypoint,
@@ -70,6 +86,12 @@ extern "C" {
     extern VAStatus i965_SyncSurface(
         VADriverContextP, VASurfaceID);
 
+    extern VAStatus i965_QuerySurfaceStatus(
+        VADriverContextP, VASurfaceID, VASurfaceStatus *);
+
+    extern struct hw_context *i965_proc_context_init(
+        VADriverContextP, struct object_config *);
+
     extern struct hw_codec_info *i965_get_codec_info(int);
     extern const struct intel_device_info *i965_get_device_info(int);
 
@@ -27,6 +27,7 @@
 #include "i965_test_fixture.h"
 #include "test_utils.h"
 
+#include <chrono>
 #include <numeric>
 #include <cstring>
 #include <memory>
@@ -526,5 +527,135 @@ INSTANTIATE_TEST_CASE_P(
     )
 );
 
+class JPEGEncodeRepeatTest
+    : public JPEGEncodeInputTest
+{ };
+
+// Encodes the same small picture many times, as done for MJPEG streams, to
+// check that reusing the converted tables across pictures doesn't change the
+// output, and to report the time spent per picture.
+TEST_P(JPEGEncodeRepeatTest, SameTables)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (not HAS_JPEG_ENCODING(i965)) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is unsupported on this hardware" << std::endl;
+        return;
+    }
+
+    ASSERT_NO_FAILURE(SetUpSurfaces());
+    ASSERT_NO_FAILURE(SetUpConfig());
+    ASSERT_NO_FAILURE(SetUpContext());
+    ASSERT_NO_FAILURE(SetUpCodedBuffer());
+    ASSERT_NO_FAILURE(SetUpPicture());
+    ASSERT_NO_FAILURE(SetUpIQMatrix());
+    ASSERT_NO_FAILURE(SetUpHuffmanTables());
+    ASSERT_NO_FAILURE(SetUpSlice());
+    ASSERT_NO_FAILURE(SetUpHeader());
+    ASSERT_NO_FAILURE(Encode());
+
+    const ByteData first(output);
+    const unsigned frames(1000);
+
+    const auto start(std::chrono::steady_clock::now());
+    for (unsigned i(1); i < frames; ++i) {
+        ASSERT_NO_FAILURE(Encode());
+        ASSERT_TRUE(first == output) << "picture " << i << " differs";
+    }
+    const std::chrono::duration<double, std::micro> elapsed(
+        std::chrono::steady_clock::now() - start);
+
+    RecordProperty("usec_per_picture",
+        int(elapsed.count() / (frames - 1)));
+
+    VerifyOutput();
+}
+
+// Submits several pictures, each with its own coded buffer, before reading
+// back any of them, so that they may share one batch when the driver runs
+// with VA_INTEL_JPEG_ENCODE_BATCH. Every output must match the one of a
+// picture encoded on its own.
+TEST_P(JPEGEncodeRepeatTest, BackToBack)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (not HAS_JPEG_ENCODING(i965)) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is unsupported on this hardware" << std::endl;
+        return;
+    }
+
+    ASSERT_NO_FAILURE(SetUpSurfaces());
+    ASSERT_NO_FAILURE(SetUpConfig());
+    ASSERT_NO_FAILURE(SetUpContext());
+    ASSERT_NO_FAILURE(SetUpCodedBuffer());
+    ASSERT_NO_FAILURE(SetUpPicture());
+    ASSERT_NO_FAILURE(SetUpIQMatrix());
+    ASSERT_NO_FAILURE(SetUpHuffmanTables());
+    ASSERT_NO_FAILURE(SetUpSlice());
+    ASSERT_NO_FAILURE(SetUpHeader());
+    ASSERT_NO_FAILURE(Encode());
+
+    const ByteData first(output);
+    const unsigned pictures(16);
+    const unsigned size(input->image->sizes.sum() * 2 + 16384u);
+
+    Buffers codedBuffers, pictureBuffers;
+    for (unsigned i(0); i < pictures; ++i) {
+        ASSERT_NO_FAILURE(
+            codedBuffers.push_back(
+                createBuffer(context, VAEncCodedBufferType, size)));
+        input->picture.coded_buf = codedBuffers.back();
+        ASSERT_NO_FAILURE(
+            pictureBuffers.push_back(
+                createBuffer(context, VAEncPictureParameterBufferType,
+                    sizeof(PictureParameter), 1, &input->picture)));
+    }
+
+    // the picture parameters come first, see SetUpPicture()
+    Buffers buffers(renderBuffers);
+    for (unsigned i(0); i < pictures; ++i) {
+        buffers.front() = pictureBuffers[i];
+        ASSERT_NO_FAILURE(beginPicture(context, surfaces.front()));
+        ASSERT_NO_FAILURE(
+            renderPicture(context, buffers.data(), buffers.size()));
+        ASSERT_NO_FAILURE(endPicture(context));
+    }
+
+    for (unsigned i(0); i < pictures; ++i) {
+        ASSERT_NO_FAILURE(
+            VACodedBufferSegment *segment =
+                mapBuffer<VACodedBufferSegment>(codedBuffers[i]));
+        EXPECT_PTR_NULL(segment->next);
+
+        const size_t headerSize(1);
+        const ByteData result(
+            reinterpret_cast<uint8_t *>(segment->buf) + headerSize,
+            reinterpret_cast<uint8_t *>(segment->buf) + segment->size);
+
+        unmapBuffer(codedBuffers[i]);
+
+        EXPECT_TRUE(first == result) << "picture " << i << " differs";
+    }
+
+    for (auto id : pictureBuffers)
+        destroyBuffer(id);
+    for (auto id : codedBuffers)
+        destroyBuffer(id);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Repeat, JPEGEncodeRepeatTest,
+    ::testing::Combine(
+        ::testing::Values(
+            TestInputCreator::Shared(new FixedSizeCreator({160, 120}))
+        ),
+        ::testing::Values("I420", "NV12", "YUY2")
+    )
+);
+
 } // namespace Encode
 } // namespace JPEG
@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+#include "i965_internal_decl.h"
+#include "i965_jpeg_test_data.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <tuple>
+#include <vector>
+
+namespace JPEG {
+namespace Decode {
+
+typedef std::vector<i965_jpeg_sw_plane> Planes;
+
+// Planes sized after the components of the picture, without padding
+class JPEGSoftwareDecodeTest : public ::testing::Test
+{
+protected:
+    void SetUpPlanes(const PictureParameter& pparam)
+    {
+        unsigned hmax(1), vmax(1);
+        for (unsigned i(0); i < pparam.num_components; ++i) {
+            hmax = std::max(hmax, unsigned(pparam.components[i].h_sampling_factor));
+            vmax = std::max(vmax, unsigned(pparam.components[i].v_sampling_factor));
+        }
+
+        buffers.resize(pparam.num_components);
+        planes.resize(pparam.num_components);
+        for (unsigned i(0); i < pparam.num_components; ++i) {
+            i965_jpeg_sw_plane& plane = planes[i];
+            plane.width = (pparam.picture_width
+                * pparam.components[i].h_sampling_factor + hmax - 1) / hmax;
+            plane.height = (pparam.picture_height
+                * pparam.components[i].v_sampling_factor + vmax - 1) / vmax;
+            plane.pitch = plane.width;
+            buffers[i].assign(plane.pitch * plane.height, 0x5a);
+            plane.data = buffers[i].data();
+        }
+    }
+
+    int Decode(const PictureParameter& pparam, const IQMatrix& iqmatrix,
+        const HuffmanTable& huffman, const SliceParameter& sparam,
+        const ByteData& slice, int threads = 1)
+    {
+        const i965_jpeg_sw_slice s = {&sparam, slice.data(), unsigned(slice.size())};
+        return i965_jpeg_sw_decode(&pparam, &iqmatrix, &huffman, &s, 1,
+            planes.data(), threads);
+    }
+
+    std::vector<ByteData>   buffers;
+    Planes                  planes;
+};
+
+class JPEGSoftwareDecodeFourCCTest
+    : public JPEGSoftwareDecodeTest
+    , public ::testing::WithParamInterface<
+        std::tuple<TestPattern::SharedConst, const char*> >
+{ };
+
+// Same patterns and tolerance as the hardware decode test
+TEST_P(JPEGSoftwareDecodeFourCCTest, Decode)
+{
+    TestPattern::SharedConst testPattern;
+    std::string sFourcc;
+    std::tie(testPattern, sFourcc) = GetParam();
+
+    ASSERT_PTR(testPattern.get());
+    ASSERT_EQ(4u, sFourcc.size());
+
+    PictureData::SharedConst pd = testPattern->encoded(
+        VA_FOURCC(sFourcc[0], sFourcc[1], sFourcc[2], sFourcc[3]));
+    ASSERT_PTR(pd.get());
+
+    ASSERT_NO_FAILURE(SetUpPlanes(pd->pparam));
+    EXPECT_EQ(0, Decode(pd->pparam, pd->iqmatrix, pd->huffman, pd->sparam,
+        pd->slice));
+
+    const unsigned width(pd->pparam.picture_width);
+    const unsigned height(pd->pparam.picture_height);
+    const ByteData& decoded = testPattern->decoded();
+
+    for (unsigned i(0); i < planes.size(); ++i) {
+        const unsigned hsample(
+            i ? pd->pparam.components[0].h_sampling_factor : 1);
+        const unsigned vsample(
+            i ? pd->pparam.components[0].v_sampling_factor : 1);
+        const uint8_t *expect = decoded.data() + width * height * i;
+
+        for (unsigned row(0); row < height / vsample; ++row) {
+            for (unsigned col(0); col < width / hsample; ++col) {
+                unsigned sum(0);
+                for (unsigned y(0); y < vsample; ++y)
+                    for (unsigned x(0); x < hsample; ++x)
+                        sum += expect[(row * vsample + y) * width
+                            + col * hsample + x];
+
+                EXPECT_NEAR(sum / (hsample * vsample),
+                    planes[i].data[row * planes[i].pitch + col], 2)
+                    << "component " << i << " row " << row << " col " << col;
+            }
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    JPEG, JPEGSoftwareDecodeFourCCTest,
+    ::testing::Combine(
+        ::testing::Values(
+            TestPattern::SharedConst(new TestPatternData<1>),
+            TestPattern::SharedConst(new TestPatternData<2>),
+            TestPattern::SharedConst(new TestPatternData<3>),
+            TestPattern::SharedConst(new TestPatternData<4>)
+        ),
+        ::testing::Values("IMC3", "422H", "422V", "444P", "411P"))
+);
+
+// Writes 4:2:0 pictures made of flat blocks, with restart intervals
+class FlatBlockWriter
+{
+public:
+    FlatBlockWriter(const HuffmanTable& huffman)
+        : data()
+        , acc(0)
+        , bits(0)
+    {
+        for (unsigned i(0); i < 2; ++i) {
+            makeCodes(huffman.huffman_table[i].num_dc_codes,
+                huffman.huffman_table[i].dc_values, dcCodes[i]);
+            makeCodes(huffman.huffman_table[i].num_ac_codes,
+                huffman.huffman_table[i].ac_values, acCodes[i]);
+        }
+    }
+
+    // One quantized DC value per block, in decoding order
+    void writeBlock(unsigned table, int diff)
+    {
+        unsigned size(0);
+        for (int v(std::abs(diff)); v; v >>= 1)
+            ++size;
+
+        put(dcCodes[table][size]);
+        if (size)
+            put({unsigned(diff < 0 ? diff - 1 : diff) & ((1u << size) - 1), size});
+        put(acCodes[table][0x00]); // EOB
+    }
+
+    void writeRestart(unsigned n)
+    {
+        flush();
+        data.push_back(0xff);
+        data.push_back(0xd0 + (n & 7));
+    }
+
+    void flush()
+    {
+        if (bits % 8)
+            put({(1u << (8 - bits % 8)) - 1, 8 - bits % 8});
+    }
+
+    ByteData data;
+
+private:
+    typedef std::pair<unsigned, unsigned> Code; // code, length
+
+    static void makeCodes(const uint8_t *counts, const uint8_t *values,
+        std::map<unsigned, Code>& codes)
+    {
+        unsigned code(0), k(0);
+        for (unsigned len(1); len <= 16; ++len, code <<= 1)
+            for (unsigned i(0); i < counts[len - 1]; ++i)
+                codes[values[k++]] = Code(code++, len);
+    }
+
+    void put(const Code& code)
+    {
+        for (unsigned i(code.second); i--;) {
+            acc = (acc << 1) | ((code.first >> i) & 1);
+            if (++bits % 8 == 0) {
+                data.push_back(acc & 0xff);
+                if ((acc & 0xff) == 0xff)
+                    data.push_back(0x00);
+            }
+        }
+    }
+
+    std::map<unsigned, Code> dcCodes[2];
+    std::map<unsigned, Code> acCodes[2];
+    unsigned acc;
+    unsigned bits;
+};
+
+class JPEGSoftwareDecodeRestartTest : public JPEGSoftwareDecodeTest
+{
+protected:
+    static const unsigned width = 1024;
+    static const unsigned height = 512;
+    static const unsigned interval = 3;
+    static const unsigned mcusPerRow = width / 16;
+    static const unsigned numMCUs = mcusPerRow * (height / 16);
+    static const unsigned numIntervals = (numMCUs + interval - 1) / interval;
+
+    virtual void SetUp()
+    {
+        pparam = defaultPictureParameter;
+        pparam.picture_width = width;
+        pparam.picture_height = height;
+        pparam.components[0].h_sampling_factor = 2;
+        pparam.components[0].v_sampling_factor = 2;
+
+        sparam = defaultSliceParameter;
+        sparam.restart_interval = interval;
+        sparam.num_mcus = numMCUs;
+
+        // a quantizer of 8 makes the pixels equal to the DC value + 128
+        iqmatrix = defaultIQMatrix;
+        for (unsigned i(0); i < 2; ++i)
+            for (unsigned j(0); j < 64; ++j)
+                iqmatrix.quantiser_table[i][j] = 8;
+
+        // 4 luma blocks and 2 chroma blocks per MCU
+        std::srand(1);
+        levels.resize(numMCUs * 6);
+        for (auto& level : levels)
+            level = std::rand() % 200 - 100;
+
+        ASSERT_NO_FAILURE(SetUpPlanes(pparam));
+    }
+
+    // Leaves out the data of @skipInterval, or its leading marker
+    ByteData Write(unsigned skipInterval = -1, bool skipMarker = false)
+    {
+        FlatBlockWriter writer(defaultHuffmanTable);
+        int pred[3] = {0, 0, 0};
+
+        for (unsigned mcu(0); mcu < numMCUs; ++mcu) {
+            const unsigned n(mcu / interval);
+            if (mcu && mcu % interval == 0) {
+                std::fill(pred, pred + 3, 0);
+                if (not skipMarker or n != skipInterval)
+                    writer.writeRestart(n - 1);
+            }
+
+            if (n == skipInterval and not skipMarker)
+                continue;
+
+            for (unsigned b(0); b < 6; ++b) {
+                const unsigned c(b < 4 ? 0 : b - 3);
+                const int level(levels[mcu * 6 + b]);
+                writer.writeBlock(c ? 1 : 0, level - pred[c]);
+                pred[c] = level;
+            }
+        }
+        writer.flush();
+
+        return writer.data;
+    }
+
+    // The top-left pixel of each block, -1 for the concealed intervals
+    void Verify(unsigned concealedInterval = -1)
+    {
+        for (unsigned mcu(0); mcu < numMCUs; ++mcu) {
+            const unsigned x(mcu % mcusPerRow), y(mcu / mcusPerRow);
+            for (unsigned b(0); b < 6; ++b) {
+                const unsigned c(b < 4 ? 0 : b - 3);
+                const unsigned bx(c ? x : x * 2 + b % 2);
+                const unsigned by(c ? y : y * 2 + b / 2);
+                const uint8_t *block = planes[c].data
+                    + by * 8 * planes[c].pitch + bx * 8;
+                const int expect(mcu / interval == concealedInterval ?
+                    128 : levels[mcu * 6 + b] + 128);
+
+                ASSERT_EQ(expect, block[0])
+                    << "MCU " << mcu << " block " << b;
+                ASSERT_EQ(expect, block[7 * planes[c].pitch + 7])
+                    << "MCU " << mcu << " block " << b;
+            }
+        }
+    }
+
+    PictureParameter    pparam;
+    SliceParameter      sparam;
+    IQMatrix            iqmatrix;
+    std::vector<int>    levels;
+};
+
+TEST_F(JPEGSoftwareDecodeRestartTest, Intact)
+{
+    const ByteData slice(Write());
+    sparam.slice_data_size = slice.size();
+
+    EXPECT_EQ(0, Decode(pparam, iqmatrix, defaultHuffmanTable, sparam, slice));
+    Verify();
+}
+
+TEST_F(JPEGSoftwareDecodeRestartTest, Threads)
+{
+    const ByteData slice(Write());
+    sparam.slice_data_size = slice.size();
+
+    EXPECT_EQ(0, Decode(pparam, iqmatrix, defaultHuffmanTable, sparam, slice,
+        I965_JPEG_SW_MAX_THREADS));
+    Verify();
+}
+
+// Only the interval without data is concealed
+TEST_F(JPEGSoftwareDecodeRestartTest, MissingData)
+{
+    const unsigned damaged(numIntervals / 2);
+    const ByteData slice(Write(damaged));
+    sparam.slice_data_size = slice.size();
+
+    EXPECT_EQ(1, Decode(pparam, iqmatrix, defaultHuffmanTable, sparam, slice,
+        I965_JPEG_SW_MAX_THREADS));
+    Verify(damaged);
+}
+
+// The intervals after a lost marker are found by the marker numbers
+TEST_F(JPEGSoftwareDecodeRestartTest, MissingMarker)
+{
+    const unsigned damaged(numIntervals / 3);
+    const ByteData slice(Write(damaged, true));
+    sparam.slice_data_size = slice.size();
+
+    EXPECT_EQ(1, Decode(pparam, iqmatrix, defaultHuffmanTable, sparam, slice,
+        I965_JPEG_SW_MAX_THREADS));
+    Verify(damaged);
+}
+
+TEST_F(JPEGSoftwareDecodeRestartTest, Truncated)
+{
+    ByteData slice(Write());
+    slice.resize(slice.size() / 2);
+    sparam.slice_data_size = slice.size();
+
+    EXPECT_LT(0, Decode(pparam, iqmatrix, defaultHuffmanTable, sparam, slice,
+        I965_JPEG_SW_MAX_THREADS));
+}
+
+TEST_F(JPEGSoftwareDecodeRestartTest, InvalidTableSelector)
+{
+    const ByteData slice(Write());
+    sparam.slice_data_size = slice.size();
+    sparam.components[1].dc_table_selector = 2;
+
+    EXPECT_EQ(-1, Decode(pparam, iqmatrix, defaultHuffmanTable, sparam, slice));
+}
+
+} // namespace Decode
+} // namespace JPEG
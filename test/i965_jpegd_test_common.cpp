@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_jpegd_test_common.h"
+
+namespace JPEG {
+namespace Decode {
+
+Surfaces PictureDecodeFixture::decodePicture(PictureData::SharedConst pd)
+{
+    VAConfigAttrib a = { type:VAConfigAttribRTFormat, value:pd->format };
+    ConfigAttribs attribs(1, a);
+
+    Surfaces surfaces = createSurfaces(
+        pd->pparam.picture_width, pd->pparam.picture_height, pd->format);
+    VAConfigID config = createConfig(
+        VAProfileJPEGBaseline, VAEntrypointVLD, attribs);
+    VAContextID context = createContext(
+        config, pd->pparam.picture_width, pd->pparam.picture_height, 0,
+        surfaces);
+
+    VABufferID buffers[] = {
+        createBuffer(context, VAPictureParameterBufferType,
+            sizeof(pd->pparam), 1, &pd->pparam),
+        createBuffer(context, VAIQMatrixBufferType,
+            sizeof(IQMatrix), 1, &pd->iqmatrix),
+        createBuffer(context, VAHuffmanTableBufferType,
+            sizeof(HuffmanTable), 1, &pd->huffman),
+        createBuffer(context, VASliceParameterBufferType,
+            sizeof(pd->sparam), 1, &pd->sparam),
+        createBuffer(context, VASliceDataBufferType,
+            pd->sparam.slice_data_size, 1, pd->slice.data()),
+    };
+
+    beginPicture(context, surfaces.front());
+    for (size_t i(0); i < sizeof(buffers) / sizeof(buffers[0]); ++i)
+        renderPicture(context, &buffers[i]);
+    endPicture(context);
+
+    for (size_t i(0); i < sizeof(buffers) / sizeof(buffers[0]); ++i)
+        destroyBuffer(buffers[i]);
+    destroyContext(context);
+    destroyConfig(config);
+
+    return surfaces;
+}
+
+} // namespace Decode
+} // namespace JPEG
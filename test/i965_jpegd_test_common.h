@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_JPEGD_TEST_COMMON_H
+#define I965_JPEGD_TEST_COMMON_H
+
+#include "i965_test_fixture.h"
+#include "i965_jpeg_test_data.h"
+
+namespace JPEG {
+namespace Decode {
+
+/**
+ * Test fixture for test cases which only need some JPEG picture decoded
+ * through the regular VA entry points, e.g. to look at what the driver
+ * does around the decode rather than at the decoded pixels.
+ */
+class PictureDecodeFixture
+    : public I965TestFixture
+{
+protected:
+    /**
+     * Decodes @pd into a new surface and returns it.  The config, context
+     * and buffers are destroyed again, the surface is neither synced nor
+     * destroyed.  May generate a non-fatal test assertion failure.
+     */
+    Surfaces decodePicture(PictureData::SharedConst pd);
+};
+
+} // namespace Decode
+} // namespace JPEG
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_jpegd_test_common.h"
+
+namespace MockBufmgr {
+
+using namespace JPEG::Decode;
+
+class MockBufmgrTest : public PictureDecodeFixture { };
+
+static void countExec(void *data, const uint32_t *batch, int used,
+    unsigned int flags)
+{
+    unsigned *count = static_cast<unsigned *>(data);
+
+    EXPECT_GT(used, 0);
+    ++*count;
+}
+
+TEST_F(MockBufmgrTest, JPEGDecode)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (not g_intel_mock_bufmgr or not HAS_JPEG_DECODING(i965)) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " needs VA_INTEL_MOCK_BUFMGR and JPEG decoding" << std::endl;
+        return;
+    }
+
+    TestPattern::SharedConst testPattern(new TestPatternData<1>);
+    PictureData::SharedConst pd = testPattern->encoded(VA_FOURCC_IMC3);
+    ASSERT_PTR(pd.get());
+
+    struct intel_mock_bufmgr_stats before, after;
+    unsigned callbacks(0);
+
+    intel_mock_bufmgr_get_stats(i965->intel.bufmgr, &before);
+    intel_mock_bufmgr_set_exec_callback(i965->intel.bufmgr, countExec,
+        &callbacks);
+
+    Surfaces surfaces = decodePicture(pd);
+    syncSurface(surfaces.front());
+    destroySurfaces(surfaces);
+
+    intel_mock_bufmgr_set_exec_callback(i965->intel.bufmgr, NULL, NULL);
+    intel_mock_bufmgr_get_stats(i965->intel.bufmgr, &after);
+
+    EXPECT_LT(before.num_execs, after.num_execs);
+    EXPECT_EQ(after.num_execs - before.num_execs, callbacks);
+    EXPECT_LT(before.num_relocs, after.num_relocs);
+    EXPECT_EQ(before.num_bos, after.num_bos);
+}
+
+} // namespace MockBufmgr
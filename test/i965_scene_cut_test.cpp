@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+#include "i965_internal_decl.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace AVC {
+namespace Encode {
+
+class SceneCutTest : public ::testing::Test
+{
+protected:
+    static const int width = 320;
+    static const int height = 240;
+
+    virtual void SetUp()
+    {
+        sceneCut = i965_scene_cut_new(width, height);
+        ASSERT_PTR(sceneCut);
+    }
+
+    virtual void TearDown()
+    {
+        i965_scene_cut_free(sceneCut);
+    }
+
+    // a smooth random texture, @seed selects the scene and @shift pans it
+    static std::vector<uint8_t> picture(unsigned seed, int shift = 0)
+    {
+        std::vector<uint8_t> luma(width * height);
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<double> frequency(0.02, 0.2), phase(0, 6.28);
+        double fx[4], fy[4], p[4];
+
+        for (int i(0); i < 4; ++i) {
+            fx[i] = frequency(rng);
+            fy[i] = frequency(rng);
+            p[i] = phase(rng);
+        }
+
+        for (int y(0); y < height; ++y) {
+            for (int x(0); x < width; ++x) {
+                double v(128);
+
+                for (int i(0); i < 4; ++i)
+                    v += 28 * std::sin(fx[i] * (x + shift) + fy[i] * y + p[i]);
+
+                luma[y * width + x] = uint8_t(v) + rng() % 8;
+            }
+        }
+
+        return luma;
+    }
+
+    int detect(const std::vector<uint8_t>& luma, bool isIntra = false)
+    {
+        return i965_scene_cut_detect(sceneCut, luma.data(), width, isIntra);
+    }
+
+    // averages each 4x4 block, as the GPU scaling of the encoder does
+    int detectScaled(const std::vector<uint8_t>& luma, bool isIntra = false)
+    {
+        const int pitch(width / 4 + 8);
+        std::vector<uint8_t> samples(pitch * height / 4);
+
+        for (int y(0); y < height / 4; ++y) {
+            for (int x(0); x < width / 4; ++x) {
+                int sum(8);
+
+                for (int i(0); i < 4; ++i)
+                    for (int j(0); j < 4; ++j)
+                        sum += luma[(y * 4 + i) * width + x * 4 + j];
+
+                samples[y * pitch + x] = sum / 16;
+            }
+        }
+
+        return i965_scene_cut_detect_scaled(sceneCut, samples.data(), pitch,
+            isIntra);
+    }
+
+    i965_scene_cut *sceneCut;
+};
+
+TEST_F(SceneCutTest, StaticScene)
+{
+    const std::vector<uint8_t> luma(picture(1));
+
+    EXPECT_EQ(0, detect(luma, true));
+
+    for (unsigned i(0); i < 30; ++i)
+        EXPECT_EQ(0, detect(luma)) << i;
+}
+
+TEST_F(SceneCutTest, Pan)
+{
+    EXPECT_EQ(0, detect(picture(1), true));
+
+    for (int i(1); i < 30; ++i)
+        EXPECT_EQ(0, detect(picture(1, (i % 5) * 2 - 4))) << i;
+}
+
+TEST_F(SceneCutTest, Cut)
+{
+    EXPECT_EQ(0, detect(picture(1), true));
+
+    for (unsigned i(1); i < 20; ++i)
+        EXPECT_EQ(0, detect(picture(1))) << i;
+
+    EXPECT_EQ(1, detect(picture(2)));
+
+    // the new scene is referenced from the promoted picture
+    for (unsigned i(0); i < 20; ++i)
+        EXPECT_EQ(0, detect(picture(2))) << i;
+}
+
+TEST_F(SceneCutTest, Scaled)
+{
+    EXPECT_EQ(0, detectScaled(picture(1), true));
+
+    for (int i(1); i < 20; ++i)
+        EXPECT_EQ(0, detectScaled(picture(1, (i % 5) * 2 - 4))) << i;
+
+    EXPECT_EQ(1, detectScaled(picture(2)));
+    EXPECT_EQ(0, detectScaled(picture(2)));
+}
+
+TEST_F(SceneCutTest, MinDistance)
+{
+    EXPECT_EQ(0, detect(picture(1), true));
+
+    // too close to the I picture of the application
+    for (int i(1); i < I965_SCENE_CUT_MIN_DISTANCE; ++i)
+        EXPECT_EQ(0, detect(picture(i + 1))) << i;
+
+    EXPECT_EQ(1, detect(picture(100)));
+
+    // and to the promoted one
+    EXPECT_EQ(0, detect(picture(101)));
+}
+
+TEST_F(SceneCutTest, ApplicationIntra)
+{
+    EXPECT_EQ(0, detect(picture(1), true));
+
+    for (unsigned i(1); i < 20; ++i)
+        EXPECT_EQ(0, detect(picture(1))) << i;
+
+    // the application codes the cut as an I picture already
+    EXPECT_EQ(0, detect(picture(2), true));
+    EXPECT_EQ(0, detect(picture(2)));
+}
+
+TEST_F(SceneCutTest, FlatPictures)
+{
+    std::vector<uint8_t> luma(width * height, 16);
+
+    EXPECT_EQ(0, detect(luma, true));
+
+    for (unsigned i(1); i < 20; ++i)
+        EXPECT_EQ(0, detect(luma)) << i;
+
+    // a fade to another flat picture has no structure to code
+    std::fill(luma.begin(), luma.end(), 200);
+    EXPECT_EQ(0, detect(luma));
+}
+
+} // namespace Encode
+} // namespace AVC
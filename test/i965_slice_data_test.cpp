@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_test_fixture.h"
+
+#include <vector>
+
+namespace SliceData {
+
+/* What the MPEG-2 decode batches tell about the slice data setup */
+struct BatchInfo
+{
+    unsigned numIndObjBaseAddrStates;
+    std::vector<uint32_t> bsdDataOffsets;
+};
+
+static void inspectBatch(void *data, const uint32_t *batch, int used,
+    unsigned int flags)
+{
+    BatchInfo *info = static_cast<BatchInfo *>(data);
+
+    for (int i(0); i < used / 4; ) {
+        const uint32_t header(batch[i]);
+        int length;
+
+        if (header == MI_BATCH_BUFFER_END)
+            break;
+
+        if ((header >> 29) == 0) {
+            // MI commands below 0x10 have no length field
+            length = ((header >> 23) & 0x3f) < 0x10 ? 1 : (header & 0xff) + 2;
+        } else {
+            length = (header & 0xfff) + 2;
+
+            if ((header & 0xffff0000) == MFX_IND_OBJ_BASE_ADDR_STATE)
+                ++info->numIndObjBaseAddrStates;
+            else if ((header & 0xffff0000) == MFD_MPEG2_BSD_OBJECT)
+                info->bsdDataOffsets.push_back(batch[i + 2]);
+        }
+
+        i += length;
+    }
+}
+
+class CoalesceTest : public I965TestFixture
+{
+protected:
+    /* Decodes a two slice MPEG-2 picture, one slice data buffer each */
+    BatchInfo decode(bool coalesce)
+    {
+        struct i965_driver_data *i965(*this);
+        BatchInfo info = { 0, std::vector<uint32_t>() };
+        int saved(i965->coalesce_slice_data);
+
+        VAPictureParameterBufferMPEG2 pparam;
+        memset(&pparam, 0, sizeof(pparam));
+        pparam.horizontal_size = 64;
+        pparam.vertical_size = 32;
+        pparam.forward_reference_picture = VA_INVALID_SURFACE;
+        pparam.backward_reference_picture = VA_INVALID_SURFACE;
+        pparam.picture_coding_type = 1; // I
+        pparam.f_code = 0xffff;
+        pparam.picture_coding_extension.bits.picture_structure = 3;
+        pparam.picture_coding_extension.bits.top_field_first = 1;
+        pparam.picture_coding_extension.bits.frame_pred_frame_dct = 1;
+        pparam.picture_coding_extension.bits.progressive_frame = 1;
+        pparam.picture_coding_extension.bits.is_first_field = 1;
+
+        VASliceParameterBufferMPEG2 sparams[2];
+        std::vector<uint8_t> slices[2] = {
+            std::vector<uint8_t>(100, 0x55),
+            std::vector<uint8_t>(60, 0xaa),
+        };
+
+        for (unsigned i(0); i < 2; ++i) {
+            memset(&sparams[i], 0, sizeof(sparams[i]));
+            sparams[i].slice_data_size = slices[i].size();
+            sparams[i].slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+            sparams[i].slice_vertical_position = i;
+            sparams[i].quantiser_scale_code = 1;
+            sparams[i].intra_slice_flag = 1;
+        }
+
+        Surfaces surfaces = createSurfaces(64, 32, VA_RT_FORMAT_YUV420);
+        VAConfigID config = createConfig(VAProfileMPEG2Main, VAEntrypointVLD);
+        VAContextID context = createContext(config, 64, 32, 0, surfaces);
+
+        Buffers buffers;
+        buffers.push_back(createBuffer(context, VAPictureParameterBufferType,
+            sizeof(pparam), 1, &pparam));
+        for (unsigned i(0); i < 2; ++i) {
+            buffers.push_back(createBuffer(context, VASliceParameterBufferType,
+                sizeof(sparams[i]), 1, &sparams[i]));
+            buffers.push_back(createBuffer(context, VASliceDataBufferType,
+                slices[i].size(), 1, slices[i].data()));
+        }
+
+        i965->coalesce_slice_data = coalesce;
+        intel_mock_bufmgr_set_exec_callback(i965->intel.bufmgr, inspectBatch,
+            &info);
+
+        beginPicture(context, surfaces.front());
+        for (size_t i(0); i < buffers.size(); ++i)
+            renderPicture(context, &buffers[i]);
+        endPicture(context);
+        syncSurface(surfaces.front());
+
+        intel_mock_bufmgr_set_exec_callback(i965->intel.bufmgr, NULL, NULL);
+        i965->coalesce_slice_data = saved;
+
+        for (size_t i(0); i < buffers.size(); ++i)
+            destroyBuffer(buffers[i]);
+        destroyContext(context);
+        destroyConfig(config);
+        destroySurfaces(surfaces);
+
+        return info;
+    }
+};
+
+TEST_F(CoalesceTest, MPEG2)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (not g_intel_mock_bufmgr or not HAS_MPEG2_DECODING(i965) or
+        not (IS_GEN8(i965->intel.device_info) or
+             IS_GEN9(i965->intel.device_info))) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " needs VA_INTEL_MOCK_BUFMGR and Gen8+ MPEG-2 decoding"
+            << std::endl;
+        return;
+    }
+
+    // one indirect object base per slice data buffer, in place
+    BatchInfo separate = decode(false);
+    EXPECT_EQ(2u, separate.numIndObjBaseAddrStates);
+    ASSERT_EQ(2u, separate.bsdDataOffsets.size());
+    EXPECT_EQ(0u, separate.bsdDataOffsets[0]);
+    EXPECT_EQ(0u, separate.bsdDataOffsets[1]);
+
+    // a single one, the second slice moved behind the first
+    BatchInfo coalesced = decode(true);
+    EXPECT_EQ(1u, coalesced.numIndObjBaseAddrStates);
+    ASSERT_EQ(2u, coalesced.bsdDataOffsets.size());
+    EXPECT_EQ(0u, coalesced.bsdDataOffsets[0]);
+    EXPECT_LE(100u, coalesced.bsdDataOffsets[1]);
+    EXPECT_EQ(0u, coalesced.bsdDataOffsets[1] % 64);
+}
+
+} // namespace SliceData
@@ -54,7 +54,11 @@ void I965TestEnvironment::SetUp()
     ASSERT_EQ(-1, m_handle);
     ASSERT_PTR_NULL(m_vaDisplay);
 
-    m_handle = open("/dev/dri/renderD128", O_RDWR);
+    /* The mock buffer manager does not need a DRM device */
+    if (std::getenv("VA_INTEL_MOCK_BUFMGR"))
+        m_handle = open("/dev/null", O_RDWR);
+    else
+        m_handle = open("/dev/dri/renderD128", O_RDWR);
     if (m_handle < 0)
         m_handle = open("/dev/dri/card0", O_RDWR);
 
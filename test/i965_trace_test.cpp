@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_jpegd_test_common.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <vector>
+
+namespace Trace {
+
+using namespace JPEG::Decode;
+
+class TraceTest : public PictureDecodeFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        PictureDecodeFixture::SetUp();
+
+        char name[] = "/tmp/i965_trace_test.XXXXXX";
+        int fd = mkstemp(name);
+
+        ASSERT_NE(-1, fd);
+        close(fd);
+        filename = name;
+    }
+
+    virtual void TearDown()
+    {
+        if (not filename.empty())
+            unlink(filename.c_str());
+
+        PictureDecodeFixture::TearDown();
+    }
+
+    /* Writes a trace holding one record of @type, @size is what the
+     * record header claims, only @words are written as the payload */
+    void writeRecord(uint32_t type, uint32_t size,
+        const std::vector<uint32_t>& words)
+    {
+        struct i965_trace_header header = {
+            magic:I965_TRACE_MAGIC, version:I965_TRACE_VERSION };
+        struct i965_trace_record record = { type:type, size:size };
+
+        FILE *fp = fopen(filename.c_str(), "wb");
+        ASSERT_PTR(fp);
+        EXPECT_EQ(1u, fwrite(&header, sizeof(header), 1, fp));
+        EXPECT_EQ(1u, fwrite(&record, sizeof(record), 1, fp));
+        if (not words.empty()) {
+            EXPECT_EQ(words.size(),
+                fwrite(&words[0], sizeof(uint32_t), words.size(), fp));
+        }
+        fclose(fp);
+    }
+
+    std::string filename;
+};
+
+TEST_F(TraceTest, RecordAndReplayJPEG)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (not HAS_JPEG_DECODING(i965)) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is unsupported on this hardware" << std::endl;
+        return;
+    }
+
+    TestPattern::SharedConst testPattern(new TestPatternData<1>);
+    PictureData::SharedConst pd = testPattern->encoded(VA_FOURCC_IMC3);
+    ASSERT_PTR(pd.get());
+
+    struct i965_trace *saved = i965->trace;
+    i965->trace = i965_trace_open(filename.c_str());
+    ASSERT_PTR(i965->trace);
+
+    Surfaces surfaces = decodePicture(pd);
+    syncSurface(surfaces.front());
+    destroySurfaces(surfaces);
+
+    i965_trace_close(i965->trace);
+    i965->trace = saved;
+
+    struct i965_trace_replay_stats stats;
+    EXPECT_STATUS(i965_trace_replay(*this, filename.c_str(), &stats));
+    EXPECT_EQ(1u, stats.num_pictures);
+    EXPECT_EQ(5u, stats.num_buffers);
+}
+
+TEST_F(TraceTest, ReplayRejectsGarbage)
+{
+    FILE *fp = fopen(filename.c_str(), "wb");
+    ASSERT_PTR(fp);
+    fputs("not a trace", fp);
+    fclose(fp);
+
+    EXPECT_STATUS_EQ(VA_STATUS_ERROR_INVALID_PARAMETER,
+        i965_trace_replay(*this, filename.c_str(), NULL));
+}
+
+TEST_F(TraceTest, ReplayRejectsTruncatedRecord)
+{
+    // the payload is not allocated for a size the file can not hold
+    writeRecord(I965_TRACE_END_PICTURE, 0xffffffff, std::vector<uint32_t>(1));
+
+    EXPECT_STATUS_EQ(VA_STATUS_ERROR_INVALID_PARAMETER,
+        i965_trace_replay(*this, filename.c_str(), NULL));
+}
+
+TEST_F(TraceTest, ReplayRejectsBadCounts)
+{
+    // format, width, height, fourcc, then 0x40000000 surfaces without IDs
+    std::vector<uint32_t> words(5);
+    words[0] = VA_RT_FORMAT_YUV420;
+    words[1] = 64;
+    words[2] = 64;
+    words[4] = 0x40000000;
+
+    writeRecord(I965_TRACE_CREATE_SURFACES,
+        words.size() * sizeof(uint32_t), words);
+    EXPECT_STATUS_EQ(VA_STATUS_ERROR_INVALID_PARAMETER,
+        i965_trace_replay(*this, filename.c_str(), NULL));
+
+    // profile, entrypoint, config and 0x40000000 attributes
+    words.resize(4);
+    words[3] = 0x40000000;
+
+    writeRecord(I965_TRACE_CREATE_CONFIG,
+        words.size() * sizeof(uint32_t), words);
+    EXPECT_STATUS_EQ(VA_STATUS_ERROR_INVALID_PARAMETER,
+        i965_trace_replay(*this, filename.c_str(), NULL));
+}
+
+} // namespace Trace
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test.h"
+#include "i965_internal_decl.h"
+
+#include <cstring>
+#include <random>
+
+namespace AVC {
+namespace Encode {
+namespace VDEnc {
+
+// The BRC update DMEM as it was filled before it was split into a static and
+// a per-frame part. It rewrote every field of the mapped buffer each frame.
+namespace Reference {
+
+static const uint16_t start_global_adjust_frame[4] = { 10, 50, 100, 150 };
+static const uint8_t global_rate_ratio_threshold[7] = { 80, 90, 95, 101, 105, 115, 130};
+static const uint8_t start_global_adjust_mult[5] = { 1, 1, 3, 2, 1 };
+static const uint8_t start_global_adjust_div[5] = { 40, 5, 5, 3, 1 };
+static const int8_t global_rate_ratio_threshold_qp[8] = { -3, -2, -1, 0, 1, 1, 2, 3 };
+
+void updateDMEM(gen9_vdenc_context *vdenc_context, huc_brc_update_dmem *dmem)
+{
+    int num_p_in_gop(0);
+
+    dmem->brc_func = 1;
+
+    if (vdenc_context->brc_initted && (vdenc_context->current_pass == 0)) {
+        vdenc_context->brc_init_previous_target_buf_full_in_bits =
+            (uint32_t)(vdenc_context->brc_init_current_target_buf_full_in_bits);
+        vdenc_context->brc_init_current_target_buf_full_in_bits += vdenc_context->brc_init_reset_input_bits_per_frame;
+        vdenc_context->brc_target_size += vdenc_context->brc_init_reset_input_bits_per_frame;
+    }
+
+    if (vdenc_context->brc_target_size > vdenc_context->vbv_buffer_size_in_bit)
+        vdenc_context->brc_target_size -= vdenc_context->vbv_buffer_size_in_bit;
+
+    dmem->target_size = vdenc_context->brc_target_size;
+    dmem->peak_tx_bits_per_frame = (uint32_t)(vdenc_context->brc_init_current_target_buf_full_in_bits - vdenc_context->brc_init_previous_target_buf_full_in_bits);
+    dmem->target_slice_size = 0;
+
+    std::memcpy(dmem->start_global_adjust_frame, start_global_adjust_frame, sizeof(dmem->start_global_adjust_frame));
+    std::memcpy(dmem->global_rate_ratio_threshold, global_rate_ratio_threshold, sizeof(dmem->global_rate_ratio_threshold));
+
+    dmem->current_frame_type = (vdenc_context->frame_type + 2) % 3;
+
+    std::memcpy(dmem->start_global_adjust_mult, start_global_adjust_mult, sizeof(dmem->start_global_adjust_mult));
+    std::memcpy(dmem->start_global_adjust_div, start_global_adjust_div, sizeof(dmem->start_global_adjust_div));
+    std::memcpy(dmem->global_rate_ratio_threshold_qp, global_rate_ratio_threshold_qp, sizeof(dmem->global_rate_ratio_threshold_qp));
+
+    dmem->current_pak_pass = vdenc_context->current_pass;
+    dmem->max_num_passes = 2;
+
+    dmem->scene_change_detect_enable = 1;
+    dmem->scene_change_prev_intra_percent_threshold = 96;
+    dmem->scene_change_cur_intra_perent_threshold = 192;
+
+    if (vdenc_context->ref_dist && vdenc_context->gop_size > 0)
+        num_p_in_gop = (vdenc_context->gop_size - 1) / vdenc_context->ref_dist;
+
+    for (unsigned i(0); i < 2; ++i)
+        dmem->scene_change_width[i] = std::min((num_p_in_gop + 1) / 5, 6);
+
+    dmem->ip_average_coeff = vdenc_context->is_low_delay ? 0 : 128;
+
+    dmem->skip_frame_size = 0;
+    dmem->num_of_frames_skipped = 0;
+
+    dmem->roi_source = 0;
+    dmem->hme_detection_enable = 0;
+    dmem->hme_cost_enable = 1;
+
+    dmem->second_level_batchbuffer_size = 228;
+}
+
+} // namespace Reference
+
+static void resetBRC(gen9_vdenc_context *vdenc_context, unsigned gop_size)
+{
+    vdenc_context->gop_size = gop_size;
+    vdenc_context->ref_dist = 1;
+    vdenc_context->vbv_buffer_size_in_bit = 4000000;
+    vdenc_context->brc_init_reset_input_bits_per_frame = 4000000 / 30.;
+    vdenc_context->brc_init_current_target_buf_full_in_bits = 0;
+    vdenc_context->brc_init_previous_target_buf_full_in_bits = 0;
+    vdenc_context->brc_target_size = 2000000;
+}
+
+TEST(VDEncBRCUpdateDMEMTest, ByteIdentical)
+{
+    gen9_vdenc_context *reference = static_cast<gen9_vdenc_context *>(
+        calloc(1, sizeof(gen9_vdenc_context)));
+    gen9_vdenc_context *vdenc = static_cast<gen9_vdenc_context *>(
+        calloc(1, sizeof(gen9_vdenc_context)));
+
+    ASSERT_PTR(reference);
+    ASSERT_PTR(vdenc);
+
+    // what the GPU sees in brc_update_dmem_res[] for both implementations
+    huc_brc_update_dmem referenceBuffer[NUM_OF_BRC_PAK_PASSES];
+    huc_brc_update_dmem buffer[NUM_OF_BRC_PAK_PASSES];
+    std::memset(referenceBuffer, 0, sizeof(referenceBuffer));
+    std::memset(buffer, 0, sizeof(buffer));
+
+    const int numDwords(sizeof(huc_brc_update_dmem) / sizeof(uint32_t));
+    int dw_index[numDwords];
+    std::mt19937 rng(38);
+
+    for (unsigned frame(0); frame < 120; ++frame) {
+        // a BRC reset with a new GOP in the middle of the sequence
+        const bool reset(frame == 0 or frame == 57);
+        const unsigned gop_size(frame < 57 ? 30 : 60);
+
+        if (reset) {
+            resetBRC(reference, gop_size);
+            resetBRC(vdenc, gop_size);
+            vdenc->brc_update_dmem_valid = 0;
+        }
+
+        reference->frame_type = vdenc->frame_type =
+            (frame % gop_size) ? VDENC_FRAME_P : VDENC_FRAME_I;
+
+        for (unsigned pass(0); pass < NUM_OF_BRC_PAK_PASSES; ++pass) {
+            reference->current_pass = vdenc->current_pass = pass;
+
+            Reference::updateDMEM(reference, &referenceBuffer[pass]);
+
+            huc_brc_update_dmem *uploaded = &vdenc->brc_update_dmem[pass];
+            if (!(vdenc->brc_update_dmem_valid & (1 << pass))) {
+                gen9_vdenc_init_huc_brc_update_dmem(vdenc, uploaded, pass);
+                gen9_vdenc_update_huc_brc_update_dmem(vdenc, uploaded);
+                uploaded->frame_byte_count = buffer[pass].frame_byte_count;
+                uploaded->slice_size_violation = buffer[pass].slice_size_violation;
+                buffer[pass] = *uploaded;
+                vdenc->brc_update_dmem_valid |= 1 << pass;
+            } else {
+                huc_brc_update_dmem dmem(*uploaded);
+                gen9_vdenc_update_huc_brc_update_dmem(vdenc, &dmem);
+
+                const int n = gen9_vdenc_sync_huc_brc_update_dmem(uploaded,
+                    &dmem, dw_index);
+
+                // target size, peak bits and frame type at most
+                EXPECT_LE(n, 3) << "frame " << frame << " pass " << pass;
+
+                for (int i(0); i < n; ++i)
+                    reinterpret_cast<uint32_t *>(&buffer[pass])[dw_index[i]] =
+                        reinterpret_cast<uint32_t *>(uploaded)[dw_index[i]];
+            }
+
+            ASSERT_EQ(0, std::memcmp(&referenceBuffer[pass], &buffer[pass],
+                sizeof(huc_brc_update_dmem)))
+                << "frame " << frame << " pass " << pass;
+
+            reference->brc_initted = vdenc->brc_initted = 1;
+        }
+
+        // the frame status stored by the batch into every DMEM buffer
+        const uint32_t byteCount(rng()), status(rng());
+        for (unsigned pass(0); pass < NUM_OF_BRC_PAK_PASSES; ++pass) {
+            referenceBuffer[pass].frame_byte_count = byteCount;
+            referenceBuffer[pass].slice_size_violation = status;
+            buffer[pass].frame_byte_count = byteCount;
+            buffer[pass].slice_size_violation = status;
+        }
+    }
+
+    EXPECT_EQ(reference->brc_target_size, vdenc->brc_target_size);
+
+    free(reference);
+    free(vdenc);
+}
+
+} // namespace VDEnc
+} // namespace Encode
+} // namespace AVC
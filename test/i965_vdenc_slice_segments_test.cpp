@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+#include "i965_internal_decl.h"
+
+#include <cstring>
+#include <vector>
+
+namespace AVC {
+namespace Encode {
+namespace VDEnc {
+
+class VDEncSliceSegmentsTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        std::memset(&status, 0, sizeof(status));
+        std::memset(&segment, 0, sizeof(segment));
+        segment.buf = data;
+    }
+
+    std::vector<VACodedBufferSegment *> segments()
+    {
+        std::vector<VACodedBufferSegment *> result;
+
+        for (VACodedBufferSegment *s(&segment); s;
+            s = static_cast<VACodedBufferSegment *>(s->next))
+            result.push_back(s);
+
+        return result;
+    }
+
+    gen9_vdenc_status status;
+    VACodedBufferSegment segment;
+    unsigned char data[4096];
+};
+
+TEST_F(VDEncSliceSegmentsTest, NothingDone)
+{
+    status.num_slices = 4;
+
+    EXPECT_EQ(1, gen9_vdenc_chain_slice_segments(&segment, &status));
+    ASSERT_EQ(1u, segments().size());
+    EXPECT_EQ(0u, segment.size);
+    EXPECT_EQ(data, segment.buf);
+}
+
+TEST_F(VDEncSliceSegmentsTest, Partial)
+{
+    status.num_slices = 4;
+    status.num_slices_done = 2;
+    status.slice_end_offset[0] = 1000;
+    status.slice_end_offset[1] = 1500;
+
+    EXPECT_EQ(2, gen9_vdenc_chain_slice_segments(&segment, &status));
+
+    const std::vector<VACodedBufferSegment *> s(segments());
+    ASSERT_EQ(2u, s.size());
+    EXPECT_EQ(data, s[0]->buf);
+    EXPECT_EQ(1000u, s[0]->size);
+    EXPECT_EQ(data + 1000, s[1]->buf);
+    EXPECT_EQ(500u, s[1]->size);
+}
+
+TEST_F(VDEncSliceSegmentsTest, Complete)
+{
+    const uint32_t ends[] = { 100, 100, 2000, 2500 };
+
+    status.num_slices = 4;
+    status.num_slices_done = 4;
+    std::memcpy(status.slice_end_offset, ends, sizeof(ends));
+
+    // remapping a complete frame gives the same list
+    for (unsigned map(0); map < 2; ++map) {
+        EXPECT_EQ(4, gen9_vdenc_chain_slice_segments(&segment, &status));
+
+        const std::vector<VACodedBufferSegment *> s(segments());
+        ASSERT_EQ(4u, s.size());
+
+        uint32_t start(0);
+        for (unsigned i(0); i < s.size(); ++i) {
+            EXPECT_EQ(data + start, s[i]->buf) << i;
+            EXPECT_EQ(ends[i] - start, s[i]->size) << i;
+            EXPECT_EQ(0u, s[i]->status) << i;
+            start = ends[i];
+        }
+    }
+}
+
+} // namespace VDEnc
+} // namespace Encode
+} // namespace AVC
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "i965_test_fixture.h"
+
+#include <vector>
+
+namespace VP9Prob {
+
+class ProbabilityReadbackTest : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+
+        surfaces = createSurfaces(64, 64, VA_RT_FORMAT_YUV420, 2);
+        config = createConfig(VAProfileVP9Profile0, VAEntrypointVLD);
+        context = createContext(config, 64, 64, 0, surfaces);
+    }
+
+    virtual void TearDown()
+    {
+        destroyContext(context);
+        destroyConfig(config);
+        destroySurfaces(surfaces);
+
+        I965TestFixture::TearDown();
+    }
+
+    struct gen9_hcpd_context *hcpdContext()
+    {
+        struct i965_driver_data *i965(*this);
+        struct object_context *obj_context = CONTEXT(context);
+
+        if (not obj_context or obj_context->wrapper_context != VA_INVALID_ID)
+            return NULL;
+
+        return reinterpret_cast<struct gen9_hcpd_context *>(
+            obj_context->hw_context);
+    }
+
+    /* Decodes a frame parallel picture refreshing frame context 0 */
+    void decode(VASurfaceID surface, bool key_frame)
+    {
+        VADecPictureParameterBufferVP9 pparam;
+        memset(&pparam, 0, sizeof(pparam));
+        pparam.frame_width = 64;
+        pparam.frame_height = 64;
+        for (size_t i(0); i < 8; ++i)
+            pparam.reference_frames[i] = VA_INVALID_SURFACE;
+        pparam.pic_fields.bits.frame_type = key_frame ? 0 : 1;
+        pparam.pic_fields.bits.show_frame = 1;
+        pparam.pic_fields.bits.refresh_frame_context = 1;
+        pparam.pic_fields.bits.frame_parallel_decoding_mode = 1;
+        pparam.frame_header_length_in_bytes = 16;
+        pparam.first_partition_size = 16;
+
+        std::vector<uint8_t> slice(64, 0x55);
+        VASliceParameterBufferVP9 sparam;
+        memset(&sparam, 0, sizeof(sparam));
+        sparam.slice_data_size = slice.size();
+        sparam.slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+
+        Buffers buffers;
+        buffers.push_back(createBuffer(context, VAPictureParameterBufferType,
+            sizeof(pparam), 1, &pparam));
+        buffers.push_back(createBuffer(context, VASliceParameterBufferType,
+            sizeof(sparam), 1, &sparam));
+        buffers.push_back(createBuffer(context, VASliceDataBufferType,
+            slice.size(), 1, slice.data()));
+
+        beginPicture(context, surface);
+        for (size_t i(0); i < buffers.size(); ++i)
+            renderPicture(context, &buffers[i]);
+        endPicture(context);
+        syncSurface(surface);
+
+        for (size_t i(0); i < buffers.size(); ++i)
+            destroyBuffer(buffers[i]);
+    }
+
+    Surfaces surfaces;
+    VAConfigID config;
+    VAContextID context;
+};
+
+TEST_F(ProbabilityReadbackTest, FrameParallelRefresh)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (not g_intel_mock_bufmgr or not HAS_VP9_DECODING(i965) or
+        not IS_GEN9(i965->intel.device_info) or not hcpdContext()) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " needs VA_INTEL_MOCK_BUFMGR and Gen9 VP9 decoding"
+            << std::endl;
+        return;
+    }
+
+    struct gen9_hcpd_context *hcpd(hcpdContext());
+
+    // no backward adaptation, the context is still read back
+    decode(surfaces.front(), true);
+    EXPECT_TRUE(hcpd->vp9_prob_readback_pending);
+
+    VP9_PROB_BUFFER *prob_buffer =
+        &hcpd->vp9_prob_buffers[hcpd->vp9_prob_buffer_index];
+    EXPECT_EQ(-1, prob_buffer->frame_context_idx);
+
+    // what the HW wrote back
+    const std::vector<uint8_t> expected(16, 0x42);
+    EXPECT_EQ(0, dri_bo_subdata(prob_buffer->bo, 0, expected.size(),
+        expected.data()));
+
+    const unsigned serial(hcpd->vp9_frame_ctx_serial[0]);
+
+    // the inter frame starts from the read back context
+    decode(surfaces.back(), false);
+    EXPECT_NE(serial, hcpd->vp9_frame_ctx_serial[0]);
+
+    const uint8_t *fc = reinterpret_cast<const uint8_t *>(&hcpd->vp9_frame_ctx[0]);
+    EXPECT_EQ(expected, std::vector<uint8_t>(fc, fc + 16));
+
+    EXPECT_TRUE(hcpd->vp9_prob_readback_pending);
+    EXPECT_EQ(-1,
+        hcpd->vp9_prob_buffers[hcpd->vp9_prob_buffer_index].frame_context_idx);
+}
+
+} // namespace VP9Prob
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+#include "i965_internal_decl.h"
+
+#include <cstring>
+
+namespace VPP {
+
+class AVSCoefficientsTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        std::memset(&config, 0, sizeof(config));
+        config.coeff_frac_bits = 6;
+        config.coeff_epsilon = 1.0f / (1U << 6);
+        config.num_phases = 16;
+        config.num_luma_coeffs = 8;
+        config.num_chroma_coeffs = 4;
+
+        for (int i = 0; i < AVS_MAX_LUMA_COEFFS; i++) {
+            config.coeff_range.lower_bound.y_k_h[i] = -2;
+            config.coeff_range.lower_bound.y_k_v[i] = -2;
+            config.coeff_range.upper_bound.y_k_h[i] = 2;
+            config.coeff_range.upper_bound.y_k_v[i] = 2;
+        }
+
+        for (int i = 0; i < AVS_MAX_CHROMA_COEFFS; i++) {
+            const float bound = (i == 0 || i == 3) ? 1 : 2;
+            config.coeff_range.lower_bound.uv_k_h[i] = -bound;
+            config.coeff_range.lower_bound.uv_k_v[i] = -bound;
+            config.coeff_range.upper_bound.uv_k_h[i] = bound;
+            config.coeff_range.upper_bound.uv_k_v[i] = bound;
+        }
+
+        avs_init_state(&avs, &config);
+    }
+
+    // compares the current coefficients of avs with freshly generated ones
+    void expectGenerated(float sx, float sy)
+    {
+        AVSState fresh;
+
+        avs_init_state(&fresh, &config);
+        ASSERT_TRUE(avs_update_coefficients(&fresh, sx, sy, VA_FILTER_SCALING_HQ));
+        EXPECT_EQ(0, std::memcmp(fresh.coeffs, avs.coeffs,
+            (config.num_phases + 1) * sizeof(AVSCoeffs)));
+    }
+
+    AVSConfig config;
+    AVSState avs;
+};
+
+TEST_F(AVSCoefficientsTest, PrepareKeepsCurrent)
+{
+    ASSERT_TRUE(avs_update_coefficients(&avs, 0.5f, 0.5f, VA_FILTER_SCALING_HQ));
+    ASSERT_TRUE(avs_prepare_coefficients(&avs, 0.25f, 0.25f, VA_FILTER_SCALING_HQ));
+
+    EXPECT_EQ(2, avs.num_cached);
+    EXPECT_EQ(0.5f, avs.scale_x);
+    expectGenerated(0.5f, 0.5f);
+}
+
+TEST_F(AVSCoefficientsTest, UpdateFromCache)
+{
+    const float ratios[] = { 0.75f, 0.5f, 0.375f, 0.25f };
+
+    for (float ratio : ratios)
+        ASSERT_TRUE(avs_prepare_coefficients(&avs, ratio, ratio, VA_FILTER_SCALING_HQ));
+
+    EXPECT_EQ(4, avs.num_cached);
+
+    // alternating between the prepared ratios doesn't generate anything new
+    for (int i = 0; i < 3; i++) {
+        for (float ratio : ratios) {
+            ASSERT_TRUE(avs_update_coefficients(&avs, ratio, ratio, VA_FILTER_SCALING_HQ));
+            expectGenerated(ratio, ratio);
+        }
+    }
+
+    EXPECT_EQ(4, avs.num_cached);
+}
+
+TEST_F(AVSCoefficientsTest, Eviction)
+{
+    for (int i = 0; i < AVS_CACHE_SIZE + 2; i++) {
+        const float ratio = 1.0f / (i + 2);
+        ASSERT_TRUE(avs_update_coefficients(&avs, ratio, ratio, VA_FILTER_SCALING_HQ));
+        expectGenerated(ratio, ratio);
+    }
+
+    EXPECT_EQ(AVS_CACHE_SIZE, avs.num_cached);
+
+    // the two oldest entries were replaced
+    for (int i = 0; i < AVS_CACHE_SIZE; i++)
+        EXPECT_NE(0.5f, avs.cache[i].scale_x);
+
+    ASSERT_TRUE(avs_update_coefficients(&avs, 0.5f, 0.5f, VA_FILTER_SCALING_HQ));
+    expectGenerated(0.5f, 0.5f);
+}
+
+TEST_F(AVSCoefficientsTest, DefaultQualityNotCached)
+{
+    ASSERT_TRUE(avs_prepare_coefficients(&avs, 0.5f, 0.5f, VA_FILTER_SCALING_DEFAULT));
+    ASSERT_TRUE(avs_update_coefficients(&avs, 0.5f, 0.5f, VA_FILTER_SCALING_DEFAULT));
+
+    EXPECT_EQ(0, avs.num_cached);
+}
+
+} // namespace VPP
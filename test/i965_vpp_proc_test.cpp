@@ -0,0 +1,536 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_test_fixture.h"
+
+#include <cstring>
+#include <vector>
+
+namespace VPP {
+
+/*
+ * Runs i965_proc_picture() on a proc context of its own: the whole VPP
+ * pipeline of Gen6/7, the format conversion context of Gen7.5+.
+ */
+class ProcPictureTest : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+
+        struct i965_driver_data *i965(*this);
+        proc_context = NULL;
+
+        // the multi pass path is only planned on Gen7+
+        if (i965 and HAS_VPP(i965) and i965->pp_context
+            and (IS_GEN7(i965->intel.device_info)
+                or IS_GEN8(i965->intel.device_info)
+                or IS_GEN9(i965->intel.device_info)))
+            proc_context = reinterpret_cast<i965_proc_context *>(
+                i965_proc_context_init(*this, NULL));
+    }
+
+    virtual void TearDown()
+    {
+        if (proc_context)
+            proc_context->base.destroy(proc_context);
+
+        destroySurfaces(surfaces);
+        I965TestFixture::TearDown();
+    }
+
+    bool skip()
+    {
+        if (proc_context)
+            return false;
+
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is not supported on this hardware" << std::endl;
+
+        return true;
+    }
+
+    VASurfaceID createSurface(int width, int height, unsigned fourcc)
+    {
+        struct i965_driver_data *i965(*this);
+        const bool yuy2(fourcc == VA_FOURCC_YUY2);
+        Surfaces created = createSurfaces(width, height,
+            yuy2 ? VA_RT_FORMAT_YUV422 : VA_RT_FORMAT_YUV420);
+
+        EXPECT_EQ(1u, created.size());
+        if (created.empty())
+            return VA_INVALID_ID;
+
+        i965_check_alloc_surface_bo(*this, SURFACE(created.front()), 1,
+            fourcc, yuy2 ? SUBSAMPLE_YUV422H : SUBSAMPLE_YUV420);
+        EXPECT_PTR(SURFACE(created.front())->bo);
+        surfaces.push_back(created.front());
+
+        return created.front();
+    }
+
+    i965_proc_plan plan(VAProcPipelineParameterBuffer& param, VASurfaceID target)
+    {
+        struct i965_driver_data *i965(*this);
+        i965_proc_plan result;
+
+        i965_proc_picture_plan(*this, proc_context, &param,
+            SURFACE(param.surface), SURFACE(target), &result);
+
+        return result;
+    }
+
+    VAStatus process(const VAProcPipelineParameterBuffer& param, VASurfaceID target)
+    {
+        struct i965_driver_data *i965(*this);
+        union codec_state codec_state;
+
+        VABufferID id = createBuffer(VA_INVALID_ID,
+            VAProcPipelineParameterBufferType, sizeof(param), 1, &param);
+
+        std::memset(&codec_state, 0, sizeof(codec_state));
+        codec_state.proc.pipeline_param = BUFFER(id)->buffer_store;
+        codec_state.proc.current_render_target = target;
+
+        const VAStatus status = i965_proc_picture(*this, VAProfileNone,
+            &codec_state, &proc_context->base);
+
+        destroyBuffer(id);
+
+        return status;
+    }
+
+    // the first buffer and the layers rendered after it in one picture
+    VAStatus compose(const std::vector<VAProcPipelineParameterBuffer>& layers,
+        VASurfaceID target)
+    {
+        struct i965_driver_data *i965(*this);
+        union codec_state codec_state;
+        std::vector<VABufferID> ids;
+
+        std::memset(&codec_state, 0, sizeof(codec_state));
+
+        for (size_t i(0); i < layers.size(); ++i) {
+            ids.push_back(createBuffer(VA_INVALID_ID,
+                VAProcPipelineParameterBufferType, sizeof(layers[i]), 1,
+                &layers[i]));
+
+            if (i == 0)
+                codec_state.proc.pipeline_param = BUFFER(ids[i])->buffer_store;
+            else
+                codec_state.proc.layer_params[i - 1] = BUFFER(ids[i])->buffer_store;
+        }
+
+        codec_state.proc.num_layer_params = layers.size() - 1;
+        codec_state.proc.current_render_target = target;
+
+        const VAStatus status = i965_proc_picture(*this, VAProfileNone,
+            &codec_state, &proc_context->base);
+
+        for (size_t i(0); i < ids.size(); ++i)
+            destroyBuffer(ids[i]);
+
+        return status;
+    }
+
+    // sets every byte of the surface, luma and chroma alike for packed ones
+    void fill(VASurfaceID surface, uint8_t luma, uint8_t chroma)
+    {
+        VAImage image;
+        deriveImage(surface, image);
+        uint8_t *data = mapBuffer<uint8_t>(image.buf);
+
+        if (data) {
+            std::memset(data, luma, image.offsets[1] ? image.offsets[1] : image.data_size);
+            if (image.offsets[1])
+                std::memset(data + image.offsets[1], chroma,
+                    image.data_size - image.offsets[1]);
+            unmapBuffer(image.buf);
+        }
+
+        destroyImage(image);
+    }
+
+    std::vector<uint8_t> luma(VASurfaceID surface, int y)
+    {
+        VAImage image;
+        std::vector<uint8_t> row;
+
+        deriveImage(surface, image);
+        const uint8_t *data = mapBuffer<uint8_t>(image.buf);
+
+        if (data) {
+            data += image.offsets[0] + y * image.pitches[0];
+            row.assign(data, data + image.width);
+            unmapBuffer(image.buf);
+        }
+
+        destroyImage(image);
+
+        return row;
+    }
+
+    static VAProcPipelineParameterBuffer layer(VASurfaceID surface,
+        const VARectangle *output_region)
+    {
+        VAProcPipelineParameterBuffer param;
+
+        std::memset(&param, 0, sizeof(param));
+        param.surface = surface;
+        param.output_region = output_region;
+        param.output_background_color = 0xff000000;
+
+        return param;
+    }
+
+    i965_proc_context *proc_context;
+    Surfaces surfaces;
+};
+
+TEST_F(ProcPictureTest, Plan)
+{
+    if (skip())
+        return;
+
+    VASurfaceID input = createSurface(64, 64, VA_FOURCC_YUY2);
+    VASurfaceID target = createSurface(64, 64, VA_FOURCC_NV12);
+    VAProcPipelineParameterBuffer param;
+    i965_proc_plan p;
+
+    std::memset(&param, 0, sizeof(param));
+    param.surface = input;
+
+    // the load/save kernel converts the input in the final walk
+    p = plan(param, target);
+    EXPECT_EQ(0, p.num_filter_passes);
+    EXPECT_FALSE(p.convert_input);
+    EXPECT_FALSE(p.clear_output);
+
+    // the fill is needed as soon as the output doesn't cover the target
+    VARectangle region = { 0, 0, 64, 32 };
+    param.output_region = &region;
+    p = plan(param, target);
+    EXPECT_TRUE(p.clear_output);
+    param.output_region = NULL;
+
+    // field pictures go through the NV12 intermediate
+    param.filter_flags = VA_TOP_FIELD;
+    p = plan(param, target);
+    EXPECT_TRUE(p.convert_input);
+    param.filter_flags = 0;
+
+    // and so does the input of a filter kernel
+    VAProcFilterParameterBuffer dn;
+    std::memset(&dn, 0, sizeof(dn));
+    dn.type = VAProcFilterNoiseReduction;
+    dn.value = 0.5f;
+
+    VABufferID filter = createBuffer(VA_INVALID_ID,
+        VAProcFilterParameterBufferType, sizeof(dn), 1, &dn);
+    param.filters = &filter;
+    param.num_filters = 1;
+    p = plan(param, target);
+    EXPECT_GE(1, p.num_filter_passes);
+    EXPECT_EQ(p.num_filter_passes > 0, bool(p.convert_input));
+    destroyBuffer(filter);
+}
+
+TEST_F(ProcPictureTest, Passes)
+{
+    if (skip())
+        return;
+
+    VASurfaceID nv12 = createSurface(64, 64, VA_FOURCC_NV12);
+    VASurfaceID yuy2 = createSurface(64, 64, VA_FOURCC_YUY2);
+    VASurfaceID target = createSurface(64, 64, VA_FOURCC_NV12);
+    VASurfaceID output = createSurface(32, 32, VA_FOURCC_NV12);
+    VAProcPipelineParameterBuffer param;
+
+    // an additional output keeps the picture off the single walk fast path
+    std::memset(&param, 0, sizeof(param));
+    param.surface = nv12;
+    param.additional_outputs = &output;
+    param.num_additional_outputs = 1;
+
+    // one walk per output
+    EXPECT_STATUS(process(param, target));
+    EXPECT_EQ(2u, proc_context->last_num_passes);
+
+    // and the background fill
+    VARectangle region = { 0, 0, 64, 32 };
+    param.output_region = &region;
+    EXPECT_STATUS(process(param, target));
+    EXPECT_EQ(3u, proc_context->last_num_passes);
+    param.output_region = NULL;
+
+    // no separate conversion of the input
+    param.surface = yuy2;
+    EXPECT_STATUS(process(param, target));
+    EXPECT_EQ(2u, proc_context->last_num_passes);
+
+    EXPECT_EQ(3u, proc_context->num_pictures);
+    EXPECT_EQ(7u, proc_context->num_passes);
+}
+
+TEST_F(ProcPictureTest, PrivateFilter)
+{
+    if (skip())
+        return;
+
+    VASurfaceID input = createSurface(64, 64, VA_FOURCC_NV12);
+    VASurfaceID target = createSurface(64, 64, VA_FOURCC_NV12);
+    VAProcPipelineParameterBuffer param;
+
+    // a filter type past the kernel table
+    VAProcFilterParameterBufferToneMappingIntel tm;
+    std::memset(&tm, 0, sizeof(tm));
+    tm.type = VAProcFilterToneMappingIntel;
+    tm.transfer = VA_TONE_MAPPING_TRANSFER_PQ;
+
+    VABufferID filter = createBuffer(VA_INVALID_ID,
+        VAProcFilterParameterBufferType, sizeof(tm), 1, &tm);
+
+    std::memset(&param, 0, sizeof(param));
+    param.surface = input;
+    param.filters = &filter;
+    param.num_filters = 1;
+
+    EXPECT_EQ(0, plan(param, target).num_filter_passes);
+    EXPECT_EQ(VA_STATUS_ERROR_UNSUPPORTED_FILTER, process(param, target));
+
+    destroyBuffer(filter);
+}
+
+TEST_F(ProcPictureTest, FieldRateOptIn)
+{
+    if (skip())
+        return;
+
+    struct i965_driver_data *i965(*this);
+    VASurfaceID input = createSurface(64, 64, VA_FOURCC_NV12);
+    VASurfaceID target = createSurface(64, 64, VA_FOURCC_NV12);
+    VASurfaceID output = createSurface(64, 64, VA_FOURCC_NV12);
+    VASurfaceID scaled = createSurface(32, 32, VA_FOURCC_NV12);
+    VAProcPipelineParameterBuffer param;
+
+    VAProcFilterParameterBufferDeinterlacing di;
+    std::memset(&di, 0, sizeof(di));
+    di.type = VAProcFilterDeinterlacing;
+    di.algorithm = VAProcDeinterlacingMotionAdaptive;
+
+    VABufferID filter = createBuffer(VA_INVALID_ID,
+        VAProcFilterParameterBufferType, sizeof(di), 1, &di);
+    VAProcFilterParameterBufferDeinterlacing *deint =
+        reinterpret_cast<VAProcFilterParameterBufferDeinterlacing *>(
+            BUFFER(filter)->buffer_store->buffer);
+
+    std::memset(&param, 0, sizeof(param));
+    param.surface = input;
+    param.filters = &filter;
+    param.num_filters = 1;
+    param.additional_outputs = &output;
+    param.num_additional_outputs = 1;
+
+    // an additional output of the output size is still a scaled copy
+    EXPECT_EQ(-1, i965_proc_field_rate_filter(*this, &param, SURFACE(target)));
+
+    // unless the application asks for the second field
+    deint->flags = VA_DEINTERLACING_FIELD_RATE_INTEL;
+    EXPECT_EQ(0, i965_proc_field_rate_filter(*this, &param, SURFACE(target)));
+
+    // of a first field picture
+    deint->flags |= VA_DEINTERLACING_BOTTOM_FIELD;
+    EXPECT_EQ(-1, i965_proc_field_rate_filter(*this, &param, SURFACE(target)));
+    deint->flags |= VA_DEINTERLACING_BOTTOM_FIELD_FIRST;
+    EXPECT_EQ(0, i965_proc_field_rate_filter(*this, &param, SURFACE(target)));
+
+    deint->flags = VA_DEINTERLACING_FIELD_RATE_INTEL | VA_DEINTERLACING_ONE_FIELD;
+    EXPECT_EQ(-1, i965_proc_field_rate_filter(*this, &param, SURFACE(target)));
+
+    deint->flags = VA_DEINTERLACING_FIELD_RATE_INTEL;
+    deint->algorithm = VAProcDeinterlacingBob;
+    EXPECT_EQ(-1, i965_proc_field_rate_filter(*this, &param, SURFACE(target)));
+    deint->algorithm = VAProcDeinterlacingMotionAdaptive;
+
+    // the second field has the size of the output region
+    param.additional_outputs = &scaled;
+    EXPECT_EQ(-1, i965_proc_field_rate_filter(*this, &param, SURFACE(target)));
+
+    destroyBuffer(filter);
+}
+
+TEST_F(ProcPictureTest, FieldRateChains)
+{
+    if (skip())
+        return;
+
+    struct i965_driver_data *i965(*this);
+    VASurfaceID input = createSurface(64, 64, VA_FOURCC_NV12);
+    VASurfaceID target = createSurface(64, 64, VA_FOURCC_NV12);
+    VASurfaceID output = createSurface(64, 64, VA_FOURCC_NV12);
+    VAProcPipelineParameterBuffer param;
+
+    VAProcFilterParameterBufferDeinterlacing di;
+    std::memset(&di, 0, sizeof(di));
+    di.type = VAProcFilterDeinterlacing;
+    di.algorithm = VAProcDeinterlacingMotionAdaptive;
+
+    VAProcFilterParameterBuffer dn;
+    std::memset(&dn, 0, sizeof(dn));
+    dn.type = VAProcFilterNoiseReduction;
+    dn.value = 0.5f;
+
+    VABufferID filters[2] = {
+        createBuffer(VA_INVALID_ID, VAProcFilterParameterBufferType,
+            sizeof(di), 1, &di),
+        createBuffer(VA_INVALID_ID, VAProcFilterParameterBufferType,
+            sizeof(dn), 1, &dn),
+    };
+    VAProcFilterParameterBufferDeinterlacing *deint =
+        reinterpret_cast<VAProcFilterParameterBufferDeinterlacing *>(
+            BUFFER(filters[0])->buffer_store->buffer);
+
+    // denoise after deinterlacing, with a plain additional output
+    std::memset(&param, 0, sizeof(param));
+    param.surface = input;
+    param.filters = filters;
+    param.num_filters = 2;
+    param.additional_outputs = &output;
+    param.num_additional_outputs = 1;
+
+    EXPECT_STATUS(process(param, target));
+
+    // the second field can't go through the filters after deinterlacing
+    deint->flags = VA_DEINTERLACING_FIELD_RATE_INTEL;
+    EXPECT_EQ(VA_STATUS_ERROR_UNIMPLEMENTED, process(param, target));
+
+    destroyBuffer(filters[1]);
+    destroyBuffer(filters[0]);
+}
+
+TEST_F(ProcPictureTest, ComposeRejects)
+{
+    if (skip())
+        return;
+
+    VASurfaceID input = createSurface(32, 32, VA_FOURCC_NV12);
+    VASurfaceID target = createSurface(64, 64, VA_FOURCC_NV12);
+    const VARectangle left = { 0, 0, 32, 64 }, outside = { 48, 0, 32, 64 };
+    std::vector<VAProcPipelineParameterBuffer> layers(2, layer(input, &left));
+
+    // no blending kernel
+    VABlendState blend;
+    std::memset(&blend, 0, sizeof(blend));
+    blend.flags = VA_BLEND_GLOBAL_ALPHA;
+    blend.global_alpha = 0.5f;
+    layers[1].blend_state = &blend;
+    EXPECT_EQ(VA_STATUS_ERROR_UNIMPLEMENTED, compose(layers, target));
+    layers[1].blend_state = NULL;
+
+    // nor filters
+    VAProcFilterParameterBuffer dn;
+    std::memset(&dn, 0, sizeof(dn));
+    dn.type = VAProcFilterNoiseReduction;
+    VABufferID filter = createBuffer(VA_INVALID_ID,
+        VAProcFilterParameterBufferType, sizeof(dn), 1, &dn);
+    layers[1].filters = &filter;
+    layers[1].num_filters = 1;
+    EXPECT_EQ(VA_STATUS_ERROR_UNIMPLEMENTED, compose(layers, target));
+    layers[1].filters = NULL;
+    layers[1].num_filters = 0;
+    destroyBuffer(filter);
+
+    layers[1].output_region = &outside;
+    EXPECT_EQ(VA_STATUS_ERROR_INVALID_PARAMETER, compose(layers, target));
+}
+
+TEST_F(ProcPictureTest, ComposeUnfilledTarget)
+{
+    if (skip())
+        return;
+
+    VASurfaceID input = createSurface(32, 32, VA_FOURCC_NV12);
+    VASurfaceID target = createSurface(64, 64, VA_FOURCC_YUY2);
+    const VARectangle left = { 0, 0, 32, 64 }, right = { 32, 0, 32, 64 };
+    std::vector<VAProcPipelineParameterBuffer> layers;
+
+    // no single layer covers the target, the background has to be filled
+    layers.push_back(layer(input, &left));
+    layers.push_back(layer(input, &right));
+
+    fill(target, 0x33, 0x33);
+
+    // only NV12 targets can be, the others are left alone
+    EXPECT_EQ(VA_STATUS_ERROR_UNIMPLEMENTED, compose(layers, target));
+
+    const std::vector<uint8_t> row(luma(target, 0));
+    ASSERT_FALSE(row.empty());
+    for (size_t i(0); i < row.size(); ++i)
+        ASSERT_EQ(0x33, row[i]) << "byte " << i;
+}
+
+TEST_F(ProcPictureTest, ComposeTiles)
+{
+    if (skip())
+        return;
+
+    VASurfaceID a = createSurface(16, 64, VA_FOURCC_NV12);
+    VASurfaceID b = createSurface(16, 64, VA_FOURCC_NV12);
+    VASurfaceID target = createSurface(64, 64, VA_FOURCC_NV12);
+    const VARectangle tile_a = { 0, 0, 16, 64 }, tile_b = { 32, 0, 16, 64 };
+    std::vector<VAProcPipelineParameterBuffer> layers;
+
+    fill(a, 0x50, 0x80);
+    fill(b, 0xa0, 0x80);
+    fill(target, 0x33, 0x33);
+
+    layers.push_back(layer(a, &tile_a));
+    layers.push_back(layer(b, &tile_b));
+
+    // a hidden layer covers the target, but doesn't save the fill
+    VABlendState hidden;
+    std::memset(&hidden, 0, sizeof(hidden));
+    hidden.flags = VA_BLEND_GLOBAL_ALPHA;
+    layers.push_back(layer(a, NULL));
+    layers.back().blend_state = &hidden;
+
+    EXPECT_STATUS(compose(layers, target));
+
+    // nothing is executed on the mock
+    if (g_intel_mock_bufmgr)
+        return;
+
+    syncSurface(target);
+
+    const std::vector<uint8_t> row(luma(target, 32));
+    ASSERT_EQ(64u, row.size());
+    EXPECT_EQ(0x50, row[8]);
+    EXPECT_EQ(16, row[24]);             // black background
+    EXPECT_EQ(0xa0, row[40]);
+    EXPECT_EQ(16, row[56]);
+}
+
+} // namespace VPP
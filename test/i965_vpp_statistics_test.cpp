@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "i965_test_fixture.h"
+
+#include <cstring>
+#include <vector>
+
+namespace VPP {
+
+class StatisticsTest : public ::testing::TestWithParam<int>
+{
+protected:
+    virtual void SetUp()
+    {
+        info = i965_get_device_info(GetParam());
+        ASSERT_PTR(info);
+    }
+
+    // header followed by the raw statistics of a 720x480 picture
+    void init(unsigned int flags)
+    {
+        const unsigned int size = i965_proc_statistics_size(info, 720, 480);
+
+        // per-block statistics, per-frame statistics and the histogram
+        EXPECT_LE(768u * 120 + 128 + 1024, size);
+
+        bo.assign(I965_PROC_STATISTICS_HEADER_SIZE + size, 0xee);
+        i965_proc_statistics_init(segment(), info, 720, 480, flags);
+    }
+
+    i965_proc_statistics_segment *segment()
+    {
+        return reinterpret_cast<i965_proc_statistics_segment *>(&bo[0]);
+    }
+
+    uint32_t *raw(unsigned int offset)
+    {
+        return reinterpret_cast<uint32_t *>(
+            &bo[I965_PROC_STATISTICS_HEADER_SIZE + offset]);
+    }
+
+    const intel_device_info *info;
+    std::vector<uint8_t> bo;
+};
+
+TEST_P(StatisticsTest, Parse)
+{
+    const unsigned int flags = VA_PROC_STATISTICS_HISTOGRAM |
+        VA_PROC_STATISTICS_NOISE | VA_PROC_STATISTICS_MOTION;
+
+    init(flags);
+
+    // the per-frame statistics follow 120 rows of per-block statistics
+    EXPECT_EQ(768u * 120, segment()->per_frame_offset);
+
+    for (unsigned int i = 0; i < 256; i++)
+        *raw(segment()->histogram_offset + i * 4) = i * 3;
+
+    *raw(segment()->per_frame_offset + 0x00) = 123456;
+    *raw(segment()->per_frame_offset + 0x2c) = 5000;
+    *raw(segment()->per_frame_offset + 0x30) = 250;
+
+    i965_proc_statistics_parse(segment());
+
+    const VAProcStatisticsIntel& stats = segment()->base;
+
+    EXPECT_EQ(flags, stats.flags);
+    for (unsigned int i = 0; i < 256; i++)
+        EXPECT_EQ(i * 3, stats.histogram[i]);
+    EXPECT_EQ(123456u, stats.motion_sum);
+    EXPECT_EQ(5000u, stats.noise_sum);
+    EXPECT_EQ(250u, stats.noise_count);
+
+    // mapping again keeps what the application may have changed
+    segment()->base.motion_sum = 0;
+    i965_proc_statistics_parse(segment());
+    EXPECT_EQ(0u, stats.motion_sum);
+}
+
+TEST_P(StatisticsTest, OnlyWrittenStatistics)
+{
+    init(VA_PROC_STATISTICS_NOISE);
+
+    *raw(segment()->per_frame_offset + 0x2c) = 10;
+    *raw(segment()->per_frame_offset + 0x30) = 2;
+
+    i965_proc_statistics_parse(segment());
+
+    const VAProcStatisticsIntel& stats = segment()->base;
+
+    EXPECT_EQ(unsigned(VA_PROC_STATISTICS_NOISE), stats.flags);
+    EXPECT_EQ(10u, stats.noise_sum);
+    EXPECT_EQ(2u, stats.noise_count);
+    EXPECT_EQ(0u, stats.motion_sum);
+    for (unsigned int i = 0; i < 256; i++)
+        EXPECT_EQ(0u, stats.histogram[i]);
+}
+
+TEST_P(StatisticsTest, NoPicture)
+{
+    bo.assign(I965_PROC_STATISTICS_HEADER_SIZE, 0xee);
+    i965_proc_statistics_init(segment(), NULL, 0, 0, 0);
+    i965_proc_statistics_parse(segment());
+
+    EXPECT_EQ(0u, segment()->base.flags);
+    EXPECT_EQ(0u, segment()->base.noise_count);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    VEBox, StatisticsTest, ::testing::Values(0x0412, 0x1616, 0x1916));
+
+class StatisticsBufferTest : public I965TestFixture
+{
+};
+
+TEST_F(StatisticsBufferTest, NonVEBoxPicture)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+
+    if (!HAS_VPP(i965)) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is not supported on this hardware" << std::endl;
+        return;
+    }
+
+    Surfaces surfaces = createSurfaces(64, 64, VA_RT_FORMAT_YUV420, 2);
+    ASSERT_EQ(2u, surfaces.size());
+
+    VAConfigID config = createConfig(VAProfileNone, VAEntrypointVideoProc);
+    VAContextID context = createContext(config, 64, 64);
+    VABufferID statistics = createBuffer(context,
+        VAProcStatisticsBufferTypeIntel, sizeof(VAProcStatisticsIntel));
+
+    // what a previous VEBOX picture left
+    i965_proc_statistics_segment *segment =
+        mapBuffer<i965_proc_statistics_segment>(statistics);
+    ASSERT_PTR(segment);
+    segment->flags = VA_PROC_STATISTICS_NOISE;
+    segment->mapped = 0;
+    unmapBuffer(statistics);
+
+    // a plain copy, without any VEBOX filter
+    VAProcPipelineParameterBuffer param;
+    std::memset(&param, 0, sizeof(param));
+    param.surface = surfaces[0];
+
+    VABufferID pipeline = createBuffer(context,
+        VAProcPipelineParameterBufferType, sizeof(param), 1, &param);
+    VABufferID buffers[2] = { pipeline, statistics };
+
+    beginPicture(context, surfaces[1]);
+    renderPicture(context, buffers, 2);
+    endPicture(context);
+
+    const VAProcStatisticsIntel *stats =
+        mapBuffer<VAProcStatisticsIntel>(statistics);
+    ASSERT_PTR(stats);
+    EXPECT_EQ(0u, stats->flags);
+    EXPECT_EQ(0u, stats->noise_count);
+    unmapBuffer(statistics);
+
+    destroyBuffer(pipeline);
+    destroyBuffer(statistics);
+    destroyContext(context);
+    destroyConfig(config);
+    destroySurfaces(surfaces);
+}
+
+} // namespace VPP
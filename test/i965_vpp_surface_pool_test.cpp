@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_test_fixture.h"
+
+#include <set>
+
+namespace VPP {
+
+class ProcSurfacePoolTest : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+        i965_proc_surface_pool_init(&pool);
+    }
+
+    virtual void TearDown()
+    {
+        i965_proc_surface_pool_destroy(*this, &pool);
+        I965TestFixture::TearDown();
+    }
+
+    object_surface *get(int width, int height)
+    {
+        object_surface *obj_surface(NULL);
+
+        EXPECT_STATUS(i965_proc_surface_pool_get(*this, &pool, width, height,
+            VA_FOURCC_NV12, 1, &obj_surface));
+        EXPECT_PTR(obj_surface);
+
+        return obj_surface;
+    }
+
+    void release()
+    {
+        i965_proc_surface_pool_release(*this, &pool);
+    }
+
+    i965_proc_surface_pool pool;
+};
+
+TEST_F(ProcSurfacePoolTest, Reuse)
+{
+    object_surface *a(get(64, 64));
+    object_surface *b(get(64, 64));
+    EXPECT_NE(a, b);
+    EXPECT_PTR(a->bo);
+    EXPECT_EQ(unsigned(VA_FOURCC_NV12), a->fourcc);
+    release();
+
+    // the same two surfaces again, a third size gets a new one
+    std::set<object_surface *> surfaces;
+    surfaces.insert(get(64, 64));
+    surfaces.insert(get(64, 64));
+    EXPECT_EQ(1u, surfaces.count(a));
+    EXPECT_EQ(1u, surfaces.count(b));
+
+    object_surface *c(get(32, 32));
+    EXPECT_EQ(0u, surfaces.count(c));
+    release();
+
+    EXPECT_EQ(3u, pool.num_allocations);
+    EXPECT_EQ(2u, pool.num_reuses);
+    EXPECT_EQ(0u, pool.num_releases);
+}
+
+TEST_F(ProcSurfacePoolTest, IdleTrim)
+{
+    get(64, 64);
+    release();
+
+    // kept while another size is in use for the idle period
+    for (int i(1); i < I965_PROC_SURFACE_POOL_IDLE_FRAMES; ++i) {
+        get(32, 32);
+        release();
+    }
+
+    EXPECT_EQ(0u, pool.num_releases);
+
+    get(32, 32);
+    release();
+
+    EXPECT_EQ(1u, pool.num_releases);
+    EXPECT_EQ(2u, pool.num_allocations);
+
+    get(64, 64);
+    release();
+
+    EXPECT_EQ(3u, pool.num_allocations);
+}
+
+TEST_F(ProcSurfacePoolTest, Evict)
+{
+    for (int i(0); i < I965_PROC_SURFACE_POOL_SIZE; ++i)
+        get(16 * (i + 1), 16);
+
+    object_surface *obj_surface(NULL);
+    EXPECT_EQ(VA_STATUS_ERROR_ALLOCATION_FAILED,
+        i965_proc_surface_pool_get(*this, &pool, 16, 32, VA_FOURCC_NV12, 1,
+            &obj_surface));
+    release();
+
+    // every surface is idle, the least recently used one makes room
+    get(16 * 2, 16);
+    get(16, 32);
+    release();
+
+    EXPECT_EQ(unsigned(I965_PROC_SURFACE_POOL_SIZE) + 1, pool.num_allocations);
+    EXPECT_EQ(1u, pool.num_reuses);
+    EXPECT_EQ(1u, pool.num_releases);
+}
+
+} // namespace VPP
@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+#include "i965_internal_decl.h"
+
+#include <cstring>
+#include <vector>
+
+namespace VPP {
+
+class SWProcessTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        std::memset(&config, 0, sizeof(config));
+        config.coeff_frac_bits = 6;
+        config.coeff_epsilon = 1.0f / (1U << 6);
+        config.num_phases = 16;
+        config.num_luma_coeffs = 8;
+        config.num_chroma_coeffs = 4;
+
+        for (int i = 0; i < AVS_MAX_LUMA_COEFFS; i++) {
+            config.coeff_range.lower_bound.y_k_h[i] = -2;
+            config.coeff_range.lower_bound.y_k_v[i] = -2;
+            config.coeff_range.upper_bound.y_k_h[i] = 2;
+            config.coeff_range.upper_bound.y_k_v[i] = 2;
+        }
+
+        for (int i = 0; i < AVS_MAX_CHROMA_COEFFS; i++) {
+            const float bound = (i == 0 || i == 3) ? 1 : 2;
+            config.coeff_range.lower_bound.uv_k_h[i] = -bound;
+            config.coeff_range.lower_bound.uv_k_v[i] = -bound;
+            config.coeff_range.upper_bound.uv_k_h[i] = bound;
+            config.coeff_range.upper_bound.uv_k_v[i] = bound;
+        }
+
+        avs_init_state(&avs, &config);
+    }
+
+    // allocates a tightly packed picture in storage
+    static void initImage(i965_vpp_sw_image& image, std::vector<uint8_t>& storage,
+        unsigned int fourcc, int width, int height)
+    {
+        const int cw = (width + 1) / 2, ch = (height + 1) / 2;
+
+        std::memset(&image, 0, sizeof(image));
+        image.fourcc = fourcc;
+        image.width = width;
+        image.height = height;
+
+        switch (fourcc) {
+        case VA_FOURCC_NV12:
+            storage.assign(width * height + cw * 2 * ch, 0);
+            image.planes[0] = &storage[0];
+            image.pitches[0] = width;
+            image.planes[1] = &storage[width * height];
+            image.pitches[1] = cw * 2;
+            break;
+        case VA_FOURCC_I420:
+        case VA_FOURCC_YV12:
+            storage.assign(width * height + cw * ch * 2, 0);
+            image.planes[0] = &storage[0];
+            image.pitches[0] = width;
+            image.planes[1] = &storage[width * height];
+            image.pitches[1] = cw;
+            image.planes[2] = &storage[width * height + cw * ch];
+            image.pitches[2] = cw;
+            break;
+        case VA_FOURCC_YUY2:
+        case VA_FOURCC_UYVY:
+            storage.assign(cw * 4 * height, 0);
+            image.planes[0] = &storage[0];
+            image.pitches[0] = cw * 4;
+            break;
+        default:
+            storage.assign(width * 4 * height, 0);
+            image.planes[0] = &storage[0];
+            image.pitches[0] = width * 4;
+            break;
+        }
+    }
+
+    static void fillNV12(i965_vpp_sw_image& image, uint8_t y, uint8_t u, uint8_t v)
+    {
+        for (int j = 0; j < image.height; j++)
+            std::memset(image.planes[0] + j * image.pitches[0], y, image.width);
+
+        for (int j = 0; j < (image.height + 1) / 2; j++) {
+            for (int i = 0; i < (image.width + 1) / 2; i++) {
+                image.planes[1][j * image.pitches[1] + 2 * i] = u;
+                image.planes[1][j * image.pitches[1] + 2 * i + 1] = v;
+            }
+        }
+    }
+
+    static VARectangle rect(int x, int y, int width, int height)
+    {
+        VARectangle r;
+
+        r.x = x;
+        r.y = y;
+        r.width = width;
+        r.height = height;
+
+        return r;
+    }
+
+    AVSConfig config;
+    AVSState avs;
+};
+
+TEST_F(SWProcessTest, NV12ToI420)
+{
+    i965_vpp_sw_image src, dst;
+    std::vector<uint8_t> src_data, dst_data;
+    const VARectangle r = rect(0, 0, 32, 16);
+
+    initImage(src, src_data, VA_FOURCC_NV12, 32, 16);
+    initImage(dst, dst_data, VA_FOURCC_I420, 32, 16);
+
+    for (size_t i = 0; i < src_data.size(); i++)
+        src_data[i] = (i * 37 + 11) & 0xff;
+
+    ASSERT_TRUE(i965_vpp_sw_process(&src, &r, &dst, &r, NULL, NULL));
+
+    EXPECT_EQ(0, std::memcmp(src.planes[0], dst.planes[0], 32 * 16));
+
+    for (int j = 0; j < 8; j++) {
+        for (int i = 0; i < 16; i++) {
+            EXPECT_EQ(src.planes[1][j * 32 + 2 * i], dst.planes[1][j * 16 + i]);
+            EXPECT_EQ(src.planes[1][j * 32 + 2 * i + 1], dst.planes[2][j * 16 + i]);
+        }
+    }
+}
+
+TEST_F(SWProcessTest, YUY2ToUYVY)
+{
+    i965_vpp_sw_image src, dst;
+    std::vector<uint8_t> src_data, dst_data;
+    const VARectangle r = rect(0, 0, 16, 8);
+
+    initImage(src, src_data, VA_FOURCC_YUY2, 16, 8);
+    initImage(dst, dst_data, VA_FOURCC_UYVY, 16, 8);
+
+    for (size_t i = 0; i < src_data.size(); i++)
+        src_data[i] = (i * 53 + 7) & 0xff;
+
+    ASSERT_TRUE(i965_vpp_sw_process(&src, &r, &dst, &r, NULL, NULL));
+
+    for (size_t i = 0; i < src_data.size(); i += 2) {
+        EXPECT_EQ(src_data[i], dst_data[i + 1]);
+        EXPECT_EQ(src_data[i + 1], dst_data[i]);
+    }
+}
+
+TEST_F(SWProcessTest, YUVToRGB)
+{
+    i965_vpp_sw_image src, dst;
+    std::vector<uint8_t> src_data, dst_data;
+    const VARectangle r = rect(0, 0, 8, 8);
+
+    initImage(src, src_data, VA_FOURCC_NV12, 8, 8);
+    initImage(dst, dst_data, VA_FOURCC_BGRA, 8, 8);
+
+    fillNV12(src, 235, 128, 128);
+    ASSERT_TRUE(i965_vpp_sw_process(&src, &r, &dst, &r, NULL, NULL));
+
+    for (size_t i = 0; i < dst_data.size(); i++)
+        EXPECT_EQ(255, dst_data[i]);
+
+    // BT.601 red, BGRA keeps it in the third byte
+    fillNV12(src, 81, 90, 240);
+    ASSERT_TRUE(i965_vpp_sw_process(&src, &r, &dst, &r, NULL, NULL));
+
+    for (size_t i = 0; i < dst_data.size(); i += 4) {
+        EXPECT_NEAR(0, dst_data[i], 2);
+        EXPECT_NEAR(0, dst_data[i + 1], 2);
+        EXPECT_NEAR(255, dst_data[i + 2], 2);
+        EXPECT_EQ(255, dst_data[i + 3]);
+    }
+}
+
+TEST_F(SWProcessTest, RGBToYUV)
+{
+    i965_vpp_sw_image src, dst;
+    std::vector<uint8_t> src_data, dst_data;
+    const VARectangle r = rect(0, 0, 8, 8);
+
+    initImage(src, src_data, VA_FOURCC_RGBX, 8, 8);
+    initImage(dst, dst_data, VA_FOURCC_NV12, 8, 8);
+    src_data.assign(src_data.size(), 255);
+
+    ASSERT_TRUE(i965_vpp_sw_process(&src, &r, &dst, &r, NULL, NULL));
+
+    for (int i = 0; i < 64; i++)
+        EXPECT_EQ(235, dst.planes[0][i]);
+
+    for (int i = 0; i < 32; i++)
+        EXPECT_EQ(128, dst.planes[1][i]);
+}
+
+TEST_F(SWProcessTest, FlatStaysFlat)
+{
+    i965_vpp_sw_image src, dst;
+    std::vector<uint8_t> src_data, dst_data;
+    const VARectangle src_rect = rect(0, 0, 64, 32);
+    const VARectangle dst_rect = rect(0, 0, 46, 20);
+
+    initImage(src, src_data, VA_FOURCC_NV12, 64, 32);
+    initImage(dst, dst_data, VA_FOURCC_NV12, 46, 20);
+    fillNV12(src, 100, 60, 200);
+
+    ASSERT_TRUE(avs_update_coefficients(&avs, 46.0f / 64, 20.0f / 32, VA_FILTER_SCALING_HQ));
+
+    for (int pass = 0; pass < 2; pass++) {
+        ASSERT_TRUE(i965_vpp_sw_process(&src, &src_rect, &dst, &dst_rect,
+            pass ? &avs : NULL, NULL));
+
+        for (int i = 0; i < 46 * 20; i++)
+            EXPECT_EQ(100, dst.planes[0][i]);
+
+        for (int i = 0; i < 23 * 10; i++) {
+            EXPECT_EQ(60, dst.planes[1][2 * i]);
+            EXPECT_EQ(200, dst.planes[1][2 * i + 1]);
+        }
+    }
+}
+
+TEST_F(SWProcessTest, HalfDownscale)
+{
+    i965_vpp_sw_image src, dst;
+    std::vector<uint8_t> src_data, dst_data;
+    const VARectangle src_rect = rect(0, 0, 64, 16);
+    const VARectangle dst_rect = rect(0, 0, 32, 8);
+
+    initImage(src, src_data, VA_FOURCC_NV12, 64, 16);
+    initImage(dst, dst_data, VA_FOURCC_NV12, 32, 8);
+    fillNV12(src, 0, 128, 128);
+
+    for (int j = 0; j < 16; j++) {
+        for (int i = 0; i < 64; i++)
+            src.planes[0][j * 64 + i] = i * 4;
+    }
+
+    // samples fall between two source pixels
+    ASSERT_TRUE(i965_vpp_sw_process(&src, &src_rect, &dst, &dst_rect, NULL, NULL));
+
+    for (int j = 0; j < 8; j++) {
+        for (int i = 0; i < 32; i++)
+            EXPECT_EQ(8 * i + 2, dst.planes[0][j * 32 + i]);
+    }
+
+    // the symmetric AVS filters keep a ramp linear away from the edges
+    ASSERT_TRUE(avs_update_coefficients(&avs, 0.5f, 0.5f, VA_FILTER_SCALING_HQ));
+    ASSERT_TRUE(i965_vpp_sw_process(&src, &src_rect, &dst, &dst_rect, &avs, NULL));
+
+    for (int j = 0; j < 8; j++) {
+        for (int i = 3; i < 29; i++)
+            EXPECT_NEAR(8 * i + 2, dst.planes[0][j * 32 + i], 1);
+    }
+}
+
+TEST_F(SWProcessTest, RampStaysLinear)
+{
+    i965_vpp_sw_image src, dst;
+    std::vector<uint8_t> src_data, dst_data;
+    const VARectangle src_rect = rect(0, 0, 64, 16);
+    const VARectangle dst_rect = rect(0, 0, 48, 16);
+
+    initImage(src, src_data, VA_FOURCC_NV12, 64, 16);
+    initImage(dst, dst_data, VA_FOURCC_NV12, 48, 16);
+    fillNV12(src, 0, 128, 128);
+
+    for (int j = 0; j < 16; j++) {
+        for (int i = 0; i < 64; i++)
+            src.planes[0][j * 64 + i] = i * 4;
+    }
+
+    // every phase is hit, half of them through the mirrored filters
+    ASSERT_TRUE(avs_update_coefficients(&avs, 0.75f, 1.0f, VA_FILTER_SCALING_HQ));
+
+    for (int pass = 0; pass < 2; pass++) {
+        ASSERT_TRUE(i965_vpp_sw_process(&src, &src_rect, &dst, &dst_rect,
+            pass ? &avs : NULL, NULL));
+
+        for (int j = 0; j < 16; j++) {
+            for (int i = 4; i < 44; i++)
+                EXPECT_NEAR(4 * ((i + 0.5f) * 4 / 3 - 0.5f), dst.planes[0][j * 48 + i], 1);
+        }
+    }
+}
+
+TEST_F(SWProcessTest, OutputRectangle)
+{
+    i965_vpp_sw_image src, dst;
+    std::vector<uint8_t> src_data, dst_data;
+    const VARectangle src_rect = rect(0, 0, 16, 16);
+    const VARectangle dst_rect = rect(8, 4, 8, 8);
+
+    initImage(src, src_data, VA_FOURCC_NV12, 16, 16);
+    initImage(dst, dst_data, VA_FOURCC_NV12, 32, 16);
+    fillNV12(src, 200, 50, 150);
+    fillNV12(dst, 16, 128, 128);
+
+    ASSERT_TRUE(i965_vpp_sw_process(&src, &src_rect, &dst, &dst_rect, NULL, NULL));
+
+    for (int j = 0; j < 16; j++) {
+        for (int i = 0; i < 32; i++) {
+            const bool inside = (i >= 8 && i < 16 && j >= 4 && j < 12);
+            EXPECT_EQ(inside ? 200 : 16, dst.planes[0][j * 32 + i]);
+        }
+    }
+
+    for (int j = 0; j < 8; j++) {
+        for (int i = 0; i < 16; i++) {
+            const bool inside = (i >= 4 && i < 8 && j >= 2 && j < 6);
+            EXPECT_EQ(inside ? 50 : 128, dst.planes[1][j * 32 + 2 * i]);
+        }
+    }
+}
+
+TEST_F(SWProcessTest, Rejects)
+{
+    i965_vpp_sw_image src, dst;
+    std::vector<uint8_t> src_data, dst_data;
+    const VARectangle r = rect(0, 0, 16, 16);
+    const VARectangle outside = rect(8, 8, 16, 16);
+
+    initImage(src, src_data, VA_FOURCC_NV12, 16, 16);
+    initImage(dst, dst_data, VA_FOURCC_NV12, 16, 16);
+
+    EXPECT_FALSE(i965_vpp_sw_process(&src, &r, &dst, &outside, NULL, NULL));
+
+    dst.fourcc = VA_FOURCC_P010;
+    EXPECT_FALSE(i965_vpp_sw_supports_format(VA_FOURCC_P010));
+    EXPECT_FALSE(i965_vpp_sw_process(&src, &r, &dst, &r, NULL, NULL));
+}
+
+} // namespace VPP
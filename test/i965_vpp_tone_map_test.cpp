@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+#include "i965_internal_decl.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace VPP {
+
+class ToneMapTest : public ::testing::TestWithParam<unsigned int>
+{
+protected:
+    virtual void SetUp()
+    {
+        std::memset(&param, 0, sizeof(param));
+        param.type = VAProcFilterToneMappingIntel;
+        param.transfer = GetParam();
+
+        std::memset(&tone_map, 0, sizeof(tone_map));
+    }
+
+    virtual void TearDown()
+    {
+        i965_tone_map_free(&tone_map);
+    }
+
+    // A P010 picture of @width x @height filled by @sample(x, y, plane)
+    template <typename F>
+    void makeSource(int width, int height, F sample)
+    {
+        src_data.assign(width * height * 3, 0);
+
+        std::memset(&src, 0, sizeof(src));
+        src.fourcc = VA_FOURCC_P010;
+        src.width = width;
+        src.height = height;
+        src.planes[0] = &src_data[0];
+        src.pitches[0] = width * 2;
+        src.planes[1] = &src_data[width * height * 2];
+        src.pitches[1] = width * 2;
+
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++)
+                store(0, x, y, sample(x, y, 0));
+        }
+
+        for (int y = 0; y < height / 2; y++) {
+            for (int x = 0; x < width / 2; x++) {
+                store(1, x * 2, y, sample(x, y, 1));
+                store(1, x * 2 + 1, y, sample(x, y, 2));
+            }
+        }
+
+        dst_data.assign(width * height * 3 / 2, 0);
+
+        std::memset(&dst, 0, sizeof(dst));
+        dst.fourcc = VA_FOURCC_NV12;
+        dst.width = width;
+        dst.height = height;
+        dst.planes[0] = &dst_data[0];
+        dst.pitches[0] = width;
+        dst.planes[1] = &dst_data[width * height];
+        dst.pitches[1] = width;
+    }
+
+    void store(int plane, int x, int y, int value)
+    {
+        uint8_t *p = src.planes[plane] + y * src.pitches[plane] + x * 2;
+
+        p[0] = (value << 6) & 0xff;
+        p[1] = (value << 6) >> 8;
+    }
+
+    VAProcFilterParameterBufferToneMappingIntel param;
+    i965_tone_map tone_map;
+    std::vector<uint8_t> src_data, dst_data;
+    i965_vpp_sw_image src, dst;
+};
+
+TEST_P(ToneMapTest, Reference)
+{
+    float black[3], white[3], grey[3];
+
+    // 10 bit black and white stay in the 8 bit limited range
+    ASSERT_TRUE(i965_tone_map_reference(&param, 64, 512, 512, black));
+    EXPECT_NEAR(16.0f, black[0], 0.5f);
+    EXPECT_NEAR(128.0f, black[1], 0.5f);
+    EXPECT_NEAR(128.0f, black[2], 0.5f);
+
+    ASSERT_TRUE(i965_tone_map_reference(&param, 940, 512, 512, white));
+    EXPECT_NEAR(235.0f, white[0], 1.0f);
+    EXPECT_NEAR(128.0f, white[1], 0.5f);
+    EXPECT_NEAR(128.0f, white[2], 0.5f);
+
+    // mid grey is kept neutral and below the peak
+    ASSERT_TRUE(i965_tone_map_reference(&param, 500, 512, 512, grey));
+    EXPECT_LT(black[0], grey[0]);
+    EXPECT_GT(white[0], grey[0]);
+    EXPECT_NEAR(128.0f, grey[1], 0.5f);
+    EXPECT_NEAR(128.0f, grey[2], 0.5f);
+
+    // luma is monotonic
+    float prev[3] = { 0, 0, 0 }, cur[3];
+
+    for (int y = 64; y <= 940; y += 4) {
+        ASSERT_TRUE(i965_tone_map_reference(&param, y, 512, 512, cur));
+        EXPECT_LE(prev[0], cur[0] + 0.01f) << y;
+        prev[0] = cur[0];
+    }
+
+    VAProcFilterParameterBufferToneMappingIntel bad = param;
+
+    bad.transfer = 0;
+    EXPECT_FALSE(i965_tone_map_reference(&bad, 64, 512, 512, cur));
+    bad = param;
+    bad.lut_size = I965_TONE_MAP_MAX_LUT_SIZE + 1;
+    EXPECT_FALSE(i965_tone_map_update(&tone_map, &bad));
+}
+
+TEST_P(ToneMapTest, LutPerStream)
+{
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+    EXPECT_EQ(I965_TONE_MAP_DEFAULT_LUT_SIZE, tone_map.lut_size);
+
+    // the defaults are the same stream
+    VAProcFilterParameterBufferToneMappingIntel same = param;
+
+    same.max_luminance = 1000;
+    same.target_luminance = 100;
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &same));
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+    EXPECT_EQ(1u, tone_map.num_builds);
+
+    param.max_luminance = 4000;
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+    EXPECT_EQ(2u, tone_map.num_builds);
+
+    param.lut_size = 17;
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+    EXPECT_EQ(3u, tone_map.num_builds);
+    EXPECT_EQ(17, tone_map.lut_size);
+}
+
+TEST_P(ToneMapTest, ApplicationLut)
+{
+    // 2x2x2 grid of a plain 10 to 8 bit reduction
+    std::vector<uint16_t> lut;
+
+    for (int cr = 0; cr < 2; cr++) {
+        for (int cb = 0; cb < 2; cb++) {
+            for (int y = 0; y < 2; y++) {
+                lut.push_back(y * (255 << 8));
+                lut.push_back(cb * (255 << 8));
+                lut.push_back(cr * (255 << 8));
+            }
+        }
+    }
+
+    // the transfer doesn't matter any more
+    param.transfer = 0;
+    param.lut_size = 2;
+    param.lut = &lut[0];
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+    EXPECT_EQ(2, tone_map.lut_size);
+    EXPECT_EQ(1u, tone_map.num_builds);
+
+    makeSource(16, 8, [](int x, int, int plane) {
+        return plane ? 512 : 64 * x;
+    });
+
+    const VARectangle rect = { 0, 0, 16, 8 };
+
+    ASSERT_TRUE(i965_tone_map_process(&tone_map, &src, &rect, &dst, &rect));
+
+    for (int x = 0; x < 16; x++)
+        EXPECT_NEAR(64 * x * 255 / 1023.0, dst_data[x], 1) << x;
+    EXPECT_NEAR(128, dst.planes[1][0], 1);
+    EXPECT_NEAR(128, dst.planes[1][1], 1);
+
+    // copied once per stream, the driver doesn't keep the pointer
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+    EXPECT_EQ(1u, tone_map.num_builds);
+    EXPECT_NE(&lut[0], tone_map.lut);
+
+    // the content isn't compared, a change has to be told
+    lut[3] = 0;
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+    EXPECT_EQ(1u, tone_map.num_builds);
+    EXPECT_EQ(255 << 8, tone_map.lut[3]);
+
+    param.lut_generation++;
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+    EXPECT_EQ(2u, tone_map.num_builds);
+    EXPECT_EQ(0, tone_map.lut[3]);
+
+    // or another LUT passed
+    std::vector<uint16_t> copy(lut);
+    param.lut = &copy[0];
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+    EXPECT_EQ(3u, tone_map.num_builds);
+
+    // and built again without it
+    param.transfer = GetParam();
+    param.lut = NULL;
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+    EXPECT_EQ(4u, tone_map.num_builds);
+    EXPECT_EQ(2, tone_map.lut_size);
+
+    param.transfer = 0;
+    EXPECT_FALSE(i965_tone_map_update(&tone_map, &param));
+}
+
+TEST_P(ToneMapTest, MatchesReference)
+{
+    const int width = 64, height = 64;
+    std::mt19937 gen(GetParam());
+    // within the mastering peak and around the neutral axis as real
+    // pictures are, saturated colors clipped to BT.709 are too steep
+    // for any LUT
+    std::uniform_int_distribution<int> luma(64, 720), chroma(488, 536);
+    std::vector<int> samples(width * height + width * height / 2);
+
+    for (size_t i = 0; i < samples.size(); i++)
+        samples[i] = i < size_t(width * height) ? luma(gen) : chroma(gen);
+
+    makeSource(width, height, [&](int x, int y, int plane) {
+        if (plane == 0)
+            return samples[y * width + x];
+        return samples[width * height + (y * width / 2 + x) * 2 + plane - 1];
+    });
+
+    // the default grid is a few codes coarser in chroma
+    param.lut_size = I965_TONE_MAP_MAX_LUT_SIZE;
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+
+    const VARectangle rect = { 0, 0, width, height };
+
+    ASSERT_TRUE(i965_tone_map_process(&tone_map, &src, &rect, &dst, &rect));
+
+    double sum_error = 0;
+    int max_error = 0;
+
+    for (int y = 0; y < height; y += 2) {
+        for (int x = 0; x < width; x += 2) {
+            const int cb = samples[width * height + (y / 2 * width / 2 + x / 2) * 2];
+            const int cr = samples[width * height + (y / 2 * width / 2 + x / 2) * 2 + 1];
+            float sum_c[2] = { 0, 0 };
+
+            for (int i = 0; i < 4; i++) {
+                const int px = x + (i & 1), py = y + (i >> 1);
+                float expected[3];
+
+                ASSERT_TRUE(i965_tone_map_reference(&param,
+                    samples[py * width + px], cb, cr, expected));
+
+                const int error = std::abs(dst_data[py * width + px] -
+                    int(std::lround(expected[0])));
+
+                sum_error += error;
+                max_error = std::max(max_error, error);
+                sum_c[0] += expected[1] / 4;
+                sum_c[1] += expected[2] / 4;
+            }
+
+            for (int c = 0; c < 2; c++) {
+                const int error = std::abs(dst.planes[1][y / 2 * width + x + c] -
+                    int(std::lround(sum_c[c])));
+
+                max_error = std::max(max_error, error);
+            }
+        }
+    }
+
+    EXPECT_LE(max_error, 4);
+    EXPECT_LT(sum_error / (width * height), 1.0);
+}
+
+TEST_P(ToneMapTest, Region)
+{
+    makeSource(32, 16, [](int, int, int plane) { return plane ? 512 : 940; });
+
+    ASSERT_TRUE(i965_tone_map_update(&tone_map, &param));
+
+    const VARectangle src_rect = { 4, 2, 8, 6 };
+    const VARectangle dst_rect = { 10, 8, 8, 6 };
+    const VARectangle odd_rect = { 3, 2, 8, 6 };
+    const VARectangle big_rect = { 0, 0, 10, 6 };
+
+    EXPECT_FALSE(i965_tone_map_process(&tone_map, &src, &odd_rect, &dst, &dst_rect));
+    EXPECT_FALSE(i965_tone_map_process(&tone_map, &src, &src_rect, &dst, &big_rect));
+
+    ASSERT_TRUE(i965_tone_map_process(&tone_map, &src, &src_rect, &dst, &dst_rect));
+
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 32; x++) {
+            const bool inside = x >= 10 && x < 18 && y >= 8 && y < 14;
+
+            if (inside)
+                EXPECT_NEAR(235, dst_data[y * 32 + x], 1) << x << "," << y;
+            else
+                EXPECT_EQ(0, dst_data[y * 32 + x]) << x << "," << y;
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    HDR, ToneMapTest, ::testing::Values(
+        unsigned(VA_TONE_MAPPING_TRANSFER_PQ),
+        unsigned(VA_TONE_MAPPING_TRANSFER_HLG)));
+
+} // namespace VPP
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "i965_test_fixture.h"
+
+#include <cstring>
+#include <vector>
+
+namespace VPP {
+
+class VEBoxStateTest : public ::testing::TestWithParam<int>
+{
+protected:
+    virtual void SetUp()
+    {
+        std::memset(&i965, 0, sizeof(i965));
+        std::memset(&drv, 0, sizeof(drv));
+        drv.pDriverData = &i965;
+        i965.intel.device_info = i965_get_device_info(GetParam());
+        ASSERT_PTR(i965.intel.device_info);
+
+        std::memset(&deint, 0, sizeof(deint));
+        deint.type = VAProcFilterDeinterlacing;
+        deint.algorithm = VAProcDeinterlacingMotionAdaptive;
+
+        std::memset(&std_param, 0, sizeof(std_param));
+        std_param.type = VAProcFilterSkinToneEnhancement;
+        std_param.value = 6;
+
+        amp.resize(2);
+        std::memset(&amp[0], 0, amp.size() * sizeof(amp[0]));
+        amp[0].type = VAProcFilterColorBalance;
+        amp[0].attrib = VAProcColorBalanceBrightness;
+        amp[0].value = 10.0f;
+        amp[1].type = VAProcFilterColorBalance;
+        amp[1].attrib = VAProcColorBalanceContrast;
+        amp[1].value = 1.5f;
+    }
+
+    // DN + motion adaptive DI, STD/STE, ProcAmp and an NV12 to RGBA CSC
+    void initContext(intel_vebox_context& proc_ctx)
+    {
+        std::memset(&proc_ctx, 0, sizeof(proc_ctx));
+        proc_ctx.filters_mask = VPP_DNDI_DN | VPP_DNDI_DI |
+            VPP_IECP_STD_STE | VPP_IECP_PRO_AMP | VPP_IECP_CSC |
+            VPP_IECP_CSC_TRANSFORM;
+        proc_ctx.is_dn_enabled = 1;
+        proc_ctx.is_di_enabled = 1;
+        proc_ctx.filter_di = &deint;
+        proc_ctx.filter_iecp_std = &std_param;
+        proc_ctx.filter_iecp_amp = &amp[0];
+        proc_ctx.filter_iecp_amp_num_elements = amp.size();
+        proc_ctx.fourcc_input = VA_FOURCC_NV12;
+        proc_ctx.fourcc_output = VA_FOURCC_RGBA;
+    }
+
+    static bool sameTables(const intel_vebox_context& a,
+        const intel_vebox_context& b)
+    {
+        return std::memcmp(a.dndi_table, b.dndi_table, sizeof(a.dndi_table)) == 0
+            && std::memcmp(a.iecp_table, b.iecp_table, sizeof(a.iecp_table)) == 0;
+    }
+
+    VADriverContext drv;
+    struct i965_driver_data i965;
+    VAProcFilterParameterBufferDeinterlacing deint;
+    VAProcFilterParameterBuffer std_param;
+    std::vector<VAProcFilterParameterBufferColorBalance> amp;
+    intel_vebox_context cached, fresh;
+};
+
+TEST_P(VEBoxStateTest, CachedMatchesFresh)
+{
+    initContext(cached);
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+    EXPECT_FALSE(gen75_vebox_prepare_state_tables(&drv, &cached));
+
+    // another stream and back, the tables must come back byte for byte
+    deint.flags = VA_DEINTERLACING_BOTTOM_FIELD_FIRST;
+    amp[0].value = -20.0f;
+    cached.fourcc_output = VA_FOURCC_NV12;
+    cached.filters_mask &= ~VPP_IECP_CSC_TRANSFORM;
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+
+    deint.flags = 0;
+    amp[0].value = 10.0f;
+    cached.fourcc_output = VA_FOURCC_RGBA;
+    cached.filters_mask |= VPP_IECP_CSC_TRANSFORM;
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+
+    for (int i = 0; i < 8; i++)
+        EXPECT_FALSE(gen75_vebox_prepare_state_tables(&drv, &cached));
+
+    EXPECT_EQ(3u, cached.num_state_table_builds);
+
+    initContext(fresh);
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &fresh));
+    EXPECT_TRUE(sameTables(cached, fresh));
+}
+
+TEST_P(VEBoxStateTest, SameParametersInNewBuffers)
+{
+    initContext(cached);
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+
+    // the application may send a new filter buffer with every picture
+    VAProcFilterParameterBufferDeinterlacing deint2 = deint;
+    std::vector<VAProcFilterParameterBufferColorBalance> amp2(amp);
+
+    cached.filter_di = &deint2;
+    cached.filter_iecp_amp = &amp2[0];
+    EXPECT_FALSE(gen75_vebox_prepare_state_tables(&drv, &cached));
+
+    // and formats the tables don't depend on may change
+    cached.filters_mask &= ~VPP_IECP_CSC_TRANSFORM;
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+    cached.fourcc_input = VA_FOURCC_YUY2;
+    EXPECT_FALSE(gen75_vebox_prepare_state_tables(&drv, &cached));
+}
+
+TEST_P(VEBoxStateTest, ParameterChangesRebuild)
+{
+    intel_vebox_context before;
+
+    initContext(cached);
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+    before = cached;
+
+    cached.is_first_frame = 1;
+    deint.flags = VA_DEINTERLACING_BOTTOM_FIELD;
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+    EXPECT_NE(0, std::memcmp(before.dndi_table, cached.dndi_table,
+        sizeof(before.dndi_table)));
+    before = cached;
+
+    std_param.value = 9;
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+    EXPECT_NE(0, std::memcmp(before.iecp_table, cached.iecp_table,
+        sizeof(before.iecp_table)));
+    before = cached;
+
+    amp[1].value = 0.5f;
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+    EXPECT_NE(0, std::memcmp(before.iecp_table, cached.iecp_table,
+        sizeof(before.iecp_table)));
+    before = cached;
+
+    cached.fourcc_input = VA_FOURCC_RGBA;
+    cached.fourcc_output = VA_FOURCC_NV12;
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+    EXPECT_NE(0, std::memcmp(before.iecp_table, cached.iecp_table,
+        sizeof(before.iecp_table)));
+}
+
+TEST_P(VEBoxStateTest, TooManyColorBalanceElements)
+{
+    amp.resize(VEB_STATE_MAX_AMP_ELEMENTS + 1, amp[1]);
+
+    initContext(cached);
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+    EXPECT_TRUE(gen75_vebox_prepare_state_tables(&drv, &cached));
+}
+
+// Haswell, Broadwell and Skylake lay the tables out differently
+INSTANTIATE_TEST_CASE_P(
+    VEBox, VEBoxStateTest, ::testing::Values(0x0412, 0x1616, 0x1916));
+
+/*
+ * The scratch frame stores on a real driver context: the storage pass of
+ * consecutive pictures without running the VEBOX.
+ */
+class VEBoxSurfacesTest : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+
+        struct i965_driver_data *i965(*this);
+        proc_ctx = NULL;
+
+        if (i965 and i965->intel.has_vebox and i965->pp_context) {
+            proc_ctx = gen75_vebox_context_init(*this);
+            std::memset(&pipe, 0, sizeof(pipe));
+            proc_ctx->pipeline_param = &pipe;
+        }
+    }
+
+    virtual void TearDown()
+    {
+        if (proc_ctx)
+            gen75_vebox_context_destroy(*this, proc_ctx);
+
+        destroySurfaces(surfaces);
+        I965TestFixture::TearDown();
+    }
+
+    bool skip()
+    {
+        if (proc_ctx)
+            return false;
+
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is not supported on this hardware" << std::endl;
+
+        return true;
+    }
+
+    object_surface *createSurface(int width, int height, unsigned fourcc)
+    {
+        struct i965_driver_data *i965(*this);
+        const bool yuy2(fourcc == VA_FOURCC_YUY2);
+        Surfaces created = createSurfaces(width, height,
+            yuy2 ? VA_RT_FORMAT_YUV422 : VA_RT_FORMAT_YUV420);
+
+        EXPECT_EQ(1u, created.size());
+        if (created.empty())
+            return NULL;
+
+        surfaces.push_back(created.front());
+        object_surface *obj_surface = SURFACE(created.front());
+        i965_check_alloc_surface_bo(*this, obj_surface, 1, fourcc,
+            yuy2 ? SUBSAMPLE_YUV422H : SUBSAMPLE_YUV420);
+        EXPECT_PTR(obj_surface->bo);
+
+        return obj_surface;
+    }
+
+    void picture(object_surface *input, object_surface *output)
+    {
+        proc_ctx->surface_input_object = input;
+        proc_ctx->surface_output_object = output;
+        proc_ctx->filters_mask = VPP_DNDI_DN;
+
+        EXPECT_STATUS(hsw_veb_pre_format_convert(*this, proc_ctx));
+        EXPECT_STATUS(gen75_vebox_ensure_surfaces_storage(*this, proc_ctx));
+    }
+
+    object_surface *frameStore(int index) const
+    {
+        return proc_ctx->frame_store[index].obj_surface;
+    }
+
+    intel_vebox_context *proc_ctx;
+    VAProcPipelineParameterBuffer pipe;
+    Surfaces surfaces;
+};
+
+TEST_F(VEBoxSurfacesTest, RingReuse)
+{
+    if (skip())
+        return;
+
+    object_surface *input = createSurface(64, 64, VA_FOURCC_NV12);
+    object_surface *nv12 = createSurface(64, 64, VA_FOURCC_NV12);
+    object_surface *yuy2 = createSurface(64, 64, VA_FOURCC_YUY2);
+
+    // every frame store gets a scratch surface once
+    picture(input, nv12);
+    EXPECT_EQ(unsigned(FRAME_STORE_COUNT), proc_ctx->num_reallocations);
+
+    object_surface *stmm[2] = {
+        frameStore(FRAME_IN_STMM), frameStore(FRAME_OUT_STMM) };
+    object_surface *output = frameStore(FRAME_OUT_CURRENT);
+    ASSERT_PTR(stmm[0]);
+    ASSERT_PTR(stmm[1]);
+    ASSERT_PTR(output);
+
+    picture(input, nv12);
+    EXPECT_EQ(unsigned(FRAME_STORE_COUNT), proc_ctx->num_reallocations);
+    EXPECT_EQ(output, frameStore(FRAME_OUT_CURRENT));
+
+    // another output format at the same resolution only swaps the three
+    // output stores, the motion history is kept
+    picture(input, yuy2);
+    EXPECT_EQ(unsigned(FRAME_STORE_COUNT) + 3, proc_ctx->num_reallocations);
+    EXPECT_EQ(stmm[0], frameStore(FRAME_IN_STMM));
+    EXPECT_EQ(stmm[1], frameStore(FRAME_OUT_STMM));
+    EXPECT_NE(output, frameStore(FRAME_OUT_CURRENT));
+
+    // and back, the NV12 surfaces are still in the ring
+    picture(input, nv12);
+    EXPECT_EQ(unsigned(FRAME_STORE_COUNT) + 3, proc_ctx->num_reallocations);
+    EXPECT_EQ(stmm[0], frameStore(FRAME_IN_STMM));
+    EXPECT_EQ(stmm[1], frameStore(FRAME_OUT_STMM));
+
+    EXPECT_EQ(0u, proc_ctx->num_conversions);
+}
+
+TEST_F(VEBoxSurfacesTest, ResolutionChange)
+{
+    if (skip())
+        return;
+
+    object_surface *input = createSurface(64, 64, VA_FOURCC_NV12);
+    object_surface *output = createSurface(64, 64, VA_FOURCC_NV12);
+    object_surface *small_input = createSurface(32, 32, VA_FOURCC_NV12);
+    object_surface *small_output = createSurface(32, 32, VA_FOURCC_NV12);
+
+    picture(input, output);
+    object_surface *stmm = frameStore(FRAME_IN_STMM);
+
+    // the frame stores follow the input size
+    picture(small_input, small_output);
+    EXPECT_EQ(2u * FRAME_STORE_COUNT, proc_ctx->num_reallocations);
+    EXPECT_NE(stmm, frameStore(FRAME_IN_STMM));
+    EXPECT_EQ(32, frameStore(FRAME_IN_STMM)->orig_width);
+}
+
+TEST_F(VEBoxSurfacesTest, Conversions)
+{
+    if (skip())
+        return;
+
+    object_surface *input = createSurface(64, 64, VA_FOURCC_I420);
+    object_surface *output = createSurface(64, 64, VA_FOURCC_NV12);
+    object_surface *small_input = createSurface(32, 32, VA_FOURCC_I420);
+
+    // the input goes through an NV12 temporary, kept across pictures
+    picture(input, output);
+    picture(input, output);
+    EXPECT_EQ(2u, proc_ctx->num_conversions);
+    EXPECT_EQ(unsigned(FRAME_STORE_COUNT) + 1, proc_ctx->num_reallocations);
+    ASSERT_PTR(proc_ctx->surface_input_vebox_object);
+    EXPECT_EQ(64, proc_ctx->surface_input_vebox_object->orig_width);
+
+    // until the size changes
+    picture(small_input, output);
+    EXPECT_EQ(3u, proc_ctx->num_conversions);
+    EXPECT_EQ(32, proc_ctx->surface_input_vebox_object->orig_width);
+}
+
+} // namespace VPP